@@ -27,7 +27,10 @@
 #include <evt.h>
 #include <sched.h>
 
+/* must be a power of 2: the size of a provider's request ring */
 #define ASYNC_MAX_BUFFERED 512
+#define ASYNC_RING_MASK    (ASYNC_MAX_BUFFERED-1)
+#define ASYNC_NAME_HASH_SZ 64
 
 typedef enum {
 	MSG_INIT,		/* created, but not yet make a request */
@@ -51,66 +54,171 @@ struct message {
 	/* what should the return value to the client be? */
 	int ret_val; 
 
-	/* The id of the service provider */
-	long sp_id;
+	/* The service provider (which is never freed) */
+	struct service_provider *sp;
+};
+
+/* 
+ * The requests for a provider are queued in a bounded, lock-free,
+ * multi-producer/multi-consumer ring: clients enqueue, and all of the
+ * provider's workers dequeue, without taking a lock.  Each slot's
+ * sequence number says if it can be written (seq == pos) or read (seq
+ * == pos + 1) at a position.  head and tail are on separate cache
+ * lines, as producers and consumers each update one of them.
+ */
+struct async_ring_slot {
+	volatile unsigned long seq;
+	struct message *m;
+};
 
-	struct message *next, *prev; /* linked list */
+struct async_ring {
+	volatile unsigned long head;
+	char __pad0[CACHE_LINE - sizeof(unsigned long)];
+	volatile unsigned long tail;
+	char __pad1[CACHE_LINE - sizeof(unsigned long)];
+	struct async_ring_slot slots[ASYNC_MAX_BUFFERED];
 };
 
+#define async_barrier() __asm__ __volatile__("" : : : "memory")
+
+static void async_ring_init(struct async_ring *r)
+{
+	unsigned long i;
+
+	r->head = r->tail = 0;
+	for (i = 0 ; i < ASYNC_MAX_BUFFERED ; i++) r->slots[i].seq = i;
+}
+
+/* returns -1 if the ring is full */
+static int async_ring_enqueue(struct async_ring *r, struct message *m)
+{
+	struct async_ring_slot *s;
+	unsigned long pos;
+	long dif;
+
+	while (1) {
+		pos = r->tail;
+		s   = &r->slots[pos & ASYNC_RING_MASK];
+		dif = (long)s->seq - (long)pos;
+		if (dif < 0) return -1;
+		if (0 == dif && cos_cmpxchg(&r->tail, pos, pos + 1) == (long)(pos + 1)) break;
+	}
+	s->m = m;
+	async_barrier();
+	s->seq = pos + 1;
+
+	return 0;
+}
+
+/* returns NULL if the ring is empty */
+static struct message *async_ring_dequeue(struct async_ring *r)
+{
+	struct async_ring_slot *s;
+	struct message *m;
+	unsigned long pos;
+	long dif;
+
+	while (1) {
+		pos = r->head;
+		s   = &r->slots[pos & ASYNC_RING_MASK];
+		dif = (long)s->seq - (long)(pos + 1);
+		if (dif < 0) return NULL;
+		if (0 == dif && cos_cmpxchg(&r->head, pos, pos + 1) == (long)(pos + 1)) break;
+	}
+	m = s->m;
+	async_barrier();
+	s->seq = pos + ASYNC_MAX_BUFFERED;
+
+	return m;
+}
+
 typedef enum {
 	PROVIDER_SPAWN_T = 1,
 	PROVIDER_MAIN_T,
 	PROVIDER_CLOSED_T
 } provider_type_t;
 
-struct service_provider;
+struct worker;
 struct provider_poly {
 	provider_type_t type;
 	long id;
 	long evt_id;		/* evt to trigger when work becomes available */
 	struct service_provider *sp;
+	struct worker *w;
 	/* The message being currently processed by the server */
 	struct message *curr_msg;
 };
 
+/* 
+ * Any number of workers (threads, possibly in different components)
+ * can serve a provider: each creates the provider by name, and gets
+ * its own main handle to wait on, and spawned handle for the request
+ * it is processing.
+ */
+struct worker {
+	struct provider_poly main, spawned;
+	/* idle: on the provider's list of workers waiting for requests */
+	int idle;
+	struct worker *next, *prev;
+};
+
+/* A client waiting for room in a full request ring */
+struct blocked_producer {
+	unsigned short int thd;
+	struct blocked_producer *next, *prev;
+};
+
+/* 
+ * Providers are never freed, so that messages can reference them
+ * directly.  When the last worker is removed, the provider's pending
+ * requests fail, and it can be served again by a new worker that
+ * creates it by name.
+ */
 struct service_provider {
-	struct provider_poly main;
 	char *name;
+	struct service_provider *hnext;	/* name hash chain */
+	int nworkers;
+	struct worker idle;
+	/* FIFO of producers waiting for room in the ring */
+	struct blocked_producer blocked;
 
-	struct message requests;
-	int num_reqs;
-	unsigned short int blocked_producer;
-	
-	struct service_provider *next, *prev;
-
-	struct provider_poly spawned;
+	struct async_ring requests;
 };
 
-/* a map of the service providers of type: id -> struct service_provider */
+/* a map of the provider handles of type: id -> struct provider_poly */
 COS_MAP_CREATE_STATIC(providers);
 /* a map of requests for these providers of type: id -> struct message */
 COS_MAP_CREATE_STATIC(messages);
-cos_lock_t biglock;
-#define LOCK() lock_take(&biglock)
-#define UNLOCK() lock_release(&biglock)
+/* hash table of the service providers by name */
+static struct service_provider *provider_hash[ASYNC_NAME_HASH_SZ];
 
-/* Linked list of the service providers...linearly walked to find the
- * correct .name associated with a request.  Type: char * -> struct
- * service_provider */
-struct service_provider ps;
+/* 
+ * prov_lock protects the handle map, the providers, and their
+ * workers; msg_lock the message map and the messages' state.  If both
+ * are taken, prov_lock is taken first.  The request rings are
+ * accessed with neither.
+ */
+cos_lock_t prov_lock, msg_lock;
+#define PROV_LOCK()   lock_take(&prov_lock)
+#define PROV_UNLOCK() lock_release(&prov_lock)
+#define MSG_LOCK()    lock_take(&msg_lock)
+#define MSG_UNLOCK()  lock_release(&msg_lock)
+
+static inline unsigned int provider_hash_name(char *name)
+{
+	unsigned int h = 5381;
+
+	while (*name) h = (h << 5) + h + (unsigned char)*name++;
 
-/* assumes next/prev are the pointers within the struct */
-#define FOR_EACH(a, as) \
-	for ((a) = FIRST_LIST((as), next, prev) ; \
-	     (a) != (as) ;			  \
-	     (a) = FIRST_LIST((a), next, prev) )
+	return h & (ASYNC_NAME_HASH_SZ-1);
+}
 
 static struct service_provider *provider_find(char *name)
 {
 	struct service_provider *t;
 
 	assert(name);
-	FOR_EACH(t, &ps) {
+	for (t = provider_hash[provider_hash_name(name)] ; t ; t = t->hnext) {
 		assert(t->name);
 		if (0 == strcmp(t->name, name)) return t;
 	}
@@ -123,46 +231,63 @@ static inline struct provider_poly *provider_lookup(long id)
 	return cos_map_lookup(&providers, id);
 }
 
-static void provider_prematurely_term_msg(struct message *m, struct service_provider *sp)
+/* Called with msg_lock taken */
+static void provider_free_message(struct message *m)
 {
-	assert(m && m->sp_id == sp->main.id);
-
-	m->status = MSG_PROCESSED;
-	m->ret_val = -EIO;
-	if (evt_trigger(cos_spd_id(), m->evt_id)) BUG();
+	cos_map_del(&messages, m->id);
+	if (m->reply) free(m->reply);
+	if (m->request) free(m->request);
+	free(m);
 }
 
-static int provider_main_remove(struct service_provider *sp)
+static void provider_prematurely_term_msg(struct message *m)
 {
-	long id = sp->main.id;
-
-	REM_LIST(sp, next, prev);
-	cos_map_del(&providers, id);
-	free(sp->name);
+	MSG_LOCK();
+	if (m->status == MSG_DELETE) {
+		provider_free_message(m);
+	} else {
+		m->status = MSG_PROCESSED;
+		m->ret_val = -EIO;
+		if (evt_trigger(cos_spd_id(), m->evt_id)) BUG();
+	}
+	MSG_UNLOCK();
+}
 
-	/* Delete any pending messages. */
-	while (!EMPTY_LIST(&sp->requests, next, prev)) {
-		struct message *m = NULL;
+/* 
+ * The provider has no workers: fail the queued requests, and the
+ * waiting producers.  Called with prov_lock taken.
+ */
+static void provider_drain(struct service_provider *sp)
+{
+	struct message *m;
 
-		m = FIRST_LIST(&sp->requests, next, prev);
-		provider_prematurely_term_msg(m, sp);
-		REM_LIST(m, next, prev);
+	while (NULL != (m = async_ring_dequeue(&sp->requests))) {
+		provider_prematurely_term_msg(m);
 	}
-	if (sp->spawned.type == PROVIDER_SPAWN_T && 
-	    sp->spawned.curr_msg) {
-		provider_prematurely_term_msg(sp->spawned.curr_msg, sp);
-		sp->spawned.curr_msg = NULL;
+	while (!EMPTY_LIST(&sp->blocked, next, prev)) {
+		struct blocked_producer *b = FIRST_LIST(&sp->blocked, next, prev);
+
+		REM_LIST(b, next, prev);
+		sched_wakeup(cos_spd_id(), b->thd);
 	}
+}
 
-	/* 
-	 * FIXME: this is crap -- remove the spawned id out from under
-	 * it without a notification. 
-	 */
-	if (sp->spawned.type == PROVIDER_SPAWN_T) {
-		cos_map_del(&providers, sp->spawned.id);
+static int provider_worker_remove(struct worker *w)
+{
+	struct service_provider *sp = w->main.sp;
+
+	cos_map_del(&providers, w->main.id);
+	if (w->spawned.type == PROVIDER_SPAWN_T) {
+		cos_map_del(&providers, w->spawned.id);
+		if (w->spawned.curr_msg) provider_prematurely_term_msg(w->spawned.curr_msg);
+	}
+	if (w->idle) {
+		REM_LIST(w, next, prev);
 	}
+	free(w);
 
-	free(sp);
+	if (--sp->nworkers) return 0;
+	provider_drain(sp);
 
 	return 0;
 }
@@ -170,18 +295,17 @@ static int provider_main_remove(struct service_provider *sp)
 static int provider_remove(long id)
 {
 	struct provider_poly *poly;
-	struct service_provider *sp;
 
 	poly = provider_lookup(id);
 	if (NULL == poly) return -EINVAL;
 	switch(poly->type) {
 	case PROVIDER_MAIN_T:
-		sp = poly->sp;
-		assert(sp->main.id == id);
-		return provider_main_remove(sp);
+		assert(poly->id == id);
+		return provider_worker_remove(poly->w);
 	case PROVIDER_SPAWN_T:
 		if (poly->id) cos_map_del(&providers, poly->id);
 		poly->type = PROVIDER_CLOSED_T;
+		poly->curr_msg = NULL;
 		break;
 	case PROVIDER_CLOSED_T:
 		break;
@@ -190,49 +314,74 @@ static int provider_remove(long id)
 	return 0;
 }
 
-static struct service_provider *provider_create(char *name, int len, long evt_id)
+static struct service_provider *provider_create(char *name, int len)
 {
 	struct service_provider *sp;
-	long id;
+	unsigned int h;
 	char *n;
 
-	/* don't recreate providers */
-	sp = provider_find(name);
-	if (sp) goto err;
 	sp = malloc(sizeof(struct service_provider));
-	if (NULL == sp) goto err;
+	if (NULL == sp) return NULL;
 	n = malloc(len + 1);
-	if (NULL == n) goto free_sp;
+	if (NULL == n) {
+		free(sp);
+		return NULL;
+	}
 	memcpy(n, name, len);
 	n[len] = '\0';
 
-	id = cos_map_add(&providers, &sp->main);
-	if (0 > id) goto free_both;
-
 	memset(sp, 0, sizeof(struct service_provider));
-
-	INIT_LIST(sp, next, prev);
-	ADD_LIST(&ps, sp, next, prev);
-	INIT_LIST(&sp->requests, next, prev);
-	sp->main.type = PROVIDER_MAIN_T;
-	sp->main.sp = sp;
-	sp->main.id = id;
-	sp->main.evt_id = evt_id;
-	sp->spawned.type = PROVIDER_CLOSED_T;
-	sp->spawned.sp = sp;
+	INIT_LIST(&sp->idle, next, prev);
+	INIT_LIST(&sp->blocked, next, prev);
+	async_ring_init(&sp->requests);
 	sp->name = n;
+	h = provider_hash_name(n);
+	sp->hnext = provider_hash[h];
+	provider_hash[h] = sp;
 
 	return sp;
-free_both:
-	free(n);
-free_sp:
-	free(sp);
-err:
-	return NULL;
 }
 
 /* 
- * Create a request message associated with a client.
+ * Add a worker to the provider of the given name, creating the
+ * provider if this is its first worker.
+ */
+static struct worker *provider_worker_create(char *name, int len, long evt_id)
+{
+	struct service_provider *sp;
+	struct worker *w;
+	long id;
+
+	sp = provider_find(name);
+	if (NULL == sp) sp = provider_create(name, len);
+	if (NULL == sp) return NULL;
+	w = malloc(sizeof(struct worker));
+	if (NULL == w) return NULL;
+
+	id = cos_map_add(&providers, &w->main);
+	if (0 > id) {
+		free(w);
+		return NULL;
+	}
+
+	memset(w, 0, sizeof(struct worker));
+	INIT_LIST(w, next, prev);
+	w->main.type = PROVIDER_MAIN_T;
+	w->main.sp = sp;
+	w->main.w = w;
+	w->main.id = id;
+	w->main.evt_id = evt_id;
+	w->spawned.type = PROVIDER_CLOSED_T;
+	w->spawned.sp = sp;
+	w->spawned.w = w;
+	sp->nworkers++;
+
+	return w;
+}
+
+/* 
+ * Create a request message associated with a client.  Called with
+ * msg_lock taken.
  */
 static struct message *provider_create_message(long evt_id)
 {
@@ -255,7 +404,6 @@ static struct message *provider_create_message(long evt_id)
 
 	m->evt_id = evt_id;
 	m->id = mid;
-	INIT_LIST(m, next, prev);
 	m->status = MSG_INIT;
 
 	return m;
@@ -263,7 +411,8 @@ static struct message *provider_create_message(long evt_id)
 
 /* 
  * Delete a given message.  The actual freeing of the object might be
- * done at a later point in time if it is currently being processed.
+ * done at a later point in time if it is currently queued or being
+ * processed.  Called with msg_lock taken.
  */
 static int provider_release_message(struct message *m)
 {
@@ -271,20 +420,7 @@ static int provider_release_message(struct message *m)
 
 	switch (m->status) {
 	case MSG_PENDING:
-	{
-		struct provider_poly *poly;
-		struct service_provider *sp;
-
-		assert(!EMPTY_LIST(m, next, prev));
-		REM_LIST(m, next, prev);
-		poly = provider_lookup(m->sp_id);
-		assert(poly);
-		assert(poly->type == PROVIDER_MAIN_T);
-		sp = poly->sp;
-		
-		sp->num_reqs--;
-		break;
-	}
+		/* the ring owns it: the worker dequeuing it frees it */
 	case MSG_PROCESSING:
 		/* can't delete it now, delete it when processing is
 		 * done */
@@ -295,181 +431,267 @@ static int provider_release_message(struct message *m)
 	case MSG_INIT:
 		break;
 	}
-
-	cos_map_del(&messages, m->id);
-	if (m->reply) free(m->reply);
-	if (m->request) free(m->request);
-	free(m);
+	provider_free_message(m);
 
 	return 0;
 }
 
+/* 
+ * A request was enqueued: if a worker is waiting for requests, wake
+ * it up.  Idle workers are woken in LIFO order, as the most recently
+ * active one is the most likely to be cache-warm.
+ */
+static void provider_wake_worker(struct service_provider *sp)
+{
+	struct worker *w;
+
+	async_barrier();
+	/* 
+	 * Unlocked check: a worker marks itself idle before looking
+	 * in the ring a final time, so either it sees the request, or
+	 * we see it here.  The same holds for the last worker being
+	 * removed, which drains the ring.
+	 */
+	if (EMPTY_LIST(&sp->idle, next, prev) && sp->nworkers) return;
+	PROV_LOCK();
+	if (0 == sp->nworkers) {
+		provider_drain(sp);
+	} else if (!EMPTY_LIST(&sp->idle, next, prev)) {
+		w = FIRST_LIST(&sp->idle, next, prev);
+		REM_LIST(w, next, prev);
+		w->idle = 0;
+		if (evt_trigger(cos_spd_id(), w->main.evt_id)) BUG();
+	}
+	PROV_UNLOCK();
+}
+
+/* Room was made in the ring: wake the producer waiting the longest */
+static void provider_wake_producer(struct service_provider *sp)
+{
+	struct blocked_producer *b;
+	unsigned short int thd = 0;
+
+	async_barrier();
+	if (EMPTY_LIST(&sp->blocked, next, prev)) return;
+	PROV_LOCK();
+	if (!EMPTY_LIST(&sp->blocked, next, prev)) {
+		b = FIRST_LIST(&sp->blocked, next, prev);
+		REM_LIST(b, next, prev);
+		thd = b->thd;
+	}
+	PROV_UNLOCK();
+	if (thd) sched_wakeup(cos_spd_id(), thd);
+}
+
 /* 
  * Take a request from the client, and enqueue it into the service
  * provider to be retrieved at a later point by the server.  Two edge
- * cases are if the buffer is full, we will block, and we will trigger
- * the service provider's event so that the server will know there is
- * work to be done.
+ * cases are if the ring is full, we will block (behind any other
+ * producers already waiting), and we will trigger an idle worker's
+ * event so that the server will know there is work to be done.
  *
  * Might block.
  */
 static int provider_enqueue_request(content_req_t cr, char *req, int len)
 {
-	struct message *m, *m_first;
-	struct provider_poly *poly;
+	struct message *m;
 	struct service_provider *sp;
-	int err = -ENOMEM;
+	struct blocked_producer b;
 	char *r;
 
-	LOCK();
-	/* get the message once before we sleep when it might change
-	 * or be deallocated. */
-	m_first = m = cos_map_lookup(&messages, cr);
-	if (NULL == m || m->status != MSG_INIT) {
-		err = -EINVAL;
-		goto err;
-	}
-
 	r = malloc(len);
 	if (NULL == r) {
 		printc("async_inv: could not allocate memory for request\n");
-		err = -ENOMEM;
-		goto err;
-	}
-	UNLOCK();
-retry:
-	LOCK();
-	m = cos_map_lookup(&messages, cr);
-	/* 
-	 * FIXME: This is both annoying and convoluted.  The message
-	 * might have been deleted between the time we attempted to
-	 * enqueue, which might have resulted in us sleeping, and now.
-	 * Thus m might be a different m.  This is still WRONG as a
-	 * pointer comparison only confirms that the new m is in the
-	 * same location, not that it is the same m we were talking
-	 * about before.  So this is broken, and to be fixed later.
-	 */
-	if (m != m_first) {
-		err = -EINVAL;
-		goto free;
-	}
-	poly = provider_lookup(m->sp_id);
-	if (NULL == poly) { 
-		err = -EINVAL; 
-		goto free; 
+		return -ENOMEM;
 	}
-	assert(poly->type == PROVIDER_MAIN_T);
-	sp = poly->sp;
+	memcpy(r, req, len);
 
-	/* if there are too many requests currently queued up, block */
-	if (sp->num_reqs >= ASYNC_MAX_BUFFERED) {
-		/* FIXME: only a single producer for each service_provider */
-		if (0 != sp->blocked_producer) BUG();
-		sp->blocked_producer = cos_get_thd_id();
-		UNLOCK();
-		sched_block(cos_spd_id(), 0);
-		goto retry;
+	MSG_LOCK();
+	m = cos_map_lookup(&messages, cr);
+	if (NULL == m || m->status != MSG_INIT) {
+		MSG_UNLOCK();
+		free(r);
+		return -EINVAL;
 	}
-	
-	memcpy(r, req, len);
 	m->request = r;
 	m->req_len = len;
-
-	/* Manipulate the service provider to include the message */
-	ADD_END_LIST(&sp->requests, m, next, prev);
+	/* from here on, a client closing the message only marks it */
 	m->status = MSG_PENDING;
-	sp->num_reqs++;
-	/* Notify the provider that there is data pending */
-	if (evt_trigger(cos_spd_id(), sp->main.evt_id)) BUG();
-	UNLOCK();
+	sp = m->sp;
+	MSG_UNLOCK();
+
+	b.thd = cos_get_thd_id();
+	INIT_LIST(&b, next, prev);
+	while (async_ring_enqueue(&sp->requests, m)) {
+		/* 
+		 * Full: wait for a worker to make room.  Try once more
+		 * after getting on the FIFO, as a worker only wakes
+		 * producers that are on it when it dequeues.
+		 */
+		PROV_LOCK();
+		if (0 == sp->nworkers) {
+			PROV_UNLOCK();
+			goto closed;
+		}
+		ADD_END_LIST(&sp->blocked, &b, next, prev);
+		PROV_UNLOCK();
+		if (!async_ring_enqueue(&sp->requests, m)) {
+			PROV_LOCK();
+			REM_LIST(&b, next, prev);
+			PROV_UNLOCK();
+			break;
+		}
+		sched_block(cos_spd_id(), 0);
+		PROV_LOCK();
+		/* woken, but not by a worker */
+		REM_LIST(&b, next, prev);
+		PROV_UNLOCK();
+	}
+	provider_wake_worker(sp);
 
 	return 0;
-free:
-	free(r);
-err:
-	UNLOCK();
-	return err;
+closed:
+	MSG_LOCK();
+	if (m->status == MSG_DELETE) {
+		provider_free_message(m);
+	} else {
+		m->status = MSG_PROCESSED;
+		m->ret_val = -EIO;
+	}
+	MSG_UNLOCK();
+
+	return -EIO;
 }
 
 /* 
  * The server should use this to read a request (using the cr of a
- * spawned handle) off of the request queue.  This will return a
- * pointer to the request and its length (in arguments).  If there are
- * no requests, return EAGAIN.  If error, return -EINVAL.  Set the
- * current request in the service provider to be the new request.
+ * spawned handle).  This will return the amount of the request read
+ * into req (which can be 0 if it has all been read).  If error,
+ * return -EINVAL.
  */
 static int provider_dequeue_request(content_req_t cr, char *req, int len)
 {
 	struct provider_poly *poly;
-	struct service_provider *sp;
 	struct message *m;
-	unsigned short int t;
 	int ret = 0, left, amnt;
 
-	LOCK();
+	PROV_LOCK();
 	poly = provider_lookup(cr);
-	if (NULL == poly) goto err;
-	if (poly->type != PROVIDER_SPAWN_T) goto err;
-	sp = poly->sp;
-
+	if (NULL == poly || poly->type != PROVIDER_SPAWN_T) goto err;
 	m = poly->curr_msg;
-	assert(m);
+	if (NULL == m) goto err;
+	PROV_UNLOCK();
+
+	/* the message is only accessed by this worker while processing */
 	if (len < m->req_len) BUG();
 	/* how much is there left to be read? */
 	left = m->req_len - m->req_viewed;
 	amnt = left > len ? len : left;
 	if (0 < amnt) {
-		memcpy(req, m->request, amnt);
+		memcpy(req, m->request + m->req_viewed, amnt);
 		ret = amnt;
 		m->req_viewed += amnt;
 	}
 
-	/* If there is a fully request queue, the client might blocked; wake it */
-	t = sp->blocked_producer;
-	if (0 != t) {
-		sp->blocked_producer = 0;
-		sched_wakeup(cos_spd_id(), t);
-	}
-	UNLOCK();
-
 	return ret;
 err:
-	UNLOCK();
+	PROV_UNLOCK();
 	return -EINVAL;
 }
 
+/* 
+ * Dequeue the next request to process, freeing those that were
+ * released by their clients while they were queued.
+ */
+static struct message *provider_next_request(struct service_provider *sp)
+{
+	struct message *m;
+
+	while (NULL != (m = async_ring_dequeue(&sp->requests))) {
+		provider_wake_producer(sp);
+		MSG_LOCK();
+		if (m->status == MSG_DELETE) {
+			provider_free_message(m);
+			MSG_UNLOCK();
+			continue;
+		}
+		assert(m->status == MSG_PENDING);
+		m->status = MSG_PROCESSING;
+		MSG_UNLOCK();
+		break;
+	}
+
+	return m;
+}
+
 /* 
  * spawn a new request (analogous to accept in networking) that will
- * be used to read the message.  The cr must be a handle to a given
- * ascii string in the provider lookup namespace (not a spawn).
+ * be used to read the message.  The cr must be a worker's main handle
+ * for a given ascii string in the provider lookup namespace (not a
+ * spawn).  If there are no requests, the worker is marked as idle,
+ * and its event is triggered when one arrives.
  */
 static content_req_t provider_open_req_rep(content_req_t cr, long evt_id)
 {
 	struct provider_poly *poly, *spawn;
 	struct service_provider *sp;
+	struct worker *w;
 	struct message *m;
+	long id;
 	
+	PROV_LOCK();
 	poly = provider_lookup(cr);
-	if (NULL == poly || poly->type != PROVIDER_MAIN_T) return -EINVAL;
+	if (NULL == poly || poly->type != PROVIDER_MAIN_T) {
+		PROV_UNLOCK();
+		return -EINVAL;
+	}
+	w  = poly->w;
 	sp = poly->sp;
+	/* one request at a time per worker */
+	if (w->spawned.type == PROVIDER_SPAWN_T) {
+		PROV_UNLOCK();
+		return -EBUSY;
+	}
+	PROV_UNLOCK();
 
-	if (EMPTY_LIST(&sp->requests, next, prev)) return -EAGAIN;
+	m = provider_next_request(sp);
+	if (NULL == m) {
+		/* 
+		 * Mark ourself idle before looking one last time, so
+		 * that a request enqueued in between isn't missed.
+		 */
+		PROV_LOCK();
+		if (!w->idle) {
+			w->idle = 1;
+			ADD_LIST(&sp->idle, w, next, prev);
+		}
+		PROV_UNLOCK();
+		m = provider_next_request(sp);
+		if (NULL == m) return -EAGAIN;
+		PROV_LOCK();
+		if (w->idle) {
+			w->idle = 0;
+			REM_LIST(w, next, prev);
+		}
+		PROV_UNLOCK();
+	}
+	m->req_viewed = 0;
 
-	spawn = &sp->spawned;
+	PROV_LOCK();
+	spawn = &w->spawned;
+	id = cos_map_add(&providers, spawn);
+	if (0 > id) {
+		PROV_UNLOCK();
+		provider_prematurely_term_msg(m);
+		return -ENOMEM;
+	}
 	spawn->type = PROVIDER_SPAWN_T;
-	spawn->sp = sp;
-	spawn->id = cos_map_add(&providers, spawn);
-	if (0 > spawn->id) return -ENOMEM;
+	spawn->id = id;
 	spawn->evt_id = evt_id;
-
-	sp->num_reqs--;
-	m = FIRST_LIST(&sp->requests, next, prev);
 	spawn->curr_msg = m;
-	m->status = MSG_PROCESSING;
-	REM_LIST(m, next, prev);
-	m->req_viewed = 0;
+	PROV_UNLOCK();
 
-	return spawn->id;
+	return id;
 }
 
 /* 
@@ -481,23 +703,23 @@ static content_req_t provider_open_req_rep(content_req_t cr, long evt_id)
 static int provider_reply(content_req_t cr, char *rep, int len)
 {
 	struct provider_poly *poly;
-	struct service_provider *sp;
 	struct message *m;
 	char *r;
 	int ret = 0;
 
-	LOCK();
+	PROV_LOCK();
 	poly = provider_lookup(cr);
-	if (NULL == poly || poly->type != PROVIDER_SPAWN_T) {
-		ret = -EINVAL;
-		goto err;
+	if (NULL == poly || poly->type != PROVIDER_SPAWN_T || NULL == poly->curr_msg) {
+		PROV_UNLOCK();
+		return -EINVAL;
 	}
 	assert(cr == poly->id);
-	sp = poly->sp;
-
 	m = poly->curr_msg;
-	assert(m);
+	PROV_UNLOCK();
 
+	r = malloc(len + 1);
+
+	MSG_LOCK();
 	/* 
 	 * If a reply has already been made, don't allow more.
 	 * Really, we should allow the reply to be extended, but not
@@ -508,45 +730,47 @@ static int provider_reply(content_req_t cr, char *rep, int len)
 		ret = -ENOMEM;
 		goto err;
 	}
+	/* The request is answered */
+	poly->curr_msg = NULL;
 	/* The message has been released, so delete it. */
 	if (m->status == MSG_DELETE) {
-		m->status = MSG_PROCESSED;
-		poly->curr_msg = NULL;
-		provider_release_message(m);
+		provider_free_message(m);
 		goto err;
 	}
 	m->status = MSG_PROCESSED;
 	m->ret_val = 0;
 	m->reply = NULL;
 
-	r = malloc(len + 1);
 	if (r) {
 		memcpy(r, rep, len);
 		r[len] = '\0';
 		m->reply = r;
 		m->rep_len = len;
+		r = NULL;
 	} else {
 		printc("async_inv: could not allocate reply.\n");
 		m->ret_val = -ENOMEM;
 	}
 	if (evt_trigger(cos_spd_id(), m->evt_id)) BUG();
 err:
-	UNLOCK();
+	MSG_UNLOCK();
+	if (r) free(r);
+
 	return ret;
 }
 
 /* 
  * Read out the response for a given message.  If the message hasn't
- * been processed yet, return -EAGAIN.  The buffer to populate the
- * response into is rep, and its max length should be passed in len.
- * Return a negative error, or a positive length.
+ * been processed yet, return 0, with more set.  The buffer to
+ * populate the response into is rep, and its max length should be
+ * passed in len.  Return a negative error, or a positive length.
  */
 static int provider_retrieve_reply(content_req_t cr, char *rep, int len, int *more)
 {
 	struct message *m;
 	int ret = 0, min, left;
 
-	LOCK();
+	MSG_LOCK();
 	m = cos_map_lookup(&messages, cr);
 	if (NULL == m) {
 		ret = -EINVAL;
@@ -554,7 +778,7 @@ static int provider_retrieve_reply(content_req_t cr, char *rep, int len, int *mo
 	}
 
 	/* not processed yet = data not currently available */
-	if (m->status == MSG_PENDING) {
+	if (m->status == MSG_PENDING || m->status == MSG_PROCESSING) {
 		ret = 0;//-EAGAIN;
 		*more = 1;
 		goto fin;
@@ -575,7 +799,7 @@ static int provider_retrieve_reply(content_req_t cr, char *rep, int len, int *mo
 	else *more = 1;
 	ret = min;
 fin:
-	UNLOCK();
+	MSG_UNLOCK();
 	return ret;
 }
 
@@ -588,35 +812,30 @@ content_req_t async_open(spdid_t spdid, long evt_id, struct cos_array *data)
 {
 	struct message *m;
 	struct service_provider *sp;
+	content_req_t id;
 
 	async_trace("async_open\n");
 	if (!cos_argreg_arr_intern(data)) return -EINVAL;
 	if (data->mem[data->sz] != '\0') return -EINVAL;
 
-	LOCK();
+	PROV_LOCK();
+	sp = provider_find(data->mem);
+	if (NULL != sp && 0 == sp->nworkers) sp = NULL;
+	PROV_UNLOCK();
+	if (NULL == sp) return -EINVAL;
+
+	MSG_LOCK();
 	m = provider_create_message(evt_id);
 	if (NULL == m) {
-		UNLOCK();
+		MSG_UNLOCK();
 		printc("async_inv: open -- could not create message.");
 		return -ENOMEM;
 	}
-	/* FIXME,BUG: stupid to trust that data->mem is bounded with \0  */
-	sp = provider_find(data->mem);
-	if (NULL == sp) {
-		provider_release_message(m);
-		UNLOCK();
-		return -EINVAL;
-	}
-	assert(sp->main.type == PROVIDER_MAIN_T);
-	/* FIXME: Here we don't keep a direct reference in case the sp
-	 * is later deallocated.  We avoid reference counting, but if
-	 * the sp_id is later allocated to another provider, we make
-	 * an incorrect call.  Should really do refcnting.
-	 */
-	m->sp_id = sp->main.id;
-	UNLOCK();
+	m->sp = sp;
+	id = m->id;
+	MSG_UNLOCK();
 
-	return m->id;
+	return id;
 }
 
 int async_close(spdid_t spdid, content_req_t cr)
@@ -624,14 +843,14 @@ int async_close(spdid_t spdid, content_req_t cr)
 	struct message *m;
 
 	async_trace("async_close\n");
-	LOCK();
+	MSG_LOCK();
 	m = cos_map_lookup(&messages, cr);
 	if (NULL == m) {
-		UNLOCK();
+		MSG_UNLOCK();
 		return -EINVAL;
 	}
 	provider_release_message(m);
-	UNLOCK();
+	MSG_UNLOCK();
 	return 0;
 }
 
@@ -675,22 +894,24 @@ int async_retrieve(spdid_t spdid, content_req_t cr, struct cos_array *data, int
 
 long content_create(spdid_t spdid, long evt_id, struct cos_array *data)
 {
-	struct service_provider *sp;
+	struct worker *w;
+	long id;
 
 	async_trace("content_create\n");
 	if (!cos_argreg_arr_intern(data)) return -EINVAL;
 	if (data->mem[data->sz] != '\0') return -EINVAL;
 
-	LOCK();
-	sp = provider_create(data->mem, data->sz, evt_id);
-	if (NULL == sp) {
-		UNLOCK();
+	PROV_LOCK();
+	w = provider_worker_create(data->mem, data->sz, evt_id);
+	if (NULL == w) {
+		PROV_UNLOCK();
 		return -EINVAL;
 	}
-	assert(sp->main.type == PROVIDER_MAIN_T);
-	UNLOCK();
+	assert(w->main.type == PROVIDER_MAIN_T);
+	id = w->main.id;
+	PROV_UNLOCK();
 
-	return sp->main.id;
+	return id;
 }
 
 int content_remove(spdid_t spdid, long conn_id)
@@ -698,24 +919,18 @@ int content_remove(spdid_t spdid, long conn_id)
 	int ret;
 
 	async_trace("content_remove\n");
-	LOCK();
+	PROV_LOCK();
 	ret = provider_remove(conn_id);
-	UNLOCK();
+	PROV_UNLOCK();
 	
 	return ret;
 }
 
 long content_split(spdid_t spdid, long conn_id, long evt_id)
 {
-	int ret;
-
 	async_trace("content_split\n");
 
-	LOCK();
-	ret = provider_open_req_rep(conn_id, evt_id);
-	UNLOCK();
-
-	return ret;
+	return provider_open_req_rep(conn_id, evt_id);
 }
 
 /* 
@@ -744,8 +959,8 @@ int content_read(spdid_t spdid, long conn_id, char *data, int sz)
 
 void cos_init(void *arg)
 {
-	lock_static_init(&biglock);
+	lock_static_init(&prov_lock);
+	lock_static_init(&msg_lock);
 	cos_map_init_static(&providers);
 	cos_map_init_static(&messages);
-	INIT_LIST(&ps, next, prev);
 }
@@ -11,16 +11,19 @@
 #include <cos_alloc.h>
 #include <print.h>
 #include <cos_map.h>
+#include <cos_list.h>
+#include <cos_synchronization.h>
+#include <cbuf.h>
 #include <errno.h>
 
 #include <content_mux.h>
-
-/* FIXME: locking! */
+#include <evt.h>
 
 typedef content_req_t (*content_open_fn_t)(spdid_t spdid, long evt_id, struct cos_array *data);
 typedef int (*content_request_fn_t)(spdid_t spdid, content_req_t cr, struct cos_array *data);
 typedef int (*content_retrieve_fn_t)(spdid_t spdid, content_req_t cr, struct cos_array *data, int *more);
 typedef int (*content_close_fn_t)(spdid_t spdid, content_req_t cr);
+typedef int (*content_retrieve_cbuf_fn_t)(spdid_t spdid, content_req_t cr, int *len, int *more);
 
 #include <static_content.h>
 #include <async_inv.h>
@@ -35,6 +38,7 @@ extern content_req_t alt_static_open(spdid_t spdid, long evt_id, struct cos_arra
 extern int alt_static_request(spdid_t spdid, content_req_t cr, struct cos_array *data);
 extern int alt_static_retrieve(spdid_t spdid, content_req_t cr, struct cos_array *data, int *more);
 extern int alt_static_close(spdid_t spdid, content_req_t cr);
+extern int alt_static_retrieve_cbuf(spdid_t spdid, content_req_t cr, int *len, int *more);
 
 
 struct provider_fns {
@@ -42,6 +46,8 @@ struct provider_fns {
 	content_request_fn_t  request;
 	content_retrieve_fn_t retrieve;
 	content_close_fn_t    close;
+	/* optional: return responses by reference */
+	content_retrieve_cbuf_fn_t retrieve_cbuf;
 };
 
 struct provider_fns static_content = {
@@ -55,15 +61,16 @@ struct provider_fns alt_static_content = {
 	.open = alt_static_open,
 	.request = alt_static_request,
 	.retrieve = alt_static_retrieve,
-	.close = alt_static_close
+	.close = alt_static_close,
+	.retrieve_cbuf = alt_static_retrieve_cbuf
 };
 
-/* struct provider_fns async_content = { */
-/* 	.open = async_open, */
-/* 	.request = async_request, */
-/* 	.retrieve = async_retrieve, */
-/* 	.close = async_close */
-/* }; */
+struct provider_fns async_content = {
+	.open = async_open,
+	.request = async_request,
+	.retrieve = async_retrieve,
+	.close = async_close
+};
 
 /* struct provider_fns alt_async_content = { */
 /* 	.open = alt_async_open, */
@@ -72,40 +79,41 @@ struct provider_fns alt_static_content = {
 /* 	.close = alt_async_close */
 /* }; */
 
+/* indexed by content_provider_t */
+struct provider_fns *providers[] = {
+	[CONTENT_PROVIDER_STATIC] = &static_content,
+	[CONTENT_PROVIDER_MAP]    = &alt_static_content,
+	[CONTENT_PROVIDER_ASYNC]  = &async_content
+};
+
 struct route {
 	char *prefix;
 	struct provider_fns *fns;
+	int cache; 		/* are responses cacheable? */
 };
 
 #define MAX_PATH 128
 
 /* 
- * More specific (longer) prefixes should go first.  This lookup is
- * done like routing table lookups, from the top down, choosing
- * matches as they are found.  Thus even though a more general path
- * might exist that matches the path, it will not be chosen if a more
- * specific path exists above it.
+ * The routes present at boot.  Others can be added and removed at
+ * runtime with content_route_add/del.  Lookups choose the longest
+ * matching prefix, so the order here doesn't matter.
  */
 struct route routing_tbl[] = {
-	/* { */
-	/* 	.prefix = "/cgi/hw", */
-	/* 	.fns = &async_content */
-	/* }, */
-	/* { */
-	/* 	.prefix = "/cgi/HW", */
-	/* 	.fns = &alt_async_content */
-	/* }, */
 	{
 		.prefix = "/map",
-		.fns = &alt_static_content
+		.fns = &alt_static_content,
+		.cache = 1
 	},
 	{
 		.prefix = "/", 
-		.fns = &static_content
+		.fns = &static_content,
+		.cache = 1
 	},
 	{
 		.prefix = "", 
-		.fns = &static_content
+		.fns = &static_content,
+		.cache = 1
 	},
 	{
 		.prefix = NULL, 
@@ -113,6 +121,80 @@ struct route routing_tbl[] = {
 	}
 };
 
+/***************************************************
+ * Prefix trie of routes
+ ***************************************************/
+
+/* 
+ * A node per prefix character, children kept in a sibling list.
+ * Lookup walks the path once, remembering the deepest node with a
+ * route, so its cost is linear in the path length, and independent
+ * of the number of routes.
+ */
+struct route_node {
+	char c;
+	struct route r; 	/* r.fns == NULL if no route ends here */
+	struct route_node *child, *sibling;
+};
+
+static struct route_node route_root;
+cos_lock_t route_lock;
+#define ROUTE_TAKE()    lock_take(&route_lock)
+#define ROUTE_RELEASE() lock_release(&route_lock)
+
+static inline struct route_node *route_child(struct route_node *n, char c)
+{
+	struct route_node *ch;
+
+	for (ch = n->child ; ch && ch->c != c ; ch = ch->sibling) ;
+	return ch;
+}
+
+static int route_insert(char *prefix, int len, struct provider_fns *fns, int cache)
+{
+	struct route_node *n = &route_root, *ch;
+	int i;
+
+	for (i = 0 ; i < len ; i++) {
+		ch = route_child(n, prefix[i]);
+		if (NULL == ch) {
+			ch = malloc(sizeof(struct route_node));
+			if (NULL == ch) return -ENOMEM;
+			memset(ch, 0, sizeof(struct route_node));
+			ch->c       = prefix[i];
+			ch->sibling = n->child;
+			n->child    = ch;
+		}
+		n = ch;
+	}
+	n->r.prefix = NULL;
+	n->r.fns    = fns;
+	n->r.cache  = cache;
+
+	return 0;
+}
+
+/* remove the route, and the nodes that no longer lead to any */
+static int __route_remove(struct route_node *n, char *prefix, int len)
+{
+	struct route_node *ch, **p;
+
+	if (0 == len) {
+		if (NULL == n->r.fns) return -ENOENT;
+		n->r.fns = NULL;
+		return 0;
+	}
+	for (p = &n->child ; *p && (*p)->c != prefix[0] ; p = &(*p)->sibling) ;
+	ch = *p;
+	if (NULL == ch) return -ENOENT;
+	if (__route_remove(ch, prefix+1, len-1)) return -ENOENT;
+	if (NULL == ch->r.fns && NULL == ch->child) {
+		*p = ch->sibling;
+		free(ch);
+	}
+	return 0;
+}
+
 static inline int strnlen(char *s, int max)
 {
 	int i;
@@ -124,28 +206,40 @@ static inline int strnlen(char *s, int max)
 	return max;
 }
 
-static struct provider_fns *route_lookup(char *path, int sz)
+static int route_lookup(char *path, int sz, struct route *r)
 {
+	struct route_node *n = &route_root, *match = NULL;
 	int i;
 
 	assert(path);
-	if (sz > MAX_PATH) return NULL;
+	if (sz > MAX_PATH) return -1;
+	ROUTE_TAKE();
+	for (i = 0 ; n ; i++) {
+		if (n->r.fns) match = n;
+		if (i == sz || '\0' == path[i]) break;
+		n = route_child(n, path[i]);
+	}
+	if (match) *r = match->r;
+	ROUTE_RELEASE();
+
+	return match ? 0 : -1;
+}
+
+static void route_init(void)
+{
+	int i;
+
+	lock_static_init(&route_lock);
+	memset(&route_root, 0, sizeof(struct route_node));
 	for (i = 0 ; routing_tbl[i].prefix != NULL ; i++) {
 		struct route *r = &routing_tbl[i];
-		int path_len, prefix_len;
-		if (NULL == r->prefix) return NULL;
-
-		path_len = strnlen(path, sz);
-		prefix_len = strlen(r->prefix);
-		if (path_len < prefix_len) continue;
 
-		if (0 == strncmp(r->prefix, path, prefix_len)) {
-			return r->fns;
-		}
+		if (route_insert(r->prefix, strlen(r->prefix), r->fns, r->cache)) BUG();
 	}
-	return NULL;
 }
 
+struct cache_ent;
+
 struct content_req {
 	content_req_t id, child_id;
 
@@ -156,9 +250,243 @@ struct content_req {
 	int pending_sz;
 	
 	struct provider_fns *fns;
+
+	/* 
+	 * A hit is served from cached, at offset cache_off.  A
+	 * cacheable miss remembers its path so that the response
+	 * can be inserted into the cache when it is retrieved.
+	 */
+	struct cache_ent *cached;
+	int cache_off, retrieved;
+	char *fill_path;
 };
 
 COS_MAP_CREATE_STATIC(content_requests);
+/* 
+ * Protects the content_requests map.  A request itself is only used
+ * by the thread serving it, and the cache has its own lock.
+ */
+cos_lock_t request_lock;
+#define REQUEST_TAKE()    lock_take(&request_lock)
+#define REQUEST_RELEASE() lock_release(&request_lock)
+
+/***************************************************
+ * Response cache
+ ***************************************************/
+
+/* 
+ * Responses for cacheable routes are kept in cbufs, keyed by the
+ * normalized path (including the query string), and evicted in LRU
+ * order.  Hits don't invoke the content provider at all, and can be
+ * retrieved either by copying (content_retrieve) or as a reference
+ * to the shared, read-only cbuf (content_retrieve_cbuf).  An entry
+ * in use by a request is not evicted or freed until the request is
+ * closed.  Only responses that fit in a single cbuf (a page), and
+ * that are retrieved in one piece are cached.
+ */
+#define CACHE_MAX_ENTS 64
+#define CACHE_HASH_SZ  128 	/* power of 2 */
+#define CACHE_MAX_RESP PAGE_SIZE
+
+struct cache_ent {
+	char path[MAX_PATH+1];
+	int path_len;
+	u32_t hash;
+	long etag;
+
+	cbuf_t cb;
+	char *resp;
+	int resp_len;
+
+	int refcnt, stale;
+	struct cache_ent *hnext;       /* hash chain */
+	struct cache_ent *next, *prev; /* LRU list, most recent first */
+};
+
+cos_lock_t cache_lock;
+#define CACHE_TAKE()    lock_take(&cache_lock)
+#define CACHE_RELEASE() lock_release(&cache_lock)
+
+static struct cache_ent *cache_tbl[CACHE_HASH_SZ];
+static struct cache_ent cache_lru;
+static int cache_nents;
+static long cache_etag = 1;
+
+enum {
+	CACHE_STAT_HITS,
+	CACHE_STAT_MISSES,
+	CACHE_STAT_FILLS,
+	CACHE_STAT_EVICTIONS,
+	CACHE_STAT_INVALIDATIONS,
+	CACHE_STAT_ENTRIES,
+	CACHE_STAT_MAX
+};
+static unsigned long cache_stats[CACHE_STAT_MAX];
+
+/* 
+ * Normalize the path into out (of size MAX_PATH+1): ensure a leading
+ * '/', collapse repeated '/'s, and resolve "." and ".." segments.
+ * The query string is copied verbatim.  Return the length, or -1 if
+ * it doesn't fit.
+ */
+static int path_normalize(char *in, int len, char *out)
+{
+	int i = 0, o = 0;
+
+	out[o++] = '/';
+	while (i < len && '\0' != in[i] && '?' != in[i]) {
+		int seg, seg_len;
+
+		while (i < len && '/' == in[i]) i++;
+		seg = i;
+		while (i < len && '\0' != in[i] && '?' != in[i] && '/' != in[i]) i++;
+		seg_len = i - seg;
+
+		if (0 == seg_len || (1 == seg_len && '.' == in[seg])) continue;
+		if (2 == seg_len && '.' == in[seg] && '.' == in[seg+1]) {
+			/* remove the last segment */
+			if (o > 1) o--;
+			while (o > 1 && '/' != out[o-1]) o--;
+			continue;
+		}
+		if (o + seg_len + 1 > MAX_PATH) return -1;
+		memcpy(out + o, in + seg, seg_len);
+		o += seg_len;
+		/* keep trailing '/'s significant */
+		if (i < len && '/' == in[i]) out[o++] = '/';
+	}
+	for ( ; i < len && '\0' != in[i] ; i++) {
+		if (o >= MAX_PATH) return -1;
+		out[o++] = in[i];
+	}
+	out[o] = '\0';
+
+	return o;
+}
+
+static inline u32_t cache_hash(char *path, int len)
+{
+	u32_t h = 5381;
+	int i;
+
+	for (i = 0 ; i < len ; i++) h = ((h << 5) + h) + path[i];
+	return h;
+}
+
+static struct cache_ent *cache_lookup(char *path, int len, u32_t h)
+{
+	struct cache_ent *e;
+
+	for (e = cache_tbl[h & (CACHE_HASH_SZ-1)] ; e ; e = e->hnext) {
+		if (e->hash == h && e->path_len == len && !memcmp(e->path, path, len)) return e;
+	}
+	return NULL;
+}
+
+static void cache_ent_free(struct cache_ent *e)
+{
+	assert(0 == e->refcnt && e->stale);
+	cbuf_free(e->resp);
+	free(e);
+}
+
+/* remove from the lookup structures; freed when unreferenced */
+static void cache_remove(struct cache_ent *e)
+{
+	struct cache_ent **p;
+
+	for (p = &cache_tbl[e->hash & (CACHE_HASH_SZ-1)] ; *p != e ; p = &(*p)->hnext) assert(*p);
+	*p = e->hnext;
+	REM_LIST(e, next, prev);
+	e->stale = 1;
+	cache_nents--;
+	cache_stats[CACHE_STAT_ENTRIES] = cache_nents;
+	if (0 == e->refcnt) cache_ent_free(e);
+}
+
+static void cache_put(struct cache_ent *e)
+{
+	assert(e->refcnt > 0);
+	e->refcnt--;
+	if (0 == e->refcnt && e->stale) cache_ent_free(e);
+}
+
+/* called on a hit, with the lock */
+static struct cache_ent *cache_get(char *path, int len)
+{
+	struct cache_ent *e;
+
+	e = cache_lookup(path, len, cache_hash(path, len));
+	if (NULL == e) {
+		cache_stats[CACHE_STAT_MISSES]++;
+		return NULL;
+	}
+	cache_stats[CACHE_STAT_HITS]++;
+	e->refcnt++;
+	REM_LIST(e, next, prev);
+	ADD_LIST(&cache_lru, e, next, prev);
+
+	return e;
+}
+
+static void cache_insert(char *path, char *resp, int resp_len)
+{
+	struct cache_ent *e;
+	u32_t h;
+	int len;
+
+	if (resp_len <= 0 || resp_len > CACHE_MAX_RESP) return;
+	len = strlen(path);
+	h   = cache_hash(path, len);
+	/* raced with another miss for the same path */
+	if (cache_lookup(path, len, h)) return;
+
+	/* evict the least recently used unreferenced entry */
+	if (cache_nents >= CACHE_MAX_ENTS) {
+		for (e = LAST_LIST(&cache_lru, next, prev) ; 
+		     e != &cache_lru && e->refcnt ; 
+		     e = LAST_LIST(e, next, prev)) ;
+		if (e == &cache_lru) return;
+		cache_remove(e);
+		cache_stats[CACHE_STAT_EVICTIONS]++;
+	}
+
+	e = malloc(sizeof(struct cache_ent));
+	if (NULL == e) return;
+	e->resp = cbuf_alloc(resp_len, &e->cb);
+	if (NULL == e->resp) {
+		free(e);
+		return;
+	}
+	memcpy(e->resp, resp, resp_len);
+	e->resp_len = resp_len;
+	memcpy(e->path, path, len+1);
+	e->path_len = len;
+	e->hash     = h;
+	e->etag     = cache_etag++;
+	e->refcnt   = 0;
+	e->stale    = 0;
+	e->hnext    = cache_tbl[h & (CACHE_HASH_SZ-1)];
+	cache_tbl[h & (CACHE_HASH_SZ-1)] = e;
+	ADD_LIST(&cache_lru, e, next, prev);
+	cache_nents++;
+	cache_stats[CACHE_STAT_FILLS]++;
+	cache_stats[CACHE_STAT_ENTRIES] = cache_nents;
+}
+
+static void cache_flush(void)
+{
+	while (!EMPTY_LIST(&cache_lru, next, prev)) {
+		cache_remove(FIRST_LIST(&cache_lru, next, prev));
+		cache_stats[CACHE_STAT_INVALIDATIONS]++;
+	}
+}
+
+static void cache_init(void)
+{
+	lock_static_init(&cache_lock);
+	INIT_LIST(&cache_lru, next, prev);
+}
 
 static struct content_req *request_alloc(struct provider_fns *fns, long evt_id, spdid_t spdid)
 {
@@ -171,7 +499,9 @@ static struct content_req *request_alloc(struct provider_fns *fns, long evt_id,
 	r = malloc(sizeof(struct content_req));
 	if (!r) return NULL;
 	
+	REQUEST_TAKE();
 	id = cos_map_add(&content_requests, r);
+	REQUEST_RELEASE();
 	if (-1 == id) {
 		free(r);
 		return NULL;
@@ -180,19 +510,38 @@ static struct content_req *request_alloc(struct provider_fns *fns, long evt_id,
 	r->spdid = spdid;
 	r->fns = fns;
 	r->id = id;
+	r->child_id  = -1;
+	r->cached    = NULL;
+	r->cache_off = 0;
+	r->retrieved = 0;
+	r->fill_path = NULL;
 
 	return r;
 }
 
 static inline struct content_req *request_find(content_req_t cr)
 {
+	struct content_req *r;
+
 	assert(0 <= cr);
-	return cos_map_lookup(&content_requests, cr);
+	REQUEST_TAKE();
+	r = cos_map_lookup(&content_requests, cr);
+	REQUEST_RELEASE();
+
+	return r;
 }
 
 static void request_free(struct content_req *req)
 {
+	REQUEST_TAKE();
 	cos_map_del(&content_requests, req->id);
+	REQUEST_RELEASE();
+	if (req->cached) {
+		CACHE_TAKE();
+		cache_put(req->cached);
+		CACHE_RELEASE();
+	}
+	if (req->fill_path) free(req->fill_path);
 	free(req);
 }
 
@@ -200,21 +549,50 @@ content_req_t content_open(spdid_t spdid, long evt_id, struct cos_array *data)
 {
 	struct provider_fns *fns;
 	struct content_req *r;
+	struct route rt;
+	struct cos_array *npath;
+	char path[MAX_PATH+1];
+	int path_len;
 
 	if (!cos_argreg_arr_intern(data)) return -EINVAL;
 	/* FIXME: should allow polling */
 	if (evt_id < 0) return -EINVAL;
 
-	fns = route_lookup(data->mem, data->sz);
-	if (NULL == fns) return -EINVAL;
+	/* 
+	 * Route, open, and cache all on the normalized path so that
+	 * a cached response is always the one its path routes to.
+	 */
+	path_len = path_normalize(data->mem, data->sz, path);
+	if (path_len < 0) return -EINVAL;
+	if (route_lookup(path, path_len, &rt)) return -EINVAL;
+	fns = rt.fns;
 	r = request_alloc(fns, evt_id, spdid);
 	if (NULL == r) return -ENOMEM;
 
+	if (rt.cache) {
+		CACHE_TAKE();
+		r->cached = cache_get(path, path_len);
+		CACHE_RELEASE();
+		/* hit: the provider is never involved */
+		if (r->cached) return r->id;
+		r->fill_path = malloc(path_len+1);
+		if (r->fill_path) memcpy(r->fill_path, path, path_len+1);
+	}
+
+	npath = cos_argreg_alloc(sizeof(struct cos_array) + path_len + 1);
+	if (NULL == npath) {
+		request_free(r);
+		return -ENOMEM;
+	}
+	memcpy(npath->mem, path, path_len + 1);
+	npath->sz = path_len;
+
 	assert(fns && fns->open);
-	r->child_id = fns->open(cos_spd_id(), evt_id, data);
+	r->child_id = fns->open(cos_spd_id(), evt_id, npath);
+	cos_argreg_free(npath);
 	if (r->child_id < 0) {
 		content_req_t err = r->child_id;
-		printc("content_mgr: cannot open content w/ %s\n", data->mem);
+		printc("content_mgr: cannot open content w/ %s\n", path);
 		request_free(r);
 		return err;
 	}
@@ -229,6 +607,11 @@ int content_request(spdid_t spdid, content_req_t cr, struct cos_array *data)
 	r = request_find(cr);
 	if (NULL == r) return -EINVAL;
 
+	/* cached data is available immediately */
+	if (r->cached) {
+		evt_trigger(cos_spd_id(), r->evt_id);
+		return 0;
+	}
 	assert(r->fns && r->fns->request);
 	return r->fns->request(cos_spd_id(), r->child_id, data);
 }
@@ -238,14 +621,174 @@ int content_retrieve(spdid_t spdid, content_req_t cr, struct cos_array *data, in
 {
 	struct content_req *r;
 
+	int ret;
+
 	r = request_find(cr);
 	if (NULL == r) {
 		printc("could not find request!\n");
 		return -EINVAL;
 	}
 
+	if (r->cached) {
+		struct cache_ent *e = r->cached;
+		int amnt;
+
+		if (!cos_argreg_arr_intern(data)) return -EINVAL;
+		if (!cos_argreg_buff_intern((char*)more, sizeof(int))) return -EINVAL;
+		amnt = e->resp_len - r->cache_off;
+		if (amnt > data->sz) amnt = data->sz;
+		memcpy(data->mem, e->resp + r->cache_off, amnt);
+		r->cache_off += amnt;
+		data->sz = amnt;
+		*more = r->cache_off < e->resp_len;
+		return 0;
+	}
+
 	assert(r->fns && r->fns->retrieve);
-	return r->fns->retrieve(cos_spd_id(), r->child_id, data, more);
+	ret = r->fns->retrieve(cos_spd_id(), r->child_id, data, more);
+	if (ret) return ret;
+	/* a complete response, retrieved at once and not CONTENT_NOCACHE, is cached */
+	if (r->fill_path && !r->retrieved && !*more) {
+		CACHE_TAKE();
+		cache_insert(r->fill_path, data->mem, data->sz);
+		CACHE_RELEASE();
+	}
+	*more &= ~CONTENT_NOCACHE;
+	r->retrieved = 1;
+
+	return ret;
+}
+
+/* 
+ * Retrieve a cached response as a reference to the cbuf holding it,
+ * rather than as a copy.  The cbuf is read-only and valid until the
+ * request is closed.  *len is only set if the response is cached;
+ * otherwise content_retrieve should be used.  *more is set to the
+ * CONTENT_* flags (content_req.h).
+ */
+int content_retrieve_cbuf(spdid_t spdid, content_req_t cr, int *len, int *more)
+{
+	struct content_req *r;
+	struct cache_ent *e;
+
+	if (!cos_argreg_buff_intern((char*)len, sizeof(int)) ||
+	    !cos_argreg_buff_intern((char*)more, sizeof(int))) return -EINVAL;
+	r = request_find(cr);
+	if (NULL == r) return -EINVAL;
+	e = r->cached;
+	if (NULL == e) {
+		int cb;
+
+		/* the provider might have prebuilt responses */
+		if (r->retrieved || NULL == r->fns->retrieve_cbuf) return 0;
+		cb = r->fns->retrieve_cbuf(cos_spd_id(), r->child_id, len, more);
+		/* if declined, content_retrieve can still fill the cache */
+		if (cb > 0) r->retrieved = 1;
+		return cb;
+	}
+	if (r->cache_off) return 0;
+
+	r->cache_off = e->resp_len;
+	*len  = e->resp_len;
+	*more = 0;
+
+	return (int)e->cb;
+}
+
+/* The entity tag of a cached response, or -ENOENT */
+long content_etag(spdid_t spdid, content_req_t cr)
+{
+	struct content_req *r;
+
+	r = request_find(cr);
+	if (NULL == r) return -EINVAL;
+	if (NULL == r->cached) return -ENOENT;
+	return r->cached->etag;
+}
+
+/* 
+ * Hook for providers: the content for a path (or, with an empty
+ * path, for all paths) has changed, so drop the cached responses.
+ * Requests currently being served from them are unaffected.
+ */
+int content_invalidate(spdid_t spdid, struct cos_array *data)
+{
+	struct cache_ent *e;
+	char path[MAX_PATH+1];
+	int len;
+
+	if (!cos_argreg_arr_intern(data)) return -EINVAL;
+
+	CACHE_TAKE();
+	if (0 == data->sz) {
+		cache_flush();
+	} else if ((len = path_normalize(data->mem, data->sz, path)) > 0) {
+		e = cache_lookup(path, len, cache_hash(path, len));
+		if (e) {
+			cache_remove(e);
+			cache_stats[CACHE_STAT_INVALIDATIONS]++;
+		}
+	}
+	CACHE_RELEASE();
+
+	return 0;
+}
+
+unsigned long *content_stats(spdid_t spdid, unsigned long *stats)
+{
+	int sz = CACHE_STAT_MAX * sizeof(unsigned long);
+
+	if (!cos_argreg_buff_intern((char*)stats, sz)) return NULL;
+	CACHE_TAKE();
+	memcpy(stats, cache_stats, sz);
+	CACHE_RELEASE();
+
+	return stats;
+}
+
+int content_stats_len(spdid_t spdid)
+{
+	return CACHE_STAT_MAX;
+}
+
+/* 
+ * Route the paths starting with prefix to one of the providers
+ * (content_provider_t), replacing any previous route for that same
+ * prefix.  The cache is flushed as cached responses might now be
+ * answered by another provider.
+ */
+int content_route_add(spdid_t spdid, struct cos_array *prefix, int provider, int cache)
+{
+	int ret;
+
+	if (!cos_argreg_arr_intern(prefix)) return -EINVAL;
+	if (prefix->sz > MAX_PATH) return -EINVAL;
+	if (provider < 0 || provider >= CONTENT_PROVIDER_MAX) return -EINVAL;
+
+	ROUTE_TAKE();
+	ret = route_insert(prefix->mem, strnlen(prefix->mem, prefix->sz), 
+			   providers[provider], cache);
+	ROUTE_RELEASE();
+	CACHE_TAKE();
+	cache_flush();
+	CACHE_RELEASE();
+
+	return ret;
+}
+
+int content_route_del(spdid_t spdid, struct cos_array *prefix)
+{
+	int ret;
+
+	if (!cos_argreg_arr_intern(prefix)) return -EINVAL;
+	ROUTE_TAKE();
+	ret = __route_remove(&route_root, prefix->mem, strnlen(prefix->mem, prefix->sz));
+	ROUTE_RELEASE();
+	CACHE_TAKE();
+	cache_flush();
+	CACHE_RELEASE();
+
+	return ret;
 }
 
 /* type = content_close_fn_t */
@@ -253,19 +796,26 @@ int content_close(spdid_t spdid, content_req_t cr)
 {
 	struct content_req *r;
 	content_close_fn_t c;
+	content_req_t child_id;
 
 	r = request_find(cr);
 	if (NULL == r) return -EINVAL;
 	assert(r->fns && r->fns->close);
 	c = r->fns->close;
+	child_id = r->child_id;
 	request_free(r);
 	
-	return c(cos_spd_id(), r->child_id);
+	/* cache hits never opened the provider */
+	if (child_id < 0) return 0;
+	return c(cos_spd_id(), child_id);
 }
 
 void cos_init(void *arg)
 {
 	cos_map_init_static(&content_requests);
+	lock_static_init(&request_lock);
+	route_init();
+	cache_init();
 	return;
 }
 
@@ -18,6 +18,7 @@
 #include <cos_list.h>
 #include <print.h>
 #include <cos_map.h>
+#include <cos_vect.h>
 
 #include <errno.h>
 
@@ -60,7 +61,8 @@ typedef enum {
 COS_MAP_CREATE_STATIC(evt_map);
 cos_lock_t evt_lock;
 
-struct evt_grp grps;
+/* thread id -> event group */
+COS_VECT_CREATE_STATIC(grps);
 
 /* 
  * mapping_* functions are for maintaining mappings between an
@@ -103,39 +105,21 @@ static inline void evt_grp_free(struct evt_grp *g)
 {
 	int i;
 
-	if (!EMPTY_LIST(g, next, prev)) {
-		REM_LIST(g, next, prev);
-	}
-	while (!EMPTY_LIST(&g->events, next, prev)) {
-		struct evt *e;
-		
-		e = FIRST_LIST(&g->events, next, prev);
-		REM_LIST(e, next, prev);
-	}
-	for (i = 0 ; i < EVT_NUM_PRIOS ; i++) {
-		while (!EMPTY_LIST(&g->triggered[i], next, prev)) {
-			struct evt *e;
-			
-			e = FIRST_LIST(&g->triggered[i], next, prev);
-			REM_LIST(e, next, prev);
-		}
+	assert(0 == g->nevts);
+	for (i = 0 ; i < EVT_GRP_CHUNKS ; i++) {
+		if (g->chunks[i]) free(g->chunks[i]);
 	}
 	free(g);
 }
 
 static inline struct evt_grp *evt_grp_find(u16_t tid)
 {
-	struct evt_grp *g;
-
-	for (g = FIRST_LIST(&grps, next, prev) ; g != &grps ; g = FIRST_LIST(g, next, prev)) {
-		if (g->tid == tid) return g;
-	}
-	return NULL;
+	return cos_vect_lookup(&grps, tid);
 }
 
 static inline int evt_grp_add(struct evt_grp *g)
 {
-	ADD_LIST(&grps, g, next, prev);
+	if (0 > cos_vect_add_id(&grps, g, g->tid)) return -1;
 	return 0;
 }
 
@@ -144,14 +128,12 @@ static inline int evt_grp_add(struct evt_grp *g)
  * is never good, but the code is much simpler for it.  A trade-off
  * I'm commonly making now.
  */
-long evt_create(spdid_t spdid)
+/* Create an event in the current thread's group, with evt_lock held */
+static long __evt_create(spdid_t spdid, u16_t tid)
 {
-	u16_t tid = cos_get_thd_id();
 	struct evt_grp *g;
 	struct evt *e;
-	int ret = -ENOMEM;
 
-	lock_take(&evt_lock);
 	g = evt_grp_find(tid);
 	/* If the group associated with this thread hasn't been
 	 * created yet. */
@@ -163,21 +145,59 @@ long evt_create(spdid_t spdid)
 			evt_grp_free(g);
 			goto err;
 		}
-		evt_grp_add(g);
+		if (evt_grp_add(g)) {
+			__evt_free(e);
+			evt_grp_free(g);
+			goto err;
+		}
 	} else {
 		e = __evt_new(g);
 		if (NULL == e) goto err;
 	}
 	e->extern_id = mapping_create(e);
 	if (0 > e->extern_id) goto free_evt_err;
-	ret = e->extern_id;
-done:
-	lock_release(&evt_lock);
-	return ret;
+
+	return e->extern_id;
 free_evt_err:
 	__evt_free(e);
 err:
-	goto done;
+	return -ENOMEM;
+}
+
+long evt_create(spdid_t spdid)
+{
+	long ret;
+
+	lock_take(&evt_lock);
+	ret = __evt_create(spdid, cos_get_thd_id());
+	lock_release(&evt_lock);
+
+	return ret;
+}
+
+/* 
+ * Create up to data->sz/sizeof(long) events in a single invocation,
+ * for clients that cache event ids.  Returns the number created, or
+ * an error if none could be.
+ */
+int evt_create_mult(spdid_t spdid, struct cos_array *data)
+{
+	u16_t tid = cos_get_thd_id();
+	int i, max;
+	long ret = 0;
+
+	if (!cos_argreg_arr_intern(data)) return -EINVAL;
+	max = data->sz / sizeof(long);
+
+	lock_take(&evt_lock);
+	for (i = 0 ; i < max ; i++) {
+		ret = __evt_create(spdid, tid);
+		if (0 > ret) break;
+		((long*)data->mem)[i] = ret;
+	}
+	lock_release(&evt_lock);
+
+	return i ? i : (int)ret;
 }
 
 void evt_free(spdid_t spdid, long extern_evt)
@@ -225,30 +245,37 @@ err:
 }
 
 /* As above, but return more than one event notifications */
+#define EVT_GATHER_BATCH 32
 int evt_grp_mult_wait(spdid_t spdid, struct cos_array *data)
 {
 	struct evt_grp *g;
-	struct evt *e = NULL;
+	struct evt *e = NULL, *es[EVT_GATHER_BATCH];
 	int evt_gathered = 0, evt_max;
 
 	if (!cos_argreg_arr_intern(data)) return -EINVAL;
 	evt_max = data->sz / sizeof(long);
 
 	while (1) {
+		int i, n;
+
 		lock_take(&evt_lock);
 
 		g = evt_grp_find(cos_get_thd_id());
 		ACT_RECORD(ACT_WAIT_GRP, spdid, e ? e->extern_id : 0, cos_get_thd_id(), 0);
 		if (NULL == g) goto err;
+		if (cos_get_thd_id() != g->tid) goto err;
+		g->status = EVTG_INACTIVE;
 
-		/* gather multiple events */
+		/* gather multiple events, only visiting those that are ready */
 		do {
-			if (__evt_grp_read_noblock(g, &e)) goto err;
-			if (NULL != e) {
-				((long*)data->mem)[evt_gathered] = e->extern_id;
-				evt_gathered++;
+			int amnt = evt_max - evt_gathered;
+
+			if (amnt > EVT_GATHER_BATCH) amnt = EVT_GATHER_BATCH;
+			n = __evt_grp_gather(g, es, amnt);
+			for (i = 0 ; i < n ; i++) {
+				((long*)data->mem)[evt_gathered++] = es[i]->extern_id;
 			}
-		} while (e && evt_gathered < evt_max);
+		} while (n == EVT_GATHER_BATCH && evt_gathered < evt_max);
 
 		/* return them if they were gathered */
 		if (evt_gathered > 0) {
@@ -262,7 +289,11 @@ int evt_grp_mult_wait(spdid_t spdid, struct cos_array *data)
 		 * status)
 		 */
 		if (__evt_grp_read(g, &e)) goto err;
-		assert(NULL == e);
+		if (NULL != e) {
+			((long*)data->mem)[0] = e->extern_id;
+			lock_release(&evt_lock);
+			return 1;
+		}
 		lock_release(&evt_lock);
 		ACT_RECORD(ACT_SLEEP, spdid, 0, cos_get_thd_id(), 0);
 		if (0 > sched_block(cos_spd_id(), 0)) BUG();
@@ -300,11 +331,29 @@ err:
 	return -1; 
 }
 
+/* 
+ * The common case is that the waiting thread is not blocked (it is
+ * busy processing other events), and all we need to do is to set the
+ * event's ready bit, which we can do with atomic instructions and
+ * without the lock.  Readers mark themselves blocked before checking
+ * the bitmaps a last time, so if we don't see them blocked after
+ * setting the bit, they will see the bit.  Event structures are
+ * type-stable, so a concurrent evt_free can at worst make us set the
+ * bit of the event that reuses the index (a spurious notification).
+ */
 int evt_trigger(spdid_t spdid, long extern_evt)
 {
 	struct evt *e;
+	struct evt_grp *g;
 	int ret = 0;
 
+	e = cos_map_lookup(&evt_map, extern_evt);
+	if (likely(e && e->extern_id == extern_evt && (g = e->grp))) {
+		ACT_RECORD(ACT_TRIGGER, spdid, e->extern_id, cos_get_thd_id(), 0);
+		__evt_ready_set(g, e->prio, e->idx);
+		if (likely(EVTG_BLOCKED != g->status && EVT_BLOCKED != e->status)) return 0;
+	}
+
 	lock_take(&evt_lock);
 
 	e = mapping_find(extern_evt);
@@ -329,14 +378,53 @@ err:
 int evt_set_prio(spdid_t spdid, long extern_evt, int prio)
 {
 	struct evt *e;
+	int ready;
 
-	if (prio >= EVT_NUM_PRIOS) return -1;
+	if (prio < 0 || prio >= EVT_NUM_PRIOS) return -1;
 
 	lock_take(&evt_lock);
 	e = mapping_find(extern_evt);
 	if (NULL == e) goto err;
+	/* move a pending notification to the new priority */
+	ready = __evt_ready(e);
+	if (ready) __evt_clear(e);
 	e->prio = prio;
-	/* FIXME: place into correct list in the group if it is triggered */
+	if (ready) __evt_ready_set(e->grp, e->prio, e->idx);
+	lock_release(&evt_lock);
+	return 0;
+err:
+	lock_release(&evt_lock);
+	return -1;
+}
+
+/* 
+ * A level-triggered event is reported by each read until it is
+ * explicitly cleared with evt_clear, rather than only once per
+ * trigger.
+ */
+int evt_set_level(spdid_t spdid, long extern_evt, int level)
+{
+	struct evt *e;
+
+	lock_take(&evt_lock);
+	e = mapping_find(extern_evt);
+	if (NULL == e) goto err;
+	e->level = !!level;
+	lock_release(&evt_lock);
+	return 0;
+err:
+	lock_release(&evt_lock);
+	return -1;
+}
+
+int evt_clear(spdid_t spdid, long extern_evt)
+{
+	struct evt *e;
+
+	lock_take(&evt_lock);
+	e = mapping_find(extern_evt);
+	if (NULL == e) goto err;
+	__evt_clear(e);
 	lock_release(&evt_lock);
 	return 0;
 err:
@@ -346,10 +434,21 @@ err:
 
 static void init_evts(void)
 {
+	long id;
+	int d;
+
 	lock_static_init(&evt_lock);
 	cos_map_init_static(&evt_map);
+	/* 
+	 * evt_trigger looks up events without the lock: expand the map
+	 * to its final depth now, so the root and depth never change
+	 * under it.
+	 */
+	for (d = 1, id = COS_VECT_BASE ; d < COS_VECT_DEPTH_MAX ; d++, id *= COS_VECT_BASE) {
+		if (__cos_vect_expand(&evt_map.data, id)) BUG();
+	}
+	cos_vect_init_static(&grps);
 	if (mapping_create(NULL) != 0) BUG();
-	INIT_LIST(&grps, next, prev);
 }
 
 void cos_init(void *arg)
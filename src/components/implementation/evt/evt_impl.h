@@ -13,21 +13,33 @@
 #include <cos_list.h>
 #include <cos_debug.h>
 #include <cos_alloc.h>
+#include <bitmap.h>
 
-/* 
- * Structures for an edge-triggered event component.
- * 
- * Current implementation has 64 events per event group.  Threads wait
- * on event groups, and events are triggered/reported giving a group
- * id and event id.  Events cannot be shared across groups.  The sum
- * of these limitations exist only to simplify implementation, and can
- * be relaxed.
+/*
+ * Structures for an event component supporting edge- and
+ * level-triggered events.
+ *
+ * Threads wait on event groups, and events are triggered/reported
+ * giving a group id and event id.  Events cannot be shared across
+ * groups.
+ *
+ * Each event has an index in its group, and which events are ready
+ * is tracked in a three level bitmap per priority: a word per 32
+ * events, a summary word per chunk with a bit per non-empty word,
+ * and a group summary with a bit per non-empty chunk.  Finding the
+ * next ready event is a few least-significant-bit operations
+ * regardless of the group size, so reading n events is O(n), not
+ * O(group size).
+ *
+ * Bits are only ever set with atomic instructions so that triggers
+ * can mark an event ready without taking the event lock (see
+ * evt_trigger).  Readers hold the lock, so there is a single
+ * clearer at a time.
  */
 
 typedef enum {
-	EVT_TRIGGERED, 	/* has the event been triggered */
 	EVT_BLOCKED,    /* the thread is blocked only on this one event */
-	EVT_INACTIVE	/* event has not been triggered since last read */
+	EVT_INACTIVE	/* no thread blocked on this specific event */
 } evt_status_t;
 
 typedef enum {
@@ -35,24 +47,38 @@ typedef enum {
 	EVTG_BLOCKED
 } evt_grp_status_t;
 
-#define EVT_NUM_PRIOS 2
-#define EVT_PER_GRP 250
+#define EVT_NUM_PRIOS   2
+#define EVT_CHUNK_WORDS 16
+#define EVT_PER_CHUNK   (EVT_CHUNK_WORDS * WORD_SIZE)
+#define EVT_GRP_CHUNKS  WORD_SIZE
+#define EVT_PER_GRP     (EVT_PER_CHUNK * EVT_GRP_CHUNKS)
 struct evt_grp;
 
 struct evt {
-	evt_status_t status;
-	int prio;
+	volatile evt_status_t status;
+	int prio, level, idx;
 	long extern_id;
 	struct evt_grp *grp;
-	struct evt *next, *prev;
+	struct evt *next;	/* freelist */
+};
+
+struct evt_chunk {
+	int nused;
+	u32_t used[EVT_CHUNK_WORDS];
+	volatile u32_t summary[EVT_NUM_PRIOS];
+	volatile u32_t ready[EVT_NUM_PRIOS][EVT_CHUNK_WORDS];
+	struct evt *evts[EVT_PER_CHUNK];
 };
 
 struct evt_grp {
 	spdid_t spdid; 		/* currently ignored */
 	u16_t tid;              /* thread that waits for events */
-	evt_grp_status_t status;
-	struct evt_grp *next, *prev;
-	struct evt events, triggered[EVT_NUM_PRIOS];
+	volatile evt_grp_status_t status;
+	int nevts;
+	/* where the next read starts, so that no event starves */
+	int cursor[EVT_NUM_PRIOS];
+	volatile u32_t summary[EVT_NUM_PRIOS];
+	struct evt_chunk *chunks[EVT_GRP_CHUNKS];
 };
 
 static inline void evt_grp_init(struct evt_grp *eg, spdid_t spdid, u16_t tid)
@@ -62,14 +88,144 @@ static inline void evt_grp_init(struct evt_grp *eg, spdid_t spdid, u16_t tid)
 	eg->spdid = spdid;
 	eg->tid = tid;
 	eg->status = EVTG_INACTIVE;
-	INIT_LIST(eg, next, prev);
-	INIT_LIST(&eg->events, next, prev);
+	eg->nevts = 0;
 	for (i = 0 ; i < EVT_NUM_PRIOS ; i++) {
-		INIT_LIST(&eg->triggered[i], next, prev);
+		eg->cursor[i] = 0;
+		eg->summary[i] = 0;
+	}
+	for (i = 0 ; i < EVT_GRP_CHUNKS ; i++) eg->chunks[i] = NULL;
+}
+
+/*
+ * Bitmap manipulation.  Triggers can set bits concurrently with a
+ * reader clearing them, so a summary bit is only cleared after its
+ * word is seen empty, and is set again if a trigger raced with us.
+ */
+static inline void __evt_atomic_set(volatile u32_t *w, u32_t bit)
+{
+	u32_t o;
+
+	do {
+		o = *w;
+		if (o & bit) return;
+	} while (unlikely(cos_cmpxchg(w, (long)o, (long)(o | bit)) != (long)(o | bit)));
+}
+
+static inline u32_t __evt_atomic_clear(volatile u32_t *w, u32_t bit)
+{
+	u32_t o;
+
+	do {
+		o = *w;
+		if (!(o & bit)) return o;
+	} while (unlikely(cos_cmpxchg(w, (long)o, (long)(o & ~bit)) != (long)(o & ~bit)));
+
+	return o & ~bit;
+}
+
+static inline void __evt_ready_set(struct evt_grp *g, int prio, int idx)
+{
+	struct evt_chunk *c = g->chunks[idx / EVT_PER_CHUNK];
+	int off = idx % EVT_PER_CHUNK;
+
+	__evt_atomic_set(&c->ready[prio][off / WORD_SIZE], 1U << (off % WORD_SIZE));
+	__evt_atomic_set(&c->summary[prio], 1U << (off / WORD_SIZE));
+	__evt_atomic_set(&g->summary[prio], 1U << (idx / EVT_PER_CHUNK));
+}
+
+static inline void __evt_ready_clear(struct evt_grp *g, int prio, int idx)
+{
+	struct evt_chunk *c = g->chunks[idx / EVT_PER_CHUNK];
+	int off = idx % EVT_PER_CHUNK;
+	volatile u32_t *w = &c->ready[prio][off / WORD_SIZE];
+	u32_t wbit = 1U << (off / WORD_SIZE), cbit = 1U << (idx / EVT_PER_CHUNK);
+
+	if (__evt_atomic_clear(w, 1U << (off % WORD_SIZE))) return;
+	__evt_atomic_clear(&c->summary[prio], wbit);
+	if (*w) __evt_atomic_set(&c->summary[prio], wbit);
+	if (c->summary[prio]) return;
+	__evt_atomic_clear(&g->summary[prio], cbit);
+	if (c->summary[prio]) __evt_atomic_set(&g->summary[prio], cbit);
+}
+
+static inline int __evt_ready(struct evt *e)
+{
+	struct evt_chunk *c = e->grp->chunks[e->idx / EVT_PER_CHUNK];
+	int off = e->idx % EVT_PER_CHUNK;
+
+	return c->ready[e->prio][off / WORD_SIZE] & (1U << (off % WORD_SIZE));
+}
+
+/* lowest index of a ready event >= from, or -1 */
+static int __evt_ready_next(struct evt_grp *g, int prio, int from)
+{
+	u32_t gmask;
+	int fc = from / EVT_PER_CHUNK, fw = (from % EVT_PER_CHUNK) / WORD_SIZE;
+
+	if (from >= EVT_PER_GRP) return -1;
+	gmask = g->summary[prio] & (~0UL << fc);
+	while (gmask) {
+		int ci = log32(ls_one(gmask));
+		struct evt_chunk *c = g->chunks[ci];
+		u32_t wmask;
+
+		wmask = c->summary[prio];
+		if (ci == fc) wmask &= ~0UL << fw;
+		while (wmask) {
+			int wi = log32(ls_one(wmask));
+			u32_t w = c->ready[prio][wi];
+
+			if (ci == fc && wi == fw) w &= ~0UL << (from % WORD_SIZE);
+			if (w) return ci * EVT_PER_CHUNK + wi * WORD_SIZE + log32(ls_one(w));
+			wmask &= wmask - 1;
+		}
+		gmask &= gmask - 1;
 	}
+	return -1;
 }
 
-/* 
+static inline struct evt *__evt_lookup_idx(struct evt_grp *g, int idx)
+{
+	return g->chunks[idx / EVT_PER_CHUNK]->evts[idx % EVT_PER_CHUNK];
+}
+
+/*
+ * Gather up to max ready events into es, starting at each
+ * priority's cursor and wrapping around once so that an event is
+ * reported at most once per call.  Edge-triggered events are
+ * consumed, level-triggered events stay ready until evt_clear.
+ */
+static int __evt_grp_gather(struct evt_grp *g, struct evt **es, int max)
+{
+	int prio, n = 0;
+
+	for (prio = 0 ; prio < EVT_NUM_PRIOS && n < max ; prio++) {
+		int start = g->cursor[prio], pos = start, wrapped = 0;
+
+		while (n < max) {
+			struct evt *e;
+			int idx;
+
+			idx = __evt_ready_next(g, prio, pos);
+			if (idx < 0 && !wrapped && start > 0) {
+				wrapped = 1;
+				pos = 0;
+				continue;
+			}
+			if (idx < 0 || (wrapped && idx >= start)) break;
+			pos = g->cursor[prio] = idx + 1;
+
+			e = __evt_lookup_idx(g, idx);
+			/* freed after being triggered */
+			if (NULL == e || !e->level) __evt_ready_clear(g, prio, idx);
+			if (NULL == e) continue;
+			es[n++] = e;
+		}
+	}
+	return n;
+}
+
+/*
  * Return the thread id of the thread that is waiting on the event in
  * the tid argument, or 0 if there is none in the tid argument.
  * Return 0 if no error, -1 otherwise.
@@ -88,12 +244,9 @@ static inline int __evt_trigger(struct evt *e)
 	assert(g);
 	gs = g->status;
 	s = e->status;
-	REM_LIST(e, next, prev);
-	/* Add to the triggered list */
-	ADD_END_LIST(&g->triggered[e->prio], e, next, prev);
+	__evt_ready_set(g, e->prio, e->idx);
 
-	/* mark the event as triggered. */
-	e->status = EVT_TRIGGERED;
+	e->status = EVT_INACTIVE;
 	g->status = EVTG_INACTIVE;
 	/* Someone waiting on this event? */
 	if (EVT_BLOCKED == s || EVTG_BLOCKED == gs) {
@@ -102,42 +255,30 @@ static inline int __evt_trigger(struct evt *e)
 	return 0;
 }
 
-/* 
+/*
  * As below but don't change the data-structure to reflect that we've
- * blocked if there are no events. 
+ * blocked if there are no events.
  */
 static int __evt_grp_read_noblock(struct evt_grp *g, struct evt **evt)
 {
-	int i;
-	struct evt *e;
 	*evt = NULL;
 
 	assert(NULL != g && NULL != (void*)evt);
 	if (cos_get_thd_id() != g->tid) return -1;
+	if (__evt_grp_gather(g, evt, 1)) g->status = EVTG_INACTIVE;
 
-	for (i = 0 ; i < EVT_NUM_PRIOS ; i++) {
-		if (!EMPTY_LIST(&g->triggered[i], next, prev)) {
-			e = FIRST_LIST(&g->triggered[i], next, prev);
-			assert(e != &g->triggered[i]);
-			REM_LIST(e, next, prev);
-			assert(e->status == EVT_TRIGGERED);
-			e->status = EVT_INACTIVE;
-			g->status = EVTG_INACTIVE;
-			*evt = e;
-			ADD_LIST(&g->events, e, next, prev);
-			
-			return 0;
-		}
-	}
 	return 0;
 }
 
-/* 
+/*
  * return value indicates if an error has occured (-1) or not (0).
  * evt is set to an event if that event has been triggered, or is set
- * to NULL otherwise.  
+ * to NULL otherwise.
  *
- * Some sort of a lock should probably be taken before calling this fn.
+ * Some sort of a lock should probably be taken before calling this
+ * fn.  Triggers can set events ready without it, so after marking
+ * the group as blocked, we check once more: either we see their
+ * event, or they see that we are blocked.
  */
 static int __evt_grp_read(struct evt_grp *g, struct evt **evt)
 {
@@ -145,9 +286,9 @@ static int __evt_grp_read(struct evt_grp *g, struct evt **evt)
 
 	*evt = NULL;
 	ret = __evt_grp_read_noblock(g, evt);
-	if (ret) return ret;
-	if (NULL == *evt) g->status = EVTG_BLOCKED;
-	return 0;
+	if (ret || NULL != *evt) return ret;
+	g->status = EVTG_BLOCKED;
+	return __evt_grp_read_noblock(g, evt);
 }
 
 static int __evt_read(struct evt *e)
@@ -159,37 +300,91 @@ static int __evt_read(struct evt *e)
 	g = e->grp;
 	assert(NULL != g && g->status != EVTG_BLOCKED);
 	if (cos_get_thd_id() != g->tid) return -1;
-	if (EVT_TRIGGERED == e->status) {
-		/* remove from the triggered list */
-		REM_LIST(e, next, prev);
-		ADD_LIST(&g->events, e, next, prev);
-		e->status = EVT_INACTIVE;
-		return 1;
-	}
+	if (__evt_ready(e)) goto ready;
 	e->status = EVT_BLOCKED;
+	/* see __evt_grp_read */
+	if (__evt_ready(e)) goto ready;
 	return 0;
+ready:
+	e->status = EVT_INACTIVE;
+	if (!e->level) __evt_ready_clear(g, e->prio, e->idx);
+	return 1;
 }
 
+static inline void __evt_clear(struct evt *e)
+{
+	if (__evt_ready(e)) __evt_ready_clear(e->grp, e->prio, e->idx);
+}
+
+/*
+ * Event structures are never returned to the heap, so that a
+ * lock-free trigger racing with evt_free never touches freed memory.
+ */
+static struct evt *evt_freelist;
+
 static inline void __evt_free(struct evt *e)
 {
+	struct evt_grp *g = e->grp;
+	struct evt_chunk *c;
+	int off;
+
+	if (g) {
+		c   = g->chunks[e->idx / EVT_PER_CHUNK];
+		off = e->idx % EVT_PER_CHUNK;
+		__evt_clear(e);
+		c->evts[off] = NULL;
+		c->used[off / WORD_SIZE] &= ~(1U << (off % WORD_SIZE));
+		c->nused--;
+		g->nevts--;
+	}
 	e->grp = NULL;
 	e->status = EVT_INACTIVE;
-	REM_LIST(e, next, prev);
-	free(e);
+	e->next = evt_freelist;
+	evt_freelist = e;
 }
 
 static inline struct evt *__evt_new(struct evt_grp *g)
 {
+	struct evt_chunk *c = NULL;
 	struct evt *e;
+	int i, off;
+
+	if (g->nevts >= EVT_PER_GRP) return NULL;
+	for (i = 0 ; i < EVT_GRP_CHUNKS ; i++) {
+		c = g->chunks[i];
+		if (NULL == c) {
+			c = malloc(sizeof(struct evt_chunk));
+			if (NULL == c) return NULL;
+			memset(c, 0, sizeof(struct evt_chunk));
+			g->chunks[i] = c;
+		}
+		if (c->nused < EVT_PER_CHUNK) break;
+	}
+	assert(i < EVT_GRP_CHUNKS);
+	for (off = 0 ; off < EVT_CHUNK_WORDS ; off++) {
+		if (~c->used[off]) break;
+	}
+	assert(off < EVT_CHUNK_WORDS);
+	off = off * WORD_SIZE + log32(ls_one(~c->used[off]));
 
-	e = malloc(sizeof(struct evt));
-	if (NULL == e) return NULL;
+	if (evt_freelist) {
+		e = evt_freelist;
+		evt_freelist = e->next;
+	} else {
+		e = malloc(sizeof(struct evt));
+		if (NULL == e) return NULL;
+	}
 	e->status = EVT_INACTIVE;
-	e->prio = 0;
-	e->grp = g;
-	ADD_LIST(&g->events, e, next, prev);
+	e->prio   = 0;
+	e->level  = 0;
+	e->idx    = i * EVT_PER_CHUNK + off;
+	e->grp    = g;
+	e->next   = NULL;
+	c->used[off / WORD_SIZE] |= 1U << (off % WORD_SIZE);
+	c->evts[off] = e;
+	c->nused++;
+	g->nevts++;
 	return e;
 }
 
 #endif /* EVT_H */
-
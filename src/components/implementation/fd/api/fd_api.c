@@ -16,7 +16,10 @@
 #include <errno.h>
 
 #include <cos_alloc.h>
-#include <cos_map.h>
+#include <cos_vect.h>
+#include <cos_list.h>
+#include <resp_desc.h>
+#include <cbuf.h>
 
 #include <fd.h>
 
@@ -27,8 +30,10 @@
 
 typedef enum {
 	DESC_TOP,
+	DESC_FREE,
 	DESC_NET,
-	DESC_HTTP
+	DESC_HTTP,
+	DESC_EPOLL
 } desc_t;
 
 struct descriptor;
@@ -37,24 +42,81 @@ struct fd_ops {
 	int (*split)(struct descriptor *d);
 	int (*read)(int fd, struct descriptor *d, char *buff, int sz);
 	int (*write)(int fd, struct descriptor *d, char *buff, int sz);
+	/* optional: response descriptors (resp_desc.h) */
+	int (*read_resp)(int fd, struct descriptor *d, struct cos_array *data);
+	int (*write_resp)(int fd, struct descriptor *d, struct cos_array *data);
 };
 
 struct descriptor {
 	int fd_num;
 	long evt_id;
+	/* the thread that created evt_id (and whose group it is in) */
+	u16_t evt_thd;
 	desc_t type;
 	void *data;
 	struct descriptor *free;
 
+	/* 
+	 * The epoll set this descriptor is registered with, and the
+	 * events of interest.  For an epoll descriptor, ep_next/prev
+	 * is the head of the list of its members.
+	 */
+	struct descriptor *epoll;
+	u32_t ep_events;
+	struct descriptor *ep_next, *ep_prev;
+
+	/* reads of response descriptors aren't supported by the source */
+	int no_resp;
+
 	struct fd_ops ops;
 };
 
+/* 
+ * The descriptor table (fd -> descriptor) and the event table (evt
+ * id -> descriptor) are read without a lock.  Descriptors are never
+ * freed, only recycled with their fd number, so a lookup always
+ * returns valid memory (that of a free descriptor if the fd was
+ * closed).  The tables are created with a depth of 2, so that their
+ * root never changes, and leaves are added under fd_pool_lock.
+ */
 COS_VECT_CREATE_STATIC(evt2fdesc);
-COS_MAP_CREATE_STATIC(fds);
-cos_lock_t fd_lock;
+COS_VECT_CREATE_STATIC(fd_table);
+/* the next fd number never used */
+static volatile long fd_next = 0;
+
+/* 
+ * fd_lock protects the event notification cache, epoll sets, and the
+ * creation and removal of descriptors' associations with their
+ * events; fd_pool_lock the global freelist of descriptors, and the
+ * growth of the tables.  fd_lock is taken first.
+ */
+cos_lock_t fd_lock, fd_pool_lock;
 #define FD_LOCK_TAKE() 	lock_take(&fd_lock)
 #define FD_LOCK_RELEASE() lock_release(&fd_lock)
 
+/* 
+ * Each thread caches free descriptors and event ids.  Events are
+ * delivered to the group of the thread that created them, so the ids
+ * must be reused by the same thread.  A thread's cache is only
+ * accessed by that thread, so it needs no lock.  Descriptors move
+ * between the threads' freelists and a global freelist in batches.
+ */
+#define FD_FREELIST_MAX   64
+#define FD_FREELIST_BATCH 16
+#define EVT_ID_CACHE_MIN  8
+#define EVT_ID_CACHE_MAX  64
+
+struct fd_thd_cache {
+	struct descriptor *free;
+	int nfree;
+	long evt_ids[EVT_ID_CACHE_MAX];
+	/* evt_batch: how many ids to create on a miss */
+	int nevts, evt_batch;
+};
+/* thread ids start at 1 */
+static struct fd_thd_cache thd_caches[MAX_NUM_THREADS+1];
+static struct descriptor *fd_pool;
+
 /* 
  * Provide a cache of events that have happened to amortize the cost
  * of invoking the event server.
@@ -91,36 +153,55 @@ static int fill_evt_notif_cache(void)
 
 /*
  * Provide a cache for event ids so that we don't need to ask for new
- * ones and deallocate them all the time.  
+ * ones and deallocate them all the time.  On a miss, the cache is
+ * refilled with a batch of ids created in one invocation; the batch
+ * grows while the thread keeps missing, and shrinks when ids are
+ * freed into a full cache.
  */
-#define EVT_ID_CACHE_SZ 8
-static long cached_ids[EVT_ID_CACHE_SZ];
+static inline struct fd_thd_cache *fd_thd_cache(void)
+{
+	u16_t tid = cos_get_thd_id();
+
+	assert(tid <= MAX_NUM_THREADS);
+	return &thd_caches[tid];
+}
 
 static long evt_create_cached(spdid_t spdid)
 {
-	int i;
-
-	for (i = 0 ; i < EVT_ID_CACHE_SZ ; i++) {
-		if (cached_ids[i] >= 0) {
-			long ret;
-			ret = cached_ids[i];
-			cached_ids[i] = -1;
-			return ret;
-		}
+	struct fd_thd_cache *c = fd_thd_cache();
+	struct cos_array *data;
+	int n;
+
+	if (c->nevts > 0) return c->evt_ids[--c->nevts];
+
+	if (c->evt_batch < EVT_ID_CACHE_MIN) c->evt_batch = EVT_ID_CACHE_MIN;
+	data = cos_argreg_alloc(sizeof(struct cos_array) + c->evt_batch * sizeof(long));
+	if (NULL == data) return evt_create(spdid);
+	data->sz = c->evt_batch * sizeof(long);
+	n = evt_create_mult(spdid, data);
+	if (n > 0) {
+		memcpy(c->evt_ids, data->mem, n * sizeof(long));
+		c->nevts = n;
 	}
-	return evt_create(spdid);
-}
+	cos_argreg_free(data);
+	if (n <= 0) return evt_create(spdid);
+	if (c->evt_batch < EVT_ID_CACHE_MAX) c->evt_batch *= 2;
 
+	return c->evt_ids[--c->nevts];
+}
 
-static void evt_free_cached(spdid_t spdid, long evt_id)
+/* Called with the fd lock held */
+static void evt_free_cached(spdid_t spdid, struct descriptor *d)
 {
+	struct fd_thd_cache *c = fd_thd_cache();
+	long evt_id = d->evt_id;
 	int i;
 
 	/* remove this event id from the notification cache */
 	for (i = 0 ; i < evt_notif_top ; i++) {
 		int j;
 		
-		while (evt_notif_cache[i] == evt_id) {
+		while (i < evt_notif_top && evt_notif_cache[i] == evt_id) {
 			for (j = i ; j < evt_notif_top-1 ; j++) {
 				evt_notif_cache[j] = evt_notif_cache[j+1];
 			}
@@ -128,15 +209,35 @@ static void evt_free_cached(spdid_t spdid, long evt_id)
 		}
 	}
 
-	for (i = 0 ; i < EVT_ID_CACHE_SZ ; i++) {
-		if (cached_ids[i] < 0) {
-			cached_ids[i] = evt_id;
-			return;
-		}
+	/* only the creating thread can reuse the id */
+	if (d->evt_thd == cos_get_thd_id() && c->nevts < EVT_ID_CACHE_MAX) {
+		c->evt_ids[c->nevts++] = evt_id;
+		return;
 	}
+	if (d->evt_thd == cos_get_thd_id() && c->evt_batch > EVT_ID_CACHE_MIN) c->evt_batch /= 2;
 	evt_free(spdid, evt_id);
 }
 
+/* 
+ * Set an entry in one of the lock-free tables, adding a leaf to the
+ * table if necessary.
+ */
+static int fd_table_set(cos_vect_t *v, long id, void *val)
+{
+	int ret = 0;
+
+	if (!__cos_vect_set(v, id, val)) return 0;
+	lock_take(&fd_pool_lock);
+	if (NULL == __cos_vect_lookup(v, id)) {
+		if (0 > cos_vect_add_id(v, val, id)) ret = -1;
+	} else {
+		__cos_vect_set(v, id, val);
+	}
+	lock_release(&fd_pool_lock);
+
+	return ret;
+}
+
 static struct descriptor *evt2fd_lookup(long evt_id)
 {
 	return cos_vect_lookup(&evt2fdesc, evt_id);
@@ -145,7 +246,7 @@ static struct descriptor *evt2fd_lookup(long evt_id)
 static void evt2fd_create(long evt_id, struct descriptor *d)
 {
 	assert(NULL == evt2fd_lookup(evt_id));
-	if (0 > cos_vect_add_id(&evt2fdesc, d, evt_id)) BUG();
+	if (fd_table_set(&evt2fdesc, evt_id, d)) BUG();
 }
 
 static void evt2fd_remove(long evt_id)
@@ -160,32 +261,106 @@ static inline int fd_get_index(struct descriptor *d)
 
 static inline struct descriptor *fd_get_desc(int fd)
 {
-	return cos_map_lookup(&fds, fd);
+	struct descriptor *d = cos_vect_lookup(&fd_table, fd);
+
+	if (NULL == d || DESC_FREE == d->type) return NULL;
+	return d;
 }
 
-static struct descriptor *fd_alloc(desc_t t)
+/* 
+ * Move a batch of descriptors from the global freelist to this
+ * thread's, allocating new ones (with new fd numbers) if it is empty.
+ */
+static int fd_freelist_refill(struct fd_thd_cache *c)
 {
 	struct descriptor *d;
-	int id;
+	int i;
 
-	d = malloc(sizeof(struct descriptor));
-	if (NULL == d) return NULL;
-	d->type = t;
-	id = cos_map_add(&fds, d);
-	if (-1 == id) {
-		free(d);
-		return NULL;
+	lock_take(&fd_pool_lock);
+	for (i = 0 ; i < FD_FREELIST_BATCH && fd_pool ; i++) {
+		d       = fd_pool;
+		fd_pool = d->free;
+		d->free = c->free;
+		c->free = d;
+		c->nfree++;
+	}
+	lock_release(&fd_pool_lock);
+	if (c->nfree) return 0;
+
+	for (i = 0 ; i < FD_FREELIST_BATCH ; i++) {
+		long fd;
+
+		d = malloc(sizeof(struct descriptor));
+		if (NULL == d) break;
+		/* claim an fd number */
+		do {
+			fd = fd_next;
+		} while (cos_cmpxchg(&fd_next, fd, fd + 1) != fd + 1);
+		d->fd_num = (int)fd;
+		d->type   = DESC_FREE;
+		if (fd_table_set(&fd_table, fd, d)) {
+			free(d);
+			break;
+		}
+		d->free = c->free;
+		c->free = d;
+		c->nfree++;
 	}
-	d->fd_num = (int)id;
+
+	return c->nfree ? 0 : -1;
+}
+
+static struct descriptor *fd_alloc(desc_t t)
+{
+	struct fd_thd_cache *c = fd_thd_cache();
+	struct descriptor *d;
+
+	if (NULL == c->free && fd_freelist_refill(c)) return NULL;
+	d       = c->free;
+	c->free = d->free;
+	c->nfree--;
+
+	d->evt_id  = -1;
+	d->evt_thd = cos_get_thd_id();
+	d->data    = NULL;
+	d->epoll   = NULL;
+	d->no_resp = 0;
+	d->free    = NULL;
+	INIT_LIST(d, ep_next, ep_prev);
+	memset(&d->ops, 0, sizeof(struct fd_ops));
+	/* visible to lookups only once initialized */
+	__asm__ __volatile__("" : : : "memory");
+	d->type    = t;
 
 	return d;
 }
 
+static void fd_epoll_rem(struct descriptor *d);
+
+/* Called with the fd lock held */
 static void fd_free(struct descriptor *d)
 {
-	cos_map_del(&fds, (long)d->fd_num);
-	evt2fd_remove(d->evt_id);
-	free(d);
+	struct fd_thd_cache *c = fd_thd_cache();
+	int i;
+
+	fd_epoll_rem(d);
+	if (d->evt_id >= 0) evt2fd_remove(d->evt_id);
+	d->type = DESC_FREE;
+	d->free = c->free;
+	c->free = d;
+	c->nfree++;
+	if (c->nfree < FD_FREELIST_MAX) return;
+
+	/* give a batch back to the other threads */
+	lock_take(&fd_pool_lock);
+	for (i = 0 ; i < FD_FREELIST_BATCH ; i++) {
+		d       = c->free;
+		c->free = d->free;
+		c->nfree--;
+		d->free = fd_pool;
+		fd_pool = d;
+	}
+	lock_release(&fd_pool_lock);
 }
 
 
@@ -204,7 +379,7 @@ static int fd_net_close(int fd, struct descriptor *d)
 	assert(d->type == DESC_NET);
 	nc = (net_connection_t)d->data;
 	ret = net_close(cos_spd_id(), nc);
-	evt_free_cached(cos_spd_id(), d->evt_id);
+	evt_free_cached(cos_spd_id(), d);
 	fd_free(d);
 	FD_LOCK_RELEASE();
 
@@ -217,7 +392,6 @@ static int fd_net_read(int fd, struct descriptor *d, char *buf, int sz)
 
 	assert(d->type == DESC_NET);
 	nc = (net_connection_t)d->data;
-	FD_LOCK_RELEASE();
 	return net_recv(cos_spd_id(), nc, buf, sz);
 }
 
@@ -227,10 +401,18 @@ static int fd_net_write(int fd, struct descriptor *d, char *buf, int sz)
 
 	assert(d->type == DESC_NET);
 	nc = (net_connection_t)d->data;
-	FD_LOCK_RELEASE();
 	return net_send(cos_spd_id(), nc, buf, sz);
 }
 
+static int fd_net_write_resp(int fd, struct descriptor *d, struct cos_array *data)
+{
+	net_connection_t nc;
+
+	assert(d->type == DESC_NET);
+	nc = (net_connection_t)d->data;
+	return net_send_resp(cos_spd_id(), nc, data);
+}
+
 int cos_socket(int domain, int type, int protocol)
 {
 	net_connection_t nc;
@@ -254,9 +436,10 @@ int cos_socket(int domain, int type, int protocol)
 	d->evt_id = evt_id;
 	evt2fd_create(evt_id, d);
 
-	d->ops.close = fd_net_close;
-	d->ops.read  = fd_net_read;
-	d->ops.write = fd_net_write;
+	d->ops.close      = fd_net_close;
+	d->ops.read       = fd_net_read;
+	d->ops.write      = fd_net_write;
+	d->ops.write_resp = fd_net_write_resp;
 
 	switch (type) {
 	case SOCK_STREAM:
@@ -280,7 +463,7 @@ int cos_socket(int domain, int type, int protocol)
 
 	return fd;
 err_cleanup:
-	evt_free_cached(cos_spd_id(), d->evt_id);
+	evt_free_cached(cos_spd_id(), d);
 	fd_free(d);
 	/* fall through */
 err:
@@ -329,46 +512,40 @@ err:
 	return -EBADFD;
 }
 
+/* 
+ * Accept takes no lock: the new descriptor and its event come from
+ * this thread's caches.
+ */
 int cos_accept(int fd)
 {
 	struct descriptor *d, *d_new;
 	net_connection_t nc_new, nc;
 	long evt_id;
 
-	do {
-		FD_LOCK_TAKE();
-		d = fd_get_desc(fd);
-		if (NULL == d) goto err;
-		if (d->type != DESC_NET) goto err;
-		nc = (net_connection_t)d->data;
-		FD_LOCK_RELEASE();
-		nc_new = net_accept(cos_spd_id(), nc);
-		if (-EAGAIN == nc_new) {
-			return -EAGAIN;
-			/* 
-			 * Blocking accept: 
-			 * if (evt_wait(cos_spd_id(), d->evt_id)) BUG();
-			 */
-		} else if (nc_new < 0) {
-			return nc_new;
-		}
-	} while (-EAGAIN == nc_new);
+	d = fd_get_desc(fd);
+	if (NULL == d || d->type != DESC_NET) return -EBADFD;
+	nc = (net_connection_t)d->data;
+	nc_new = net_accept(cos_spd_id(), nc);
+	/* 
+	 * Blocking accept would be: 
+	 * if (evt_wait(cos_spd_id(), d->evt_id)) BUG();
+	 */
+	if (nc_new < 0) return nc_new;
 
-	FD_LOCK_TAKE();
 	/* If this error is triggered, we should also close the nc */
 	if (NULL == (d_new = fd_alloc(DESC_NET))) {
 		net_close(cos_spd_id(), nc_new);
-		FD_LOCK_RELEASE();
 		return -ENOMEM;
 	}
 
-	d_new->ops.close = fd_net_close;
-	d_new->ops.read  = fd_net_read;
-	d_new->ops.write = fd_net_write;
+	d_new->ops.close      = fd_net_close;
+	d_new->ops.read       = fd_net_read;
+	d_new->ops.write      = fd_net_write;
+	d_new->ops.write_resp = fd_net_write_resp;
 
 	fd = fd_get_index(d_new);
 	d_new->data = (void*)nc_new;
-	evt_id = evt_create(cos_spd_id());
+	evt_id = evt_create_cached(cos_spd_id());
 	if (0 > evt_id) {
 		printc("cos_accept: evt_create (evt %d) failed with %ld", fd, evt_id);
 		BUG();
@@ -377,12 +554,8 @@ int cos_accept(int fd)
 	evt2fd_create(evt_id, d_new);
 	/* Associate the net connection with the event value fd */
 	if (0 < net_accept_data(cos_spd_id(), nc_new, evt_id)) BUG();
-	FD_LOCK_RELEASE();
 
 	return fd;
-err:
-	FD_LOCK_RELEASE();
-	return -EBADFD;
 }
 
 static int fd_app_close(int fd, struct descriptor *d)
@@ -393,10 +566,7 @@ static int fd_app_close(int fd, struct descriptor *d)
 
 	conn_id = (long)d->data;
 	content_remove(cos_spd_id(), conn_id);
-	evt_free_cached(cos_spd_id(), d->evt_id);
-	FD_LOCK_RELEASE();
-	
-	FD_LOCK_TAKE();
+	evt_free_cached(cos_spd_id(), d);
 	fd_free(d);
 	FD_LOCK_RELEASE();
 
@@ -409,18 +579,26 @@ static int fd_app_read(int fd, struct descriptor *d, char *buff, int sz)
 
 	assert(d->type == DESC_HTTP);
 	conn_id = (long)d->data;
-	FD_LOCK_RELEASE();
 
 	return content_read(cos_spd_id(), conn_id, buff, sz);
 }
 
+static int fd_app_read_resp(int fd, struct descriptor *d, struct cos_array *data)
+{
+	long conn_id;
+
+	assert(d->type == DESC_HTTP);
+	conn_id = (long)d->data;
+
+	return content_read_resp(cos_spd_id(), conn_id, data);
+}
+
 static int fd_app_write(int fd, struct descriptor *d, char *buff, int sz)
 {
 	long conn_id;
 
 	assert(d->type == DESC_HTTP);
 	conn_id = (long)d->data;
-	FD_LOCK_RELEASE();
 	return content_write(cos_spd_id(), conn_id, buff, sz);
 }
 
@@ -435,10 +613,11 @@ static int fd_app_split(struct descriptor *d)
 		goto err;
 	}
 	fd = fd_get_index(d_new);
-	d_new->ops.close = fd_app_close;
-	d_new->ops.read  = fd_app_read;
-	d_new->ops.write = fd_app_write;
-	d_new->ops.split = fd_app_split;
+	d_new->ops.close     = fd_app_close;
+	d_new->ops.read      = fd_app_read;
+	d_new->ops.write     = fd_app_write;
+	d_new->ops.split     = fd_app_split;
+	d_new->ops.read_resp = fd_app_read_resp;
 
 	if (0 > (evt_id = evt_create_cached(cos_spd_id()))) {
 		printc("Could not create event for app fd: %ld\n", evt_id);
@@ -458,7 +637,7 @@ static int fd_app_split(struct descriptor *d)
 
 	return fd;
 err_cleanup:
-	evt_free_cached(cos_spd_id(), d_new->evt_id);
+	evt_free_cached(cos_spd_id(), d_new);
 	fd_free(d_new);
 	/* fall through */
 err:
@@ -486,10 +665,11 @@ int cos_app_open(int type, struct cos_array *data)
 	}
 	d->evt_id = evt_id;
 	evt2fd_create(evt_id, d);
-	d->ops.close = fd_app_close;
-	d->ops.read  = fd_app_read;
-	d->ops.write = fd_app_write;
-	d->ops.split = fd_app_split;
+	d->ops.close     = fd_app_close;
+	d->ops.read      = fd_app_read;
+	d->ops.write     = fd_app_write;
+	d->ops.split     = fd_app_split;
+	d->ops.read_resp = fd_app_read_resp;
 
 	conn_id = content_create(cos_spd_id(), evt_id, data);
 	if (conn_id < 0) goto err_cleanup;
@@ -498,7 +678,7 @@ int cos_app_open(int type, struct cos_array *data)
 
 	return fd;
 err_cleanup:
-	evt_free_cached(cos_spd_id(), d->evt_id);
+	evt_free_cached(cos_spd_id(), d);
 	fd_free(d);
 	/* fall through */
 err:
@@ -535,34 +715,332 @@ err:
 	return -EBADFD;
 }
 
-int cos_read(int fd, char *buf, int sz)
+/* 
+ * The internal read and write paths, used for the public calls, and
+ * for data moved within this component (vectors and splices).  They
+ * take no lock: the ops only read the descriptor's data.
+ */
+static int fd_read(int fd, char *buf, int sz)
 {
 	struct descriptor *d;
+	int (*read)(int fd, struct descriptor *d, char *buff, int sz);
 
-	if (!cos_argreg_buff_intern(buf, sz)) return -EFAULT;
-	FD_LOCK_TAKE();
 	d = fd_get_desc(fd);
-	if (NULL == d) goto err;
+	if (NULL == d) return -EBADFD;
+	/* the descriptor might be concurrently closed and reused */
+	read = d->ops.read;
+	if (NULL == read) return -EBADFD;
 
-	return d->ops.read(fd, d, buf, sz);
-err:
-	FD_LOCK_RELEASE();
-	return -EBADFD;
+	return read(fd, d, buf, sz);
 }
 
-int cos_write(int fd, char *buf, int sz)
+static int fd_write(int fd, char *buf, int sz)
 {
 	struct descriptor *d;
+	int (*write)(int fd, struct descriptor *d, char *buff, int sz);
 
-	if (!cos_argreg_buff_intern(buf, sz)) return -EFAULT;
-	FD_LOCK_TAKE();
 	d = fd_get_desc(fd);
-	if (NULL == d) goto err;
+	if (NULL == d) return -EBADFD;
+	write = d->ops.write;
+	if (NULL == write) return -EBADFD;
 
-	return d->ops.write(fd, d, buf, sz);
-err:
+	return write(fd, d, buf, sz);
+}
+
+static int fd_read_resp(int fd, struct cos_array *data)
+{
+	struct descriptor *d;
+	int (*read_resp)(int fd, struct descriptor *d, struct cos_array *data);
+
+	d = fd_get_desc(fd);
+	if (NULL == d) return -EBADFD;
+	read_resp = d->ops.read_resp;
+	if (NULL == read_resp) return -ENOTSUP;
+
+	return read_resp(fd, d, data);
+}
+
+static int fd_write_resp(int fd, struct cos_array *data)
+{
+	struct descriptor *d;
+	int (*write_resp)(int fd, struct descriptor *d, struct cos_array *data);
+
+	d = fd_get_desc(fd);
+	if (NULL == d) return -EBADFD;
+	write_resp = d->ops.write_resp;
+	if (NULL == write_resp) return -ENOTSUP;
+
+	return write_resp(fd, d, data);
+}
+
+int cos_read(int fd, char *buf, int sz)
+{
+	if (!cos_argreg_buff_intern(buf, sz)) return -EFAULT;
+	return fd_read(fd, buf, sz);
+}
+
+int cos_write(int fd, char *buf, int sz)
+{
+	if (!cos_argreg_buff_intern(buf, sz)) return -EFAULT;
+	return fd_write(fd, buf, sz);
+}
+
+/* 
+ * The descriptor is passed through unchanged: the content is only
+ * referenced by it, and is copied (if at all) by the transport.
+ */
+int cos_read_resp(int fd, struct cos_array *data)
+{
+	if (!cos_argreg_arr_intern(data)) return -EFAULT;
+	return fd_read_resp(fd, data);
+}
+
+int cos_write_resp(int fd, struct cos_array *data)
+{
+	if (!cos_argreg_arr_intern(data)) return -EFAULT;
+	return fd_write_resp(fd, data);
+}
+
+/* 
+ * Vectored I/O: the segments are read or written in order, and the
+ * call stops at the first that is short (no more data, or no more
+ * room).  Returns the total amount moved, or an error if nothing
+ * was.
+ */
+static struct cos_iov *fd_iov_valid(struct cos_array *data)
+{
+	struct cos_iov *v;
+	int i, hdr;
+
+	if (!cos_argreg_arr_intern(data)) return NULL;
+	if (data->sz < (int)sizeof(struct cos_iov)) return NULL;
+	v = (struct cos_iov *)data->mem;
+	if (v->cnt < 0 || v->cnt > COS_IOV_MAX) return NULL;
+	hdr = sizeof(struct cos_iov) + v->cnt * sizeof(struct cos_iovec);
+	if (hdr > data->sz) return NULL;
+	for (i = 0 ; i < v->cnt ; i++) {
+		struct cos_iovec *e = &v->iov[i];
+
+		if (e->off < hdr || e->len < 0 || e->len > data->sz - e->off) return NULL;
+	}
+
+	return v;
+}
+
+int cos_readv(int fd, struct cos_array *data)
+{
+	struct cos_iov *v;
+	int i, ret, tot = 0;
+
+	if (NULL == (v = fd_iov_valid(data))) return -EFAULT;
+	for (i = 0 ; i < v->cnt ; i++) {
+		struct cos_iovec *e = &v->iov[i];
+
+		if (0 == e->len) continue;
+		ret = fd_read(fd, data->mem + e->off, e->len);
+		if (ret < 0) return tot ? tot : ret;
+		tot += ret;
+		if (ret < e->len) break;
+	}
+
+	return tot;
+}
+
+int cos_writev(int fd, struct cos_array *data)
+{
+	struct cos_iov *v;
+	int i, ret, tot = 0;
+
+	if (NULL == (v = fd_iov_valid(data))) return -EFAULT;
+	for (i = 0 ; i < v->cnt ; i++) {
+		struct cos_iovec *e = &v->iov[i];
+
+		if (0 == e->len) continue;
+		ret = fd_write(fd, data->mem + e->off, e->len);
+		if (ret < 0) return tot ? tot : ret;
+		tot += ret;
+		if (ret < e->len) break;
+	}
+
+	return tot;
+}
+
+/* 
+ * Splice: move data from one descriptor to another without it
+ * passing through the caller.  Responses from an application are
+ * moved as response descriptors, so that content in cbufs is passed
+ * by reference to the transport.  Otherwise (e.g. requests from the
+ * network to an application), the data is copied through a buffer
+ * in this component.
+ */
+/* 
+ * The argument region spans COS_ARGREG_SZ, so copies are done in
+ * large pieces to amortize the invocations, leaving the rest of the
+ * region to the components invoked.  Flattened responses can be
+ * written to a transport, so those writes are kept under its maximum
+ * send size.  The slab has room for the headers and a whole
+ * response's worth of data copied out of non-cbuf content.
+ */
+#define FD_SPLICE_BUF_SZ (COS_ARGREG_SZ/2)
+#define FD_FLAT_BUF_SZ   1400
+#define FD_RESP_MAX_LEN  (6*1400)
+#define FD_RESP_SLAB_SZ  (FD_RESP_MAX_LEN + 1024)
+
+/* 
+ * For a transport that can't send descriptors: copy the described
+ * data out in pieces, and write them.
+ */
+static int fd_write_flat(int fd, struct resp_desc *d)
+{
+	char *buf;
+	int i, used = 0, tot = 0, ret = 0;
+
+	buf = cos_argreg_alloc(FD_FLAT_BUF_SZ);
+	if (NULL == buf) return -ENOMEM;
+	for (i = 0 ; i < d->nsegs ; i++) {
+		struct resp_seg *s = &d->segs[i];
+		char *p;
+		int left;
+
+		if (s->cb) {
+			p = cbuf2buf((cbuf_t)s->cb, s->cb_len);
+			if (NULL == p) {
+				ret = -EINVAL;
+				goto done;
+			}
+		} else {
+			p = d->slab;
+		}
+		p += s->off;
+		for (left = s->len ; left > 0 ; ) {
+			int amnt = FD_FLAT_BUF_SZ - used;
+
+			if (amnt > left) amnt = left;
+			memcpy(buf + used, p, amnt);
+			used += amnt;
+			p    += amnt;
+			left -= amnt;
+			if (used < FD_FLAT_BUF_SZ) continue;
+			if (used != (ret = fd_write(fd, buf, used))) goto done;
+			tot += used;
+			used = 0;
+		}
+	}
+	if (used && used != (ret = fd_write(fd, buf, used))) goto done;
+	ret = tot + used;
+done:
+	cos_argreg_free(buf);
+
+	return ret;
+}
+
+/* Returns -ENOSYS if the input can't produce descriptors */
+static int fd_splice_resp(int fd_in, int fd_out, int len)
+{
+	struct cos_array *data;
+	int sz = sizeof(struct resp_desc) + FD_RESP_SLAB_SZ, ret = 0, tot = 0;
+
+	data = cos_argreg_alloc(sizeof(struct cos_array) + sz);
+	if (NULL == data) return -ENOMEM;
+	while (tot < len) {
+		int amnt, max = len - tot;
+
+		if (max > FD_RESP_MAX_LEN) max = FD_RESP_MAX_LEN;
+		data->sz = sz;
+		resp_desc_init(data->mem, sz, max);
+		amnt = fd_read_resp(fd_in, data);
+		if (-ENOSYS == amnt || -ENOTSUP == amnt) {
+			ret = tot ? 0 : -ENOSYS;
+			break;
+		}
+		if (amnt <= 0) {
+			ret = tot ? 0 : amnt;
+			break;
+		}
+		ret = fd_write_resp(fd_out, data);
+		if (-ENOTSUP == ret || -ENOSYS == ret) {
+			ret = fd_write_flat(fd_out, (struct resp_desc *)data->mem);
+		}
+		/* 
+		 * The descriptor is already read from the input, so
+		 * there is no recovering from a failed write.
+		 */
+		if (amnt != ret) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		tot += amnt;
+		ret  = 0;
+	}
+	cos_argreg_free(data);
+
+	return ret ? ret : tot;
+}
+
+static int fd_splice_copy(int fd_in, int fd_out, int len)
+{
+	char *buf;
+	int ret = 0, tot = 0;
+
+	buf = cos_argreg_alloc(FD_SPLICE_BUF_SZ);
+	if (NULL == buf) return -ENOMEM;
+	while (tot < len) {
+		int amnt, max = len - tot;
+
+		if (max > FD_SPLICE_BUF_SZ) max = FD_SPLICE_BUF_SZ;
+		amnt = fd_read(fd_in, buf, max);
+		if (amnt <= 0) {
+			ret = tot ? 0 : amnt;
+			break;
+		}
+		ret = fd_write(fd_out, buf, amnt);
+		if (amnt != ret) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		tot += amnt;
+		ret  = 0;
+		/* the input has no more data for now */
+		if (amnt < max) break;
+	}
+	cos_argreg_free(buf);
+
+	return ret ? ret : tot;
+}
+
+/* 
+ * Move up to len bytes from fd_in to fd_out.  Returns the amount
+ * moved, 0 if the input has no data, or an error (e.g. -EPIPE if the
+ * input was closed).  If the output fails, the data read from the
+ * input is lost, and the error is returned.
+ */
+int cos_splice(int fd_in, int fd_out, int len)
+{
+	struct descriptor *d_in, *d_out;
+	int resp, ret;
+
+	if (len <= 0) return -EINVAL;
+	FD_LOCK_TAKE();
+	d_in  = fd_get_desc(fd_in);
+	d_out = fd_get_desc(fd_out);
+	if (NULL == d_in || NULL == d_out) {
+		FD_LOCK_RELEASE();
+		return -EBADFD;
+	}
+	resp = !d_in->no_resp && d_in->ops.read_resp;
 	FD_LOCK_RELEASE();
-	return -EBADFD;
+
+	if (resp) {
+		ret = fd_splice_resp(fd_in, fd_out, len);
+		if (-ENOSYS != ret) return ret;
+		/* copy the input's data from now on */
+		FD_LOCK_TAKE();
+		d_in = fd_get_desc(fd_in);
+		if (d_in) d_in->no_resp = 1;
+		FD_LOCK_RELEASE();
+	}
+
+	return fd_splice_copy(fd_in, fd_out, len);
 }
 
 int cos_wait(int fd)
@@ -601,7 +1079,13 @@ int cos_wait_all(void)
 	evt_notif_top--;
 	evt = evt_notif_cache[evt_notif_top];
 #else
-	evt = evt_grp_wait(cos_spd_id());
+	/* notifications deferred by cos_epoll_wait come first */
+	if (evt_notif_top > 0) {
+		evt_notif_top--;
+		evt = evt_notif_cache[evt_notif_top];
+	} else {
+		evt = evt_grp_wait(cos_spd_id());
+	}
 #endif
 	d = evt2fd_lookup(evt);
 	assert(d);
@@ -611,16 +1095,248 @@ int cos_wait_all(void)
 	return fd;
 }
 
+/* 
+ * epoll-like interface
+ *
+ * An epoll descriptor is a set of member descriptors with their
+ * events of interest.  Events are still delivered to the event group
+ * of the thread that created the descriptors, so cos_epoll_wait
+ * should be called by that thread.  A single evt_grp_mult_wait
+ * retrieves a batch of notifications that are then translated into
+ * (fd, event mask) pairs, amortizing the invocations of both this
+ * component and the event manager across all ready descriptors.
+ * Notifications for descriptors not in the set are deferred to
+ * cos_wait_all.
+ */
+
+/* Called with the fd lock held */
+static void fd_epoll_rem(struct descriptor *d)
+{
+	struct descriptor *m;
+
+	if (d->type == DESC_EPOLL) {
+		while (!EMPTY_LIST(d, ep_next, ep_prev)) {
+			m = FIRST_LIST(d, ep_next, ep_prev);
+			REM_LIST(m, ep_next, ep_prev);
+			m->epoll = NULL;
+		}
+		return;
+	}
+	if (NULL == d->epoll) return;
+	REM_LIST(d, ep_next, ep_prev);
+	d->epoll = NULL;
+}
+
+static int fd_epoll_close(int fd, struct descriptor *d)
+{
+	assert(d->type == DESC_EPOLL);
+	fd_free(d);
+	FD_LOCK_RELEASE();
+
+	return 0;
+}
+
+static int fd_epoll_read(int fd, struct descriptor *d, char *buff, int sz)
+{
+	return -EINVAL;
+}
+
+static int fd_epoll_write(int fd, struct descriptor *d, char *buff, int sz)
+{
+	return -EINVAL;
+}
+
+int cos_epoll_create(int size)
+{
+	struct descriptor *d;
+	int fd;
+
+	FD_LOCK_TAKE();
+	if (NULL == (d = fd_alloc(DESC_EPOLL))) {
+		FD_LOCK_RELEASE();
+		return -ENOMEM;
+	}
+	d->ops.close = fd_epoll_close;
+	d->ops.read  = fd_epoll_read;
+	d->ops.write = fd_epoll_write;
+	d->ops.split = NULL;
+	d->data      = NULL;
+	fd = fd_get_index(d);
+	FD_LOCK_RELEASE();
+
+	return fd;
+}
+
+int cos_epoll_ctl(int epfd, int op, int fd, u32_t events)
+{
+	struct descriptor *ep, *d;
+	int ret = 0;
+
+	FD_LOCK_TAKE();
+	ep = fd_get_desc(epfd);
+	d  = fd_get_desc(fd);
+	if (NULL == ep || ep->type != DESC_EPOLL || 
+	    NULL == d  || d->type == DESC_EPOLL) {
+		ret = -EBADFD;
+		goto done;
+	}
+
+	switch (op) {
+	case COS_EPOLL_CTL_ADD:
+		if (NULL != d->epoll) {
+			ret = -EEXIST;
+			break;
+		}
+		d->epoll     = ep;
+		d->ep_events = events;
+		ADD_LIST(ep, d, ep_next, ep_prev);
+		break;
+	case COS_EPOLL_CTL_MOD:
+		if (ep != d->epoll) {
+			ret = -ENOENT;
+			break;
+		}
+		d->ep_events = events;
+		break;
+	case COS_EPOLL_CTL_DEL:
+		if (ep != d->epoll) {
+			ret = -ENOENT;
+			break;
+		}
+		fd_epoll_rem(d);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+done:
+	FD_LOCK_RELEASE();
+	return ret;
+}
+
+/* 
+ * The event manager does not record why an event was triggered, so
+ * the readiness of the connections in a batch of notifications is
+ * retrieved from the transport layer with a single net_ready.  Other
+ * descriptors only trigger when they can be read.
+ */
+#define EPOLL_NET (1U<<31) 	/* readiness yet to be retrieved */
+
+static u32_t net2epoll(int r)
+{
+	return (r & NET_READY_IN  ? COS_EPOLLIN  : 0) |
+	       (r & NET_READY_OUT ? COS_EPOLLOUT : 0) |
+	       (r & NET_READY_HUP ? COS_EPOLLHUP : 0);
+}
+
+int cos_epoll_wait(int epfd, struct cos_array *evts)
+{
+	struct cos_epoll_event *ee;
+	struct cos_array *data, *ready;
+	struct descriptor *ep, *d;
+	net_connection_t *ncs;
+	int max, amnt, i, j, nnet, n = 0;
+
+	if (!cos_argreg_arr_intern(evts)) return -EFAULT;
+	max = evts->sz / sizeof(struct cos_epoll_event);
+	if (max <= 0) return -EINVAL;
+	ee = (struct cos_epoll_event *)evts->mem;
+
+	FD_LOCK_TAKE();
+	ep = fd_get_desc(epfd);
+	if (NULL == ep || ep->type != DESC_EPOLL) {
+		FD_LOCK_RELEASE();
+		return -EBADFD;
+	}
+	FD_LOCK_RELEASE();
+
+	data  = cos_argreg_alloc((sizeof(long) * max) + sizeof(struct cos_array));
+	if (NULL == data) return -ENOMEM;
+	ready = cos_argreg_alloc((sizeof(net_connection_t) * max) + sizeof(struct cos_array));
+	if (NULL == ready) {
+		cos_argreg_free(data);
+		return -ENOMEM;
+	}
+	ncs = (net_connection_t *)ready->mem;
+	while (0 == n) {
+		data->sz = max * sizeof(long);
+		/* can block...don't hold a lock */
+		amnt = evt_grp_mult_wait(cos_spd_id(), data);
+		if (amnt <= 0) {
+			n = amnt;
+			break;
+		}
+		assert(amnt <= max);
+
+		FD_LOCK_TAKE();
+		/* the set might have been closed while we blocked */
+		if (ep != fd_get_desc(epfd)) {
+			FD_LOCK_RELEASE();
+			n = -EBADFD;
+			break;
+		}
+		for (i = 0, nnet = 0 ; i < amnt ; i++) {
+			long evt = ((long*)data->mem)[i];
+
+			d = evt2fd_lookup(evt);
+			/* closed since the trigger */
+			if (NULL == d) continue;
+			if (d->epoll != ep) {
+				if (evt_notif_top < EVT_NOTIF_CACHE_MAX) {
+					evt_notif_cache[evt_notif_top++] = evt;
+				} else {
+					printc("fd: dropping notification for fd %d\n", d->fd_num);
+				}
+				continue;
+			}
+			ee[n].fd     = d->fd_num;
+			/* the events of interest until the readiness is known */
+			ee[n].events = d->ep_events;
+			if (DESC_NET == d->type) {
+				ee[n].events |= EPOLL_NET;
+				ncs[nnet++]   = (net_connection_t)d->data;
+			}
+			n++;
+		}
+		FD_LOCK_RELEASE();
+
+		ready->sz = nnet * sizeof(net_connection_t);
+		if (nnet && net_ready(cos_spd_id(), ready) != nnet) BUG();
+		for (i = 0, j = 0, nnet = 0 ; i < n ; i++) {
+			u32_t r = COS_EPOLLIN;
+
+			if (ee[i].events & EPOLL_NET) r = net2epoll(ncs[nnet++]);
+			r &= ee[i].events | COS_EPOLLHUP;
+			if (!r) continue;
+			ee[j].fd     = ee[i].fd;
+			ee[j].events = r;
+			j++;
+		}
+		n = j;
+	}
+	cos_argreg_free(ready);
+	cos_argreg_free(data);
+	if (n > 0) evts->sz = n * sizeof(struct cos_epoll_event);
+
+	return n;
+}
+
 static void init(void) 
 {
 	int i;
 
 	lock_static_init(&fd_lock);
-	cos_map_init_static(&fds);
+	lock_static_init(&fd_pool_lock);
 	cos_vect_init_static(&evt2fdesc);
-
-	for (i = 0 ; i < EVT_ID_CACHE_SZ ; i++) {
-		cached_ids[i] = -1;
+	cos_vect_init_static(&fd_table);
+	/* depth 2 from the start, so lock-free lookups see a fixed root */
+	if (__cos_vect_expand(&evt2fdesc, COS_VECT_BASE) ||
+	    __cos_vect_expand(&fd_table, COS_VECT_BASE)) BUG();
+	fd_pool = NULL;
+	for (i = 0 ; i <= MAX_NUM_THREADS ; i++) {
+		thd_caches[i].free      = NULL;
+		thd_caches[i].nfree     = 0;
+		thd_caches[i].nevts     = 0;
+		thd_caches[i].evt_batch = EVT_ID_CACHE_MIN;
 	}
 	for (i = 0 ; i < EVT_NOTIF_CACHE_MAX ; i++) {
 		evt_notif_cache[i] = -1;
@@ -97,6 +97,11 @@ int content_read(spdid_t spdid, long connection_id, char *buff, int sz)
 	return ret;
 }
 
+int content_read_resp(spdid_t spdid, long connection_id, struct cos_array *data)
+{
+	return -ENOSYS;
+}
+
 long content_create(spdid_t spdid, long evt_id, struct cos_array *d)
 {
 	struct connection *c = connection_alloc(evt_id);
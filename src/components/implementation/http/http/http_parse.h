@@ -0,0 +1,233 @@
+#ifndef HTTP_PARSE_H
+#define HTTP_PARSE_H
+
+/* 
+ * The HTTP request parser, and the ring buffer it parses from.  It
+ * depends only on string.h, so that http_parse_test can build it,
+ * and run its unit tests and benchmark, on the host.
+ */
+
+#include <string.h>
+
+/*
+ * Requests are parsed incrementally out of a per-connection ring
+ * buffer.  The parser is a state machine that records where it left
+ * off, so a request fragmented across many writes is neither copied
+ * into a new buffer nor re-parsed from its start when more data
+ * arrives.  The path of a request is kept as an offset into the ring,
+ * and any number of pipelined requests can be parsed from a single
+ * write.  A request is consumed from the ring as soon as it has been
+ * made to the content manager.
+ */
+#define HTTP_RB_ORDER 11
+#define HTTP_RB_SZ    (1<<HTTP_RB_ORDER)
+#define HTTP_RB_MASK  (HTTP_RB_SZ-1)
+
+struct http_rb {
+	/* free-running indices: unconsumed data is [head, tail) */
+	unsigned int head, tail;
+	char buf[HTTP_RB_SZ];
+};
+
+static inline void http_rb_init(struct http_rb *rb)
+{
+	rb->head = rb->tail = 0;
+}
+
+static inline char http_rb_char(struct http_rb *rb, unsigned int off)
+{
+	return rb->buf[off & HTTP_RB_MASK];
+}
+
+/* copy in as much of data as fits, returning the amount copied */
+static int http_rb_put(struct http_rb *rb, char *data, int sz)
+{
+	int amnt, first;
+
+	amnt = HTTP_RB_SZ - (int)(rb->tail - rb->head);
+	if (sz < amnt) amnt = sz;
+	first = HTTP_RB_SZ - (rb->tail & HTTP_RB_MASK);
+	if (first > amnt) first = amnt;
+	memcpy(&rb->buf[rb->tail & HTTP_RB_MASK], data, first);
+	memcpy(rb->buf, data + first, amnt - first);
+	rb->tail += amnt;
+
+	return amnt;
+}
+
+/* copy out a slice of the ring, which might wrap around its end */
+static void http_rb_copy(struct http_rb *rb, unsigned int off, int len, char *dest)
+{
+	int first = HTTP_RB_SZ - (off & HTTP_RB_MASK);
+
+	if (first > len) first = len;
+	memcpy(dest, &rb->buf[off & HTTP_RB_MASK], first);
+	memcpy(dest + first, rb->buf, len - first);
+}
+
+typedef enum {
+	HP_METHOD,		/* "GET " */
+	HP_PATH_WS,		/* whitespace before the path */
+	HP_PATH,
+	HP_VER_WS,		/* whitespace before the version */
+	HP_VERSION,		/* "HTTP/1." */
+	HP_MINOR,
+	HP_REQ_CR,		/* end of the request line */
+	HP_LF,
+	HP_LINE,		/* start of a header line, or of the final \r\n */
+	HP_HDR_NAME,		/* matching "connection:" */
+	HP_CONN_VAL,
+	HP_HDR,
+	HP_END_LF
+} http_parse_state_t;
+
+enum {HP_DONE, HP_MORE, HP_ERR};
+
+/* head_flags: the value of the Connection header */
+#define HP_CONN_CLOSE     0x1
+#define HP_CONN_KEEPALIVE 0x2
+
+struct http_parser {
+	http_parse_state_t state;
+	/* next byte to parse, and the start of the request/path in the ring */
+	unsigned int pos, start, path_off;
+	int path_len, idx, minor_version, head_flags;
+	/* the HP_CONN_* values the current Connection token might be */
+	int conn_match;
+};
+
+static const char http_get_str[]     = "GET ";
+static const char http_version_str[] = "HTTP/1.";
+static const char http_conn_str[]    = "connection:";
+static const char http_close_str[]   = "close";
+static const char http_ka_str[]      = "keep-alive";
+
+static inline char http_lower(char c)
+{
+	return ('A' <= c && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static inline void http_parse_reset(struct http_parser *p, unsigned int start)
+{
+	p->state         = HP_METHOD;
+	p->pos           = p->start = p->path_off = start;
+	p->path_len      = 0;
+	p->idx           = 0;
+	p->minor_version = -1;
+	p->head_flags    = 0;
+	p->conn_match    = 0;
+}
+
+/*
+ * Parse from where we left off up to the end of the data in the ring.
+ * Returns HP_DONE with p->pos just past the request when a whole
+ * request has been parsed, HP_MORE when all available data is
+ * consumed without completing it, and HP_ERR on a malformed request.
+ */
+static int http_parse(struct http_parser *p, struct http_rb *rb)
+{
+	for (; p->pos != rb->tail ; p->pos++) {
+		char c = http_rb_char(rb, p->pos);
+
+		switch (p->state) {
+		case HP_METHOD:
+			if (c != http_get_str[p->idx]) return HP_ERR;
+			if (++p->idx == sizeof(http_get_str)-1) p->state = HP_PATH_WS;
+			break;
+		case HP_PATH_WS:
+			if (' ' == c) break;
+			p->path_off = p->pos;
+			p->state    = HP_PATH;
+			/* fall through */
+		case HP_PATH:
+			if (' ' == c) {
+				p->idx   = 0;
+				p->state = HP_VER_WS;
+				break;
+			}
+			if ('\r' == c || '\n' == c) return HP_ERR;
+			p->path_len++;
+			break;
+		case HP_VER_WS:
+			if (' ' == c) break;
+			p->state = HP_VERSION;
+			/* fall through */
+		case HP_VERSION:
+			if (c != http_version_str[p->idx]) return HP_ERR;
+			if (++p->idx == sizeof(http_version_str)-1) p->state = HP_MINOR;
+			break;
+		case HP_MINOR:
+			if ('0' != c && '1' != c) return HP_ERR;
+			p->minor_version = c - '0';
+			p->state = HP_REQ_CR;
+			break;
+		case HP_REQ_CR:
+			if ('\r' != c) return HP_ERR;
+			p->state = HP_LF;
+			break;
+		case HP_LF:
+			if ('\n' != c) return HP_ERR;
+			p->state = HP_LINE;
+			break;
+		case HP_LINE:
+			if ('\r' == c) {
+				p->state = HP_END_LF;
+				break;
+			}
+			p->idx   = 0;
+			p->state = HP_HDR_NAME;
+			/* fall through */
+		case HP_HDR_NAME:
+			if (http_lower(c) == http_conn_str[p->idx]) {
+				if (++p->idx == sizeof(http_conn_str)-1) {
+					p->idx        = 0;
+					p->conn_match = HP_CONN_CLOSE | HP_CONN_KEEPALIVE;
+					p->state      = HP_CONN_VAL;
+				}
+				break;
+			}
+			p->state = HP_HDR;
+			/* fall through */
+		case HP_HDR:
+			if ('\r' == c) p->state = HP_LF;
+			break;
+		case HP_CONN_VAL:
+			/* 
+			 * A list of tokens separated by ',' and
+			 * whitespace.  Each whole token is compared,
+			 * case-insensitively, to "close" and
+			 * "keep-alive".
+			 */
+			if (' ' == c || '\t' == c || ',' == c || '\r' == c) {
+				if (p->conn_match & HP_CONN_CLOSE && 
+				    p->idx == sizeof(http_close_str)-1) {
+					p->head_flags |= HP_CONN_CLOSE;
+				}
+				if (p->conn_match & HP_CONN_KEEPALIVE && 
+				    p->idx == sizeof(http_ka_str)-1) {
+					p->head_flags |= HP_CONN_KEEPALIVE;
+				}
+				p->idx        = 0;
+				p->conn_match = HP_CONN_CLOSE | HP_CONN_KEEPALIVE;
+				if ('\r' == c) p->state = HP_LF;
+				break;
+			}
+			c = http_lower(c);
+			if (p->idx >= (int)sizeof(http_close_str)-1 || c != http_close_str[p->idx]) {
+				p->conn_match &= ~HP_CONN_CLOSE;
+			}
+			if (p->idx >= (int)sizeof(http_ka_str)-1 || c != http_ka_str[p->idx]) {
+				p->conn_match &= ~HP_CONN_KEEPALIVE;
+			}
+			if (p->conn_match) p->idx++;
+			break;
+		case HP_END_LF:
+			if ('\n' != c) return HP_ERR;
+			p->pos++;
+			return HP_DONE;
+		}
+	}
+	return HP_MORE;
+}
+
+#endif	/* HTTP_PARSE_H */
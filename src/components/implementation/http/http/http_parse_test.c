@@ -0,0 +1,275 @@
+/**
+ * Copyright 2009 by Boston University.
+ *
+ * Redistribution of this file is permitted under the GNU General
+ * Public License v2.
+ *
+ * Author:  Gabriel Parmer, gabep1@cs.bu.edu, 2009
+ */
+
+/* 
+ * Unit tests and a throughput benchmark for the request parser in
+ * http_parse.h.  They run on the host ("make parse_test"); for the
+ * benchmark, build http_parse_test and run it with -b.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "http_parse.h"
+
+int ut_num = 0;
+
+enum {UT_SUCCESS, UT_FAIL, UT_PENDING};
+
+/* parse s from an empty ring */
+static int ut_parse(char *s, int len, struct http_parser *p, struct http_rb *rb)
+{
+	http_rb_init(rb);
+	http_parse_reset(p, rb->head);
+	if (http_rb_put(rb, s, len) != len) return HP_ERR;
+	return http_parse(p, rb);
+}
+
+static int print_ut(char *s, int len, int type, int print_success)
+{
+	static struct http_rb rb;
+	struct http_parser p;
+	int r, ret;
+
+	ret = ut_parse(s, len, &p, &rb);
+	switch(type) {
+	case UT_SUCCESS:
+		r = (HP_DONE != ret || p.pos != (unsigned int)len);
+		break;
+	case UT_FAIL:
+		r = (HP_ERR != ret);
+		break;
+	case UT_PENDING:
+		r = (HP_MORE != ret);
+		break;
+	}
+
+	if (r) {
+		printf("******************\nUnit test %d failed:\n"
+		       "String (@%p):\n%s\nResult (%d @ %u):\n<%s>\n******************\n\n",
+		       ut_num, s, s, ret, p.pos, s + p.pos);
+		ut_num++;
+		return 1;
+	} else if (print_success) {
+		printf("Unit test %d successful(s@%p-%p, e@%u).\n", ut_num, s, s+len, p.pos);
+	}
+	ut_num++;
+	return 0;
+}
+
+/* parse s, a whole request, and check the Connection header's flags */
+static int print_ut_conn(char *s, int flags, int print_success)
+{
+	static struct http_rb rb;
+	struct http_parser p;
+	int ret;
+
+	ret = ut_parse(s, strlen(s), &p, &rb);
+	if (HP_DONE != ret || p.head_flags != flags) {
+		printf("******************\nUnit test %d failed (ret %d, flags %d, expected %d):\n"
+		       "String:\n%s\n******************\n\n", ut_num, ret, p.head_flags, flags, s);
+		ut_num++;
+		return 1;
+	} else if (print_success) {
+		printf("Unit test %d successful (flags %d).\n", ut_num, flags);
+	}
+	ut_num++;
+	return 0;
+}
+
+/*
+ * Feed s into the ring chunk bytes at a time, consuming requests as
+ * the connection does, and check the number of requests parsed, and
+ * their paths (separated by ' ' in paths).
+ */
+static int print_ut_chunked(char *s, int chunk, int nreqs, char *paths, int print_success)
+{
+	static struct http_rb rb;
+	struct http_parser p;
+	char path[HTTP_RB_SZ];
+	int len = strlen(s), off = 0, n = 0, ret = HP_MORE;
+
+	http_rb_init(&rb);
+	http_parse_reset(&p, rb.head);
+	while (off < len) {
+		int amnt = len - off < chunk ? len - off : chunk;
+
+		if (http_rb_put(&rb, s + off, amnt) != amnt) goto fail;
+		off += amnt;
+		while (HP_DONE == (ret = http_parse(&p, &rb))) {
+			int plen = strchr(paths, ' ') ? strchr(paths, ' ') - paths : (int)strlen(paths);
+
+			http_rb_copy(&rb, p.path_off, p.path_len, path);
+			if (p.path_len != plen || memcmp(path, paths, plen)) goto fail;
+			paths += plen + 1;
+			n++;
+			rb.head = p.pos;
+			http_parse_reset(&p, p.pos);
+		}
+		if (HP_ERR == ret) goto fail;
+	}
+	if (n != nreqs || rb.head != rb.tail) goto fail;
+	if (print_success) printf("Unit test %d successful (%d requests, chunks of %d).\n", ut_num, n, chunk);
+	ut_num++;
+	return 0;
+fail:
+	printf("******************\nUnit test %d failed (chunks of %d, request %d, ret %d):\n"
+	       "String:\n%s\n******************\n\n", ut_num, chunk, n, ret, s);
+	ut_num++;
+	return 1;
+}
+
+static int unittest_http_parse(int print_success)
+{
+	int success = 1, i, j;
+	char *ut_successes[] = {
+		"GET / HTTP/1.1\r\nUser-Agent: httperf/0.9.0\r\nHost: localhost\r\n\r\n",
+		"GET /cgi/hw HTTP/1.0\r\n\r\n",
+		NULL
+	};
+	char *ut_pend[] = {
+		"G",		/* 1 */
+		"GET",
+		"GET ",
+		"GET /",
+		"GET / ",	/* 5 */
+		"GET / HT",
+		"GET / HTTP/1.",
+		"GET / HTTP/1.1",
+		"GET / HTTP/1.1\r",
+		"GET / HTTP/1.1\r\n", /* 10 */
+		"GET / HTTP/1.1\r\nUser-",
+		"GET / HTTP/1.1\r\nUser-blah:blah\r",
+		"GET / HTTP/1.1\r\nUser-blah:blah\r\n\r",
+		NULL
+	};
+	char *ut_fail[] = {
+		"GET / HTTP/1.2",
+		"GET / HTTP/1.2\r\nUser-blah:blah\r", /* 14 */
+		"POST / HTTP/1.1\r\n\r\n",
+		"GET /\r\n\r\n",
+		"GET / HTTP/1.1\r\n\rX",
+		NULL
+	};
+	/* pipelined requests, and the paths they should yield */
+	struct {
+		char *reqs, *paths;
+		int nreqs;
+	} ut_piped[] = {
+		{"GET / HTTP/1.1\r\nUser-Agent: httperf/0.9.0\r\nHost: localhost\r\n\r\n", "/", 1},
+		{"GET /cgi/hw HTTP/1.1\r\nHost: localhost\r\n\r\n"
+		 "GET /fs/bar HTTP/1.0\r\n\r\n"
+		 "GET   /  HTTP/1.1\r\nUser-Agent: httperf/0.9.0\r\nHost: localhost\r\n\r\n",
+		 "/cgi/hw /fs/bar /", 3},
+		{NULL, NULL, 0}
+	};
+	/* Connection headers, and the flags they should yield */
+	struct {
+		char *req;
+		int flags;
+	} ut_conn[] = {
+		{"GET / HTTP/1.1\r\nConnection: close\r\n\r\n", HP_CONN_CLOSE},
+		{"GET / HTTP/1.0\r\nconnection:Keep-Alive\r\n\r\n", HP_CONN_KEEPALIVE},
+		{"GET / HTTP/1.1\r\nCONNECTION: keep-alive, Upgrade\r\n\r\n", HP_CONN_KEEPALIVE},
+		{"GET / HTTP/1.1\r\nConnection: TE,close\r\n\r\n", HP_CONN_CLOSE},
+		{"GET / HTTP/1.1\r\nConnection: closed\r\n\r\n", 0},
+		{"GET / HTTP/1.1\r\nConnection: clos\r\n\r\n", 0},
+		{"GET / HTTP/1.1\r\nConnection: kept-alive\r\n\r\n", 0},
+		{"GET / HTTP/1.1\r\nConnection-X: close\r\n\r\n", 0},
+		{"GET / HTTP/1.1\r\nX-Connection: close\r\n\r\n", 0},
+		{NULL, 0}
+	};
+	int chunks[] = {1, 2, 3, 7, 16, HTTP_RB_SZ, 0};
+
+	for (i = 0 ; ut_successes[i] ; i++) {
+		if (print_ut(ut_successes[i], strlen(ut_successes[i]), UT_SUCCESS, print_success)) {
+			success = 0;
+		}
+	}
+	for (i = 0 ; ut_pend[i] ; i++) {
+		if (print_ut(ut_pend[i], strlen(ut_pend[i]), UT_PENDING, print_success)) {
+			success = 0;
+		}
+	}
+	for (i = 0 ; ut_fail[i] ; i++) {
+		if (print_ut(ut_fail[i], strlen(ut_fail[i]), UT_FAIL, print_success)) {
+			success = 0;
+		}
+	}
+	for (i = 0 ; ut_conn[i].req ; i++) {
+		if (print_ut_conn(ut_conn[i].req, ut_conn[i].flags, print_success)) {
+			success = 0;
+		}
+	}
+	/* fragmented and pipelined requests */
+	for (i = 0 ; ut_piped[i].reqs ; i++) {
+		for (j = 0 ; chunks[j] ; j++) {
+			if (print_ut_chunked(ut_piped[i].reqs, chunks[j], ut_piped[i].nreqs, 
+					     ut_piped[i].paths, print_success)) {
+				success = 0;
+			}
+		}
+	}
+
+	if (success) return 0;
+	return 1;
+}
+
+/* 
+ * Parse throughput: pipelined httperf-style requests, written into
+ * the ring in 1400 byte (segment-sized) chunks.
+ */
+static void bench_http_parse(int iters)
+{
+	static struct http_rb rb;
+	struct http_parser p;
+	struct timeval start, end;
+	char req[] = "GET /cgi/hw HTTP/1.1\r\nUser-Agent: httperf/0.9.0\r\nHost: 10.0.2.8\r\n\r\n";
+	char buff[32*sizeof(req)];
+	int len = 0, i, nreqs = 0;
+	unsigned long long bytes = 0;
+	double usec;
+
+	for (i = 0 ; i < 32 ; i++, len += sizeof(req)-1) memcpy(buff + len, req, sizeof(req)-1);
+
+	http_rb_init(&rb);
+	http_parse_reset(&p, rb.head);
+	gettimeofday(&start, NULL);
+	for (i = 0 ; i < iters ; i++) {
+		int off = 0;
+
+		while (off < len) {
+			int amnt = len - off < 1400 ? len - off : 1400;
+
+			amnt = http_rb_put(&rb, buff + off, amnt);
+			off += amnt;
+			while (HP_DONE == http_parse(&p, &rb)) {
+				nreqs++;
+				rb.head = p.pos;
+				http_parse_reset(&p, p.pos);
+			}
+		}
+		bytes += len;
+	}
+	gettimeofday(&end, NULL);
+	usec = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+	printf("Parsed %d requests (%llu bytes) in %.0f usec: %.0f reqs/sec, %.1f MB/sec\n",
+	       nreqs, bytes, usec, nreqs / (usec / 1000000), bytes / usec);
+}
+
+int main(int argc, char *argv[])
+{
+	if (unittest_http_parse(0)) return -1;
+	printf("All parser unit tests passed.\n");
+	/* ./http_parse_test -b: parser benchmark */
+	if (argc > 1 && !strcmp(argv[1], "-b")) bench_http_parse(100000);
+
+	return 0;
+}
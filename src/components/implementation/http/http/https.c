@@ -23,6 +23,8 @@
 
 #define ENOMEM 2
 #define EINVAL 3
+#define EAGAIN 4
+#define EBUSY  5
 
 #else  /* COS_LINUX_ENV */
 
@@ -33,154 +35,41 @@
 #include <http.h>
 
 #include <content_mux.h>
+#include <cbuf.h>
 #include <timed_blk.h>
 #include <sched.h>
+#include <evt.h>
+#include <cos_list.h>
+#include <cos_synchronization.h>
+#include <resp_desc.h>
+#include <sched_conf.h>
 
 #endif	/* COS_LINUX_ENV */
 
+#include "http_parse.h"
+
 /* Keeping some stats (unsynchronized across threads currently) */
 static volatile unsigned long http_conn_cnt = 0, http_req_cnt = 0;
 
-inline static int is_whitespace(char s)
-{
-	if (' ' == s) return 1;
-	return 0;
-}
-
-inline static char *remove_whitespace(char *s, int len)
-{
-	while (is_whitespace(*(s++)) && len--);
-	return s-1;
-}
-
-inline static char *find_whitespace(char *s, int len)
-{
-	while (!is_whitespace(*(s++)) && len--);
-	return s-1;
-}
-
-inline static int memcmp_fail_loc(char *s, char *c, int s_len,
-				  int c_len, char **fail_loc)
-{
-	int min = (c_len < s_len) ? c_len : s_len;
-
-	if (memcmp(s, c, min)) {
-		*fail_loc = s;
-		return 1;
-	}
-	*fail_loc = s + min;
-	if (c_len > s_len) return 1;
-	return 0;
-}
-
-static inline char *http_end_line(char *s, int len)
-{
-	if (len < 2) return NULL;
-	if ('\r' == s[0] && '\n' == s[1]) return s+2;
-	return NULL;
-}
-
-inline static int get_http_version(char *s, int len, char **ret, int *minor_version)
-{
-	char *c;
-	char http_str[] = "HTTP/1.";
-	int http_sz = sizeof(http_str)-1; // -1 for \n
-
-	c = remove_whitespace(s, len);
-	if (memcmp_fail_loc(c, http_str, len, http_sz, ret) ||
-	    0 == (len - (*ret-s))) {
-		*minor_version = -1;
-		return 1;
-	}
-	c += http_sz;
-	*minor_version = ((int)*c) - (int)'0';
-	c++;
-	if (http_end_line(c, len - (c-s))) c += 2;
-	*ret = c;
-	return 0;
-}
-
-static int http_find_next_line(char *s, int len, char **ret)
-{
-	char *r, *e;
-
-	for (e = s;
-	     len >= 2 && NULL == (r = http_end_line(e, len));
-	     e++, len--);
-
-	if (len >= 2) {
-		*ret = r;
-		return 0;
-	} else {
-		assert(len == 1 || len == 0);
-		*ret = e+len;
-		return 1;
-	}
-}
+/*
+ * Admission control: when HTTP_MAX_OUTSTANDING requests are
+ * outstanding at the content providers, or a provider refuses a
+ * request with -EAGAIN, a new request is answered right away with a
+ * 503 and its connection is closed.  Shedding load here, before any
+ * work is done for the request, keeps the latency of the admitted
+ * requests bounded under overload.
+ */
+#define HTTP_MAX_OUTSTANDING 256
+static volatile unsigned long http_outstanding = 0, http_shed_cnt = 0;
 
-static int http_find_header_end(char *s, int len, char **curr, int flags)
+/* all connections' threads update the count, without a lock */
+static inline void http_outstanding_add(long n)
 {
-	char *p, *c;
+	long o;
 
-	c = s;
 	do {
-		p = c;
-
-		/* parse the header and add in flags here */
-
-		if (http_find_next_line(c, len-(int)(c-s), &c)) {
-			/* Malformed: last characters not cr lf */
-			*curr = c;
-			return 1;
-		}
-	} while((int)(c - p) > 2);
-
-	*curr = c;
-	return 0;
-}
-
-typedef struct {
-	char *end;
-	char *path;
-	int path_len;
-	int head_flags;
-} get_ret_t;
-
-static int http_get_parse(char *req, int len, get_ret_t *ret)
-{
-	char *s = req, *e, *end;
-	char *path;
-	int path_len, minor_version;
-
-	end = req + len;
-
-	if (memcmp_fail_loc(s, "GET ", len, 4, &e)) goto malformed_request;
-
-	path = remove_whitespace(e, len);
-	e = find_whitespace(path, len - (path-s));
-	path_len = e-path;
-	e = remove_whitespace(e, len - (e-s));
-
-	if (get_http_version(e, len - (e-s), &e, &minor_version)) goto malformed_request;
-	if (minor_version != 0 && minor_version != 1) {
-		/* This should be seen as an error: */
-		e = s;
-		goto malformed_request;
-	}
-
-	ret->head_flags = 0;
-	if (http_find_header_end(e, len - (e-s), &e, ret->head_flags)) goto malformed_request;
-
-	ret->end = e;
-	ret->path = path;
-	ret->path_len = path_len;
-	return 0;
-
-malformed_request:
-	ret->path = NULL;
-	ret->path_len = -1;
-	ret->end = e;
-	return -1;
+		o = http_outstanding;
+	} while (cos_cmpxchg(&http_outstanding, o, o + n) != o + n);
 }
 
 extern long content_open(spdid_t spdid, long evt_id, struct cos_array *data);
@@ -190,16 +79,43 @@ extern int content_close(spdid_t spdid, long cr);
 
 extern int timed_event_block(spdid_t spdid, unsigned int microsec);
 
+/* 
+ * The piece of a response currently being sent: resp is NULL until
+ * it is retrieved, and off is how much of it has been sent.  If it
+ * is in a cbuf, cb is that cbuf.
+ */
 struct http_response {
 	char *resp;
-	int resp_len;
+	int resp_len, off;
 	int more; 		/* is there more data to retrieve? */
+	int malloced;		/* resp is ours to free */
+	cbuf_t cb;
+	int cb_len, persist;	/* persist: the cbuf is never freed */
 };
 
 struct connection {
 	int refcnt;
 	long conn_id, evt_id;
 	struct http_request *pending_reqs;
+	/* 
+	 * Requests with responses that are referenced by a
+	 * descriptor, freed once the descriptor is sent.
+	 */
+	struct http_request *retired;
+	struct http_parser parser;
+	struct http_rb rb;
+
+	/* 
+	 * closing: no more responses are sent, and the next read
+	 * tells the connection manager to close the connection.
+	 * last_active is in seconds (http_secs).  Both are also
+	 * read, and closing set, by the idle timeout.
+	 */
+	volatile int closing;
+	/* shed: a request was rejected, later ones are dropped */
+	int shed;
+	volatile unsigned long last_active;
+	struct connection *next, *prev;
 };
 
 /*
@@ -208,18 +124,21 @@ struct connection {
  * c
  * |
  * V
- * p<->p<->p<->.<->.<->.<->P
+ * p<->p<->p<->p
  *
- * c: connection, P: request with pending data, .: requests that have
- * not been processed (requests made to content containers), p:
- * requests that have been processed (sent to content managers), but
- * where the reply has not been transferred yet.  In most cases, P
- * will also have the malloc flag set.
+ * c: connection, p: requests that have been processed (sent to
+ * content managers), but where the reply has not been transferred
+ * yet.  A request that is still incomplete is not on this queue;
+ * its partial data is in the connection's ring, and its progress is
+ * tracked by the connection's parser.
  */
-#define HTTP_REQ_PENDING      0x1 /* incomplete request, pending more
-				   * data */
-#define HTTP_REQ_MALLOC       0x2 /* the buffer has been malloced */
-#define HTTP_REQ_PROCESSED    0x4 /* request not yet made */
+#define HTTP_REQ_PROCESSED    0x4 /* request has been made */
+#define HTTP_REQ_CLOSE        0x8 /* close connection after response */
+#define HTTP_REQ_V10          0x10 /* HTTP/1.0 request */
+#define HTTP_REQ_HEAD_SENT    0x20
+#define HTTP_REQ_CHUNKED      0x40 /* Transfer-Encoding: chunked */
+#define HTTP_REQ_REFERENCED   0x80 /* response referenced by a descriptor */
+#define HTTP_REQ_REJECTED     0x100 /* answered with a 503 */
 
 enum {HTTP_TYPE_TOP, 
       HTTP_TYPE_GET};
@@ -230,8 +149,9 @@ struct http_request {
 	struct connection *c;
 	struct http_response resp;
 
-	char *req, *path;
-	int req_len, path_len;
+	/* the path, as an offset into the connection's ring */
+	unsigned int path_off;
+	int path_len;
 
 	struct http_request *next, *prev;
 };
@@ -244,7 +164,7 @@ static int http_get_request(struct http_request *r)
 
 	arg = cos_argreg_alloc(r->path_len + sizeof(struct cos_array) + 1);
 	assert(arg);
-	memcpy(arg->mem, r->path, r->path_len);
+	http_rb_copy(&r->c->rb, r->path_off, r->path_len, arg->mem);
 	arg->sz = r->path_len;
 	arg->mem[arg->sz] = '\0';
 	if (0 > r->content_id ) {
@@ -259,42 +179,6 @@ static int http_get_request(struct http_request *r)
 	return ret;
 }
 
-static int http_get(struct http_request *r)
-{
-	get_ret_t ret;
-	char *s = r->req, *p;
-	int len = r->req_len;
-
-	if (http_get_parse(s, len, &ret)) {
-		r->req_len = (int)(ret.end - s);
-		return -1;
-	}
-	p = malloc(ret.path_len+1);
-	if (!p) {
-		printc("path could not be allocated\n");
-		r->req_len = 0;
-		return -1;
-	}
-	memcpy(p, ret.path, ret.path_len);
-	p[ret.path_len] = '\0';
-
-	r->path = p;
-	r->path_len = ret.path_len;
-	r->req_len = (int)(ret.end - s);
-	r->flags |= ret.head_flags;
-	return 0;
-}
-
-static int http_parse_request(struct http_request *r)
-{
-	if (!memcmp("GET", r->req, 3)) {
-		r->type = HTTP_TYPE_GET;
-		return http_get(r);
-	}
-	printc("unknown request type for message\n<<%s>>\n", r->req);
-	return -1;
-}
-
 static int http_make_request(struct http_request *r)
 {
 	switch (r->type) {
@@ -317,7 +201,14 @@ static struct connection *http_new_connection(long conn_id, long evt_id)
 	c->conn_id = conn_id;
 	c->evt_id = evt_id;
 	c->pending_reqs = NULL;
+	c->retired = NULL;
 	c->refcnt = 1;
+	c->closing = 0;
+	c->shed = 0;
+	c->last_active = 0;
+	INIT_LIST(c, next, prev);
+	http_rb_init(&c->rb);
+	http_parse_reset(&c->parser, c->rb.head);
 
 	return c;
 }
@@ -353,7 +244,7 @@ static void http_free_connection(struct connection *c)
 	conn_refcnt_dec(c);
 }
 
-static inline void http_init_request(struct http_request *r, int buff_len, struct connection *c, char *req)
+static inline void http_init_request(struct http_request *r, struct connection *c)
 {
 	static long id = 0;
 
@@ -363,8 +254,6 @@ static inline void http_init_request(struct http_request *r, int buff_len, struc
 	r->type = HTTP_TYPE_TOP;
 	r->c = c;
 	c->refcnt++;
-	r->req = req;
-	r->req_len = buff_len;
 	if (c->pending_reqs) {
 		struct http_request *head = c->pending_reqs, *tail = head->prev;
 
@@ -379,33 +268,31 @@ static inline void http_init_request(struct http_request *r, int buff_len, struc
 	}
 }
 
-static struct http_request *http_new_request_flags(struct connection *c, char *req, int buff_len, int flags)
+static struct http_request *http_new_request(struct connection *c)
 {
 	struct http_request *r = malloc(sizeof(struct http_request));
 
 	if (NULL == r) return r;
-	http_init_request(r, buff_len, c, req);
-	r->flags = flags;
+	http_init_request(r, c);
 
 	return r;
 }
 
-static struct http_request *http_new_request(struct connection *c, char *req, int buff_len)
+static inline void http_resp_release(struct http_response *hr)
 {
-	return http_new_request_flags(c, req, buff_len, 0);
+	if (hr->malloced) free(hr->resp);
+	hr->resp     = NULL;
+	hr->malloced = 0;
 }
 
 static void __http_free_request(struct http_request *r)
 {
-	/* FIXME: don't free response if in arg. reg. */
-	if (r->resp.resp) free(r->resp.resp);
-	if (r->path) free(r->path);
-	assert(r->req);
-	if (r->flags & HTTP_REQ_MALLOC) free(r->req);
+	http_resp_release(&r->resp);
 	free(r);
 }
 
-static void http_free_request(struct http_request *r)
+/* remove the request from its connection's queue of pending requests */
+static void http_unlink_request(struct http_request *r)
 {
 	struct connection *c = r->c;
 	struct http_request *next = r->next, *prev = r->prev;
@@ -420,279 +307,520 @@ static void http_free_request(struct http_request *r)
 	if (c->pending_reqs == r) {
 		c->pending_reqs = (r == next) ? NULL : next;
 	}
-	content_close(cos_spd_id(), r->content_id);
-	conn_refcnt_dec(c);
+}
+
+static void http_release_request(struct http_request *r)
+{
+	if (HTTP_REQ_PROCESSED == (r->flags & (HTTP_REQ_PROCESSED | HTTP_REQ_REJECTED))) {
+		http_outstanding_add(-1);
+	}
+	if (r->content_id >= 0) content_close(cos_spd_id(), r->content_id);
+	conn_refcnt_dec(r->c);
 	__http_free_request(r);
 }
 
+static void http_free_request(struct http_request *r)
+{
+	http_unlink_request(r);
+	http_release_request(r);
+}
+
 /* 
- * This is annoying, but the caller needs to know the buffer size of
- * the request that we are using.  In most cases, the passed in buffer
- * is what we use, so it isn't an issue, but if we malloc our own
- * buffer (see the HTTP_REQ_PENDING case), then the total buffer size
- * can grow.  Thus the buff_sz argument.
+ * The request's response is referenced by a descriptor that has not
+ * been sent yet, so the content (and its cbufs) must be kept until
+ * the next read.
  */
-static struct http_request *connection_handle_request(struct connection *c, char *buff,
-						      int amnt, int *buff_sz)
+static void http_retire_request(struct http_request *r)
 {
-	struct http_request *r, *last;
+	struct connection *c = r->c;
 
-	*buff_sz = amnt;
-	r = http_new_request(c, buff, amnt);
-	if (NULL == r) return NULL;
-	last = r->prev;
+	http_unlink_request(r);
+	r->next    = c->retired;
+	c->retired = r;
+}
 
-	/* 
-	 * If a previous request required more data to parse correctly
-	 * (was pending), then we need to combine its buffer with the
-	 * current one and try to parse again.
-	 */
-	if (last != r && last->flags & HTTP_REQ_PENDING) {
-		char *new_buff;
-		int new_len;
+static void connection_free_retired(struct connection *c)
+{
+	struct http_request *r;
 
-		if (last->prev != last && last->prev->flags & HTTP_REQ_PENDING) {
-			http_free_request(r);
-			return NULL;
-		}
-		new_len = amnt + last->req_len;
-		new_buff = malloc(new_len + 1);
-		if (NULL == new_buff) {
-			printc("malloc fail 1\n"); fflush(stdout);
-			http_free_request(r);
-			return NULL;
-		}
-		memcpy(new_buff, last->req, last->req_len);
-		memcpy(new_buff + last->req_len, buff, amnt);
-		buff = new_buff;
-		*buff_sz = amnt = new_len;
-		new_buff[new_len] = '\0';
-		http_free_request(last);
-
-		if (r->flags & HTTP_REQ_MALLOC) free(r->req);
-		r->req_len = new_len;
-		r->req = new_buff;
-		r->flags |= HTTP_REQ_MALLOC;
+	while (NULL != (r = c->retired)) {
+		c->retired = r->next;
+		http_release_request(r);
 	}
+}
 
-	/*
-	 * Process the list of requests first, then go through and
-	 * actually make the requests.
-	 */
-	if (http_parse_request(r)) {
-		char *save_buff;
+/* 
+ * Parse and make all of the complete requests in the connection's
+ * ring.  A trailing partial request stays in the ring, and parsing
+ * resumes within it on the next write.
+ */
+static int connection_parse_requests(struct connection *c)
+{
+	struct http_parser *p = &c->parser;
+	struct http_request *r;
+	int ret, err;
+
+	while (HP_DONE == (ret = http_parse(p, &c->rb))) {
+		r = http_new_request(c);
+		if (NULL == r) return -ENOMEM;
+		r->type      = HTTP_TYPE_GET;
+		r->path_off  = p->path_off;
+		r->path_len  = p->path_len;
+		/* HTTP/1.1 connections persist unless asked not to, 1.0 unless asked to */
+		if (0 == p->minor_version) {
+			r->flags |= HTTP_REQ_V10;
+			if (!(p->head_flags & HP_CONN_KEEPALIVE)) r->flags |= HTTP_REQ_CLOSE;
+		} else if (p->head_flags & HP_CONN_CLOSE) {
+			r->flags |= HTTP_REQ_CLOSE;
+		}
 
-		/* parse error?! Parsing broke somewhere _in_ the
-		 * message, so we need to report this as an error */
-		if (r->req_len != amnt) {
-			/* FIXME: kill connection */
-			http_free_request(r);
-			return NULL;
-		}		
-		assert(r->req_len == amnt && r->req == buff);
-		/*
-		 * If we failed because we simply don't have a whole
-		 * message (more data is pending), then store it away
-		 * appropriately.
-		 */
-		save_buff = malloc(amnt + 1);
-		if (NULL == save_buff) {
-			printc("malloc fail 2\n"); fflush(stdout);
-			/* FIXME: kill connection */
-			http_free_request(r);
-			return NULL;
+		if (http_outstanding >= HTTP_MAX_OUTSTANDING) err = -EAGAIN;
+		else                                          err = http_make_request(r);
+		if (-EAGAIN == err || -EBUSY == err) {
+			/* answer with a 503, and drop the rest */
+			r->flags   |= HTTP_REQ_PROCESSED | HTTP_REQ_REJECTED | HTTP_REQ_CLOSE;
+			c->shed     = 1;
+			c->rb.head  = c->rb.tail;
+			http_parse_reset(p, c->rb.tail);
+			http_shed_cnt++;
+			return 0;
 		}
-		memcpy(save_buff, buff, amnt);
-		save_buff[amnt] = '\0';
-		if (r->flags & HTTP_REQ_MALLOC) free(r->req);
-		r->req = save_buff;
-		r->flags |= (HTTP_REQ_PENDING | HTTP_REQ_MALLOC);
+		if (err) {
+			printc("https: Could not process response.\n");
+			return -1;
+		}
+		r->flags |= HTTP_REQ_PROCESSED;
+		http_outstanding_add(1);
+
+		/* The request has been made: release its data */
+		c->rb.head = p->pos;
+		http_parse_reset(p, p->pos);
 	}
-	return r;
+	if (HP_ERR == ret) {
+		/* FIXME: send an error response, and kill the connection */
+		printc("https: malformed request.\n");
+		return -1;
+	}
+
+	return 0;
 }
 
-static int connection_parse_requests(struct connection *c, char *req, int req_sz)
+static int connection_write(struct connection *c, char *req, int req_sz)
 {
-	struct http_request *r, *first;
-
-	/* Parse all the requests in the buffer */
 	while (req_sz > 0) {
-		int start_amnt;
-
-		r = connection_handle_request(c, req, req_sz, &start_amnt);
-		/* TODO: here we should check if an error occurred and
-		 * the response can be sent.  If so set
-		 * HTTP_REQ_PROCESSED. */
-		if (NULL == r) return 1;
-		req = r->req + r->req_len;
-		req_sz = start_amnt - r->req_len;
+		int amnt;
+
+		/* requests after a rejected one are dropped */
+		if (c->shed) return 0;
+		amnt = http_rb_put(&c->rb, req, req_sz);
+		/* A single request larger than the ring */
+		if (0 == amnt) return -ENOMEM;
+		req    += amnt;
+		req_sz -= amnt;
+		if (connection_parse_requests(c)) return -EINVAL;
 	}
-	
-	/* Now submit those requests (process them) */
-	first = r = c->pending_reqs;
-	if (NULL == r) return 0;
-	do {
-		if (!(r->flags & (HTTP_REQ_PENDING | HTTP_REQ_PROCESSED))) {
-			if (http_make_request(r)) {
-				printc("https: Could not process response.\n");
-				return -1;
-			}
-			if (!(r->flags & HTTP_REQ_PENDING)) r->flags |= HTTP_REQ_PROCESSED;
-		}
-		r = r->next;
-	} while (r != first);
-	
+
 	return 0;
 }
 
-static const char success_head[] =
+/*
+ * The status line, Date, and Content-Type headers are the same for
+ * every response within a second.  They are formatted once a second
+ * by the timer thread (see cos_init) into the inactive one of two
+ * buffers, which is then made the current one.
+ */
+static const char http_head_fmt[] =
 	"HTTP/1.1 200 OK\r\n"
-	"Date: Sat, 14 Feb 2008 14:59:00 GMT\r\n"
-	"Content-Type: text/html\r\n"
-	"Connection: close\r\n"
-	"Content-Length: ";
-//static const char resp[] = "all your base are belong to us\r\n";
+	"Date: %s, %02d %s %d %02d:%02d:%02d GMT\r\n"
+	"Content-Type: text/html\r\n";
+#define HTTP_HEAD_MAX 96
+static char http_head[2][HTTP_HEAD_MAX];
+static int http_head_len[2], http_head_curr;
+
+/* 
+ * There is no access to a real-time clock, so the date is the time
+ * since boot, added to this base (Thu, 14 Feb 2008 14:59:00 GMT).
+ */
+#define HTTP_DATE_BASE 1203001140UL
+
+static volatile unsigned long http_secs = 0;
+
+static void http_head_update(unsigned long secs)
+{
+	static const char *days[]   = {"Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};
+	static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+				       "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+	unsigned long t = HTTP_DATE_BASE + secs, days_since, era_day, yoe, doy, mp;
+	int next = !http_head_curr, year, month, day;
+
+	/* days since the epoch to the civil date (years start in March) */
+	days_since = t / 86400;
+	era_day    = (days_since + 719468) % 146097;
+	yoe        = (era_day - era_day/1460 + era_day/36524 - era_day/146096) / 365;
+	doy        = era_day - (365*yoe + yoe/4 - yoe/100);
+	mp         = (5*doy + 2) / 153;
+	day        = doy - (153*mp + 2)/5 + 1;
+	month      = mp < 10 ? mp + 2 : mp - 10;
+	year       = (days_since + 719468) / 146097 * 400 + yoe + (month < 2);
+
+	http_head_len[next] = snprintf(http_head[next], HTTP_HEAD_MAX, http_head_fmt,
+				       days[days_since % 7], day, months[month], year,
+				       (int)(t % 86400) / 3600, (int)(t % 3600) / 60, (int)(t % 60));
+	http_head_curr = next;
+}
+
+/* 
+ * Responses are written into a flat buffer (content_read), or into a
+ * response descriptor (content_read_resp) where data in cbufs is
+ * referenced rather than copied.
+ */
+struct http_out {
+	char *buf;
+	int sz, used;
+	struct resp_desc *d;
+};
+
+static inline int http_out_len(struct http_out *o)
+{
+	return o->d ? o->d->tot_len : o->used;
+}
+
+/* where to write len bytes of generated data, or NULL if no room */
+static char *http_out_ptr(struct http_out *o, int len)
+{
+	char *p;
+
+	if (o->d) return resp_desc_slab_add(o->d, len);
+	if (len > o->sz - o->used) return NULL;
+	p        = o->buf + o->used;
+	o->used += len;
+
+	return p;
+}
+
+/* 
+ * How much data can be added, leaving overhead bytes of room for
+ * generated data around it?  ref: the data is added by reference.
+ */
+static int http_out_avail(struct http_out *o, int ref, int overhead)
+{
+	struct resp_desc *d = o->d;
+	int avail, slab;
+
+	if (NULL == d) return o->sz - o->used - overhead;
+	/* the data, and generated data before and after it */
+	if (RESP_DESC_MAX_SEGS - d->nsegs < 3) return -1;
+	slab  = d->slab_sz - d->slab_used - overhead;
+	avail = d->max_len - d->tot_len - overhead;
+	if (slab < 0)              return -1;
+	if (!ref && slab < avail) avail = slab;
+
+	return avail;
+}
+
+/* returns 1 if the data was referenced rather than copied */
+static int http_out_data(struct http_out *o, struct http_request *r, int amnt)
+{
+	struct http_response *hr = &r->resp;
+
+	if (o->d && !cbuf_is_null(hr->cb)) {
+		resp_desc_cbuf_add(o->d, hr->cb, hr->cb_len, hr->off, amnt, 
+				   hr->persist ? RESP_SEG_PERSIST : 0);
+		r->flags |= HTTP_REQ_REFERENCED;
+		return 1;
+	}
+	memcpy(http_out_ptr(o, amnt), hr->resp + hr->off, amnt);
+
+	return 0;
+}
 
 #define MAX_SUPPORTED_DIGITS 20
 
-/* Must prefix data by "content_length\r\n\r\n" */
-static int http_get_header(char *dest, int max_len, int content_len, int *resp_len)
+static const char http_conn_close[]     = "Connection: close\r\n";
+static const char http_conn_keepalive[] = "Connection: keep-alive\r\n";
+static const char http_chunked[]        = "Transfer-Encoding: chunked\r\n\r\n";
+static const char http_chunk_end[]      = "0\r\n\r\n";
+static const char http_err_head[]       =
+	"HTTP/1.1 500 Internal Server Error\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n\r\n";
+static const char http_503[]            = 
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Retry-After: 1\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n\r\n";
+/* chunk size in hex, and \r\n before and after the chunk */
+#define HTTP_CHUNK_OVERHEAD (8 + 2 + 2)
+/* upper bound on the header, and the first chunk's framing */
+#define HTTP_HEAD_RESERVE   (HTTP_HEAD_MAX + sizeof(http_conn_keepalive) + sizeof(http_chunked) + \
+			     HTTP_CHUNK_OVERHEAD + sizeof(http_chunk_end))
+
+/* 
+ * Generate the header for r.  content_len < 0 means that the length
+ * is not known up front.  Returns the length of the header, or -1
+ * if it doesn't fit.
+ */
+static int http_get_header(struct http_out *o, struct http_request *r, int content_len)
 {
-	int resp_sz = content_len;
-	int head_sz = sizeof(success_head)-1;
-	int tot_sz, len_sz = 0;
-	char len_str[MAX_SUPPORTED_DIGITS];
-
-	len_sz = snprintf(len_str, MAX_SUPPORTED_DIGITS, "%d\r\n\r\n", resp_sz);
-	if (MAX_SUPPORTED_DIGITS == len_sz || len_sz < 1) {
-		printc("length of response body too large\n");
-		*resp_len = 0;
-		return -1;
+	int curr = http_head_curr, head_sz = http_head_len[curr];
+	int conn_sz, len_sz, tot_sz;
+	const char *conn;
+	char len_str[MAX_SUPPORTED_DIGITS + sizeof("Content-Length: \r\n\r\n")], *dest;
+
+	if (r->flags & HTTP_REQ_CHUNKED) {
+		len_sz = sizeof(http_chunked)-1;
+		memcpy(len_str, http_chunked, len_sz);
+	} else if (content_len < 0) {
+		/* delimited by closing the connection */
+		len_sz = 2;
+		memcpy(len_str, "\r\n", 2);
+	} else {
+		len_sz = snprintf(len_str, sizeof(len_str), "Content-Length: %d\r\n\r\n", content_len);
+		if ((int)sizeof(len_str) <= len_sz || len_sz < 1) {
+			printc("length of response body too large\n");
+			return -1;
+		}
+	}
+	if (r->flags & HTTP_REQ_CLOSE) {
+		conn    = http_conn_close;
+		conn_sz = sizeof(http_conn_close)-1;
+	} else {
+		conn    = http_conn_keepalive;
+		conn_sz = sizeof(http_conn_keepalive)-1;
 	}
 
-	tot_sz = head_sz + len_sz + resp_sz;
-	/* +1 for \0 so we can print the string */
-	if (tot_sz + 1 > max_len) {
-		*resp_len = 0;
-		return 1;
+	tot_sz = head_sz + conn_sz + len_sz;
+	/* the header must leave room for some body in a descriptor */
+	if (http_out_avail(o, 0, tot_sz) < 0) return -1;
+	dest = http_out_ptr(o, tot_sz);
+	if (NULL == dest) return -1;
+	memcpy(dest, http_head[curr], head_sz);
+	memcpy(dest + head_sz, conn, conn_sz);
+	memcpy(dest + head_sz + conn_sz, len_str, len_sz);
+
+	return tot_sz;
+}
+
+/* 
+ * Retrieve the next piece of r's response.  Responses in a cbuf are
+ * referenced, not copied.  Otherwise the response is retrieved into
+ * *arr, which the caller must free, and which is returned holding
+ * at most max bytes.
+ */
+static int http_retrieve(struct http_request *r, int max, struct cos_array **arr_ret)
+{
+	struct http_response *hr = &r->resp;
+	struct cos_array *arr;
+	int *more, *cb_len, cb, ret;
+
+	arr = cos_argreg_alloc(sizeof(struct cos_array) + max);
+	more = cos_argreg_alloc(sizeof(int));
+	cb_len = cos_argreg_alloc(sizeof(int));
+	assert(arr && more && cb_len);
+	*arr_ret = NULL;
+
+	*cb_len     = -1;
+	hr->cb      = cbuf_null();
+	hr->persist = 0;
+	cb = content_retrieve_cbuf(cos_spd_id(), r->content_id, cb_len, more);
+	if (*cb_len >= 0) {
+		hr->resp_len = *cb_len;
+		hr->resp     = cbuf2buf((cbuf_t)cb, hr->resp_len);
+		hr->cb       = (cbuf_t)cb;
+		hr->cb_len   = *cb_len;
+		hr->persist  = *more & CONTENT_PERSIST;
+		hr->more     = *more & CONTENT_MORE;
+		ret          = (NULL == hr->resp) ? -EINVAL : 0;
+	} else {
+		arr->sz = max;
+		if (0 == (ret = content_retrieve(cos_spd_id(), r->content_id, arr, more))) {
+			hr->resp_len = arr->sz;
+			hr->resp     = arr->mem;
+		}
+		hr->more = *more;
 	}
-	memcpy(dest, success_head, head_sz);
-	dest += head_sz;
-	memcpy(dest, len_str, len_sz);
-	dest += len_sz;
-	*resp_len = len_sz + head_sz;
-	dest[0] = '\0';
+	hr->off      = 0;
+	hr->malloced = 0;
+	cos_argreg_free(cb_len);
+	cos_argreg_free(more);
+	if (ret || hr->resp != arr->mem) {
+		cos_argreg_free(arr);
+		return ret;
+	}
+	*arr_ret = arr;
 
 	return 0;
 }
 
-static int connection_get_reply(struct connection *c, char *resp, int resp_sz)
+/* 
+ * Write as much of the pending responses as fits into o.  A
+ * response with a known length is sent with a Content-Length, and
+ * can be split across reads.  One that the content provider returns
+ * in pieces (more is set) is streamed with chunked encoding (or, for
+ * HTTP/1.0, delimited by closing the connection).  Data that is in a
+ * cbuf is only copied into a flat buffer, and is referenced by a
+ * descriptor; the unsent part of data retrieved into the argument
+ * region is saved.
+ */
+static int connection_get_reply(struct connection *c, struct http_out *o)
 {
 	struct http_request *r;
-	int used = 0;
+	struct http_response *hr = NULL;
+	struct cos_array *arr;
 
-	/* 
-	 * Currently, this doesn't do anything interesting.  In the
-	 * future it will call the content provider and get the
-	 * (ready) response.
-	 */
-	r = c->pending_reqs;
-	if (NULL == r) return 0;
-	while (r) {
-		struct http_request *next;
-		struct cos_array *arr = NULL;
-		char *local_resp;
-		int *more = NULL; 
-		int local_more, consumed, ret, local_resp_sz;
+	/* the previous descriptor has been sent by now */
+	connection_free_retired(c);
+	while (NULL != (r = c->pending_reqs) && !c->closing) {
+		int ret, amnt, avail, chunked, overhead, refd = 0;
+		char *p;
+
+		hr  = &r->resp;
+		arr = NULL;
 
 		assert(r->c == c);
-		if (r->flags & HTTP_REQ_PENDING) break;
-		assert(r->flags & HTTP_REQ_PROCESSED);
+		/* a request that could not be made */
+		if (!(r->flags & HTTP_REQ_PROCESSED)) break;
+		if (r->flags & HTTP_REQ_REJECTED) {
+			p = http_out_ptr(o, sizeof(http_503)-1);
+			if (NULL == p) {
+				if (http_out_len(o)) break;
+				return -ENOMEM;
+			}
+			memcpy(p, http_503, sizeof(http_503)-1);
+			c->closing = 1;
+			http_free_request(r);
+			break;
+		}
 		assert(r->content_id >= 0);
 
-		/* Previously saved response? */
-		if (NULL != r->resp.resp) {
-			local_resp = r->resp.resp;
-			local_resp_sz = r->resp.resp_len;
-			local_more = r->resp.more;
-		} else {
-			/* Make the request to the content
-			 * component */
-			more = cos_argreg_alloc(sizeof(int));
-			assert(more);
-			arr = cos_argreg_alloc(sizeof(struct cos_array) + resp_sz - used);
-			assert(arr);
-
-			arr->sz = resp_sz - used;
-			if ((ret = content_retrieve(cos_spd_id(), r->content_id, arr, more))) {
-				cos_argreg_free(arr);
-				cos_argreg_free(more);
-				if (0 > ret) {
-					BUG();
-					/* FIXME send an error message. */
-				}
+		if (NULL == hr->resp) {
+			/* 
+			 * Leave room for the header and chunk framing, or
+			 * wait for the next read if there is none.
+			 */
+			overhead = 0;
+			if (!(r->flags & HTTP_REQ_HEAD_SENT)) overhead = HTTP_HEAD_RESERVE;
+			else if (r->flags & HTTP_REQ_CHUNKED) overhead = HTTP_CHUNK_OVERHEAD + sizeof(http_chunk_end)-1;
+			avail = http_out_avail(o, 0, overhead);
+			if (avail <= 0) {
+				if (http_out_len(o)) break;
+				avail = http_out_avail(o, 0, 0);
+				if (avail <= 0) return -ENOMEM;
+			}
+			if ((ret = http_retrieve(r, avail, &arr)) > 0) {
 				printc("https get reply returning %d.\n", ret);
 				return ret;
 			}
-			local_more = *more;
-			local_resp_sz = arr->sz;
-			local_resp = arr->mem;
-		}
-		
-		/* still more date, but not available now... */
-		if (local_resp_sz == 0) {
-			cos_argreg_free(arr);
-			cos_argreg_free(more);
-			break;
-		}
-
-		/* If the header and data couldn't fit into the
-		 * provided buffer, then we need to save the response,
-		 * so that we can send it out later... */
-		if (http_get_header(resp+used, resp_sz-used, local_resp_sz, &consumed)) {
-			if (NULL == r->resp.resp) {
-				char *save;
-			
-				save = malloc(local_resp_sz);
-				assert(save);
-				assert(arr);
-				memcpy(save, arr->mem, local_resp_sz);
-				cos_argreg_free(arr);
-				r->resp.more = *more;
-				cos_argreg_free(more);
-
-				r->resp.resp = save;
-				r->resp.resp_len = local_resp_sz;
+			if (ret < 0) {
+				/* 
+				 * The response can't be retrieved: reply
+				 * with an error (or, if its header was
+				 * sent, cut it short), and close the
+				 * connection.
+				 */
+				if (!(r->flags & HTTP_REQ_HEAD_SENT)) {
+					amnt = sizeof(http_err_head)-1;
+					p    = http_out_ptr(o, amnt);
+					if (NULL == p) {
+						if (http_out_len(o)) break;
+						return -ENOMEM;
+					}
+					memcpy(p, http_err_head, amnt);
+				}
+				printc("https: error %d retrieving a response.\n", ret);
+				c->closing = 1;
+				if (r->flags & HTTP_REQ_REFERENCED) http_retire_request(r);
+				else                                http_free_request(r);
+				break;
 			}
-			if (0 == used) {
-				printc("https: could not allocate either header or response of sz %d:%s\n", local_resp_sz, local_resp);
+			/* still more data, but not available now... */
+			if (0 == hr->resp_len && hr->more) {
 				if (arr) cos_argreg_free(arr);
-				if (more) cos_argreg_free(more);
-				return -ENOMEM;
+				hr->resp = NULL;
+				break;
 			}
-			break;
 		}
 
-		memcpy(resp+used+consumed, local_resp, local_resp_sz);
-		
-		if (arr)  cos_argreg_free(arr);
-		if (more) cos_argreg_free(more);
-		more = NULL;
-		arr  = NULL;
+		if (!(r->flags & HTTP_REQ_HEAD_SENT)) {
+			if (hr->more) {
+				if (r->flags & HTTP_REQ_V10) r->flags |= HTTP_REQ_CLOSE;
+				else                         r->flags |= HTTP_REQ_CHUNKED;
+			}
+			if (0 > http_get_header(o, r, hr->more ? -1 : hr->resp_len)) goto save;
+			r->flags |= HTTP_REQ_HEAD_SENT;
+		}
 
-		used += local_resp_sz + consumed;
+		chunked  = r->flags & HTTP_REQ_CHUNKED;
+		overhead = 0;
+		if (chunked) {
+			overhead = HTTP_CHUNK_OVERHEAD;
+			if (!hr->more) overhead += sizeof(http_chunk_end)-1;
+		}
+		avail = http_out_avail(o, !cbuf_is_null(hr->cb), overhead);
+		amnt  = hr->resp_len - hr->off;
+		if (amnt > avail) amnt = avail;
+		if (amnt > 0) {
+			if (chunked) {
+				char chunk_head[HTTP_CHUNK_OVERHEAD];
+				int sz;
+
+				sz = sprintf(chunk_head, "%x\r\n", amnt);
+				memcpy(http_out_ptr(o, sz), chunk_head, sz);
+			}
+			refd     = http_out_data(o, r, amnt);
+			hr->off += amnt;
+			if (chunked) memcpy(http_out_ptr(o, 2), "\r\n", 2);
+		}
+		/* out of room for the rest of this piece */
+		if (hr->off < hr->resp_len || avail < 0) goto save;
+
+		if (arr) cos_argreg_free(arr);
+		http_resp_release(hr);
+		/* 
+		 * The next piece of a streamed response.  Retrieving it
+		 * can release the cbuf of this piece, which is only
+		 * persistent if the provider says so.
+		 */
+		if (hr->more) {
+			if (refd && !hr->persist) break;
+			continue;
+		}
 
-		next = r->next;
+		if (chunked) {
+			p = http_out_ptr(o, sizeof(http_chunk_end)-1);
+			memcpy(p, http_chunk_end, sizeof(http_chunk_end)-1);
+		}
 
 		/* bookkeeping */
 		http_req_cnt++;
 
-		http_free_request(r);
-		r = c->pending_reqs;
-		assert(r == next || NULL == r);
+		if (r->flags & HTTP_REQ_CLOSE) c->closing = 1;
+		if (r->flags & HTTP_REQ_REFERENCED) http_retire_request(r);
+		else                                http_free_request(r);
 	}
 
-	return used;
+	return http_out_len(o);
+save:
+	/* Only data in the argument region needs to be copied to be kept */
+	if (arr) {
+		char *save;
+		int rest = hr->resp_len - hr->off;
+
+		save = malloc(rest + 1);
+		assert(save);
+		memcpy(save, hr->resp + hr->off, rest);
+		cos_argreg_free(arr);
+		hr->resp     = save;
+		hr->resp_len = rest;
+		hr->off      = 0;
+		hr->malloced = 1;
+	}
+	if (0 == http_out_len(o)) {
+		printc("https: could not fit header of response of sz %d\n", hr->resp_len);
+		return -ENOMEM;
+	}
+
+	return http_out_len(o);
 }
 
 
@@ -704,13 +832,30 @@ static int connection_get_reply(struct connection *c, char *resp, int resp_sz)
 // ./ab -c 32 -n 66000 10.0.2.8:200/cgi/hw2
 
 COS_MAP_CREATE_STATIC(conn_map);
+/* all connections, for the idle timeout */
+static struct connection conn_list;
+/* 
+ * Protects conn_map and conn_list, which the timer thread walks.  It
+ * is only held to add, find or remove a connection, never across
+ * calls to the content manager, which can block.  A connection
+ * itself is only used by the connection manager thread serving it,
+ * except for the idle timeout's accesses to closing and last_active.
+ */
+static cos_lock_t http_lock;
+#define HTTP_LOCK()   lock_take(&http_lock)
+#define HTTP_UNLOCK() lock_release(&http_lock)
+
+/* seconds a connection with no outstanding requests is kept open */
+#define HTTP_IDLE_TIMEOUT 15
 
 static int connection_process_requests(struct connection *c, char *req, int req_sz,
 				char *resp, int resp_sz)
 {
 	/* FIXME: close connection on error? */
-	if (connection_parse_requests(c, req, req_sz)) return -EINVAL;
-	return connection_get_reply(c, resp, resp_sz);
+	struct http_out o = {.buf = resp, .sz = resp_sz, .used = 0, .d = NULL};
+
+	if (connection_write(c, req, req_sz)) return -EINVAL;
+	return connection_get_reply(c, &o);
 }
 
 long content_split(spdid_t spdid, long conn_id, long evt_id)
@@ -721,26 +866,73 @@ long content_split(spdid_t spdid, long conn_id, long evt_id)
 int content_write(spdid_t spdid, long connection_id, char *reqs, int sz)
 {
 	struct connection *c;
+	int ret = sz;
 
 //	printc("HTTP write");
 	
+	HTTP_LOCK();
 	c = cos_map_lookup(&conn_map, connection_id);
+	HTTP_UNLOCK();
 	if (NULL == c) return -EINVAL;
-	if (connection_parse_requests(c, reqs, sz)) return -EINVAL;
+	c->last_active = http_secs;
+	/* requests after the connection is to be closed are dropped */
+	if (!c->closing && connection_write(c, reqs, sz)) ret = -EINVAL;
 	
-	return sz;
+	return ret;
 }
 
+/* 
+ * Returns -EPIPE once all responses have been read from a connection
+ * that is closing, so that the connection manager closes it.
+ */
 int content_read(spdid_t spdid, long connection_id, char *buff, int sz)
 {
 	struct connection *c;
+	struct http_out o = {.buf = buff, .sz = sz, .used = 0, .d = NULL};
+	int ret;
 	
 //	printc("HTTP read");
 
+	HTTP_LOCK();
 	c = cos_map_lookup(&conn_map, connection_id);
+	HTTP_UNLOCK();
 	if (NULL == c) return -EINVAL;
+	c->last_active = http_secs;
+	ret = connection_get_reply(c, &o);
+	if (0 == ret && c->closing) ret = -EPIPE;
 	
-	return connection_get_reply(c, buff, sz);
+	return ret;
+}
+
+/* 
+ * As content_read, but the response is described by the descriptor
+ * in data rather than copied: content in cbufs is referenced.  The
+ * descriptor must be sent before the next read of the connection.
+ * Returns the number of bytes described.
+ */
+int content_read_resp(spdid_t spdid, long connection_id, struct cos_array *data)
+{
+	struct connection *c;
+	struct http_out o = {.buf = NULL, .sz = 0, .used = 0};
+	int ret;
+
+	if (!cos_argreg_arr_intern(data)) return -EINVAL;
+	o.d = (struct resp_desc *)data->mem;
+	if (!resp_desc_valid(o.d, data->sz) || 0 != o.d->nsegs) return -EINVAL;
+
+	HTTP_LOCK();
+	c = cos_map_lookup(&conn_map, connection_id);
+	if (NULL == c) {
+		ret = -EINVAL;
+		goto done;
+	}
+	c->last_active = http_secs;
+	ret = connection_get_reply(c, &o);
+	if (0 == ret && c->closing) ret = -EPIPE;
+done:
+	HTTP_UNLOCK();
+
+	return ret;
 }
 
 static int http_read_write(spdid_t spdid, long connection_id, char *reqs, int req_sz, char *resp, int resp_sz)
@@ -760,23 +952,39 @@ long content_create(spdid_t spdid, long evt_id, struct cos_array *d)
 
 //	printc("HTTP open connection");
 	if (NULL == c) return -ENOMEM;
+	HTTP_LOCK();
 	c_id = cos_map_add(&conn_map, c);
 	if (c_id < 0) {
+		HTTP_UNLOCK();
 		http_free_connection(c);
 		return -ENOMEM;
 	}
 	c->conn_id = c_id;
+	c->last_active = http_secs;
+	ADD_LIST(&conn_list, c, next, prev);
+	HTTP_UNLOCK();
 	
 	return c_id;
 }
 
 int content_remove(spdid_t spdid, long conn_id)
 {
-	struct connection *c = cos_map_lookup(&conn_map, conn_id);
+	struct connection *c;
 
-	if (NULL == c) return 1;
+	HTTP_LOCK();
+	c = cos_map_lookup(&conn_map, conn_id);
+	if (NULL == c) {
+		HTTP_UNLOCK();
+		return 1;
+	}
 	cos_map_del(&conn_map, c->conn_id);
+	REM_LIST(c, next, prev);
+	HTTP_UNLOCK();
 	c->conn_id = -1;
+	/* these close the content of the connection's requests */
+	connection_free_retired(c);
+	/* responses that will never be read */
+	while (NULL != c->pending_reqs) http_free_request(c->pending_reqs);
 	http_free_connection(c);
 
 	/* bookkeeping */
@@ -785,16 +993,50 @@ int content_remove(spdid_t spdid, long conn_id)
 	return 0;
 }
 
-#define HTTP_REPORT_FREQ 100
+/* 
+ * Close connections that have had no outstanding requests for
+ * HTTP_IDLE_TIMEOUT seconds.  The connection manager is woken up by
+ * triggering the connection's event, and reads -EPIPE.
+ */
+static void http_idle_timeout(void)
+{
+	struct connection *c;
+
+	for (c = FIRST_LIST(&conn_list, next, prev) ; 
+	     c != &conn_list ; 
+	     c = FIRST_LIST(c, next, prev)) {
+		if (c->closing || c->pending_reqs ||
+		    http_secs - c->last_active < HTTP_IDLE_TIMEOUT) continue;
+		c->closing = 1;
+		evt_trigger(cos_spd_id(), c->evt_id);
+	}
+}
+
+#define HTTP_TICKS_PER_SEC CPU_TIMER_FREQ
 
 void cos_init(void *arg)
 {
+	unsigned long start;
+
 	cos_map_init_static(&conn_map);
+	lock_static_init(&http_lock);
+	INIT_LIST(&conn_list, next, prev);
+	start = sched_timestamp();
+	http_head_update(0);
 
+	/* Once a second: the Date header, idle connections, and stats */
 	while (1) {
-		timed_event_block(cos_spd_id(), HTTP_REPORT_FREQ);
-		printc("HTTP conns %ld, reqs %ld\n", http_conn_cnt, http_req_cnt);
-		http_conn_cnt = http_req_cnt = 0;
+		timed_event_block(cos_spd_id(), HTTP_TICKS_PER_SEC);
+		http_secs = (sched_timestamp() - start) / HTTP_TICKS_PER_SEC;
+		/* double buffered, so readers need no lock */
+		http_head_update(http_secs);
+		HTTP_LOCK();
+		http_idle_timeout();
+		HTTP_UNLOCK();
+		sched_comp_load_report(cos_spd_id(), http_outstanding);
+		printc("HTTP conns %ld, reqs %ld, shed %ld, outstanding %ld\n", 
+		       http_conn_cnt, http_req_cnt, http_shed_cnt, http_outstanding);
+		http_conn_cnt = http_req_cnt = http_shed_cnt = 0;
 	}
 	
 	return;
@@ -816,7 +1058,7 @@ void cos_init(void *arg)
 #include <unistd.h>
 
 
-#define BUFF_SZ 256//1024
+#define BUFF_SZ (16*1024)
 
 static int connection_event(struct connection *c)
 {
@@ -933,95 +1175,12 @@ void prep_signals(void)
 	}
 }
 
-int ut_num = 0;
-
-enum {UT_SUCCESS, UT_FAIL, UT_PENDING};
-static int print_ut(char *s, int len, get_ret_t *ret, int type, int print_success)
-{
-	int r;
-
-	switch(type) {
-	case UT_SUCCESS:
-		r = http_get_parse(s, len, ret);
-		break;
-	case UT_FAIL:
-		r = !http_get_parse(s, len, ret);
-		break;
-	case UT_PENDING:
-		r = (!http_get_parse(s, len, ret) && ret->end != s+len);
-		break;
-	}
-
-	if (r) {
-		printf("******************\nUnit test %d failed:\n"
-		       "String (@%p):\n%s\nResult(@%p):\n<%s>\n******************\n\n",
-		       ut_num, s, s, ret->end, ret->end);
-		ut_num++;
-		return 1;
-	} else if (print_success) {
-		printf("Unit test %d successful(s@%p-%p, e@%p).\n", ut_num, s, s+len, ret->end);
-	}
-	ut_num++;
-	return 0;
-}
-
-static int unittest_http_parse(int print_success)
-{
-	int success = 1, i;
-	char *ut_successes[] = {
-		"GET / HTTP/1.1\r\nUser-Agent: httperf/0.9.0\r\nHost: localhost\r\n\r\n",
-		NULL
-	};
-	char *ut_pend[] = {
-		"G",		/* 1 */
-		"GET",
-		"GET ",
-		"GET /",
-		"GET / ",	/* 5 */
-		"GET / HT",
-		"GET / HTTP/1.",
-		"GET / HTTP/1.1",
-		"GET / HTTP/1.1\r",
-		"GET / HTTP/1.1\r\n", /* 10 */
-		"GET / HTTP/1.1\r\nUser-",
-		"GET / HTTP/1.1\r\nUser-blah:blah\r",
-		NULL
-	};
-	char *ut_fail[] = {
-		"GET / HTTP/1.2",
-		"GET / HTTP/1.2\r\nUser-blah:blah\r", /* 14 */
-		NULL
-	};
-	get_ret_t ret;
-
-	for (i = 0 ; ut_successes[i] ; i++) {
-		if (print_ut(ut_successes[i], strlen(ut_successes[i]), &ret, UT_SUCCESS, print_success)) {
-			success = 0;
-		}
-	}
-	for (i = 0 ; ut_pend[i] ; i++) {
-		if (print_ut(ut_pend[i], strlen(ut_pend[i]), &ret, UT_PENDING, print_success)) {
-			success = 0;
-		}
-	}
-	for (i = 0 ; ut_fail[i] ; i++) {
-		if (print_ut(ut_fail[i], strlen(ut_fail[i]), &ret, UT_FAIL, print_success)) {
-			success = 0;
-		}
-	}
-
-	if (success) return 0;
-	return 1;
-}
-
 int main(void)
 {
 	int sfd, epfd;
 	struct connection main_c;
 	struct epoll_event new_evts[MAX_CONNECTIONS];
 
-	if (unittest_http_parse(0)) return -1;
-
 	prep_signals();
 
 	epfd = epoll_create(MAX_CONNECTIONS);
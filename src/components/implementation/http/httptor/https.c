@@ -740,6 +740,11 @@ static int http_read_write(spdid_t spdid, long connection_id, char *reqs, int re
 	return connection_process_requests(c, reqs, req_sz, resp, resp_sz);
 }
 
+int content_read_resp(spdid_t spdid, long connection_id, struct cos_array *data)
+{
+	return -ENOSYS;
+}
+
 long content_create(spdid_t spdid, long evt_id, struct cos_array *d)
 {
 	struct connection *c = http_new_connection(0, evt_id);
@@ -803,7 +808,7 @@ void cos_init(void *arg)
 #include <unistd.h>
 
 
-#define BUFF_SZ 256//1024
+#define BUFF_SZ (16*1024)
 
 static int connection_event(struct connection *c)
 {
@@ -44,6 +44,8 @@
 #include <cos_list.h>
 #include <cos_map.h>
 #include <cos_synchronization.h>
+#include <cos_net.h>
+#include <cos_ring.h>
 
 #include <string.h>
 #include <errno.h>
@@ -85,9 +87,33 @@ static rb_meta_t rb1_md_wildcard, rb2_md;
 static ring_buff_t rb1, rb2;
 static unsigned short int wildcard_brand_id;
 
+/* 
+ * Flow steering: The wildcard brand is serviced by a single steering
+ * thread that hashes the TCP/UDP 4-tuple of each received packet,
+ * and passes the buffer into the ring of the flow that owns that
+ * hash.  The flow's upcall thread is woken if it is blocked waiting
+ * for packets.  Thus a slow connection only delays the connections
+ * that hash to the same flow.  The steering thread is the only
+ * producer into a flow's ring, and the flow's thread the only
+ * consumer, so the rings are lock-free SPSC rings (cos_ring.h); the
+ * lock only protects the blocked/wakeup handshake.
+ */
+#define NETIF_FLOW_RING_SZ RB_SIZE
+struct netif_flow {
+	struct cos_ring *ring;
+	cos_lock_t l;
+	unsigned short int tid;
+	volatile int blocked;
+	unsigned long steered, dropped;
+};
+static struct netif_flow flows[NET_NUM_FLOWS];
+static char flow_rings[NET_NUM_FLOWS][COS_RING_SZ(NETIF_FLOW_RING_SZ)] CACHE_ALIGNED;
+static volatile int active_flows = 0;
+static volatile unsigned short int steer_thd = 0;
+
 //cos_lock_t tmap_lock;
 struct thd_map {
-	rb_meta_t *uc_rb;
+	struct netif_flow *flow;
 };
 
 COS_VECT_CREATE_STATIC(tmap);
@@ -115,14 +141,14 @@ static struct thd_map *get_thd_map(unsigned short int thd_id)
 	return cos_vect_lookup(&tmap, thd_id);
 }
 
-static int add_thd_map(unsigned short int ucid, rb_meta_t *rbm)
+static int add_thd_map(unsigned short int ucid, struct netif_flow *f)
 {
 	struct thd_map *tm;
 
 	tm = malloc(sizeof(struct thd_map));
 	if (NULL == tm) return -1;
 
-	tm->uc_rb = rbm;
+	tm->flow = f;
 	if (0 > cos_vect_add_id(&tmap, tm, ucid)) {
 		free(tm);
 		return -1;
@@ -164,7 +190,7 @@ static void rb_init(rb_meta_t *rbm, ring_buff_t *rb)
 	INIT_LIST(&rbm->avail_pages, next, prev);
 }
 
-static int rb_add_buff(rb_meta_t *r, void *buf, int len)
+static int __rb_add_buff(rb_meta_t *r, void *buf, int len, unsigned short int status)
 {
 	ring_buff_t *rb = r->rb;
 	unsigned int head;
@@ -193,7 +219,7 @@ static int rb_add_buff(rb_meta_t *r, void *buf, int len)
 	 * FIXME: There should be a memory barrier here, but I'll
 	 * cross my fingers...
 	 */
-	rbb->status = RB_READY;
+	rbb->status = status;
 	r->rb_head = (r->rb_head + 1) & (RB_SIZE-1);
 	lock_release(&r->l);
 
@@ -203,6 +229,12 @@ err:
 	return -1;
 }
 
+/* Provide an empty buffer to the kernel to receive into */
+static inline int rb_add_buff(rb_meta_t *r, void *buf, int len)
+{
+	return __rb_add_buff(r, buf, len, RB_READY);
+}
+
 /* 
  * -1 : there is no available buffer
  * 1  : the kernel found an error with this buffer, still set address
@@ -408,43 +440,148 @@ static int __netif_xmit(char *d, unsigned int sz)
 /* 	goto done; */
 }
 
+/******************* Flow steering: ********************/
+
+/* 
+ * Hash the 4-tuple of a TCP or UDP packet.  Packets of any other
+ * protocol (and fragments) are all placed in flow 0.  p points to the
+ * IP header, and len is the length of the packet.
+ */
+static inline u32_t netif_flow_hash(unsigned char *p, unsigned int len)
+{
+	u32_t saddr, daddr, ports;
+	unsigned int hlen;
+
+	if (len < 20 || (p[0] >> 4) != 4) return 0;
+	/* not TCP or UDP */
+	if (p[9] != 6 && p[9] != 17) return 0;
+	/* fragment offset or more fragments set */
+	if (((p[6] & 0x3F) | p[7]) != 0) return 0;
+	hlen = (p[0] & 0xF) * 4;
+	if (len < hlen + 4) return 0;
+
+	memcpy(&saddr, &p[12], sizeof(u32_t));
+	memcpy(&daddr, &p[16], sizeof(u32_t));
+	memcpy(&ports, &p[hlen], sizeof(u32_t));
+
+	return net_flow_hash(saddr, daddr, ports);
+}
+
+/* 
+ * The flow is chosen out of all NET_NUM_FLOWS, not those with a
+ * thread so far, so a 4-tuple always maps to the same flow (and its
+ * packets are processed in order).
+ */
+static inline struct netif_flow *netif_flow_find(unsigned int *buff)
+{
+	unsigned int len = buff[0];
+
+	if (unlikely(len > MTU)) len = MTU;
+	return &flows[netif_flow_hash((unsigned char *)&buff[1], len) % NET_NUM_FLOWS];
+}
+
+static inline int netif_flow_empty(struct netif_flow *f)
+{
+	return cos_ring_empty(f->ring);
+}
+
+/* 
+ * Retrieve a received buffer from the wildcard ring, and pass it to
+ * the ring of the flow it hashes to.  The wildcard ring is
+ * replenished with a fresh buffer which is returned to the buffer
+ * pool when the flow's thread has consumed the packet.
+ */
+static void netif_steer(void)
+{
+	unsigned int *buff;
+	void *nb;
+	int max_len, ret, wake = 0;
+	struct netif_flow *f;
+
+	ret = rb_retrieve_buff(&rb1_md_wildcard, &buff, &max_len);
+	if (ret < 0) {
+		prints("net: could not retrieve buffer from ring.\n");
+		return;
+	}
+	/* 
+	 * kernel error with the buffer, or not all flows have a thread
+	 * to receive it yet
+	 */
+	if (unlikely(ret > 0 || active_flows < NET_NUM_FLOWS)) goto drop;
+	f = netif_flow_find(buff);
+	nb = alloc_rb_buff(&rb1_md_wildcard);
+	if (unlikely(NULL == nb)) goto drop_flow;
+	if (cos_ring_enqueue(f->ring, (unsigned long)buff)) {
+		release_rb_buff(&rb1_md_wildcard, nb);
+		goto drop_flow;
+	}
+	buff = nb;
+
+	lock_take(&f->l);
+	f->steered++;
+	if (f->blocked) {
+		f->blocked = 0;
+		wake = 1;
+	}
+	lock_release(&f->l);
+	if (wake && sched_wakeup(cos_spd_id(), f->tid)) BUG();
+done:
+	if (rb_add_buff(&rb1_md_wildcard, buff, MTU)) {
+		prints("net: could not add buffer to ring.");
+	}
+	return;
+drop_flow:
+	f->dropped++;
+drop:
+	/* Recycle the buffer (dropping the packet)... */
+	goto done;
+}
+
+/* Block the current flow thread until a packet is steered to it */
+static void netif_flow_block(struct netif_flow *f)
+{
+	lock_take(&f->l);
+	if (!netif_flow_empty(f)) {
+		lock_release(&f->l);
+		return;
+	}
+	f->blocked = 1;
+	lock_release(&f->l);
+	if (sched_block(cos_spd_id(), 0) < 0) BUG();
+}
+
 static int interrupt_process(void *d, int sz, int *recv_len)
 {
 	unsigned short int ucid = cos_get_thd_id();
 	unsigned int *buff;
-	int max_len;
+	unsigned long b;
 	struct thd_map *tm;
 	unsigned int len;
 
 	assert(d);
 
 	tm = get_thd_map(ucid);
-	assert(tm);
-	if (rb_retrieve_buff(tm->uc_rb, &buff, &max_len)) {
-		prints("net: could not retrieve buffer from ring.\n");
-		goto err;
+	assert(tm && tm->flow);
+	while (cos_ring_dequeue(tm->flow->ring, &b)) {
+		netif_flow_block(tm->flow);
 	}
+	buff = (unsigned int *)b;
 	len = buff[0];
 	*recv_len = len;
 	if (unlikely(len > MTU)) {
 		printc("len %d > %d\n", len, MTU);
-		goto err_replace_buff;
+		goto err_release_buff;
 	}
 	memcpy(d, &buff[1], len);
 
-	/* OK, recycle the buffer. */
-	if (rb_add_buff(tm->uc_rb, buff, MTU)) {
-		prints("net: could not add buffer to ring.");
-	}
+	/* OK, return the buffer to the pool. */
+	release_rb_buff(&rb1_md_wildcard, buff);
 
 	return 0;
 
-err_replace_buff:
-	/* Recycle the buffer (essentially dropping packet)... */
-	if (rb_add_buff(tm->uc_rb, buff, MTU)) {
-		prints("net: OOM, and filed to add buffer.");
-	}
-err:
+err_release_buff:
+	/* Release the buffer (essentially dropping packet)... */
+	release_rb_buff(&rb1_md_wildcard, buff);
 	return -1;
 }
 
@@ -475,19 +612,55 @@ static int interrupt_wait(void)
 	return 0;
 }
 
+static void netif_steer_loop(void)
+{
+	assert(wildcard_brand_id > 0);
+	if (sched_add_thd_to_brand(cos_spd_id(), wildcard_brand_id, cos_get_thd_id())) BUG();
+	printc("net steering thd %d associated with brand %d\n", cos_get_thd_id(), wildcard_brand_id);
+	while (1) {
+		interrupt_wait();
+		netif_steer();
+	}
+}
+
+static void netif_create_steer_thd(void)
+{
+	struct cos_array *data;
+	int t;
+
+	data = cos_argreg_alloc(sizeof(struct cos_array) + 4);
+	assert(data);
+	strcpy(&data->mem[0], "r-1");
+	data->sz = 4;
+	if (0 > (t = sched_create_thread(cos_spd_id(), data))) BUG();
+	steer_thd = t;
+	cos_argreg_free(data);
+}
+
 /* 
- * Currently, this only adds to the wildcard brand.
+ * Each thread that creates an event is associated with its own flow,
+ * and is passed the packets steered to that flow.  Creating more
+ * event threads than there are flows is an error.
  */
 int netif_event_create(spdid_t spdid)
 {
 	unsigned short int ucid = cos_get_thd_id();
+	struct netif_flow *f;
 
 	assert(wildcard_brand_id > 0);
 	NET_LOCK_TAKE();
-	if (sched_add_thd_to_brand(cos_spd_id(), wildcard_brand_id, ucid)) BUG();
-	add_thd_map(ucid, /*0 wildcard port ,*/ &rb1_md_wildcard);
+	if (active_flows == NET_NUM_FLOWS) {
+		NET_LOCK_RELEASE();
+		printc("net: no flow available for net uc %d\n", ucid);
+		return -ENOMEM;
+	}
+	f = &flows[active_flows];
+	f->tid = ucid;
+	add_thd_map(ucid, f);
+	/* make the flow visible to the steering thread last */
+	active_flows++;
 	NET_LOCK_RELEASE();
-	printc("created net uc %d associated with brand %d\n", ucid, wildcard_brand_id);
+	printc("created net uc %d associated with flow %d\n", ucid, active_flows-1);
 
 	return 0;
 }
@@ -510,11 +683,8 @@ int netif_event_wait(spdid_t spdid, struct cos_array *d)
 	if (!cos_argreg_arr_intern(d)) return -EINVAL;
 	if (d->sz < MTU) return -EINVAL;
 
-	interrupt_wait();
-	prints("In netif\n");
-	NET_LOCK_TAKE();
-	if (interrupt_process(d->mem, d->sz, &ret_sz)) BUG();
-	NET_LOCK_RELEASE();
+	/* Only the flow's thread consumes from its ring: no net lock required */
+	while (interrupt_process(d->mem, d->sz, &ret_sz)) ;
 	d->sz = ret_sz;
 
 	return 0;
@@ -549,6 +719,11 @@ static int init(void)
 	
 	rb_init(&rb1_md_wildcard, &rb1);
 	rb_init(&rb2_md, &rb2);
+	for (i = 0 ; i < NET_NUM_FLOWS ; i++) {
+		flows[i].ring = cos_ring_init(flow_rings[i], sizeof(flow_rings[i]));
+		assert(flows[i].ring);
+		lock_static_init(&flows[i].l);
+	}
 
 	/* Setup the region from which headers will be transmitted. */
 	if (cos_buff_mgmt(COS_BM_XMIT_REGION, &xmit_headers, sizeof(xmit_headers), 0)) {
@@ -568,6 +743,7 @@ static int init(void)
 	}
 
 	NET_LOCK_RELEASE();
+	netif_create_steer_thd();
 
 	return 0;
 }
@@ -576,6 +752,10 @@ void cos_init(void *arg)
 {
 	static volatile int first = 1;
 	
+	if (cos_get_thd_id() == steer_thd) {
+		netif_steer_loop();
+		BUG();
+	}
 	if (first) {
 		first = 0;
 		init();
@@ -62,6 +62,16 @@ int net_send(spdid_t spdid, net_connection_t nc, void *data, int sz)
 	return -ENOTSUP;
 }
 
+int net_send_resp(spdid_t spdid, net_connection_t nc, struct cos_array *data)
+{
+	return -ENOTSUP;
+}
+
+int net_ready(spdid_t spdid, struct cos_array *conns)
+{
+	return -ENOTSUP;
+}
+
 extern unsigned int sched_tick_freq(void);
 unsigned int freq;
 void bag(void)
@@ -54,6 +54,8 @@
 #include <errno.h>
 
 #include <net_transport.h>
+#include <cbuf.h>
+#include <resp_desc.h>
 
 #define UDP_RCV_MAX (1<<15)
 #define MTU 1500
@@ -63,18 +65,7 @@
 #include <evt.h>
 #include <net_portns.h>
 #include <timed_blk.h>
-
-cos_lock_t net_lock;
-
-#define NET_LOCK_TAKE()    \
-	do {								\
-		if (lock_take(&net_lock)) prints("error taking net lock."); \
-	} while(0)
-
-#define NET_LOCK_RELEASE() \
-	do {								\
-		if (lock_release(&net_lock)) prints("error releasing net lock."); \
-	} while (0)
+#include <sched_conf.h>
 
 
 /*********************** Component Interface ************************/
@@ -145,6 +136,8 @@ static unsigned long long timing_record(timing_t type, unsigned long long prev)
 	return curr;
 }
 
+static void pkt_pool_output(void);
+
 static void timing_output(void)
 {
 	int i;
@@ -162,6 +155,7 @@ static void timing_output(void)
 			ts->min = ~0;
 		}
 	}
+	pkt_pool_output();
 }
 #endif
 
@@ -176,6 +170,71 @@ struct packet_queue {
 #endif
 };
 
+struct intern_connection;
+struct pkt_buff;
+
+typedef enum {
+	NET_CMD_INPUT,		/* async: packet received */
+	NET_CMD_TMR,		/* async: tcp timer */
+	NET_CMD_UPDATE,		/* async: data consumed/connections accepted */
+	NET_CMD_CREATE,
+	NET_CMD_BIND,
+	NET_CMD_LISTEN,
+	NET_CMD_CONNECT,
+	NET_CMD_CLOSE,
+	NET_CMD_SEND,
+	NET_CMD_SEND_RESP
+} net_cmd_t;
+
+/* 
+ * A piece of a response descriptor to be sent: either copied into a
+ * packet buffer (pq), or a reference to a persistent cbuf.
+ */
+struct send_chunk {
+	void *data;
+	int sz;
+	struct packet_queue *pq;
+};
+
+/* A request to the core thread that executes all lwip processing */
+struct net_cmd {
+	net_cmd_t type;
+	struct net_cmd *next;
+	/* thread to wake upon completion, 0 for async commands */
+	u16_t tid;
+	volatile int done;
+	int ret;
+	struct intern_connection *ic;
+	union {
+		struct {
+			struct packet_queue *pq;
+			int len;
+		} input;
+		struct {
+			conn_t type;
+			spdid_t spdid;
+			u16_t tid;
+			long evt_id;
+		} create;
+		struct {
+			struct ip_addr ip;
+			u16_t port;
+		} addr;
+		struct {
+			int queue;
+		} listen;
+		struct {
+			void *data;
+			int sz;
+			struct packet_queue *pq;
+		} send;
+		struct {
+			struct send_chunk *chunks;
+			int nchunks, sz;
+		} send_resp;
+	} a;
+};
+
 struct intern_connection {
 	u16_t tid;
 	spdid_t spdid;
@@ -201,21 +260,234 @@ struct intern_connection {
 	struct intern_connection *accepted_ic, *accepted_last;
 
 	struct intern_connection *next;
+
+	/* 
+	 * Protects the incoming and accepted queues, and the pending
+	 * updates below which are shared between the application
+	 * thread and the core thread.
+	 */
+	cos_lock_t l;
+	/* amount of data consumed, and number of connections
+	 * accepted by the application, not yet reported to lwip */
+	int recved_pending, accepted_pending, update_queued;
+	struct net_cmd update_cmd;
+	/* command waiting on the connection to be established */
+	struct net_cmd *pending_cmd;
+	/* 
+	 * Set by the core thread when a send didn't fit in the send
+	 * buffer.  It is cleared, and the event triggered, once lwip
+	 * reports sent data, so net_ready can report writability.
+	 */
+	volatile int send_full;
+
+	/* packet buffers cached for the connection's thread */
+	struct pkt_buff *pkt_cache;
+	int pkt_cache_sz;
 #ifdef TEST_TIMING
 	/* Time stamps */
 	unsigned long long ts_start; 
 #endif
 };
 
-COS_MAP_CREATE_STATIC(connections);
+/**** Packet buffer pool ****/
+
+/* 
+ * Every packet received, and every segment sent is held in a buffer
+ * of (at most) MTU size prefixed by a packet_queue.  These come from
+ * a pool of fixed-size buffers carved out of pages rather than from
+ * malloc.  Each connection caches a few buffers: those freed by the
+ * application thread as it receives data are reused when it sends
+ * without touching the global pool.  The global pool is refilled a
+ * page at a time.  The command that passes a received packet to the
+ * core thread lives after the data in its buffer (pkt_cmd), so that
+ * receiving requires no other allocation.
+ */
+#define PKT_BUFF_ALIGN(sz) (((sz) + 7) & ~7)
+#define PKT_CMD_OFF        PKT_BUFF_ALIGN(sizeof(struct packet_queue) + MTU)
+#define PKT_BUFF_SZ        PKT_BUFF_ALIGN(PKT_CMD_OFF + sizeof(struct net_cmd))
+#define PKT_PER_PAGE       (PAGE_SIZE / PKT_BUFF_SZ)
+#define PKT_CONN_CACHE_MAX 8
+
+struct pkt_buff {
+	struct pkt_buff *next;
+};
+
+static struct pkt_pool {
+	struct pkt_buff *free_list;
+	cos_lock_t l;
+	/* all counts in buffers */
+	unsigned int nfree, tot, used, max_used;
+	unsigned long alloc_fail, cache_hits;
+} pkt_pool;
+
+static inline struct net_cmd *pkt_cmd(struct packet_queue *pq)
+{
+	return (struct net_cmd *)((char *)pq + PKT_CMD_OFF);
+}
+
+static void pkt_pool_init(void)
+{
+	memset(&pkt_pool, 0, sizeof(struct pkt_pool));
+	lock_static_init(&pkt_pool.l);
+}
+
+/* Called with the pool lock taken */
+static int pkt_pool_refill(void)
+{
+	char *page;
+	int i;
+
+	page = alloc_page();
+	if (NULL == page) return -1;
+	for (i = 0 ; i < (int)PKT_PER_PAGE ; i++) {
+		struct pkt_buff *b = (struct pkt_buff *)(page + i * PKT_BUFF_SZ);
+
+		b->next = pkt_pool.free_list;
+		pkt_pool.free_list = b;
+	}
+	pkt_pool.nfree += PKT_PER_PAGE;
+	pkt_pool.tot   += PKT_PER_PAGE;
+
+	return 0;
+}
+
+static struct packet_queue *pkt_alloc(void)
+{
+	struct pkt_buff *b;
+
+	lock_take(&pkt_pool.l);
+	if (unlikely(NULL == pkt_pool.free_list && pkt_pool_refill())) {
+		pkt_pool.alloc_fail++;
+		lock_release(&pkt_pool.l);
+		return NULL;
+	}
+	b = pkt_pool.free_list;
+	pkt_pool.free_list = b->next;
+	pkt_pool.nfree--;
+	if (++pkt_pool.used > pkt_pool.max_used) pkt_pool.max_used = pkt_pool.used;
+	lock_release(&pkt_pool.l);
+
+	return (struct packet_queue *)b;
+}
+
+static void pkt_free(struct packet_queue *pq)
+{
+	struct pkt_buff *b = (struct pkt_buff *)pq;
+
+	assert(pq);
+	lock_take(&pkt_pool.l);
+	b->next = pkt_pool.free_list;
+	pkt_pool.free_list = b;
+	pkt_pool.nfree++;
+	pkt_pool.used--;
+	lock_release(&pkt_pool.l);
+}
+
+/* 
+ * The per-connection cache is only accessed by the thread that owns
+ * the connection (or by the core thread when that thread is blocked
+ * closing the connection), so it requires no lock.
+ */
+static struct packet_queue *pkt_conn_alloc(struct intern_connection *ic)
+{
+	struct pkt_buff *b = ic->pkt_cache;
+
+	if (NULL == b) return pkt_alloc();
+	ic->pkt_cache = b->next;
+	ic->pkt_cache_sz--;
+	pkt_pool.cache_hits++;
+
+	return (struct packet_queue *)b;
+}
+
+static void pkt_conn_free(struct intern_connection *ic, struct packet_queue *pq)
+{
+	struct pkt_buff *b = (struct pkt_buff *)pq;
+
+	if (ic->pkt_cache_sz >= PKT_CONN_CACHE_MAX) {
+		pkt_free(pq);
+		return;
+	}
+	b->next = ic->pkt_cache;
+	ic->pkt_cache = b;
+	ic->pkt_cache_sz++;
+}
+
+static void pkt_conn_drain(struct intern_connection *ic)
+{
+	while (ic->pkt_cache) {
+		struct pkt_buff *b = ic->pkt_cache;
+
+		ic->pkt_cache = b->next;
+		pkt_free((struct packet_queue *)b);
+	}
+	ic->pkt_cache_sz = 0;
+}
+
+#ifdef TEST_TIMING
+static void pkt_pool_output(void)
+{
+	/* Buffers sitting in connection caches are counted as used */
+	printc("pkt pool: %d/%d bufs used (hwm %d, %d B/buf), alloc failures %ld, conn cache hits %ld",
+	       pkt_pool.used, pkt_pool.tot, pkt_pool.max_used, PKT_BUFF_SZ, 
+	       pkt_pool.alloc_fail, pkt_pool.cache_hits);
+	pkt_pool.cache_hits = 0;
+}
+#endif
+
+/* 
+ * The connection table is sharded so that connections in independent
+ * flows do not serialize on a single lock to find their internal
+ * representation.  The shard is encoded in the low bits of the
+ * opaque connection id.
+ */
+#define NET_CONN_SHARDS NET_NUM_FLOWS
+struct conn_shard {
+	cos_map_t *conns;
+	cos_lock_t l;
+} CACHE_ALIGNED;
+static struct conn_shard conn_shards[NET_CONN_SHARDS];
 
 static int net_conn_init(void)
 {
-	cos_map_init_static(&connections);
+	int i;
+
+	for (i = 0 ; i < NET_CONN_SHARDS ; i++) {
+		struct conn_shard *cs = &conn_shards[i];
+
+		cs->conns = cos_map_alloc_map();
+		if (NULL == cs->conns) return -1;
+		lock_static_init(&cs->l);
+	}
 
 	return 0;
 }
 
+static inline struct conn_shard *net_conn_shard(net_connection_t nc)
+{
+	return &conn_shards[nc % NET_CONN_SHARDS];
+}
+
+/* 
+ * Choose the shard for a connection: Accepted connections are placed
+ * by the hash the interface steers their received packets with, so
+ * when all of its flows are active, the connections serviced by an
+ * upcall thread share a shard.
+ */
+static inline int net_conn_shard_choose(struct tcp_pcb *tp, u16_t tid)
+{
+	u16_t ports[2];
+	u32_t p;
+
+	if (NULL == tp) return tid % NET_CONN_SHARDS;
+	/* as in a received packet: remote is the source */
+	ports[0] = htons(tp->remote_port);
+	ports[1] = htons(tp->local_port);
+	memcpy(&p, ports, sizeof(u32_t));
+
+	return net_flow_hash(tp->remote_ip.addr, tp->local_ip.addr, p) % NET_CONN_SHARDS;
+}
+
 /* Return the opaque connection value exported to other components for
  * a given internal_connection */
 static inline net_connection_t net_conn_get_opaque(struct intern_connection *ic)
@@ -227,31 +499,42 @@ static inline net_connection_t net_conn_get_opaque(struct intern_connection *ic)
 static inline struct intern_connection *net_conn_get_internal(net_connection_t nc)
 {
 	struct intern_connection *ic;
+	struct conn_shard *cs;
+
+	cs = net_conn_shard(nc);
+	lock_take(&cs->l);
+	ic = cos_map_lookup(cs->conns, nc / NET_CONN_SHARDS);
+	lock_release(&cs->l);
 
-	ic = cos_map_lookup(&connections, nc);
 	return ic;
 }
 
 static inline int net_conn_valid(net_connection_t nc)
 {
-	return 1;
+	return nc >= 0;
 }
 
-static inline struct intern_connection *net_conn_alloc(conn_t conn_type, u16_t tid, long data)
+static inline struct intern_connection *net_conn_alloc(conn_t conn_type, u16_t tid, long data, int shard)
 {
 	struct intern_connection *ic;
-	net_connection_t nc;
+	struct conn_shard *cs;
+	long id;
 
+	assert(shard >= 0 && shard < NET_CONN_SHARDS);
 	ic = malloc(sizeof(struct intern_connection));
 	if (NULL == ic) return NULL;
-	nc = cos_map_add(&connections, ic);
-	if (-1 == nc) {
+	cs = &conn_shards[shard];
+	lock_take(&cs->l);
+	id = cos_map_add(cs->conns, ic);
+	lock_release(&cs->l);
+	if (-1 == id) {
 		free(ic);
 		return NULL;
 	}
 	memset(ic, 0, sizeof(struct intern_connection));
 
-	ic->connection_id = nc;
+	ic->connection_id = id * NET_CONN_SHARDS + shard;
+	lock_static_init(&ic->l);
 	ic->tid = tid;
 	ic->thd_status = ACTIVE;
 	ic->conn_type = conn_type;
@@ -262,10 +545,19 @@ static inline struct intern_connection *net_conn_alloc(conn_t conn_type, u16_t t
 
 static inline void net_conn_free(struct intern_connection *ic)
 {
+	struct conn_shard *cs;
+	net_connection_t nc;
+
 	assert(ic);
 	assert(0 == ic->incoming_size);
 
-	cos_map_del(&connections, net_conn_get_opaque(ic));
+	pkt_conn_drain(ic);
+	nc = net_conn_get_opaque(ic);
+	cs = net_conn_shard(nc);
+	lock_take(&cs->l);
+	cos_map_del(cs->conns, nc / NET_CONN_SHARDS);
+	lock_release(&cs->l);
+	lock_component_free(cos_spd_id(), ic->l.lock_id);
 	free(ic);
 
 	return;
@@ -297,7 +589,7 @@ static void net_conn_free_packet_data(struct intern_connection *ic)
 	while (pq) {
 		pq_next = pq->next;
 		ic->incoming_size -= pq->len;
-		free(pq);
+		pkt_free(pq);
 		pq = pq_next;
 	}
 	assert(ic->incoming_size == 0);
@@ -319,6 +611,101 @@ static inline void *cos_net_header_start(struct pbuf *p, conn_t ct)
 	return data;
 }
 
+/**** Core command queue ****/
+
+/* 
+ * All processing within lwip is done by a single core thread.  Other
+ * threads (application threads calling the net_* interface, and the
+ * network upcall threads) pass commands to it through this queue.
+ * Synchronous commands are allocated on the stack of the requesting
+ * thread, which blocks until the core thread marks the command as
+ * done and wakes it up.  Asynchronous commands (tid == 0) are either
+ * embedded in their packet's buffer (packet input), or embedded in the
+ * intern_connection (deferred updates).
+ */
+static struct net_cmd *cmd_head = NULL, *cmd_tail = NULL;
+static volatile int core_blocked = 0;
+static volatile int core_thd = 0;
+cos_lock_t cmd_lock;
+
+static void net_cmd_enqueue(struct net_cmd *c)
+{
+	int wake = 0;
+
+	c->next = NULL;
+	lock_take(&cmd_lock);
+	if (NULL == cmd_tail) {
+		assert(NULL == cmd_head);
+		cmd_head = cmd_tail = c;
+	} else {
+		cmd_tail->next = c;
+		cmd_tail = c;
+	}
+	if (core_blocked) {
+		core_blocked = 0;
+		wake = 1;
+	}
+	lock_release(&cmd_lock);
+	if (wake && sched_wakeup(cos_spd_id(), core_thd)) BUG();
+}
+
+/* Returns the entire list of pending commands, blocking if there are none */
+static struct net_cmd *net_cmd_dequeue_all(void)
+{
+	struct net_cmd *c;
+
+	while (1) {
+		lock_take(&cmd_lock);
+		c = cmd_head;
+		if (NULL != c) {
+			cmd_head = cmd_tail = NULL;
+			lock_release(&cmd_lock);
+			return c;
+		}
+		core_blocked = 1;
+		lock_release(&cmd_lock);
+		if (sched_block(cos_spd_id(), 0) < 0) BUG();
+	}
+}
+
+static int net_cmd_call(struct net_cmd *c)
+{
+	c->tid  = cos_get_thd_id();
+	c->done = 0;
+	net_cmd_enqueue(c);
+	while (!c->done) {
+		if (sched_block(cos_spd_id(), 0) < 0) BUG();
+	}
+
+	return c->ret;
+}
+
+static void net_cmd_complete(struct net_cmd *c, int ret)
+{
+	u16_t tid = c->tid;
+
+	assert(tid);
+	c->ret  = ret;
+	/* c might be deallocated as soon as done is set */
+	c->done = 1;
+	if (sched_wakeup(cos_spd_id(), tid)) BUG();
+}
+
+/* 
+ * Defer an update to lwip's view of the connection (received data
+ * consumed, or connections accepted) to the core thread.  Called with
+ * ic->l taken.  Only one update command is outstanding at a time.
+ */
+static void net_conn_defer_update(struct intern_connection *ic)
+{
+	if (ic->update_queued) return;
+	ic->update_queued = 1;
+	ic->update_cmd.type = NET_CMD_UPDATE;
+	ic->update_cmd.tid  = 0;
+	ic->update_cmd.ic   = ic;
+	net_cmd_enqueue(&ic->update_cmd);
+}
+
 /**** COS UDP function ****/
 
 /* 
@@ -333,6 +720,7 @@ static void cos_net_lwip_udp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *
 	struct intern_connection *ic;
 	struct packet_queue *pq, *last;
 	void *headers;
+	int wake = 0;
 
 	/* We should not receive a list of packets unless it is from
 	 * this host to this host (then the headers will be another
@@ -345,9 +733,10 @@ static void cos_net_lwip_udp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *
 
 	headers = cos_net_header_start(p, UDP);
 	assert (NULL != headers);
+	lock_take(&ic->l);
 	/* Over our allocation??? */
 	if (ic->incoming_size >= UDP_RCV_MAX) {
-		assert(ic->thd_status != RECVING);
+		lock_release(&ic->l);
 		assert(p->type == PBUF_ROM);
 		//free(net_packet_pq(headers));
 		assert(p->ref > 0);
@@ -371,25 +760,22 @@ static void cos_net_lwip_udp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *
 		ic->incoming_last = pq;
 	}
 	ic->incoming_size += p->len;
-	assert(1 == p->ref);
-	p->payload = p->alloc_track = NULL;
-	pbuf_free(p);
-
 	/* If the thread blocked waiting for a packet, wake it up */
 	if (RECVING == ic->thd_status) {
 		ic->thd_status = ACTIVE;
-		assert(ic->thd_status == ACTIVE); /* Detect races */
-		sched_wakeup(cos_spd_id(), ic->tid);
+		wake = 1;
 	}
+	lock_release(&ic->l);
+	assert(1 == p->ref);
+	p->payload = p->alloc_track = NULL;
+	pbuf_free(p);
+
+	if (wake) sched_wakeup(cos_spd_id(), ic->tid);
 
 	return;
 }
 
-/* 
- * FIXME: currently we associate a connection with a thread (and an
- * upcall thread), which is restrictive.
- */
-net_connection_t net_create_udp_connection(spdid_t spdid, long evt_id)
+static net_connection_t __net_create_udp_connection(spdid_t spdid, u16_t tid, long evt_id)
 {
 	struct udp_pcb *up;
 	struct intern_connection *ic;
@@ -401,7 +787,7 @@ net_connection_t net_create_udp_connection(spdid_t spdid, long evt_id)
 		ret = -ENOMEM;
 		goto err;
 	}
-	ic = net_conn_alloc(UDP, cos_get_thd_id(), evt_id);
+	ic = net_conn_alloc(UDP, tid, evt_id, net_conn_shard_choose(NULL, tid));
 	if (NULL == ic) {
 		prints("Could not allocate internal connection");
 		ret = -ENOMEM;
@@ -417,6 +803,25 @@ err:
 	return ret;
 }
 
+/* 
+ * FIXME: currently we associate a connection with a thread (and an
+ * upcall thread), which is restrictive.
+ */
+net_connection_t net_create_udp_connection(spdid_t spdid, long evt_id)
+{
+	struct net_cmd c;
+
+	c.type = NET_CMD_CREATE;
+	c.ic   = NULL;
+	c.a.create.type   = UDP;
+	c.a.create.spdid  = spdid;
+	c.a.create.tid    = cos_get_thd_id();
+	c.a.create.evt_id = evt_id;
+
+	return net_cmd_call(&c);
+}
+
+/* Called with ic->l taken */
 static int cos_net_udp_recv(struct intern_connection *ic, void *data, int sz)
 {
 	int xfer_amnt = 0;
@@ -443,7 +848,7 @@ static int cos_net_udp_recv(struct intern_connection *ic, void *data, int sz)
 			xfer_amnt = data_left;
 			ic->incoming_offset = 0;
 
-			free(pq);
+			pkt_conn_free(ic, pq);
 		} 
 		/* Consume part of first packet */
 		else {
@@ -472,10 +877,13 @@ static void cos_net_lwip_tcp_err(void *arg, err_t err)
 	case ERR_RST:
 		assert(ic->conn_type == TCP);
 		assert(ic->conn_type != TCP_CLOSED);
-		if (-1 != ic->data && evt_trigger(cos_spd_id(), ic->data)) BUG();
+		lock_take(&ic->l);
 		ic->conn_type = TCP_CLOSED;
 		ic->conn.tp = NULL;
 		net_conn_free_packet_data(ic);
+		lock_release(&ic->l);
+		/* after the close is visible to net_ready */
+		if (-1 != ic->data && evt_trigger(cos_spd_id(), ic->data)) BUG();
 		break;
 	default:
 		printc("TCP error #%d: don't really have docs to know what this means.", err);
@@ -484,6 +892,7 @@ static void cos_net_lwip_tcp_err(void *arg, err_t err)
 	return;
 }
 
+/* Executed by the core thread */
 static void __net_close(struct intern_connection *ic)
 {
 	switch (ic->conn_type) {
@@ -543,6 +952,7 @@ static err_t cos_net_lwip_tcp_recv(void *arg, struct tcp_pcb *tp, struct pbuf *p
 		return ERR_CLSD;
 	}
 	first = p;
+	lock_take(&ic->l);
 	while (p) {
 		struct pbuf *q;
 
@@ -577,18 +987,13 @@ static err_t cos_net_lwip_tcp_recv(void *arg, struct tcp_pcb *tp, struct pbuf *p
 		assert(p->ref == 1);
 		p = q;
 	}
+	lock_release(&ic->l);
 	/* Just make sure lwip is doing what we think its doing */
 	assert(first->ref == 1);
 	/* This should deallocate the entire chain */
 	pbuf_free(first);
 
 	if (-1 != ic->data && evt_trigger(cos_spd_id(), ic->data)) BUG();
-/* 	/\* If the thread blocked waiting for a packet, wake it up *\/ */
-/* 	if (RECVING == ic->thd_status) { */
-/* 		ic->thd_status = ACTIVE; */
-/* 		assert(ic->thd_status == ACTIVE); /\* Detect races *\/ */
-/* 		if (sched_wakeup(cos_spd_id(), ic->tid)) BUG(); */
-/* 	} */
 
 	return ERR_OK;
 }
@@ -604,7 +1009,11 @@ static err_t cos_net_lwip_tcp_sent(void *arg, struct tcp_pcb *tp, u16_t len)
 	 * a problem. */
 	if (-1 == ic->data) return ERR_OK;
 	/* FIXME: fix sending so that we can block and everything will work. */
-	//if (evt_trigger(cos_spd_id(), ic->data)) BUG();
+	/* A send failed for lack of space: there might be enough now */
+	if (ic->send_full) {
+		ic->send_full = 0;
+		if (evt_trigger(cos_spd_id(), ic->data)) BUG();
+	}
 
 	return ERR_OK;
 }
@@ -612,11 +1021,16 @@ static err_t cos_net_lwip_tcp_sent(void *arg, struct tcp_pcb *tp, u16_t len)
 static err_t cos_net_lwip_tcp_connected(void *arg, struct tcp_pcb *tp, err_t err)
 {
 	struct intern_connection *ic = arg;
+	struct net_cmd *c;
+
 	assert(ic);
-	
 	assert(CONNECTING == ic->thd_status);
-	if (sched_wakeup(cos_spd_id(), ic->tid)) BUG();
+	/* The connect command completes only now that we're connected */
+	c = ic->pending_cmd;
+	assert(c && NET_CMD_CONNECT == c->type);
+	ic->pending_cmd = NULL;
 	ic->thd_status = ACTIVE;
+	net_cmd_complete(c, 0);
 
 	return ERR_OK;
 }
@@ -640,7 +1054,7 @@ static net_connection_t __net_create_tcp_connection(spdid_t spdid, u16_t tid, st
 	} else {
 		tp = new_tp;
 	}
-	ic = net_conn_alloc(TCP, tid, evt_id);
+	ic = net_conn_alloc(TCP, tid, evt_id, net_conn_shard_choose(new_tp, tid));
 	if (NULL == ic) {
 		prints("Could not allocate internal connection");
 		ret = -ENOMEM;
@@ -662,7 +1076,33 @@ err:
 
 net_connection_t net_create_tcp_connection(spdid_t spdid, u16_t tid, long evt_id)
 {
-	return __net_create_tcp_connection(spdid, tid, NULL, evt_id);
+	struct net_cmd c;
+
+	c.type = NET_CMD_CREATE;
+	c.ic   = NULL;
+	c.a.create.type   = TCP;
+	c.a.create.spdid  = spdid;
+	c.a.create.tid    = tid;
+	c.a.create.evt_id = evt_id;
+
+	return net_cmd_call(&c);
+}
+
+/* 
+ * Connections accepted by lwip but not yet by the application,
+ * across all listeners.  The accept queue of each listener is
+ * bounded by the backlog passed to net_listen; this is its depth,
+ * reported to the scheduler configuration.
+ */
+static volatile long net_accepts_queued = 0;
+
+static inline void net_accepts_queued_add(long d)
+{
+	long o;
+
+	do {
+		o = net_accepts_queued;
+	} while (cos_cmpxchg(&net_accepts_queued, o, o + d) != o + d);
 }
 
 static err_t cos_net_lwip_tcp_accept(void *arg, struct tcp_pcb *new_tp, err_t err)
@@ -682,7 +1122,8 @@ static err_t cos_net_lwip_tcp_accept(void *arg, struct tcp_pcb *new_tp, err_t er
 
 	ica = net_conn_get_internal(nc);
 	if (NULL == ica) BUG();
-	ic->next = NULL;
+	lock_take(&ic->l);
+	ica->next = NULL;
 	if (NULL == ic->accepted_ic) {
 		assert(NULL == ic->accepted_last);
 		ic->accepted_ic = ica;
@@ -692,12 +1133,15 @@ static err_t cos_net_lwip_tcp_accept(void *arg, struct tcp_pcb *new_tp, err_t er
 		ic->accepted_last->next = ica;
 		ic->accepted_last = ica;
 	}
+	lock_release(&ic->l);
+	net_accepts_queued_add(1);
 	assert(-1 != ic->data);
 	if (evt_trigger(cos_spd_id(), ic->data)) BUG();
 
 	return ERR_OK;
 }
 
+/* Called with ic->l taken */
 static int cos_net_tcp_recv(struct intern_connection *ic, void *data, int sz)
 {
 	int xfer_amnt = 0;
@@ -706,7 +1150,6 @@ static int cos_net_tcp_recv(struct intern_connection *ic, void *data, int sz)
 	/* If there is data available, get it */
 	if (ic->incoming_size > 0) {
 		struct packet_queue *pq;
-		struct tcp_pcb *tp;
 		char *data_start;
 		int data_left;
 
@@ -728,7 +1171,7 @@ static int cos_net_tcp_recv(struct intern_connection *ic, void *data, int sz)
 #ifdef TEST_TIMING
 			ic->ts_start = timing_record(APP_RECV, pq->ts_start);
 #endif			
-			free(pq);
+			pkt_conn_free(ic, pq);
 		} 
 		/* Consume part of first packet */
 		else {
@@ -738,8 +1181,9 @@ static int cos_net_tcp_recv(struct intern_connection *ic, void *data, int sz)
 			assert(ic->incoming_offset >= 0 && (u32_t)ic->incoming_offset < pq->len);
 		}
 		ic->incoming_size -= xfer_amnt;
-		tp = ic->conn.tp;
-		tcp_recved(tp, xfer_amnt);
+		/* Let the core thread open the receive window */
+		ic->recved_pending += xfer_amnt;
+		net_conn_defer_update(ic);
 	}
 
 	return xfer_amnt;
@@ -747,6 +1191,9 @@ static int cos_net_tcp_recv(struct intern_connection *ic, void *data, int sz)
 
 /**** COS generic networking functions ****/
 
+/* 
+ * Returns the connection with its lock taken, or NULL with *ret set.
+ */
 static struct intern_connection *net_verify_tcp_connection(net_connection_t nc, int *ret)
 {
 	struct intern_connection *ic;
@@ -766,16 +1213,19 @@ static struct intern_connection *net_verify_tcp_connection(net_connection_t nc,
 		goto done;
 	}
 	assert(ACTIVE == ic->thd_status);
+	lock_take(&ic->l);
 	if (TCP != ic->conn_type) {
 		*ret = -ENOTSUP;
-		goto done;
+		goto unlock;
 	}
 	/* socket has not been bound */
 	if (0 == ic->conn.tp->local_port) {
 		*ret = -1;
-		goto done;
+		goto unlock;
 	}
 	return ic;
+unlock:
+	lock_release(&ic->l);
 done:
 	return NULL;
 }
@@ -785,24 +1235,13 @@ net_connection_t net_accept(spdid_t spdid, net_connection_t nc)
 	struct intern_connection *ic, *new_ic;
 	net_connection_t ret = -1;
 
-	NET_LOCK_TAKE();
 	ic = net_verify_tcp_connection(nc, &ret);
-	if (NULL == ic) {
-		ret = -EINVAL;
-		goto done;
-	}
+	if (NULL == ic) return -EINVAL;
 
 	/* No accepts are pending on this connection?: block */
 	if (NULL == ic->accepted_ic) {
 		ret = -EAGAIN;
 		goto done;
-/* 		assert(ic->tid == cos_get_thd_id()); */
-/* 		ic->thd_status = ACCEPTING; */
-/* 		NET_LOCK_RELEASE(); */
-/* 		prints("net_accept: blocking!"); */
-/* 		if (sched_block(cos_spd_id(), 0) < 0) BUG(); */
-/* 		NET_LOCK_TAKE(); */
-/* 		assert(ACTIVE == ic->thd_status); */
 	}
 
 	assert(NULL != ic->accepted_ic && NULL != ic->accepted_last);
@@ -811,11 +1250,13 @@ net_connection_t net_accept(spdid_t spdid, net_connection_t nc)
 	if (NULL == ic->accepted_ic) ic->accepted_last = NULL;
 	new_ic->next = NULL;
 	assert(ic->conn.tp);
-	tcp_accepted(ic->conn.tp);
+	ic->accepted_pending++;
+	net_conn_defer_update(ic);
 	ret = net_conn_get_opaque(new_ic);
+	net_accepts_queued_add(-1);
 
 done:
-	NET_LOCK_RELEASE();
+	lock_release(&ic->l);
 	return ret;
 }
 
@@ -827,118 +1268,61 @@ done:
 int net_accept_data(spdid_t spdid, net_connection_t nc, long data)
 {
 	struct intern_connection *ic;
-	int ret;
+	int ret, pending;
 
-	NET_LOCK_TAKE();
 	ic = net_verify_tcp_connection(nc, &ret);
-	if (NULL == ic || -1 != ic->data) goto err;
+	if (NULL == ic) return -1;
+	if (-1 != ic->data) goto err;
 	ic->data = data;
+	pending = ic->incoming_size;
+	lock_release(&ic->l);
 	/* If data has already arrived, but couldn't trigger the event
 	 * because ->data was not set, trigger the event now. */
-	if (0 < ic->incoming_size && 
-	    evt_trigger(cos_spd_id(), data)) goto err;
-	NET_LOCK_RELEASE();
+	if (0 < pending && evt_trigger(cos_spd_id(), data)) return -1;
 
 	return 0;	
 err:
-	NET_LOCK_RELEASE();
+	lock_release(&ic->l);
 	return -1;
 }
 
 int net_listen(spdid_t spdid, net_connection_t nc, int queue)
 {
-	struct tcp_pcb *tp, *new_tp;
 	struct intern_connection *ic;
+	struct net_cmd c;
 	int ret = 0;
-	spdid_t si;
 
-	NET_LOCK_TAKE();
 	ic = net_verify_tcp_connection(nc, &ret);
-	if (NULL == ic) {
-		ret = -EINVAL;
-		goto done;
-	}
-	tp = ic->conn.tp;
-	si = ic->spdid;
-	assert(NULL != tp);
-	new_tp = tcp_listen_with_backlog(tp, queue);
-	if (NULL == new_tp) {
-		ret = -ENOMEM;
-		goto done;
-	}
-	ic->conn.tp = new_tp;
-	tcp_arg(new_tp, ic);
-	tcp_accept(new_tp, cos_net_lwip_tcp_accept);
-	//if (0 > __net_create_tcp_connection(si, new_tp)) BUG();
-done:
-	NET_LOCK_RELEASE();
-	return ret;
+	if (NULL == ic) return -EINVAL;
+	lock_release(&ic->l);
+
+	c.type = NET_CMD_LISTEN;
+	c.ic   = ic;
+	c.a.listen.queue = queue;
+
+	return net_cmd_call(&c);
 }
 
 static int __net_bind(spdid_t spdid, net_connection_t nc, struct ip_addr *ip, u16_t port)
 {
 	struct intern_connection *ic;
+	struct net_cmd c;
 	u16_t tid = cos_get_thd_id();
-	int ret = 0;
 
-	NET_LOCK_TAKE();
-	if (!net_conn_valid(nc)) {
-		ret = -EINVAL;
-		goto done;
-	}
+	if (!net_conn_valid(nc)) return -EINVAL;
 	ic = net_conn_get_internal(nc);
-	if (NULL == ic) {
-		ret = -EINVAL;
-		goto done;
-	}
-	if (tid != ic->tid) {
-		ret = -EPERM;
-		goto done;
-	}
+	if (NULL == ic) return -EINVAL;
+	if (tid != ic->tid) return -EPERM;
 	assert(ACTIVE == ic->thd_status);
 
-	if (portmgr_bind(cos_spd_id(), port)) {
-		ret = -EADDRINUSE;
-		goto done;
-	}
-
-	switch (ic->conn_type) {
-	case UDP:
-	{
-		struct udp_pcb *up;
+	if (portmgr_bind(cos_spd_id(), port)) return -EADDRINUSE;
 
-		up = ic->conn.up;
-		assert(up);
-		if (ERR_OK != udp_bind(up, ip, port)) {
-			ret = -EPERM;
-			goto done;
-		}
-		break;
-	}
-	case TCP:
-	{
-		struct tcp_pcb *tp;
-		
-		tp = ic->conn.tp;
-		assert(tp);
-		if (ERR_OK != tcp_bind(tp, ip, port)) {
-			ret = -ENOMEM;
-			goto done;
-		}
-		NET_LOCK_RELEASE();
-		return 0;
-	}
-	case TCP_CLOSED:
-//		__net_close(ic);
-		ret = -EPIPE;
-		break;
-	default:
-		BUG();
-	}
+	c.type = NET_CMD_BIND;
+	c.ic   = ic;
+	c.a.addr.ip   = *ip;
+	c.a.addr.port = port;
 
-done:
-	NET_LOCK_RELEASE();
-	return ret;
+	return net_cmd_call(&c);
 }
 
 int net_bind(spdid_t spdid, net_connection_t nc, u32_t ip, u16_t port)
@@ -950,57 +1334,23 @@ int net_bind(spdid_t spdid, net_connection_t nc, u32_t ip, u16_t port)
 static int __net_connect(spdid_t spdid, net_connection_t nc, struct ip_addr *ip, u16_t port)
 {
 	struct intern_connection *ic;
+	struct net_cmd c;
 	u16_t tid = cos_get_thd_id();
 	
-	NET_LOCK_TAKE();
-	if (!net_conn_valid(nc)) goto perm_err;
+	if (!net_conn_valid(nc)) return -EPERM;
 	ic = net_conn_get_internal(nc);
-	if (NULL == ic) goto perm_err;
-	if (tid != ic->tid) goto perm_err;
+	if (NULL == ic) return -EPERM;
+	if (tid != ic->tid) return -EPERM;
 	assert(ACTIVE == ic->thd_status);
 
-	switch (ic->conn_type) {
-	case UDP:
-	{
-		struct udp_pcb *up;
+	c.type = NET_CMD_CONNECT;
+	c.ic   = ic;
+	c.a.addr.ip   = *ip;
+	c.a.addr.port = port;
 
-		up = ic->conn.up;
-		if (ERR_OK != udp_connect(up, ip, port)) {
-			NET_LOCK_RELEASE();
-			return -EISCONN;
-		}
-		break;
-	}
-	case TCP:
-	{
-		struct tcp_pcb *tp;
-
-		tp = ic->conn.tp;
-		ic->thd_status = CONNECTING;
-		if (ERR_OK != tcp_connect(tp, ip, port, cos_net_lwip_tcp_connected)) {
-			ic->thd_status = ACTIVE;
-			NET_LOCK_RELEASE();
-			return -ENOMEM;
-		}
-		NET_LOCK_RELEASE();
-		if (sched_block(cos_spd_id(), 0) < 0) BUG();
-		assert(ACTIVE == ic->thd_status);
-		/* When we wake up, we should be connected. */
-		return 0;
-	}
-	case TCP_CLOSED:
-//		__net_close(ic);
-		NET_LOCK_RELEASE();
-		return -EPIPE;
-	default:
-		BUG();
-	}
-	NET_LOCK_RELEASE();
-	return 0;
-perm_err:
-	NET_LOCK_RELEASE();
-	return -EPERM;
-}
+	/* When we wake up, we should be connected. */
+	return net_cmd_call(&c);
+}
 
 int net_connect(spdid_t spdid, net_connection_t nc, u32_t ip, u16_t port)
 {
@@ -1013,13 +1363,13 @@ int net_connect(spdid_t spdid, net_connection_t nc, u32_t ip, u16_t port)
 int net_close(spdid_t spdid, net_connection_t nc)
 {
 	struct intern_connection *ic;
+	struct net_cmd c;
 	u16_t tid = cos_get_thd_id();
 
-	NET_LOCK_TAKE();
-	if (!net_conn_valid(nc)) goto perm_err;
+	if (!net_conn_valid(nc)) return -EPERM;
 	ic = net_conn_get_internal(nc);
-	if (NULL == ic) goto perm_err; /* should really be EINVAL */
-	if (tid != ic->tid) goto perm_err;
+	if (NULL == ic) return -EPERM; /* should really be EINVAL */
+	if (tid != ic->tid) return -EPERM;
 	assert(ACTIVE == ic->thd_status);
 
 	/* This should be called from within lwip, not here, but this
@@ -1027,14 +1377,16 @@ int net_close(spdid_t spdid, net_connection_t nc)
 	 * if it were in lwip */
 	portmgr_free(cos_spd_id(), /* u16_t port_num */ 0);
 
-	__net_close(ic);
-	NET_LOCK_RELEASE();
-	return 0;
-perm_err:
-	NET_LOCK_RELEASE();
-	return -EPERM;
+	c.type = NET_CMD_CLOSE;
+	c.ic   = ic;
+
+	return net_cmd_call(&c);
 }
 
+/* 
+ * Receiving data only touches the connection's queue under its own
+ * lock, and never waits on the core thread.
+ */
 int net_recv(spdid_t spdid, net_connection_t nc, void *data, int sz)
 {
 //	struct udp_pcb *up;
@@ -1045,17 +1397,11 @@ int net_recv(spdid_t spdid, net_connection_t nc, void *data, int sz)
 //	if (!cos_argreg_buff_intern(data, sz)) return -EFAULT;
 	if (!net_conn_valid(nc)) return -EINVAL;
 
-	NET_LOCK_TAKE();
 	ic = net_conn_get_internal(nc);
-	if (NULL == ic) {
-		NET_LOCK_RELEASE();
-		return -EINVAL;
-	}
-	if (tid != ic->tid) {
-		NET_LOCK_RELEASE();
-		return -EPERM;
-	}
+	if (NULL == ic) return -EINVAL;
+	if (tid != ic->tid) return -EPERM;
 
+	lock_take(&ic->l);
 	switch (ic->conn_type) {
 	case UDP:
 		xfer_amnt = cos_net_udp_recv(ic, data, sz);
@@ -1071,31 +1417,262 @@ int net_recv(spdid_t spdid, net_connection_t nc, void *data, int sz)
 		printc("net_recv: invalid connection type: %d", ic->conn_type);
 		BUG();
 	}
+	lock_release(&ic->l);
 	assert(xfer_amnt <= sz);
-	NET_LOCK_RELEASE();
+
 	return xfer_amnt;
 }
 
 int net_send(spdid_t spdid, net_connection_t nc, void *data, int sz)
 {
 	struct intern_connection *ic;
+	struct net_cmd c;
 	u16_t tid = cos_get_thd_id();
-	int ret = sz;
+	int ret;
 
 //	if (!cos_argreg_buff_intern(data, sz)) return -EFAULT;
 	if (!net_conn_valid(nc)) return -EINVAL;
 	if (sz > MAX_SEND) return -EMSGSIZE;
 
-	NET_LOCK_TAKE();
 	ic = net_conn_get_internal(nc);
-	if (NULL == ic) {
-		ret = -EINVAL;
-		goto err;
+	if (NULL == ic) return -EINVAL;
+	if (tid != ic->tid) return -EPERM;
+
+	c.type = NET_CMD_SEND;
+	c.ic   = ic;
+	c.a.send.data = data;
+	c.a.send.sz   = sz;
+	c.a.send.pq   = NULL;
+#define TCP_SEND_COPY
+	/* 
+	 * Copy the data outside of the core thread.  UDP data is
+	 * always copied: data is in our argument region, which is not
+	 * mapped when the core thread runs.
+	 */
+#ifdef TCP_SEND_COPY
+	if (TCP == ic->conn_type || UDP == ic->conn_type) {
+#else
+	if (UDP == ic->conn_type) {
+#endif
+		struct packet_queue *pq;
+
+		pq = pkt_conn_alloc(ic);
+		if (unlikely(NULL == pq)) return -ENOMEM;
+#ifdef TEST_TIMING
+		pq->ts_start = timing_record(APP_PROC, ic->ts_start);
+#endif
+		pq->headers = NULL;
+		memcpy(net_packet_data(pq), data, sz);
+		c.a.send.pq = pq;
 	}
-	if (tid != ic->tid) {
-		ret = -EPERM;
-		goto err;
+	ret = net_cmd_call(&c);
+	if (c.a.send.pq) pkt_conn_free(ic, c.a.send.pq);
+
+	return ret;
+}
+
+/* 
+ * The readiness of a set of connections: each connection id in the
+ * array is replaced with a mask of NET_READY_* flags (0 for invalid
+ * connections).  Like net_recv, this only takes the connections'
+ * locks, so the fd component can poll the connections whose events
+ * have triggered with a single invocation.
+ */
+int net_ready(spdid_t spdid, struct cos_array *conns)
+{
+	net_connection_t *ncs;
+	int i, n;
+
+	if (!cos_argreg_arr_intern(conns)) return -EFAULT;
+	n   = conns->sz / sizeof(net_connection_t);
+	ncs = (net_connection_t *)conns->mem;
+	for (i = 0 ; i < n ; i++) {
+		struct intern_connection *ic;
+		int r = 0;
+
+		ic = net_conn_valid(ncs[i]) ? net_conn_get_internal(ncs[i]) : NULL;
+		if (NULL == ic) {
+			ncs[i] = 0;
+			continue;
+		}
+		lock_take(&ic->l);
+		switch (ic->conn_type) {
+		case UDP:
+			if (ic->incoming) r |= NET_READY_IN;
+			r |= NET_READY_OUT;
+			break;
+		case TCP:
+			if (ic->incoming || ic->accepted_ic) r |= NET_READY_IN;
+			if (!ic->send_full) r |= NET_READY_OUT;
+			break;
+		case TCP_CLOSED:
+			r |= NET_READY_HUP;
+			break;
+		default:
+			BUG();
+		}
+		lock_release(&ic->l);
+		ncs[i] = r;
+	}
+
+	return n;
+}
+
+/* 
+ * Pages of persistent cbufs that lwip references for sent data.
+ * When lwip frees such a payload, it is not a packet buffer, and
+ * must not be freed.  The pages are never removed, as the cbufs are
+ * never freed.
+ */
+#define ZC_PAGES_SZ 1024 	/* power of 2 */
+static u32_t zc_pages[ZC_PAGES_SZ];
+static int zc_npages;
+cos_lock_t zc_lock;
+
+static inline u32_t zc_hash(u32_t pg) { return (pg * 2654435761UL) & (ZC_PAGES_SZ-1); }
+
+static int zc_page_present(void *addr)
+{
+	u32_t pg = (u32_t)addr >> PAGE_ORDER, i;
+
+	for (i = zc_hash(pg) ; zc_pages[i] ; i = (i+1) & (ZC_PAGES_SZ-1)) {
+		if (zc_pages[i] == pg) return 1;
 	}
+	return 0;
+}
+
+/* Returns 0 if all of the pages holding [addr, addr+sz) are recorded */
+static int zc_pages_add(char *addr, int sz)
+{
+	u32_t pg, i;
+	int ret = 0;
+
+	lock_take(&zc_lock);
+	for (pg = (u32_t)addr >> PAGE_ORDER ; 
+	     pg <= (u32_t)(addr + sz - 1) >> PAGE_ORDER ; 
+	     pg++) {
+		for (i = zc_hash(pg) ; zc_pages[i] && zc_pages[i] != pg ; i = (i+1) & (ZC_PAGES_SZ-1)) ;
+		if (zc_pages[i]) continue;
+		/* keep the table at most half full */
+		if (zc_npages >= ZC_PAGES_SZ/2) {
+			ret = -1;
+			break;
+		}
+		zc_pages[i] = pg;
+		zc_npages++;
+	}
+	lock_release(&zc_lock);
+
+	return ret;
+}
+
+/* 
+ * Send a response descriptor (resp_desc.h).  Data in the slab, and
+ * in cbufs that might be freed once we return, is copied into packet
+ * buffers (coalescing adjacent segments).  Persistent cbufs are
+ * passed to lwip by reference, so they are never copied before
+ * being transmitted.  As with net_send, either the whole descriptor
+ * is sent, or nothing (0) if the send buffer doesn't have room.
+ */
+#define SEND_RESP_MAX_CHUNKS (2*RESP_DESC_MAX_SEGS)
+
+int net_send_resp(spdid_t spdid, net_connection_t nc, struct cos_array *data)
+{
+	struct intern_connection *ic;
+	struct resp_desc *d;
+	struct net_cmd c;
+	struct send_chunk chunks[SEND_RESP_MAX_CHUNKS], *ch = NULL;
+	u16_t tid = cos_get_thd_id();
+	int i, n = 0, ret;
+
+	if (!cos_argreg_arr_intern(data)) return -EFAULT;
+	d = (struct resp_desc *)data->mem;
+	if (!resp_desc_valid(d, data->sz)) return -EINVAL;
+	if (!net_conn_valid(nc)) return -EINVAL;
+	ic = net_conn_get_internal(nc);
+	if (NULL == ic) return -EINVAL;
+	if (tid != ic->tid) return -EPERM;
+	if (TCP != ic->conn_type) return TCP_CLOSED == ic->conn_type ? -EPIPE : -EINVAL;
+	if (0 == d->tot_len) return 0;
+
+	for (i = 0 ; i < d->nsegs ; i++) {
+		struct resp_seg *s = &d->segs[i];
+		char *p;
+		int left;
+
+		if (0 == s->len) continue;
+		if (s->cb) {
+			p = cbuf2buf((cbuf_t)s->cb, s->cb_len);
+			if (NULL == p) {
+				ret = -EINVAL;
+				goto err;
+			}
+			p += s->off;
+			if (s->flags & RESP_SEG_PERSIST && !zc_pages_add(p, s->len)) {
+				if (n == SEND_RESP_MAX_CHUNKS) {
+					ret = -EMSGSIZE;
+					goto err;
+				}
+				ch = &chunks[n++];
+				ch->data = p;
+				ch->sz   = s->len;
+				ch->pq   = NULL;
+				ch       = NULL;
+				continue;
+			}
+		} else {
+			p = &d->slab[s->off];
+		}
+		/* copy, appending to the current packet buffer */
+		for (left = s->len ; left > 0 ; ) {
+			int amnt;
+
+			if (NULL == ch || ch->sz == TCP_MSS) {
+				if (n == SEND_RESP_MAX_CHUNKS) {
+					ret = -EMSGSIZE;
+					goto err;
+				}
+				ch = &chunks[n++];
+				ch->pq = pkt_conn_alloc(ic);
+				if (unlikely(NULL == ch->pq)) {
+					n--;
+					ret = -ENOMEM;
+					goto err;
+				}
+				ch->pq->headers = NULL;
+				ch->data = net_packet_data(ch->pq);
+				ch->sz   = 0;
+			}
+			amnt = TCP_MSS - ch->sz;
+			if (amnt > left) amnt = left;
+			memcpy((char *)ch->data + ch->sz, p, amnt);
+			ch->sz += amnt;
+			p      += amnt;
+			left   -= amnt;
+		}
+	}
+
+	c.type = NET_CMD_SEND_RESP;
+	c.ic   = ic;
+	c.a.send_resp.chunks  = chunks;
+	c.a.send_resp.nchunks = n;
+	c.a.send_resp.sz      = d->tot_len;
+	ret = net_cmd_call(&c);
+err:
+	/* packet buffers not handed to lwip */
+	for (i = 0 ; i < n ; i++) {
+		if (chunks[i].pq) pkt_conn_free(ic, chunks[i].pq);
+	}
+
+	return ret;
+}
+
+/**** Core command processing (only executed by the core thread) ****/
+
+static int net_core_send(struct net_cmd *c)
+{
+	struct intern_connection *ic = c->ic;
+	int sz = c->a.send.sz, ret = sz;
 
 	switch (ic->conn_type) {
 	case UDP:
@@ -1105,18 +1682,18 @@ int net_send(spdid_t spdid, net_connection_t nc, void *data, int sz)
 
 		/* There's no blocking in the UDP case, so this is simple */
 		up = ic->conn.up;
+		assert(c->a.send.pq);
 		p = pbuf_alloc(PBUF_TRANSPORT, sz, PBUF_ROM);
-		if (NULL == p) {
-			ret = -ENOMEM;
-			goto err;
-		}
-		p->payload = data;
+		if (NULL == p) return -ENOMEM;
+		p->payload     = net_packet_data(c->a.send.pq);
+		/* lwip_free_payload frees the packet with the pbuf */
+		p->alloc_track = p->payload;
+		c->a.send.pq   = NULL;
 
 		if (ERR_OK != udp_send(up, p)) {
 			pbuf_free(p);
 			/* IP/port must not be set */
-			ret = -ENOTCONN;
-			goto err;
+			return -ENOTCONN;
 		}
 		pbuf_free(p);
 		break;
@@ -1124,37 +1701,24 @@ int net_send(spdid_t spdid, net_connection_t nc, void *data, int sz)
 	case TCP:
 	{
 		struct tcp_pcb *tp;
-#define TCP_SEND_COPY
-#ifdef TCP_SEND_COPY
-		void *d;
-		struct packet_queue *pq;
-#endif
+
 		tp = ic->conn.tp;
-		if (tcp_sndbuf(tp) < sz) { 
-			ret = 0;
-			break;
+		if (tcp_sndbuf(tp) < sz) {
+			ic->send_full = 1;
+			return 0;
 		}
 #ifdef TCP_SEND_COPY
-		pq = malloc(sizeof(struct packet_queue) + sz);
-		if (unlikely(NULL == pq)) {
-			ret = -ENOMEM;
-			goto err;
-		}
-#ifdef TEST_TIMING
-		pq->ts_start = timing_record(APP_PROC, ic->ts_start);
-#endif
-		pq->headers = NULL;
-		d = net_packet_data(pq);
-		memcpy(d, data, sz);
-		if (ERR_OK != (ret = tcp_write(tp, d, sz, 0))) {
+		assert(c->a.send.pq);
+		if (ERR_OK != (ret = tcp_write(tp, net_packet_data(c->a.send.pq), sz, 0))) {
 #else
-		if (ERR_OK != (ret = tcp_write(tp, data, sz, TCP_WRITE_FLAG_COPY))) {
+		if (ERR_OK != (ret = tcp_write(tp, c->a.send.data, sz, TCP_WRITE_FLAG_COPY))) {
 #endif
-			free(pq);
 			printc("tcp_write returned %d (sz %d, tcp_sndbuf %d, ERR_MEM: %d)", 
 			       ret, sz, tcp_sndbuf(tp), ERR_MEM);
 			BUG();
 		}
+		/* lwip now owns the data, and will free it */
+		c->a.send.pq = NULL;
 		/* No implementation of nagle's algorithm yet.  Send
 		 * out the packet immediately if possible. */
 		if (ERR_OK != (ret = tcp_output(tp))) {
@@ -1171,41 +1735,253 @@ int net_send(spdid_t spdid, net_connection_t nc, void *data, int sz)
 	default:
 		BUG();
 	}
-err:
-	NET_LOCK_RELEASE();
+
 	return ret;
 }
 
+static int net_core_send_resp(struct net_cmd *c)
+{
+	struct intern_connection *ic = c->ic;
+	struct tcp_pcb *tp;
+	int i, ret, nsegs = 0;
+
+	if (TCP_CLOSED == ic->conn_type) return -EPIPE;
+	assert(TCP == ic->conn_type);
+	tp = ic->conn.tp;
+	/* all or nothing: room in the send buffer and the segment queue? */
+	for (i = 0 ; i < c->a.send_resp.nchunks ; i++) {
+		nsegs += 2 * (c->a.send_resp.chunks[i].sz / tp->mss + 1);
+	}
+	if (tcp_sndbuf(tp) < c->a.send_resp.sz || 
+	    tp->snd_queuelen + nsegs > TCP_SND_QUEUELEN) {
+		ic->send_full = 1;
+		return 0;
+	}
+
+	for (i = 0 ; i < c->a.send_resp.nchunks ; i++) {
+		struct send_chunk *ch = &c->a.send_resp.chunks[i];
+
+		/* lwip references the data in either case */
+		if (ERR_OK != (ret = tcp_write(tp, ch->data, ch->sz, 0))) {
+			printc("tcp_write returned %d (sz %d, tcp_sndbuf %d, ERR_MEM: %d)", 
+			       ret, ch->sz, tcp_sndbuf(tp), ERR_MEM);
+			BUG();
+		}
+		/* lwip now owns the packet buffer, and will free it */
+		ch->pq = NULL;
+	}
+	if (ERR_OK != (ret = tcp_output(tp))) {
+		printc("tcp_output returned %d, ERR_MEM: %d", ret, ERR_MEM);
+		BUG();
+	}
+
+	return c->a.send_resp.sz;
+}
+
+static int net_core_bind(struct intern_connection *ic, struct ip_addr *ip, u16_t port)
+{
+	switch (ic->conn_type) {
+	case UDP:
+		assert(ic->conn.up);
+		if (ERR_OK != udp_bind(ic->conn.up, ip, port)) return -EPERM;
+		break;
+	case TCP:
+		assert(ic->conn.tp);
+		if (ERR_OK != tcp_bind(ic->conn.tp, ip, port)) return -ENOMEM;
+		break;
+	case TCP_CLOSED:
+		return -EPIPE;
+	default:
+		BUG();
+	}
+
+	return 0;
+}
+
+static int net_core_listen(struct intern_connection *ic, int queue)
+{
+	struct tcp_pcb *tp, *new_tp;
+
+	if (TCP != ic->conn_type) return -EPIPE;
+	tp = ic->conn.tp;
+	assert(NULL != tp);
+	new_tp = tcp_listen_with_backlog(tp, queue);
+	if (NULL == new_tp) return -ENOMEM;
+	lock_take(&ic->l);
+	ic->conn.tp = new_tp;
+	lock_release(&ic->l);
+	tcp_arg(new_tp, ic);
+	tcp_accept(new_tp, cos_net_lwip_tcp_accept);
+
+	return 0;
+}
+
+/* Returns 1 if the command completes asynchronously */
+static int net_core_connect(struct net_cmd *c, int *ret)
+{
+	struct intern_connection *ic = c->ic;
+
+	switch (ic->conn_type) {
+	case UDP:
+		if (ERR_OK != udp_connect(ic->conn.up, &c->a.addr.ip, c->a.addr.port)) {
+			*ret = -EISCONN;
+		}
+		return 0;
+	case TCP:
+		ic->thd_status  = CONNECTING;
+		ic->pending_cmd = c;
+		if (ERR_OK != tcp_connect(ic->conn.tp, &c->a.addr.ip, c->a.addr.port, 
+					  cos_net_lwip_tcp_connected)) {
+			ic->thd_status  = ACTIVE;
+			ic->pending_cmd = NULL;
+			*ret = -ENOMEM;
+			return 0;
+		}
+		return 1;
+	case TCP_CLOSED:
+		*ret = -EPIPE;
+		return 0;
+	default:
+		BUG();
+	}
+	return 0;
+}
+
+static void net_core_update(struct intern_connection *ic)
+{
+	int recved, accepted;
+
+	lock_take(&ic->l);
+	recved   = ic->recved_pending;
+	accepted = ic->accepted_pending;
+	ic->recved_pending = ic->accepted_pending = 0;
+	ic->update_queued  = 0;
+	lock_release(&ic->l);
+
+	if (TCP != ic->conn_type) return;
+	assert(ic->conn.tp);
+	if (recved) tcp_recved(ic->conn.tp, recved);
+	while (accepted--) tcp_accepted(ic->conn.tp);
+}
+
+static void cos_net_interrupt(struct packet_queue *pq, int len);
+
+static void net_core_process(struct net_cmd *c)
+{
+	int ret = 0;
+
+	switch (c->type) {
+	case NET_CMD_INPUT:
+		/* c is in the packet's buffer, which this can free */
+		cos_net_interrupt(c->a.input.pq, c->a.input.len);
+		return;
+	case NET_CMD_TMR:
+		tcp_tmr();
+		c->done = 1;
+		return;
+	case NET_CMD_UPDATE:
+		net_core_update(c->ic);
+		return;
+	case NET_CMD_CREATE:
+		if (UDP == c->a.create.type) {
+			ret = __net_create_udp_connection(c->a.create.spdid, c->a.create.tid, c->a.create.evt_id);
+		} else {
+			ret = __net_create_tcp_connection(c->a.create.spdid, c->a.create.tid, NULL, c->a.create.evt_id);
+		}
+		break;
+	case NET_CMD_BIND:
+		ret = net_core_bind(c->ic, &c->a.addr.ip, c->a.addr.port);
+		break;
+	case NET_CMD_LISTEN:
+		ret = net_core_listen(c->ic, c->a.listen.queue);
+		break;
+	case NET_CMD_CONNECT:
+		/* completed in cos_net_lwip_tcp_connected */
+		if (net_core_connect(c, &ret)) return;
+		break;
+	case NET_CMD_CLOSE:
+		__net_close(c->ic);
+		break;
+	case NET_CMD_SEND:
+		ret = net_core_send(c);
+		break;
+	case NET_CMD_SEND_RESP:
+		ret = net_core_send_resp(c);
+		break;
+	default:
+		BUG();
+	}
+	net_cmd_complete(c, ret);
+}
+
+static void net_core_loop(void)
+{
+	printc("network core thd %d starting...\n", cos_get_thd_id());
+	while (1) {
+		struct net_cmd *c, *next;
+
+		c = net_cmd_dequeue_all();
+		while (c) {
+			/* c can be deallocated once processed */
+			next = c->next;
+			net_core_process(c);
+			c = next;
+		}
+	}
+}
+
 /************************ LWIP integration: **************************/
 
 struct ip_addr ip, mask, gw;
 struct netif   cos_if;
 
-static void cos_net_interrupt(char *packet, int sz)
+/* Executed by the core thread, with a packet copied in by an upcall */
+static void cos_net_interrupt(struct packet_queue *pq, int len)
 {
 	void *d;
-	int len;
 	struct pbuf *p;
-	struct ip_hdr *ih;
-	struct packet_queue *pq;
 #ifdef TEST_TIMING
-	unsigned long long ts;
+	unsigned long long ts = pq->ts_start;
 #endif
-	NET_LOCK_TAKE();
+
+	p = pbuf_alloc(PBUF_IP, len, PBUF_ROM);
+	if (unlikely(!p)) {
+		prints("OOM in interrupt: allocation of pbuf failed.\n");
+		pkt_free(pq);
+		return;
+	}
+	d = net_packet_data(pq);
+	p->payload = p->alloc_track = d;
+	/* hand off packet ownership here... */
+	if (ERR_OK != cos_if.input(p, &cos_if)) {
+		prints("net: failure in IP input.");
+		pbuf_free(p);
+		return;
+	}
+
+#ifdef TEST_TIMING
+	timing_record(UPCALL_PROC, ts);
+#endif
+}
+
+/* 
+ * Executed by the network upcall threads: copy the packet out of the
+ * argument region, and pass it to the core thread.
+ */
+static void cos_net_upcall(char *packet, int sz)
+{
+	struct net_cmd *c;
+	struct packet_queue *pq;
+	struct ip_hdr *ih;
+	int len;
 
 	assert(packet);
 	ih = (struct ip_hdr*)packet;
-	if (unlikely(4 != IPH_V(ih))) goto done;
+	if (unlikely(4 != IPH_V(ih))) return;
 	len = ntohs(IPH_LEN(ih));
 	if (unlikely(len != sz || len > MTU)) {
 		printc("len %d > %d", len, MTU);
-		goto done;
-	}
-
-	p = pbuf_alloc(PBUF_IP, len, PBUF_ROM);
-	if (unlikely(!p)) {
-		prints("OOM in interrupt: allocation of pbuf failed.\n");
-		goto done;
+		return;
 	}
 
 	/* For now, we're going to do an additional copy.  Currently,
@@ -1215,36 +1991,38 @@ static void cos_net_interrupt(char *packet, int sz)
 	 * save space and free up the ring buffers, 3) it is difficult
 	 * to know in (1) which deallocation method (free or return to
 	 * ring buff) to use */
-	pq = malloc(len + sizeof(struct packet_queue));
+	pq = pkt_alloc();
 	if (unlikely(NULL == pq)) {
 		printc("OOM in interrupt: allocation of packet data (%d bytes) failed.\n", len);
-		pbuf_free(p);
-		goto done;
+		return;
 	}
-	pq->headers = d = net_packet_data(pq);
+	c = pkt_cmd(pq);
+	pq->headers = net_packet_data(pq);
 #ifdef TEST_TIMING
-#ifdef TCP_SEND_COPY
-	ts = pq->ts_start = timing_timestamp();
-#endif	
+	pq->ts_start = timing_timestamp();
 #endif	
-	memcpy(d, packet, len);
-	p->payload = p->alloc_track = d;
-	/* hand off packet ownership here... */
-	if (ERR_OK != cos_if.input(p, &cos_if)) {
-		prints("net: failure in IP input.");
-		pbuf_free(p);
-		goto done;
-	}
-
-#ifdef TEST_TIMING
-	timing_record(UPCALL_PROC, ts);
-#endif
-done:
-	NET_LOCK_RELEASE();
-	return;
+	memcpy(pq->headers, packet, len);
+
+	c->type = NET_CMD_INPUT;
+	c->tid  = 0;
+	c->ic   = NULL;
+	c->a.input.pq  = pq;
+	c->a.input.len = len;
+	net_cmd_enqueue(c);
 }
 
-static volatile int event_thd = 0;
+/* One upcall thread per flow that the interface steers packets across */
+static volatile int event_thds[NET_NUM_FLOWS];
+
+static int cos_net_is_event_thd(unsigned short int tid)
+{
+	int i;
+
+	for (i = 0 ; i < NET_NUM_FLOWS ; i++) {
+		if (event_thds[i] == tid) return 1;
+	}
+	return 0;
+}
 
 extern int ip_xmit(spdid_t spdid, struct cos_array *d);
 extern int ip_wait(spdid_t spdid, struct cos_array *d);
@@ -1256,7 +2034,7 @@ static int cos_net_evt_loop(void)
 	struct cos_array *data;
 	int alloc_sz;
 
-	assert(event_thd > 0);
+	assert(cos_net_is_event_thd(cos_get_thd_id()));
 	if (ip_netif_create(cos_spd_id())) BUG();
 	printc("network uc %d starting...\n", cos_get_thd_id());
 	alloc_sz = sizeof(struct cos_array) + MTU;
@@ -1265,7 +2043,7 @@ static int cos_net_evt_loop(void)
 	while (1) {
 		data->sz = alloc_sz;
 		ip_wait(cos_spd_id(), data);
-		cos_net_interrupt(data->mem, data->sz);
+		cos_net_upcall(data->mem, data->sz);
 	}
 	cos_argreg_free(data);
 
@@ -1285,7 +2063,7 @@ static err_t cos_net_stack_send(struct netif *ni, struct pbuf *p, struct ip_addr
 	struct cos_array *b;
 	char *buff;
 
-	/* assuming the net lock is taken here */
+	/* executed by the core thread */
 
 	assert(p && p->ref == 1);
 	assert(p->type == PBUF_RAM);
@@ -1336,14 +2114,19 @@ static void lwip_free_payload(struct pbuf *p)
 		p->payload = NULL;
 		return;
 	}
-	/* assuming this will only happen with TCP data */
+	/* referenced from a persistent cbuf */
+	if (zc_page_present(p->payload)) {
+		p->payload = NULL;
+		return;
+	}
+	/* TCP data, or UDP data copied by net_send */
 	headers = cos_net_header_start(p, TCP);
 	assert (NULL != headers); /* we could just return NULL here */
 	pq = net_packet_pq(headers);
 	/* have we successfully extracted the packet_queue? */
 	assert(pq->headers == NULL || pq->headers == headers);
 	p->payload = NULL;
-	free(pq);
+	pkt_free(pq);
 }
 
 /*** Initialization routines: ***/
@@ -1376,52 +2159,66 @@ static void init_lwip(void)
 	netif_set_up(&cos_if);
 }
 
-static void cos_net_create_netif_thd(void)
+static void cos_net_create_netif_thds(void)
 {
 	struct cos_array *data;
+	int i;
 
 	data = cos_argreg_alloc(sizeof(struct cos_array) + 4);
 	assert(data);
 	strcpy(&data->mem[0], "r-1");
 	data->sz = 4;
-	if (0 > (event_thd = sched_create_thread(cos_spd_id(), data))) BUG();
+	if (0 > (core_thd = sched_create_thread(cos_spd_id(), data))) BUG();
+	for (i = 0 ; i < NET_NUM_FLOWS ; i++) {
+		strcpy(&data->mem[0], "r-1");
+		data->sz = 4;
+		if (0 > (event_thds[i] = sched_create_thread(cos_spd_id(), data))) BUG();
+	}
 	cos_argreg_free(data);
 }
 
 static int init(void) 
 {
+	struct net_cmd tmr_cmd;
 	int cnt = 0;
 #ifdef LWIP_STATS
 	int stats_cnt = 0;
 #endif
 
-	lock_static_init(&net_lock);
+	lock_static_init(&cmd_lock);
 
-	NET_LOCK_TAKE();
-
-	net_conn_init();
-	cos_net_create_netif_thd();
+	pkt_pool_init();
+	lock_static_init(&zc_lock);
+	if (net_conn_init()) BUG();
+	/* lwip is initialized before the core thread can run */
 	init_lwip();
+	cos_net_create_netif_thds();
 
-	NET_LOCK_RELEASE();
+	tmr_cmd.type = NET_CMD_TMR;
+	tmr_cmd.tid  = 0;
+	tmr_cmd.done = 1;
 	/* Start the tcp timer */
 	while (1) {
-		/* Sleep for a quarter of seconds as prescribed by lwip */
-		NET_LOCK_TAKE();
-
-		if (++cnt == 4) {
+		/* once a second */
+		if (0 == ++cnt % 4) {
 #ifdef TEST_TIMING
 			timing_output();
 #endif
 		}
+		/* once a second */
+		if (0 == cnt % 4) sched_comp_load_report(cos_spd_id(), net_accepts_queued);
 #ifdef LWIP_STATS
 		if (++stats_cnt == 20) {
 			stats_cnt = 0;
 			stats_display();
 		}
 #endif
-		tcp_tmr();
-		NET_LOCK_RELEASE();
+		/* Only one timer command outstanding at a time */
+		if (tmr_cmd.done) {
+			tmr_cmd.done = 0;
+			net_cmd_enqueue(&tmr_cmd);
+		}
+		/* Sleep for a quarter of seconds as prescribed by lwip */
 		timed_event_block(cos_spd_id(), 25); /* expressed in ticks currently */
 		cos_mpd_update();
 	}
@@ -1435,7 +2232,8 @@ void cos_init(void *arg)
 {
 	static volatile int first = 1;
 
-	if (cos_get_thd_id() == event_thd) cos_net_evt_loop();
+	if (cos_get_thd_id() == core_thd) net_core_loop();
+	if (cos_net_is_event_thd(cos_get_thd_id())) cos_net_evt_loop();
 
 	if (first) {
 		first = 0;
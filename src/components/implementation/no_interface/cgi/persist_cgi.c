@@ -9,13 +9,15 @@
 
 #include <cos_component.h>
 #include <string.h>
+#include <stdlib.h>
 #include <cos_debug.h>
 #include <errno.h>
 
 #include <fd.h>
 #include <sched.h>
+#include <sched_conf.h>
+#include <content_mux.h>
 
-static int main_fd, data_fd;
 const char *service_names[] = {
 	"/cgi/hw",
 	"/cgi/HW",
@@ -24,29 +26,89 @@ const char *service_names[] = {
 const char *msg = "hello world";
 #define BUFF_SZ 1024
 
-void cos_init(void *arg)
+/* 
+ * Number of threads serving the requests, changed with an init
+ * string of "n<workers>".  Each opens the services itself, so that
+ * async_inv balances the requests across them.
+ */
+#define CGI_NWORKERS_DEFAULT 1
+#define CGI_NWORKERS_MAX     16
+static int nworkers = CGI_NWORKERS_DEFAULT;
+static volatile int initialized = 0;
+
+static void parse_initstr(void)
+{
+	struct cos_array *data;
+	char *c;
+
+	data = cos_argreg_alloc(sizeof(struct cos_array) + 52);
+	assert(data);
+	data->sz = 52;
+	if (sched_comp_config_initstr(cos_spd_id(), data)) goto done;
+	for (c = data->mem ; '\0' != *c ; c++) {
+		if ('n' == *c) nworkers = atoi(c + 1);
+	}
+	if (nworkers < 1)                nworkers = 1;
+	if (nworkers > CGI_NWORKERS_MAX) nworkers = CGI_NWORKERS_MAX;
+done:
+	cos_argreg_free(data);
+}
+
+static void create_workers(void)
 {
 	struct cos_array *data;
 	int i;
-	data = cos_argreg_alloc(BUFF_SZ + sizeof(struct cos_array));
+
+	data = cos_argreg_alloc(sizeof(struct cos_array) + 4);
+	assert(data);
+	for (i = 1 ; i < nworkers ; i++) {
+		strcpy(&data->mem[0], "r0");
+		data->sz = 3;
+		if (0 > sched_create_thread(cos_spd_id(), data)) BUG();
+	}
+	cos_argreg_free(data);
+}
+
+static void open_services(struct cos_array *data, int add_routes)
+{
+	int i, fd;
 
 	for (i = 0 ; NULL != service_names[i] ; i++) {
 		memcpy(data->mem, service_names[i], strlen(service_names[i]));
 		data->sz = strlen(service_names[i]);
-		if (0 > (main_fd = cos_app_open(0, data))) {
-			printc("cgi: cannot open service, ret=%d\n", main_fd);
+		/* direct requests for the service to the async provider */
+		if (add_routes && content_route_add(cos_spd_id(), data, CONTENT_PROVIDER_ASYNC, 0)) {
+			printc("cgi: cannot add route for %s\n", service_names[i]);
+		}
+		if (0 > (fd = cos_app_open(0, data))) {
+			printc("cgi: cannot open service, ret=%d\n", fd);
 			BUG();
 		}
 	}
+}
 
-	main_fd = cos_wait_all();
+void cos_init(void *arg)
+{
+	struct cos_array *data;
+	int main_fd, data_fd, first = 0;
+
+	if (!initialized) {
+		initialized = first = 1;
+		parse_initstr();
+	}
+	data = cos_argreg_alloc(BUFF_SZ + sizeof(struct cos_array));
 	assert(data);
+	open_services(data, first);
+	if (first) create_workers();
+
 	while (1) {
+		main_fd = cos_wait_all();
 		cos_mpd_update();
 		while (1) {
 			int amnt;
 
 			data_fd = cos_split(main_fd);
+			/* another worker took the request, or it is busy */
 			if (-EAGAIN == data_fd) break;
 			else if (0 > data_fd) BUG();
 
@@ -60,7 +122,6 @@ void cos_init(void *arg)
 			cos_write(data_fd, data->mem, strlen(msg));
 			cos_close(data_fd);
 		}
-		cos_wait(main_fd);
 	}
 }
 
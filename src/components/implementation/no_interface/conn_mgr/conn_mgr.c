@@ -21,7 +21,26 @@
 #include <fd.h>
 #include <sched.h>
 
-#define BUFF_SZ 1401 //(COS_MAX_ARG_SZ/2)
+/* 
+ * Retrieve ready descriptors in batches via cos_epoll_wait rather
+ * than one at a time with cos_wait_all.
+ */
+#define USE_EPOLL
+#define EPOLL_MAX_EVTS 64
+/* 
+ * Print the descriptors handled per wait every STATS_PERIOD waits,
+ * to compare the two (see net/util/ab_conn.sh).
+ */
+#define STATS_PERIOD 8192
+static unsigned long n_waits, n_handled;
+
+/* 
+ * Data is relayed between a connection's descriptors with
+ * cos_splice, so it never passes through this component (responses
+ * in cbufs are passed by reference to the network).  Each call moves
+ * up to CONN_SPLICE_MAX bytes.
+ */
+#define CONN_SPLICE_MAX (64*1024)
 
 COS_VECT_CREATE_STATIC(fds);
 
@@ -29,8 +48,11 @@ static inline int get_fd_pair(int fd)
 {
 	int pair;
 
+	/* 
+	 * can be -1 if the pair was closed earlier in the same batch
+	 * of notifications
+	 */
 	pair = (int)cos_vect_lookup(&fds, (long)fd);
-	assert(pair > 0);
 	return pair;
 }
 
@@ -39,78 +61,145 @@ static inline void set_fd_pair(int fd, int pair)
 	if (cos_vect_add_id(&fds, (void*)pair, fd) < 0) BUG();
 }
 
-int accept_fd;
+int accept_fd, epoll_fd;
+
+/* 
+ * Admission control: at most CONN_MAX connections are open at a
+ * time.  Past that, connections are left in the listener's accept
+ * queue (bounded by the backlog passed to cos_listen, beyond which
+ * new connections are dropped by the network), and are accepted as
+ * open connections close.
+ */
+#define CONN_LISTEN_BACKLOG 255
+#define CONN_MAX            512
+static int conn_cnt = 0, accept_deferred = 0;
+
+static void close_pair(int fd, int fd_pair);
 
 static void accept_new(int accept_fd)
 {
 	int fd, http_fd;
 
+	accept_deferred = 0;
 	while (1) {
+		if (conn_cnt >= CONN_MAX) {
+			accept_deferred = 1;
+			break;
+		}
 		if (0 > (fd = cos_accept(accept_fd))) {
-			if (fd == -EAGAIN) break;
-			BUG();
+			if (fd != -EAGAIN) printc("conn_mgr: accept returned %d\n", fd);
+			break;
 		}
 		if (0 > (http_fd = cos_app_open(0, NULL))) {
-			printc("app_open returned %d", http_fd);
-			BUG();
+			/* the application is out of resources: shed the connection */
+			printc("conn_mgr: app_open returned %d\n", http_fd);
+			cos_close(fd);
+			continue;
 		}
 		set_fd_pair(fd, http_fd);
 		set_fd_pair(http_fd, fd);
+		conn_cnt++;
+#ifdef USE_EPOLL
+		if (cos_epoll_ctl(epoll_fd, COS_EPOLL_CTL_ADD, fd, COS_EPOLLIN) ||
+		    cos_epoll_ctl(epoll_fd, COS_EPOLL_CTL_ADD, http_fd, COS_EPOLLIN)) {
+			printc("conn_mgr: could not add fds %d and %d to epoll\n", fd, http_fd);
+			close_pair(fd, http_fd);
+		}
+#endif
 	}
 }
 
+static void close_pair(int fd, int fd_pair)
+{
+	cos_close(fd_pair);
+	cos_close(fd);
+	set_fd_pair(fd, -1);
+	set_fd_pair(fd_pair, -1);
+	conn_cnt--;
+	/* room for a connection waiting in the accept queue */
+	if (accept_deferred) accept_new(accept_fd);
+}
+
 static void data_new(int fd)
 {
-	int amnt, fd_pair;
-	char *buf;
+	int fd_pair, ret;
 
 	fd_pair = get_fd_pair(fd);
 	if (fd_pair < 0) return;
-	buf = cos_argreg_alloc(BUFF_SZ);
-	assert(buf);
 	while (1) {
-		int ret;
-
-		amnt = cos_read(fd, buf, BUFF_SZ-1);
-		if (0 == amnt) break;
-		else if (-EPIPE == amnt) {
-			cos_close(fd_pair);
-			cos_close(fd);
-			set_fd_pair(fd, -1);
-			set_fd_pair(fd_pair, -1);
+		ret = cos_splice(fd, fd_pair, CONN_SPLICE_MAX);
+		if (0 == ret) break;
+		if (ret < 0) {
+			if (-EPIPE != ret) {
+				printc("conn_mgr: splice from fd %d to %d failed w/ %d\n", fd, fd_pair, ret);
+			}
+			close_pair(fd, fd_pair);
 			break;
-		} else if (amnt < 0) {
-			printc("read from fd %d produced %d.\n", fd, amnt);
-			BUG();
-		}
-		if (amnt != (ret = cos_write(fd_pair, buf, amnt))) {
-			cos_close(fd_pair);
-			cos_close(fd);
-			printc("conn_mgr: write failed w/ %d on fd %d\n", ret, fd_pair);
 		}
 	}
-	cos_argreg_free(buf);
 }
 
-int main(void)
+static void wait_stats(int n)
+{
+	n_handled += n;
+	if (0 != ++n_waits % STATS_PERIOD) return;
+	printc("conn_mgr: %lu descriptors in %lu waits (%lu.%02lu per wait)\n",
+	       n_handled, n_waits, n_handled/n_waits, ((n_handled*100)/n_waits) % 100);
+	n_handled = n_waits = 0;
+}
+
+static void handle(int fd)
 {
-	int fd;
+	assert(fd >= 0);
+	if (fd == accept_fd) {
+		accept_new(accept_fd);
+	} else {
+		data_new(fd);
+	}
+}
 
+int main(void)
+{
 	cos_vect_init_static(&fds);
 
 	if (0 > (accept_fd = cos_socket(PF_INET, SOCK_STREAM, 0))) BUG();
 	if (0 > cos_bind(accept_fd, 0, 200)) BUG();
-	if (0 > cos_listen(accept_fd, 255)) BUG();
+	if (0 > cos_listen(accept_fd, CONN_LISTEN_BACKLOG)) BUG();
+#ifdef USE_EPOLL
+	if (0 > (epoll_fd = cos_epoll_create(EPOLL_MAX_EVTS))) BUG();
+	if (cos_epoll_ctl(epoll_fd, COS_EPOLL_CTL_ADD, accept_fd, COS_EPOLLIN)) BUG();
 	while (1) {
+		struct cos_array *evts;
+		struct cos_epoll_event *ee;
+		int i, n;
+
+		evts = cos_argreg_alloc(sizeof(struct cos_array) + 
+					EPOLL_MAX_EVTS * sizeof(struct cos_epoll_event));
+		assert(evts);
+		evts->sz = EPOLL_MAX_EVTS * sizeof(struct cos_epoll_event);
+		n = cos_epoll_wait(epoll_fd, evts);
+		if (n <= 0) {
+			printc("conn_mgr: epoll_wait returned %d\n", n);
+			BUG();
+		}
+		ee = (struct cos_epoll_event *)evts->mem;
+
+		cos_mpd_update();
+		wait_stats(n);
+		/* handlers allocate argument buffers above evts */
+		for (i = 0 ; i < n ; i++) handle(ee[i].fd);
+		cos_argreg_free(evts);
+	}
+#else
+	while (1) {
+		int fd;
+
 		fd = cos_wait_all();
 		cos_mpd_update();
-		assert(fd >= 0);
-		if (fd == accept_fd) {
-			accept_new(accept_fd);
-		} else {
-			data_new(fd);
-		}
+		wait_stats(1);
+		handle(fd);
 	}
+#endif
 }
 
 void cos_init(void *arg)
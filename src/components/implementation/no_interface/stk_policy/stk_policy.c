@@ -35,6 +35,8 @@ struct thd_sched {
 struct component {
 	spdid_t spdid;
 	unsigned int allocated, concur_est, concur_new;
+	/* stack-miss latency percentiles (cycles) */
+	unsigned long miss_p50, miss_p90, miss_p99;
 	struct component *next, *prev;
 };
 
@@ -85,7 +87,12 @@ gather_data(void)
 		assert(est != -1);
 		//citer->concur_prev = citer->concur_est;
 		citer->concur_est = est;
-		printc("Spd %d concurrency estimate: %d\n", citer->spdid, est);
+		citer->miss_p50 = stkmgr_spd_blk_percentile(citer->spdid, 50, 0);
+		citer->miss_p90 = stkmgr_spd_blk_percentile(citer->spdid, 90, 0);
+		citer->miss_p99 = stkmgr_spd_blk_percentile(citer->spdid, 99, 1);
+		printc("Spd %d concurrency estimate: %d, stack miss latency "
+		       "p50 %ld, p90 %ld, p99 %ld\n", citer->spdid, est, 
+		       citer->miss_p50, citer->miss_p90, citer->miss_p99);
 	}
 
 	for (titer = FIRST_LIST(&threads, next, prev) ; 
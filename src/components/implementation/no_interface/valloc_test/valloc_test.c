@@ -7,6 +7,60 @@
 #define ITER 9
 #define BASE_SZ 512
 
+/* 
+ * Allocation latency with a fragmented address space: fill most of
+ * it with runs of random sizes, free every other one, then time
+ * allocations and frees of random sizes that must search the holes.
+ */
+#define FRAG_RUNS    256
+#define FRAG_MAX_SZ  8
+#define FRAG_ITER    1024
+
+static unsigned int seed = 1;
+static inline int rand_sz(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) % FRAG_MAX_SZ) + 1;
+}
+
+static void frag_bench(void)
+{
+	static struct { void *a; int sz; } runs[FRAG_RUNS];
+	unsigned long long start, end, alloc = 0, dealloc = 0;
+	int i, n = 0;
+
+	for (i = 0 ; i < FRAG_RUNS ; i++) {
+		runs[i].sz = rand_sz();
+		runs[i].a  = valloc_alloc(cos_spd_id(), cos_spd_id(), runs[i].sz);
+		if (runs[i].a) n++;
+	}
+	for (i = 0 ; i < FRAG_RUNS ; i += 2) {
+		if (!runs[i].a) continue;
+		valloc_free(cos_spd_id(), cos_spd_id(), runs[i].a, runs[i].sz);
+		runs[i].a = NULL;
+	}
+	for (i = 0 ; i < FRAG_ITER ; i++) {
+		int sz = rand_sz();
+		void *a;
+
+		rdtscll(start);
+		a = valloc_alloc(cos_spd_id(), cos_spd_id(), sz);
+		rdtscll(end);
+		alloc += end-start;
+		if (!a) continue;
+
+		rdtscll(start);
+		valloc_free(cos_spd_id(), cos_spd_id(), a, sz);
+		rdtscll(end);
+		dealloc += end-start;
+	}
+	printc("valloc fragmented (%d runs): alloc %lld, free %lld cycles avg\n", 
+	       n, alloc/FRAG_ITER, dealloc/FRAG_ITER);
+	for (i = 1 ; i < FRAG_RUNS ; i += 2) {
+		if (runs[i].a) valloc_free(cos_spd_id(), cos_spd_id(), runs[i].a, runs[i].sz);
+	}
+}
+
 void cos_init(void)
 {
 	void *a, *b, *c;
@@ -23,6 +77,7 @@ void cos_init(void)
 	valloc_free(cos_spd_id(), cos_spd_id(), b, 64);
 	valloc_free(cos_spd_id(), cos_spd_id(), a, 16);
 	valloc_free(cos_spd_id(), cos_spd_id(), c, 32);
+	frag_bench();
 
 	for (i = 0 ; i < ITER ; i++) {
 		for (j = 0 ; j <= i ; j++) {
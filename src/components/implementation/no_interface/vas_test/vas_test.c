@@ -4,16 +4,52 @@
 #include <vas_mgr.h>
 #include <mem_mgr.h>
 
+/* 
+ * Expand and contract repeatedly: the address space must not leak,
+ * so every expansion should find the same free region.
+ */
+#define STRESS_ITER 1000
+
+static void vas_stress(void)
+{
+	vaddr_t a, first = 0;
+	unsigned long long start, end;
+	int i;
+
+	rdtscll(start);
+	for (i = 0 ; i < STRESS_ITER ; i++) {
+		a = vas_mgr_expand(cos_spd_id(), cos_spd_id(), SERVICE_SIZE);
+		if (!a) {
+			printc("vas ERROR: expansion %d failed\n", i);
+			return;
+		}
+		if (!first) first = a;
+		if (a != first) printc("vas ERROR: expansion %d @ %x, not %x\n", 
+				       i, (unsigned int)a, (unsigned int)first);
+		if (vas_mgr_contract(cos_spd_id(), cos_spd_id(), a)) {
+			printc("vas ERROR: contraction %d @ %x failed\n", i, (unsigned int)a);
+			return;
+		}
+	}
+	rdtscll(end);
+	printc("vas stress: %d expand/contract pairs, %lld cycles each\n", 
+	       STRESS_ITER, (end-start)/STRESS_ITER);
+}
+
 void cos_init(void)
 {
 	vaddr_t a, t;
-	a = vas_mgr_expand(cos_spd_id(), SERVICE_SIZE*2);
+	a = vas_mgr_expand(cos_spd_id(), cos_spd_id(), SERVICE_SIZE*2);
 	printc("vas expand @ %x.\n", (unsigned int)a);
 	if (a == 0) return;
 	t = mman_get_page(cos_spd_id(), a+SERVICE_SIZE, 0);
 	printc("mapped page %x, target %x\n", 
 	       (unsigned int)t, (unsigned int)(a+SERVICE_SIZE));
 	if (t != a+SERVICE_SIZE) printc("vas ERROR\n");
+	mman_release_page(cos_spd_id(), a+SERVICE_SIZE, 0);
+	if (vas_mgr_contract(cos_spd_id(), cos_spd_id(), a)) printc("vas ERROR: contract\n");
+
+	vas_stress();
 	
 	return;
 }
@@ -1553,11 +1553,32 @@ static void sched_child_init(void)
 //#define UBENCH_ACTIVE 1
 #define UBENCH_ITER 10000
 
+/* 
+ * The pages of the argument region that both threads have touched,
+ * thus mapped, and that are toggled on each switch.
+ */
+static volatile int ubench_argreg_pages = 1;
+
+static void
+sched_argreg_touch(int npages)
+{
+	volatile char *a = cos_get_arg_region();
+	int i;
+
+	for (i = 0 ; i < npages ; i++) (void)a[i*PAGE_SIZE];
+}
+
 static void
 sched_ctxt_switch_fn(void *d)
 {
 	u16_t pid = (u16_t)(u32_t)d;
+	int touched = 1;
+
 	while (1) {
+		if (unlikely(touched != ubench_argreg_pages)) {
+			touched = ubench_argreg_pages;
+			sched_argreg_touch(touched);
+		}
 		cos_switch_thread(pid, 0);
 	}
 }
@@ -1566,18 +1587,26 @@ static void
 sched_ctxt_switch_ubench(void)
 {
 	u16_t pid, cid;
-	int i;
+	int i, p;
 	u64_t start, end;
 
 	pid = cos_get_thd_id();
 	cid = cos_create_thread((int)sched_ctxt_switch_fn, (int)pid, 0);
 
-	rdtscll(start);
-	for (i = 0 ; i < UBENCH_ITER ; i++) {
+	for (p = 1 ; p <= COS_ARGREG_PAGES ; p *= 2) {
+		ubench_argreg_pages = p;
+		sched_argreg_touch(p);
+		/* and the other thread touches its pages */
 		cos_switch_thread(cid, 0);
+
+		rdtscll(start);
+		for (i = 0 ; i < UBENCH_ITER ; i++) {
+			cos_switch_thread(cid, 0);
+		}
+		rdtscll(end);
+		printc("kernel context switch ubenchmark results (%d argument region pages): %lld\n", 
+		       p, (end-start)/(u64_t)(2*UBENCH_ITER));
 	}
-	rdtscll(end);
-	printc("kernel context switch ubenchmark results: %lld\n", (end-start)/(u64_t)(2*UBENCH_ITER));
 }
 
 static void 
@@ -227,3 +227,39 @@ sched_comp_config_poststart(spdid_t spdid, int i, struct cos_array *data)
 {
 	return __sched_comp_config(spdid, i, data, 1);
 }
+
+/* 
+ * The last queue depth reported by each component (e.g. outstanding
+ * requests in the web server, or pending accepts in the network),
+ * and the high-water mark since it was last read.
+ */
+struct comp_load {
+	int depth, max;
+};
+static struct comp_load comp_loads[MAX_NUM_SPDS];
+
+int sched_comp_load_report(spdid_t spdid, int depth)
+{
+	struct comp_load *l;
+
+	if (spdid >= MAX_NUM_SPDS || depth < 0) return -1;
+	l = &comp_loads[spdid];
+	l->depth = depth;
+	if (depth > l->max) l->max = depth;
+
+	return 0;
+}
+
+/* Returns the high-water mark of target's queue depth, and resets it */
+int sched_comp_load(spdid_t spdid, spdid_t target)
+{
+	struct comp_load *l;
+	int max;
+
+	if (target >= MAX_NUM_SPDS) return -1;
+	l = &comp_loads[target];
+	max = l->max;
+	l->max = l->depth;
+
+	return max;
+}
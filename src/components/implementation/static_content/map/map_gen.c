@@ -0,0 +1,119 @@
+/**
+ * Copyright 2011 by The George Washington University.  All rights reserved.
+ *
+ * Redistribution of this file is permitted under the GNU General
+ * Public License v2.
+ */
+
+/* 
+ * Host program run at build time to generate map_tbl.h: a perfect
+ * hash of the keys in map.h (hash and displace), and the lengths of
+ * all of the values, so that the provider neither scans the table
+ * nor calls strlen per request.
+ *
+ * A key hashes (seed 0) to one of MAP_NBUCKETS buckets.  Each bucket
+ * has a displacement (a seed) chosen here so that all of its keys
+ * hash into distinct, unused slots of the MAP_TBL_SZ table, which
+ * holds the index of the key in map[].
+ *
+ * ./map_gen > map_tbl.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "map_hash.h"
+
+#define MAX_DISP 0xFFFF
+
+struct bucket {
+	int b, n, *keys;
+};
+
+static int bucket_cmp(const void *a, const void *b)
+{
+	return ((struct bucket *)b)->n - ((struct bucket *)a)->n;
+}
+
+int main(void)
+{
+	int nents, nbuckets, tbl_sz, i, j;
+	struct bucket *bs;
+	int *slot, *disp, *tmp;
+
+	for (nents = 0 ; map[nents].key ; nents++) ;
+	nbuckets = nents/4 + 1;
+	tbl_sz   = nents + nents/4 + 1;
+
+	bs   = calloc(nbuckets, sizeof(struct bucket));
+	slot = malloc(tbl_sz * sizeof(int));
+	disp = calloc(nbuckets, sizeof(int));
+	tmp  = malloc(tbl_sz * sizeof(int));
+	if (!bs || !slot || !disp || !tmp) return -1;
+	for (i = 0 ; i < tbl_sz ; i++) slot[i] = -1;
+
+	for (i = 0 ; i < nbuckets ; i++) {
+		bs[i].b    = i;
+		bs[i].keys = malloc((nents + 1) * sizeof(int));
+		if (!bs[i].keys) return -1;
+	}
+	for (i = 0 ; i < nents ; i++) {
+		struct bucket *b = &bs[map_hash(map[i].key, 0) % nbuckets];
+		int dup = 0;
+
+		/* the provider used to return the last of duplicate keys */
+		for (j = 0 ; j < b->n ; j++) {
+			if (!strcmp(map[b->keys[j]].key, map[i].key)) {
+				b->keys[j] = i;
+				dup = 1;
+			}
+		}
+		if (!dup) b->keys[b->n++] = i;
+	}
+
+	/* place the largest buckets first, while the table is empty */
+	qsort(bs, nbuckets, sizeof(struct bucket), bucket_cmp);
+	for (i = 0 ; i < nbuckets && bs[i].n ; i++) {
+		struct bucket *b = &bs[i];
+		int d;
+
+		for (d = 1 ; d <= MAX_DISP ; d++) {
+			for (j = 0 ; j < b->n ; j++) {
+				int s = map_hash(map[b->keys[j]].key, d) % tbl_sz, k;
+
+				if (slot[s] != -1) break;
+				for (k = 0 ; k < j && tmp[k] != s ; k++) ;
+				if (k < j) break;
+				tmp[j] = s;
+			}
+			if (j == b->n) break;
+		}
+		if (d > MAX_DISP) {
+			fprintf(stderr, "map_gen: could not place bucket %d\n", b->b);
+			return -1;
+		}
+		disp[b->b] = d;
+		for (j = 0 ; j < b->n ; j++) slot[tmp[j]] = b->keys[j];
+	}
+
+	printf("/* Generated by map_gen from map.h: do not edit. */\n\n");
+	printf("#define MAP_NENTS    %d\n", nents);
+	printf("#define MAP_NBUCKETS %d\n", nbuckets);
+	printf("#define MAP_TBL_SZ   %d\n\n", tbl_sz);
+
+	printf("static const unsigned short map_disp[MAP_NBUCKETS] = {");
+	for (i = 0 ; i < nbuckets ; i++) printf("%s%d,", i % 16 ? " " : "\n\t", disp[i]);
+	printf("\n};\n\n");
+
+	printf("static const short map_slot[MAP_TBL_SZ] = {");
+	for (i = 0 ; i < tbl_sz ; i++) printf("%s%d,", i % 16 ? " " : "\n\t", slot[i]);
+	printf("\n};\n\n");
+
+	printf("static const unsigned short map_len[MAP_NENTS+1] = {");
+	for (i = 0 ; i < nents ; i++) printf("%s%d,", i % 16 ? " " : "\n\t", (int)strlen(map[i].value));
+	printf("%s0\n};\n", i % 16 ? " " : "\n\t");
+
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef MAP_HASH_H
+#define MAP_HASH_H
+
+/* 
+ * The hash shared by map_gen (which builds the perfect hash table
+ * for map.h at build time) and the provider that looks keys up in
+ * it.  FNV-1a, with the seed folded into the initial state.
+ */
+static inline unsigned int map_hash(const char *s, unsigned int seed)
+{
+	unsigned int h = 2166136261U ^ (seed * 0x9E3779B1U);
+
+	for ( ; *s ; s++) {
+		h ^= (unsigned char)*s;
+		h *= 16777619U;
+	}
+	/* final avalanche so that the seed affects all bits */
+	h ^= h >> 15;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+
+	return h;
+}
+
+#endif /* MAP_HASH_H */
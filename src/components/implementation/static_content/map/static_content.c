@@ -13,19 +13,45 @@
 #include <cos_map.h>
 #include <errno.h>
 
+#include <cos_synchronization.h>
+#include <cbuf.h>
+
 #include <static_content.h>
 
 #include <sched.h>
 #include <evt.h>
 
 #include "map.h"
+#include "map_hash.h"
+/* generated at build time by map_gen */
+#include "map_tbl.h"
 
 struct static_content {
 	content_req_t id;
 	long evt_id;
-	int answer;
+	int answer, off;
 };
 
+/* index of key in map[], or -1 */
+static int map_lookup(char *key)
+{
+	unsigned int b;
+	int i;
+
+	b = map_hash(key, 0) % MAP_NBUCKETS;
+	i = map_slot[map_hash(key, map_disp[b]) % MAP_TBL_SZ];
+	if (i < 0 || strcmp(map[i].key, key)) return -1;
+	return i;
+}
+
+/* 
+ * Responses are immutable, so each is copied into a cbuf the first
+ * time it is asked for by reference, and that cbuf is then handed
+ * out to all later requests.
+ */
+static cbuf_t map_cbufs[MAP_NENTS+1];
+cos_lock_t map_lock;
+
 COS_MAP_CREATE_STATIC(static_requests);
 
 char *parse_getreq(char *str)
@@ -43,7 +69,6 @@ content_req_t static_open(spdid_t spdid, long evt_id, struct cos_array *data)
 {
 	struct static_content *sc = malloc(sizeof(struct static_content));
 	content_req_t id;
-	int i;
 	
 	//if (!cos_argreg_arr_intern(data)) return -EINVAL;
 
@@ -55,13 +80,12 @@ content_req_t static_open(spdid_t spdid, long evt_id, struct cos_array *data)
 	}
 
 	sc->answer = -1;
+	sc->off    = 0;
 	if (data && cos_argreg_arr_intern(data)) {
 		char *key;
 
 		key = parse_getreq(data->mem);
-		for (i = 0 ; key && map[i].key ; i++) {
-			if (!strcmp(map[i].key, key)) sc->answer = i;
-		}
+		if (key) sc->answer = map_lookup(key);
 	} else {
 		printc("no data on open\n");
 	}
@@ -93,6 +117,8 @@ static const char msg[] = "Confirmation numbers not found\n";
 int static_retrieve(spdid_t spdid, content_req_t cr, struct cos_array *data, int *more)
 {
 	struct static_content *sc;
+	const char *resp;
+	int resp_len, amnt;
 
 	if (!cos_argreg_arr_intern(data)) return -EINVAL;
 	if (!cos_argreg_buff_intern((char*)more, sizeof(int))) return -EINVAL;
@@ -101,18 +127,62 @@ int static_retrieve(spdid_t spdid, content_req_t cr, struct cos_array *data, int
 	if (NULL == sc) return -EINVAL;
 
 	if (sc->answer == -1) {
-		strcpy(data->mem, msg);
-		data->sz = strlen(msg);
-		*more = 0;
+		resp     = msg;
+		resp_len = sizeof(msg)-1;
 	} else {
-		strcpy(data->mem, map[sc->answer].value);
-		data->sz = strlen(map[sc->answer].value);
-		*more = 0;
+		resp     = map[sc->answer].value;
+		resp_len = map_len[sc->answer];
 	}
+	amnt = resp_len - sc->off;
+	if (amnt > data->sz) amnt = data->sz;
+	memcpy(data->mem, resp + sc->off, amnt);
+	sc->off += amnt;
+	data->sz = amnt;
+	*more    = sc->off < resp_len;
+	if (sc->answer == -1) *more |= CONTENT_NOCACHE;
 
 	return 0;
 }
 
+/* 
+ * Return the response as a reference to a read-only cbuf rather
+ * than a copy.  *len is only set if a cbuf is returned.
+ */
+int static_retrieve_cbuf(spdid_t spdid, content_req_t cr, int *len, int *more)
+{
+	struct static_content *sc;
+	cbuf_t cb;
+	char *buf;
+	int i;
+
+	if (!cos_argreg_buff_intern((char*)len, sizeof(int)) ||
+	    !cos_argreg_buff_intern((char*)more, sizeof(int))) return -EINVAL;
+	sc = cos_map_lookup(&static_requests, cr);
+	if (NULL == sc) return -EINVAL;
+	i = sc->answer;
+	if (-1 == i || sc->off || map_len[i] > PAGE_SIZE || 0 == map_len[i]) return 0;
+
+	lock_take(&map_lock);
+	cb = map_cbufs[i];
+	if (cbuf_is_null(cb)) {
+		buf = cbuf_alloc(map_len[i], &cb);
+		if (NULL == buf) {
+			lock_release(&map_lock);
+			return 0;
+		}
+		memcpy(buf, map[i].value, map_len[i]);
+		map_cbufs[i] = cb;
+	}
+	lock_release(&map_lock);
+
+	sc->off = map_len[i];
+	*len    = map_len[i];
+	/* map_cbufs are never freed, nor their contents changed */
+	*more   = CONTENT_PERSIST;
+
+	return (int)cb;
+}
+
 int static_close(spdid_t spdid, content_req_t cr)
 {
 	struct static_content *sc;
@@ -127,6 +197,7 @@ int static_close(spdid_t spdid, content_req_t cr)
 
 void cos_init(void *arg)
 {
+	lock_static_init(&map_lock);
 	cos_map_init_static(&static_requests);
 	return;
 }
@@ -7,6 +7,7 @@
 #include <sched.h>
 #include <cinfo.h>
 #include <valloc.h>
+#include <bitmap.h>
 
 #include <stkmgr.h>
 
@@ -23,7 +24,15 @@
 
 #define STK_PER_PAGE (PAGE_SIZE/MAX_STACK_SZ)
 #define NUM_PAGES (ALL_STACK_SZ/STK_PER_PAGE)
-#define MAX_NUM_STACKS 100 //6    // MAX_NUM_THREADS
+/* 
+ * A thread uses at most one stack in each component on its
+ * invocation stack, so no more than this many stacks can be in use
+ * at once.  Stacks are created on demand up to this limit, and the
+ * targets set by stkmgr_set_concurrency bound how many are used.
+ */
+#define MAX_NUM_STACKS (MAX_NUM_THREADS*MAX_SERVICE_DEPTH)
+/* Most stacks moved into a component's freelist at once on a miss */
+#define STK_REFILL_MAX 4
 
 #define MAX_BLKED  10
 #define DEFAULT_TARGET_ALLOC 10
@@ -74,6 +83,39 @@ struct cos_stk_item {
 	struct cos_stk *stk;
 };
 
+/* 
+ * Histogram of stack-miss latencies in cycles: values less than
+ * STK_LAT_SUB have their own buckets, and each larger power of 2 is
+ * split into STK_LAT_SUB buckets, so percentiles are reported to
+ * within 1/STK_LAT_SUB of their value.
+ */
+#define STK_LAT_SUB_ORD 2
+#define STK_LAT_SUB     (1<<STK_LAT_SUB_ORD)
+#define STK_LAT_BUCKETS ((32 - STK_LAT_SUB_ORD + 1) << STK_LAT_SUB_ORD)
+
+static inline int
+stk_lat_bucket(u64_t cyc)
+{
+	u32_t c = cyc > ~0U ? ~0U : (u32_t)cyc, l;
+
+	if (c < STK_LAT_SUB) return c;
+	l = log32_floor(c);
+	return ((l - STK_LAT_SUB_ORD + 1) << STK_LAT_SUB_ORD) + 
+		((c >> (l - STK_LAT_SUB_ORD)) & (STK_LAT_SUB-1));
+}
+
+/* the largest latency in bucket b */
+static inline u32_t
+stk_lat_bucket_max(int b)
+{
+	u32_t l, lower;
+
+	if (b < STK_LAT_SUB) return b;
+	l     = (b >> STK_LAT_SUB_ORD) + STK_LAT_SUB_ORD - 1;
+	lower = (u32_t)(STK_LAT_SUB + (b & (STK_LAT_SUB-1))) << (l - STK_LAT_SUB_ORD);
+	return lower + ((1U << (l - STK_LAT_SUB_ORD)) - 1);
+}
+
 /**
  * keep track of thread id's
  * Should this be a typedef'd type?
@@ -103,6 +145,8 @@ struct spd_stk_info {
 	u64_t        thd_blk_start[MAX_NUM_THREADS];
 	u64_t        thd_blk_tot[MAX_NUM_THREADS];
 	unsigned int stat_thd_blk[MAX_BLKED];
+	/* stack-miss latencies (time blocked), see stk_lat_bucket */
+	unsigned int blk_lat[STK_LAT_BUCKETS];
 
 	/* stacks and blocked threads */
 	struct cos_stk_item stk_list;
@@ -136,6 +180,7 @@ stkmgr_update_stats_wakeup(struct spd_stk_info *ssi, unsigned short int tid)
 	tot = end - ssi->thd_blk_start[tid];
 	ssi->thd_blk_tot[tid] += tot;
 	ssi->thd_blk_start[tid] = 0;
+	ssi->blk_lat[stk_lat_bucket(tot)]++;
 }
 
 void stkmgr_reset_stats(struct spd_stk_info *ssi)
@@ -150,13 +195,36 @@ void stkmgr_reset_stats(struct spd_stk_info *ssi)
 	for (i = 0 ; i < MAX_BLKED ; i++) {
 		ssi->stat_thd_blk[i] = 0;
 	}
+	memset(ssi->blk_lat, 0, sizeof(ssi->blk_lat));
 }
 
-// The total number of stacks
-struct cos_stk_item all_stk_list[MAX_NUM_STACKS];
 // Holds all currently free stacks
 struct cos_stk_item *free_stack_list = NULL;
-int stacks_allocated, stacks_target;
+int stacks_allocated, stacks_target, stacks_created;
+
+/* Create a new stack, if we are under MAX_NUM_STACKS */
+static struct cos_stk_item *
+stk_item_create(void)
+{
+	struct cos_stk_item *csi;
+
+	if (stacks_created >= MAX_NUM_STACKS) return NULL;
+	csi = malloc(sizeof(struct cos_stk_item));
+	if (!csi) return NULL;
+	memset(csi, 0, sizeof(struct cos_stk_item));
+	INIT_LIST(csi, next, prev);
+	csi->hptr = alloc_page();
+	if (!csi->hptr) {
+		DOUT("<stk_mgr>: ERROR, could not allocate stack\n"); 
+		free(csi);
+		return NULL;
+	}
+	// figure out or location of the top of the stack
+	csi->stk = (struct cos_stk *)D_COS_STK_ADDR((char *)csi->hptr);
+	stacks_created++;
+
+	return csi;
+}
 
 static inline int
 freelist_add(struct cos_stk_item *csi)
@@ -178,8 +246,9 @@ freelist_remove(void)
 
 	if (stacks_allocated >= stacks_target) return NULL;
 	csi = free_stack_list;
+	if (csi) free_stack_list = csi->free_next;
+	else     csi = stk_item_create();
 	if (!csi) return NULL;
-	free_stack_list = csi->free_next;
 	stacks_allocated++;
 
 	return csi;
@@ -187,6 +256,9 @@ freelist_remove(void)
 
 // Holds info about stack usage
 struct spd_stk_info spd_stk_info_list[MAX_NUM_SPDS];
+/* The spds with blocked threads */
+#define SPD_BLKED_WORDS ((MAX_NUM_SPDS+WORD_SIZE-1)/WORD_SIZE)
+u32_t spds_blked[SPD_BLKED_WORDS];
 
 static void stkmgr_print_ci_freelist(void);
 
@@ -213,19 +285,54 @@ spd_freelist_value(spdid_t spdid)
 	return ssi->ci->cos_stacks.freelists[0].freelist;
 }
 
+/* 
+ * Replace the freelist head and generation with nhead and ngen if
+ * they are still head and gen.  A single instruction, so atomic on
+ * our uniprocessor.  Returns 1 on success.
+ */
 static inline int
-spd_freelist_add(spdid_t spdid, struct cos_stk_item *csi)
+spd_freelist_cmpxchg2(struct stack_fl *fl, vaddr_t head, unsigned long gen,
+		      vaddr_t nhead, unsigned long ngen)
+{
+	char ret;
+
+	__asm__ __volatile__("cmpxchg8b %1\n\t"
+			     "sete %0"
+			     : "=m" (ret), "+m" (*fl), "+a" (head), "+d" (gen)
+			     : "b" (nhead), "c" (ngen)
+			     : "memory", "cc");
+	return ret;
+}
+
+/*
+ * The component's threads pop and push stacks on its freelist with
+ * cmpxchg (see cos_asm_stkmgr_stacks.h), so we do the same here.
+ * Add a chain of stacks, first through last linked by their next
+ * pointers, to the freelist at once.
+ */
+static inline void
+spd_freelist_add_chain(spdid_t spdid, struct cos_stk_item *first, struct cos_stk_item *last)
 {
 	struct spd_stk_info *ssi = get_spd_stk_info(spdid);
+	vaddr_t *fl, old, new;
+
+	assert(ssi->ci && first && last);
+	fl  = &ssi->ci->cos_stacks.freelists[0].freelist;
+	new = D_COS_STK_ADDR(first->d_addr);
+	do {
+		old = *fl;
+		last->stk->next = (struct cos_stk *)old;
+	} while (cos_cmpxchg(fl, (long)old, (long)new) != (long)new);
+}
 
+static inline int
+spd_freelist_add(spdid_t spdid, struct cos_stk_item *csi)
+{
 	/* Should either belong to this spd, or not to another (we
 	 * don't want it mapped into two components) */
 	assert(csi->parent_spdid == spdid || EMPTY_LIST(csi, next, prev));
-	assert(ssi->ci);
 
-	/* FIXME: race */
-	csi->stk->next = (struct cos_stk*)ssi->ci->cos_stacks.freelists[0].freelist;
-	ssi->ci->cos_stacks.freelists[0].freelist = D_COS_STK_ADDR(csi->d_addr);
+	spd_freelist_add_chain(spdid, csi, csi);
 
 	return 0;
 }
@@ -253,17 +360,21 @@ spd_freelist_remove(spdid_t spdid)
 	struct cos_stk *stk;
 	struct cos_stk_item *csi;
 	struct spd_stk_info *ssi;
+	struct stack_fl *fl;
+	unsigned long gen;
 
 	ssi = get_spd_stk_info(spdid);
-	stk = (struct cos_stk *)ssi->ci->cos_stacks.freelists[0].freelist;
-	if(stk == NULL) return NULL;
+	fl  = &ssi->ci->cos_stacks.freelists[0];
+	do {
+		gen = fl->gen;
+		stk = (struct cos_stk *)fl->freelist;
+		if(stk == NULL) return NULL;
 	
-	csi = stkmgr_get_spds_stk_item(spdid, (vaddr_t)stk);
-	/* FIXME: proper error reporting... */
-	if(csi == NULL) BUG();
-	stk = csi->stk; 	/* convert to local address */
-	/* FIXME: race condition */
-	ssi->ci->cos_stacks.freelists[0].freelist = (vaddr_t)stk->next;
+		csi = stkmgr_get_spds_stk_item(spdid, (vaddr_t)stk);
+		/* FIXME: proper error reporting... */
+		if(csi == NULL) BUG();
+		/* convert to local address */
+	} while (!spd_freelist_cmpxchg2(fl, (vaddr_t)stk, gen, (vaddr_t)csi->stk->next, gen+1));
 
 	return csi;
 }
@@ -280,7 +391,6 @@ spd_freelist_empty(spdid_t spdid)
 void 
 cos_init(void *arg){
 	int i;
-	struct cos_stk_item *stk_item;
 
 	DOUT("<stkmgr>: STACK in cos_init\n");
    
@@ -292,25 +402,8 @@ cos_init(void *arg){
 		INIT_LIST(&spd_stk_info_list[i].bthd_list, next, prev);
 	}
 
-	// Initialize our free stack list
-	for(i = 0; i < MAX_NUM_STACKS; i++){
-        
-		// put stk list is some known state
-		stk_item = &(all_stk_list[i]);
-		stk_item->stk  = NULL;
-		INIT_LIST(stk_item, next, prev);
-        
-		// allocate a page
-		stk_item->hptr = alloc_page();
-		if (stk_item->hptr == NULL){
-			DOUT("<stk_mgr>: ERROR, could not allocate stack\n"); 
-		} else {
-			// figure out or location of the top of the stack
-			stk_item->stk = (struct cos_stk *)D_COS_STK_ADDR((char *)stk_item->hptr);
-			freelist_add(stk_item);
-		}
-	}
-	stacks_allocated = 0;
+	/* stacks are created on demand (stk_item_create) */
+	stacks_allocated = stacks_created = 0;
 
 	// Map all of the spds we can into this component
 	for (i = 0 ; i < MAX_NUM_SPDS ; i++) {
@@ -344,22 +437,6 @@ cos_init(void *arg){
 	return;
 }
 
-/**
- * Assuming that the top of the stack is passed
- */
-static inline struct cos_stk_item *
-stkmgr_get_cos_stk_item(vaddr_t addr){
-	int i;
-    
-	for(i = 0; i < MAX_NUM_STACKS; i++){
-		if(addr == (vaddr_t)D_COS_STK_ADDR(all_stk_list[i].d_addr)){
-			return &all_stk_list[i];
-		}
-	}
-
-	return NULL;
-}
-
 void blklist_wake_threads(struct blocked_thd *bl)
 {
 	struct blocked_thd *bthd, *bthd_next;
@@ -394,6 +471,7 @@ void spd_wake_threads(spdid_t spdid)
 	blklist_wake_threads(&ssi->bthd_list);
 	assert(EMPTY_LIST(&ssi->bthd_list, next, prev));
 	ssi->num_blocked_thds = 0;
+	bitmap_unset(spds_blked, spdid);
 }
 
 
@@ -487,7 +565,8 @@ stkmgr_stk_add_to_spd(struct cos_stk_item *stk_item, struct spd_stk_info *info)
 /* 
  * Is there a component with blocked threads?  Which is the one with
  * the largest disparity between the number of stacks it has, and the
- * number it is supposed to have?
+ * number it is supposed to have?  Only the spds with blocked threads
+ * (in spds_blked) are considered.
  */
 static struct spd_stk_info *
 stkmgr_find_spd_requiring_stk(void)
@@ -495,7 +574,9 @@ stkmgr_find_spd_requiring_stk(void)
 	int i, max_required = 0;
 	struct spd_stk_info *best = NULL;
 
-	for (i = 0 ; i < MAX_NUM_SPDS ; i++) {
+	for (i = bitmap_one_offset(spds_blked, 0, SPD_BLKED_WORDS) ; 
+	     i >= 0 ; 
+	     i = bitmap_one_offset(spds_blked, i+1, SPD_BLKED_WORDS)) {
 		struct spd_stk_info *ssi = &spd_stk_info_list[i];
 		if (!SPD_IS_MANAGED(ssi)) continue;
 
@@ -674,6 +755,7 @@ stkmgr_wait_for_stack(struct spd_stk_info *ssi)
 	DOUT("Adding thd to the blocked list: %d\n", bthd->thd_id);
 	ADD_LIST(&ssi->bthd_list, bthd, next, prev);
 	ssi->num_blocked_thds++;
+	bitmap_set(spds_blked, ssi->spdid);
 
 	RELEASE();
 
@@ -736,6 +818,80 @@ get_cos_info_page(spdid_t spdid)
 }
 
 
+static int
+__spd_concurrency_estimate(struct spd_stk_info *ssi, int reset)
+{
+	int i, avg;
+	unsigned long tot = 0, cnt = 0;
+
+	if (ssi->num_allocated < ssi->num_desired) {
+		return ssi->num_allocated + ssi->num_blocked_thds;
+	}
+
+	for (i = 0 ; i < MAX_BLKED ; i++) {
+		int n = ssi->stat_thd_blk[i];
+
+		tot += (n * i);
+		cnt += n;
+		if (reset) ssi->stat_thd_blk[i] = 0;
+	}
+	if (cnt == 0 && ssi->num_blocked_thds == 0) {
+		avg = ssi->num_allocated;
+	} else {
+		unsigned int blk_hist;
+
+		if (cnt) blk_hist = (tot/cnt) + 1; /* adjust for rounding */
+		else     blk_hist = 0;
+
+		avg = ssi->num_allocated + (blk_hist > ssi->num_blocked_thds ?
+					    blk_hist : ssi->num_blocked_thds);
+	}
+
+	return avg;
+}
+
+/*
+ * How many stacks should we move into the component beyond those it
+ * has?  Enough for its concurrency estimate (and at least demand
+ * more), within its quota, and at most STK_REFILL_MAX at once.
+ */
+static int
+stkmgr_spd_prefetch_amnt(struct spd_stk_info *ssi, int demand)
+{
+	int est, n;
+
+	est = __spd_concurrency_estimate(ssi, 0);
+	if (est < (int)ssi->num_allocated + demand) est = ssi->num_allocated + demand;
+	if (est > (int)ssi->num_desired)            est = ssi->num_desired;
+	n = est - ssi->num_allocated;
+	if (n > STK_REFILL_MAX) n = STK_REFILL_MAX;
+
+	return n < 0 ? 0 : n;
+}
+
+/*
+ * Map up to n stacks into the component, and add them to its
+ * freelist in a single operation.  Returns the number added.
+ */
+static int
+stkmgr_spd_refill(struct spd_stk_info *ssi, int n)
+{
+	struct cos_stk_item *csi, *first = NULL, *last = NULL;
+	int i;
+
+	for (i = 0 ; i < n && ssi->num_allocated < ssi->num_desired ; i++) {
+		csi = freelist_remove();
+		if (!csi) break;
+		stkmgr_stk_add_to_spd(csi, ssi);
+		csi->stk->next = first ? (struct cos_stk *)D_COS_STK_ADDR(first->d_addr) : NULL;
+		first = csi;
+		if (!last) last = csi;
+	}
+	if (first) spd_freelist_add_chain(ssi->spdid, first, last);
+
+	return i;
+}
+
 /**
  * grant a stack to an address
  *
@@ -770,6 +926,8 @@ stkmgr_grant_stack(spdid_t d_spdid)
 		if (info->num_allocated < info->num_desired &&
 		    NULL != (stk_item = freelist_remove())) {
 			stkmgr_stk_add_to_spd(stk_item, info);
+			/* we missed, so expect more concurrent threads */
+			stkmgr_spd_refill(info, stkmgr_spd_prefetch_amnt(info, 1));
 			break;
 		}
 		if (!meas) {
@@ -829,7 +987,10 @@ stkmgr_set_concurrency(spdid_t spdid, int concur_lvl, int remove_spare)
 
 	diff = ssi->num_allocated - ssi->num_desired;
 	if (diff > 0) stkmgr_spd_remove_stacks(spdid, diff);
-	if (diff < 0 && SPD_HAS_BLK_THD(ssi)) spd_wake_threads(spdid);
+	if (diff < 0) {
+		stkmgr_spd_refill(ssi, stkmgr_spd_prefetch_amnt(ssi, ssi->num_blocked_thds));
+		if (SPD_HAS_BLK_THD(ssi)) spd_wake_threads(spdid);
+	}
 
 	if (remove_spare) while (!spd_remove_spare_stacks(ssi)) ;
 
@@ -844,8 +1005,7 @@ int
 stkmgr_spd_concurrency_estimate(spdid_t spdid)
 {
 	struct spd_stk_info *ssi;
-	int i, avg;
-	unsigned long tot = 0, cnt = 0;
+	int avg;
 
 	TAKE();
 	ssi = get_spd_stk_info(spdid);
@@ -853,34 +1013,42 @@ stkmgr_spd_concurrency_estimate(spdid_t spdid)
 		RELEASE();
 		return -1;
 	}
+	assert(ssi->num_allocated >= ssi->num_desired || !SPD_HAS_BLK_THD(ssi));
+	avg = __spd_concurrency_estimate(ssi, 1);
+	RELEASE();
 
-	if (ssi->num_allocated < ssi->num_desired) {
-		assert(!SPD_HAS_BLK_THD(ssi));
-		RELEASE();
-		return ssi->num_allocated;
-	}
+	return avg;
+}
 
-	for (i = 0 ; i < MAX_BLKED ; i++) {
-		int n = ssi->stat_thd_blk[i];
+unsigned long
+stkmgr_spd_blk_percentile(spdid_t spdid, int pct, int reset)
+{
+	struct spd_stk_info *ssi;
+	unsigned long a = 0, cnt = 0, target, sum;
+	int i;
 
-		tot += (n * i);
-		cnt += n;
-		ssi->stat_thd_blk[i] = 0;
+	TAKE();
+	ssi = get_spd_stk_info(spdid);
+	if (!ssi || !SPD_IS_MANAGED(ssi) || pct < 0 || pct > 100) {
+		RELEASE();
+		return -1;
 	}
-	if (cnt == 0 && ssi->num_blocked_thds == 0) {
-		avg = ssi->num_allocated;
-	} else {
-		unsigned int blk_hist;
 
-		if (cnt) blk_hist = (tot/cnt) + 1; /* adjust for rounding */
-		else     blk_hist = 0;
-		
-		avg = ssi->num_allocated + (blk_hist > ssi->num_blocked_thds ? 
-					    blk_hist : ssi->num_blocked_thds); 
+	for (i = 0 ; i < STK_LAT_BUCKETS ; i++) cnt += ssi->blk_lat[i];
+	if (cnt) {
+		/* the smallest latency that pct of the misses are within */
+		target = (cnt * pct + 99) / 100;
+		if (!target) target = 1;
+		for (i = 0, sum = 0 ; i < STK_LAT_BUCKETS ; i++) {
+			sum += ssi->blk_lat[i];
+			if (sum >= target) break;
+		}
+		a = stk_lat_bucket_max(i);
 	}
+	if (reset) memset(ssi->blk_lat, 0, sizeof(ssi->blk_lat));
 	RELEASE();
 
-	return avg;
+	return a;
 }
 
 unsigned long
@@ -989,11 +1157,11 @@ stkmgr_in_freelist(spdid_t spdid, struct cos_stk_item *csi)
 	curr = (void *)info->ci->cos_stacks.freelists[0].freelist;
 	if (curr == NULL) return 0;
 	
-	stk_item = stkmgr_get_cos_stk_item((vaddr_t)curr);
+	stk_item = stkmgr_get_spds_stk_item(spdid, (vaddr_t)curr);
 	while(stk_item) {
 		if (stk_item == csi) return 1;
 		curr = stk_item->stk->next;
-		stk_item = stkmgr_get_cos_stk_item((vaddr_t)curr);    
+		stk_item = stkmgr_get_spds_stk_item(spdid, (vaddr_t)curr);    
 	}
 	return 0;
 }
@@ -1059,7 +1227,7 @@ stkmgr_print_ci_freelist(void)
 		curr = (void *)info->ci->cos_stacks.freelists[0].freelist;
 		if(curr) {
 			DOUT("\tcomponent freelist: %p\n", curr);
-			p = stk_item = stkmgr_get_cos_stk_item((vaddr_t)curr);
+			p = stk_item = stkmgr_get_spds_stk_item(i, (vaddr_t)curr);
 			while (stk_item) {
 				DOUT("\tStack:\n"	\
 				       "\t\tcurr: %X\n"	\
@@ -1070,7 +1238,7 @@ stkmgr_print_ci_freelist(void)
 				       (unsigned int)stk_item->stk->next);
 				print_flags(stk_item->stk);
 				curr = stk_item->stk->next;
-				stk_item = stkmgr_get_cos_stk_item((vaddr_t)curr);
+				stk_item = stkmgr_get_spds_stk_item(i, (vaddr_t)curr);
 				if (p == stk_item) {
 					printc("<<WTF: freelist recursion...>>\n");
 					break;
@@ -172,12 +172,8 @@ twrite(spdid_t spdid, td_t td, int cbid, int sz)
 		int new_sz;
 
 		new_sz = fso->allocated == 0 ? MIN_DATA_SZ : fso->allocated * 2;
-		new    = malloc(new_sz);
+		new    = realloc(fso->data, new_sz);
 		if (!new) ERR_THROW(-ENOMEM, done);
-		if (fso->data) {
-			memcpy(new, fso->data, fso->size);
-			free(fso->data);
-		}
 
 		fso->data      = new;
 		fso->allocated = new_sz;
@@ -33,36 +33,244 @@ cos_lock_t valloc_lock;
 /* vector of vas vectors for spds */
 COS_VECT_CREATE_STATIC(spd_vect);
 
-#define WORDS_PER_PAGE (PAGE_SIZE/sizeof(u32_t))
-#define MAP_MAX WORDS_PER_PAGE
-#define VAS_SPAN (WORDS_PER_PAGE * sizeof(u32_t) * 8)
+/* 
+ * Each component's virtual address space is a set of extents, each
+ * covering one PGD.  The first is the one containing its heap, and
+ * more are obtained from the vas_mgr as needed.  Each extent has a
+ * bitmap of its free pages, and every run of free pages is also a
+ * node in a per-component AVL tree, ordered by (size, address).
+ * Allocation takes the best fit from the tree in O(log n), and frees
+ * coalesce with the neighboring runs found through the bitmap.
+ */
+#define EXTENT_SZ    PGD_SIZE
+#define EXTENT_PAGES (EXTENT_SZ/PAGE_SIZE)
+#define EXTENT_WORDS (EXTENT_PAGES/WORD_SIZE)
 
-/* describes 2^(12+12+3 = 27) bytes */
-struct spd_vas_occupied {
-	u32_t pgd_occupied[WORDS_PER_PAGE];
+struct free_run {
+	struct free_run *l, *r;
+	int height;
+	unsigned long npages;
+	char *addr;
 };
 
-/* #if sizeof(struct spd_vas_occupied) != PAGE_SIZE */
-/* #error "spd_vas_occupied not sized to a page" */
-/* #endif */
-
 struct vas_extent {
-	void *start, *end;
+	char *start, *end;
+	/* a set bit is a free page */
+	u32_t map[EXTENT_WORDS];
 };
 
 struct spd_vas_tracker {
 	spdid_t spdid;
 	struct cos_component_information *ci;
-	struct vas_extent extents[MAX_SPD_VAS_LOCATIONS];
-	/* should be an array to track more than 2^27 bytes */
-	struct spd_vas_occupied *map; 
+	int nextents;
+	struct vas_extent *extents[MAX_SPD_VAS_LOCATIONS];
+	struct free_run *free;
 };
 
+/* -- free run tree --- */
+
+static inline int 
+run_cmp(unsigned long npages, char *addr, struct free_run *r)
+{
+	if (npages != r->npages) return npages < r->npages ? -1 : 1;
+	if (addr != r->addr)     return addr   < r->addr   ? -1 : 1;
+	return 0;
+}
+
+static inline int run_height(struct free_run *r) { return r ? r->height : 0; }
+
+static inline void 
+run_update(struct free_run *r)
+{
+	int lh = run_height(r->l), rh = run_height(r->r);
+
+	r->height = (lh > rh ? lh : rh) + 1;
+}
+
+static struct free_run *
+run_rotate_right(struct free_run *r)
+{
+	struct free_run *l = r->l;
+
+	r->l = l->r;
+	l->r = r;
+	run_update(r);
+	run_update(l);
+
+	return l;
+}
+
+static struct free_run *
+run_rotate_left(struct free_run *r)
+{
+	struct free_run *n = r->r;
+
+	r->r = n->l;
+	n->l = r;
+	run_update(r);
+	run_update(n);
+
+	return n;
+}
+
+static struct free_run *
+run_balance(struct free_run *r)
+{
+	int b;
+
+	run_update(r);
+	b = run_height(r->l) - run_height(r->r);
+	if (b > 1) {
+		if (run_height(r->l->l) < run_height(r->l->r)) r->l = run_rotate_left(r->l);
+		return run_rotate_right(r);
+	}
+	if (b < -1) {
+		if (run_height(r->r->r) < run_height(r->r->l)) r->r = run_rotate_right(r->r);
+		return run_rotate_left(r);
+	}
+	return r;
+}
+
+static struct free_run *
+run_insert(struct free_run *t, struct free_run *n)
+{
+	if (!t) {
+		n->l = n->r = NULL;
+		n->height = 1;
+		return n;
+	}
+	if (run_cmp(n->npages, n->addr, t) < 0) t->l = run_insert(t->l, n);
+	else                                    t->r = run_insert(t->r, n);
+
+	return run_balance(t);
+}
+
+static struct free_run *
+run_remove_min(struct free_run *t, struct free_run **min)
+{
+	if (!t->l) {
+		*min = t;
+		return t->r;
+	}
+	t->l = run_remove_min(t->l, min);
+
+	return run_balance(t);
+}
+
+/* remove the run (npages, addr), returned in *rem */
+static struct free_run *
+run_remove(struct free_run *t, unsigned long npages, char *addr, struct free_run **rem)
+{
+	int c;
+
+	if (!t) return NULL;
+	c = run_cmp(npages, addr, t);
+	if (c < 0) {
+		t->l = run_remove(t->l, npages, addr, rem);
+	} else if (c > 0) {
+		t->r = run_remove(t->r, npages, addr, rem);
+	} else {
+		struct free_run *m;
+
+		*rem = t;
+		if (!t->r) return t->l;
+		t->r = run_remove_min(t->r, &m);
+		m->l = t->l;
+		m->r = t->r;
+		t    = m;
+	}
+	return run_balance(t);
+}
+
+/* the smallest run of at least npages (the lowest addressed on ties) */
+static struct free_run *
+run_best_fit(struct free_run *t, unsigned long npages)
+{
+	struct free_run *best = NULL;
+
+	while (t) {
+		if (t->npages >= npages) {
+			best = t;
+			t    = t->l;
+		} else {
+			t    = t->r;
+		}
+	}
+	return best;
+}
+
+/* -- extents --- */
+
+static struct vas_extent *
+extent_lookup(struct spd_vas_tracker *trac, char *addr)
+{
+	int i;
+
+	for (i = 0 ; i < trac->nextents ; i++) {
+		struct vas_extent *e = trac->extents[i];
+
+		if (addr >= e->start && addr < e->end) return e;
+	}
+	return NULL;
+}
+
+/* 
+ * Add an extent whose pages from off on are free, and the run of
+ * them to the tree.
+ */
+static int 
+extent_add(struct spd_vas_tracker *trac, char *start, unsigned long off)
+{
+	struct vas_extent *e;
+	struct free_run *r;
+
+	if (trac->nextents == MAX_SPD_VAS_LOCATIONS) return -1;
+	e = malloc(sizeof(struct vas_extent));
+	if (!e) return -1;
+	r = malloc(sizeof(struct free_run));
+	if (!r) goto err_free;
+
+	e->start = start;
+	e->end   = start + EXTENT_SZ;
+	memset(e->map, 0, sizeof(e->map));
+	bitmap_set_contig(e->map, off, EXTENT_PAGES-off, 1);
+	r->npages = EXTENT_PAGES-off;
+	r->addr   = start + off*PAGE_SIZE;
+	trac->free = run_insert(trac->free, r);
+	trac->extents[trac->nextents++] = e;
+
+	return 0;
+err_free:
+	free(e);
+	return -1;
+}
+
+/* grow the component's address space by another extent */
+static int 
+extent_expand(struct spd_vas_tracker *trac)
+{
+	vaddr_t a;
+
+	if (trac->nextents == MAX_SPD_VAS_LOCATIONS) return -1;
+	a = vas_mgr_expand(cos_spd_id(), trac->spdid, EXTENT_SZ);
+	if (!a) return -1;
+	if (extent_add(trac, (char *)a, 0)) {
+		vas_mgr_contract(cos_spd_id(), trac->spdid, a);
+		return -1;
+	}
+	return 0;
+}
+
+static inline unsigned long 
+extent_off(struct vas_extent *e, char *addr)
+{
+	return (addr - e->start)/PAGE_SIZE;
+}
+
 static int __valloc_init(spdid_t spdid)
 {
 	int ret = -1;
 	struct spd_vas_tracker *trac;
-	struct spd_vas_occupied *occ;
 	struct cos_component_information *ci;
 	unsigned long page_off;
 	void *hp;
@@ -70,21 +278,16 @@ static int __valloc_init(spdid_t spdid)
 	if (cos_vect_lookup(&spd_vect, spdid)) goto success;
 	trac = malloc(sizeof(struct spd_vas_tracker));
 	if (!trac) goto done;
+	memset(trac, 0, sizeof(struct spd_vas_tracker));
 
-	occ = alloc_page();
-	if (!occ) goto err_free1;
-	
 	ci = cos_get_vas_page();
-	if (cinfo_map(cos_spd_id(), (vaddr_t)ci, spdid)) goto err_free2;
+	if (cinfo_map(cos_spd_id(), (vaddr_t)ci, spdid)) goto err_free1;
 	hp = (void*)ci->cos_heap_ptr;
 
-	trac->spdid            = spdid;
-	trac->ci               = ci;
-	trac->map              = occ;
-	trac->extents[0].start = (void*)round_to_pgd_page(hp);
-	trac->extents[0].end   = (void*)round_up_to_pgd_page(hp);
+	trac->spdid = spdid;
+	trac->ci    = ci;
 	page_off = ((unsigned long)hp - (unsigned long)round_to_pgd_page(hp))/PAGE_SIZE;
-	bitmap_set_contig(&occ->pgd_occupied[0], page_off, (PGD_SIZE/PAGE_SIZE)-page_off, 1);
+	if (extent_add(trac, (char *)round_to_pgd_page(hp), page_off)) goto err_free2;
 
 	cos_vect_add_id(&spd_vect, trac, spdid);
 	assert(cos_vect_lookup(&spd_vect, spdid));
@@ -94,7 +297,6 @@ done:
 	return ret;
 err_free2:
 	cos_release_vas_page(ci);
-	free_page(occ);
 err_free1:
 	free(trac);
 	goto done;
@@ -104,8 +306,8 @@ void *valloc_alloc(spdid_t spdid, spdid_t dest, unsigned long npages)
 {
 	void *ret = NULL;
 	struct spd_vas_tracker *trac;
-	struct spd_vas_occupied *occ;
-	long off;
+	struct vas_extent *e;
+	struct free_run *r, *rem = NULL;
 
 	LOCK();
 	trac = cos_vect_lookup(&spd_vect, dest);
@@ -113,31 +315,122 @@ void *valloc_alloc(spdid_t spdid, spdid_t dest, unsigned long npages)
 		if (__valloc_init(dest) ||
 		    !(trac = cos_vect_lookup(&spd_vect, dest))) goto done;
 	}
-	occ = trac->map;
-	assert(occ);
-	off = bitmap_extent_find_set(&occ->pgd_occupied[0], 0, npages, MAP_MAX);
-	if (off < 0) goto done;
-	ret = ((char *)trac->extents[0].start) + (off * PAGE_SIZE);
+	if (!npages || npages > EXTENT_PAGES) goto done;
+	r = run_best_fit(trac->free, npages);
+	if (!r) {
+		if (extent_expand(trac)) goto done;
+		r = run_best_fit(trac->free, npages);
+		assert(r);
+	}
+	trac->free = run_remove(trac->free, r->npages, r->addr, &rem);
+	assert(rem == r);
+	ret = r->addr;
+	if (r->npages > npages) {
+		r->addr   += npages * PAGE_SIZE;
+		r->npages -= npages;
+		trac->free = run_insert(trac->free, r);
+	} else {
+		free(r);
+	}
+	e = extent_lookup(trac, ret);
+	assert(e);
+	bitmap_set_contig(e->map, extent_off(e, ret), npages, 0);
 done:   
 	UNLOCK();
 	return ret;
 }
 
+int valloc_alloc_at(spdid_t spdid, spdid_t dest, void *addr, unsigned long npages)
+{
+	int ret = -1;
+	struct spd_vas_tracker *trac;
+	struct vas_extent *e;
+	struct free_run *r = NULL, *n = NULL;
+	unsigned long off, start, end;
+
+	LOCK();
+	trac = cos_vect_lookup(&spd_vect, dest);
+	if (!trac) goto done;
+	e = extent_lookup(trac, addr);
+	if (!e) goto done;
+	off = extent_off(e, addr);
+	if (!npages || off+npages > EXTENT_PAGES) goto done;
+	/* are the pages all within a single free run? */
+	if (!bitmap_check(e->map, off)) goto done;
+	end = bitmap_run_end(e->map, off, 1, EXTENT_WORDS);
+	if (end < off+npages) goto done;
+	start = bitmap_run_start(e->map, off, 1);
+	/* the run is split in two around the allocation */
+	if (start < off && end > off+npages) {
+		n = malloc(sizeof(struct free_run));
+		if (!n) goto done;
+	}
+
+	trac->free = run_remove(trac->free, end-start, e->start + start*PAGE_SIZE, &r);
+	assert(r);
+	if (start < off) {
+		r->addr    = e->start + start*PAGE_SIZE;
+		r->npages  = off-start;
+		trac->free = run_insert(trac->free, r);
+		r          = n;
+	}
+	if (end > off+npages) {
+		r->addr    = (char *)addr + npages*PAGE_SIZE;
+		r->npages  = end-(off+npages);
+		trac->free = run_insert(trac->free, r);
+		r          = NULL;
+	}
+	if (r) free(r);
+	bitmap_set_contig(e->map, off, npages, 0);
+	ret = 0;
+done:
+	UNLOCK();
+	return ret;
+}
+
 int valloc_free(spdid_t spdid, spdid_t dest, void *addr, unsigned long npages)
 {
 	int ret = -1;
 	struct spd_vas_tracker *trac;
-	struct spd_vas_occupied *occ;
-	unsigned long off;
+	struct vas_extent *e;
+	struct free_run *l = NULL, *r = NULL;
+	unsigned long off, start, end;
 
 	LOCK();
 	trac = cos_vect_lookup(&spd_vect, dest);
 	if (!trac) goto done;
-	occ = trac->map;
-	assert(occ);
-	off = ((char *)addr - (char *)trac->extents[0].start)/PAGE_SIZE;
-	assert(off+npages < MAP_MAX*sizeof(u32_t));
-	bitmap_set_contig(&occ->pgd_occupied[0], off, npages, 1);
+	e = extent_lookup(trac, addr);
+	if (!e) goto done;
+	off = extent_off(e, addr);
+	assert(off+npages <= EXTENT_PAGES);
+	/* should not be free already */
+	assert(bitmap_run_end(e->map, off, 0, EXTENT_WORDS) >= (int)(off+npages));
+
+	/* coalesce with the free runs on either side */
+	start = off;
+	end   = off+npages;
+	if (off > 0 && bitmap_check(e->map, off-1)) {
+		start      = bitmap_run_start(e->map, off-1, 1);
+		trac->free = run_remove(trac->free, off-start, e->start + start*PAGE_SIZE, &l);
+		assert(l);
+	}
+	if (end < EXTENT_PAGES && bitmap_check(e->map, end)) {
+		unsigned long rend = bitmap_run_end(e->map, end, 1, EXTENT_WORDS);
+
+		trac->free = run_remove(trac->free, rend-end, e->start + end*PAGE_SIZE, &r);
+		assert(r);
+		end = rend;
+	}
+	if (!l) l = r;
+	else if (r) free(r);
+	if (!l) {
+		l = malloc(sizeof(struct free_run));
+		if (!l) goto done;
+	}
+	l->addr    = e->start + start*PAGE_SIZE;
+	l->npages  = end-start;
+	trac->free = run_insert(trac->free, l);
+	bitmap_set_contig(e->map, off, npages, 1);
 	ret = 0;
 done:	
 	UNLOCK();
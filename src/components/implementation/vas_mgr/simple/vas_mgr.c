@@ -13,6 +13,7 @@
 #include <cos_vect.h>
 #include <vas_mgr.h>
 #include <sched.h>
+#include <bitmap.h>
 
 COS_VECT_CREATE_STATIC(spd_vas_map);
 cos_lock_t vas_lock;
@@ -31,29 +32,48 @@ struct spd_vas_info {
 
 struct vas_desc {
 	struct spd_vas_info *(s[PGD_PER_PTBL]);
+	/* 
+	 * Index of the free slots in s: a set bit is a free slot.
+	 * Runs of free slots are found a word at a time.
+	 */
+	u32_t free[PGD_PER_PTBL/WORD_SIZE];
 } *vas;
 
+#define SLOT_START (SERVICE_START>>PGD_SHIFT)
+#define SLOT_END   (SERVICE_END>>PGD_SHIFT)
+
 /* Till we have complete information when this component starts about
  * which virtual addresses are taken, we will keep this around. */
 struct spd_vas_info unknown = {.spdid = 0, };
 
-vaddr_t vas_mgr_expand(spdid_t spd, long amnt)
+static inline void 
+vas_slots_set(unsigned long idx, unsigned long n, struct spd_vas_info *svi)
+{
+	unsigned long i;
+
+	for (i = idx ; i < idx+n ; i++) vas->s[i] = svi;
+	bitmap_set_contig(&vas->free[0], idx, n, svi == NULL);
+}
+
+vaddr_t vas_mgr_expand(spdid_t spd, spdid_t dest, long amnt)
 {
 	struct spd_vas_info *svi;
 	vaddr_t ret = 0;
-	int loc;
-	unsigned long a, i, nentries;
+	int loc, s_idx;
+	unsigned long i, nentries;
 
 	amnt = round_up_to_pgd_page(amnt); 
+	nentries = amnt>>PGD_SHIFT;
+	if (!nentries) return 0;
 	LOCK();
-	svi = cos_vect_lookup(&spd_vas_map, spd);
+	svi = cos_vect_lookup(&spd_vas_map, dest);
 	if (!svi) {
 		svi = malloc(sizeof(struct spd_vas_info));
 		if (!svi) goto done;
 		memset(svi, 0, sizeof(struct spd_vas_info));
-		svi->spdid = spd;
+		svi->spdid = dest;
 		svi->vas = vas;
-		if (-1 == cos_vect_add_id(&spd_vas_map, svi, spd)) {
+		if (-1 == cos_vect_add_id(&spd_vas_map, svi, dest)) {
 			free(svi);
 			goto done;
 		}
@@ -63,48 +83,49 @@ vaddr_t vas_mgr_expand(spdid_t spd, long amnt)
 		if (!svi->locations[i].size) break;
 	}
 	if (i == MAX_SPD_VAS_LOCATIONS) goto done;
-
 	loc = i;
-	nentries = amnt>>PGD_SHIFT;
-	for (a = SERVICE_START, i = SERVICE_START>>PGD_SHIFT ; 
-	     a < (SERVICE_END-amnt) ; 
-	     a += SERVICE_SIZE, i++) {
-		unsigned long s = a, s_idx = i;
-		int found = 1;
-
-		printc("i=%ld, %ld\n", i, nentries);
-
-		for (; i < (s_idx + nentries) ; a += SERVICE_SIZE, i++) {
-			if (vas->s[i]) {
-				found = 0;
-				break;
-			}
-			printc("a\n");
-		}
-		printc("found %d\n", found);
-		a -= SERVICE_SIZE;
-		i--;
-		if (!found) continue;
-		
-		if (cos_vascntl(0,((COS_VAS_SPD_EXPAND << 16) & 0xFFFF0000) + spd, s, amnt)) {
-			vas->s[s_idx] = &unknown;
-			continue;
+
+	while (1) {
+		vaddr_t s;
+
+		s_idx = bitmap_contiguous_ones(&vas->free[0], SLOT_START, nentries, PGD_PER_PTBL/WORD_SIZE);
+		if (s_idx < 0) goto done;
+		s = (vaddr_t)s_idx << PGD_SHIFT;
+		if (!cos_vas_cntl(COS_VAS_SPD_EXPAND, dest, s, amnt)) {
+			vas_slots_set(s_idx, nentries, svi);
+			svi->locations[loc].size = amnt;
+			svi->locations[loc].base = ret = s;
+			break;
 		}
-		/* success */
-		for (i = s_idx ; i < (s_idx + nentries) ; i++) vas->s[i] = svi;
-		svi->locations[loc].size = amnt;
-		svi->locations[loc].base = ret = s;
-		break;
+		/* someone we don't know about owns the slot */
+		vas_slots_set(s_idx, 1, &unknown);
 	}
 done:
 	UNLOCK();
 	return ret;
 }
 
-void vas_mgr_contract(spdid_t spd, vaddr_t addr)
+/* remove the region at addr previously expanded into dest */
+int vas_mgr_contract(spdid_t spd, spdid_t dest, vaddr_t addr)
 {
-	/* -NOTSUP */
-	BUG();
+	struct spd_vas_info *svi;
+	int i, ret = -1;
+
+	LOCK();
+	svi = cos_vect_lookup(&spd_vas_map, dest);
+	if (!svi) goto done;
+	for (i = 0 ; i < MAX_SPD_VAS_LOCATIONS ; i++) {
+		if (svi->locations[i].size && svi->locations[i].base == addr) break;
+	}
+	if (i == MAX_SPD_VAS_LOCATIONS) goto done;
+	if (cos_vas_cntl(COS_VAS_SPD_RETRACT, dest, addr, svi->locations[i].size)) goto done;
+	vas_slots_set(addr>>PGD_SHIFT, svi->locations[i].size>>PGD_SHIFT, NULL);
+	svi->locations[i].size = 0;
+	svi->locations[i].base = 0;
+	ret = 0;
+done:
+	UNLOCK();
+	return ret;
 }
 
 static void init(void)
@@ -113,9 +134,11 @@ static void init(void)
 
 	lock_static_init(&vas_lock);
 	cos_vect_init_static(&spd_vas_map);
-	vas = alloc_page();
+	vas = malloc(sizeof(struct vas_desc));
 	assert(vas);
 	for (i = 0 ; i < PGD_PER_PTBL ; i++) vas->s[i] = NULL;
+	memset(vas->free, 0, sizeof(vas->free));
+	bitmap_set_contig(&vas->free[0], SLOT_START, SLOT_END-SLOT_START, 1);
 }
 
 void cos_init(void *arg)
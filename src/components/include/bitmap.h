@@ -1,20 +1,34 @@
 #ifndef BITMAP_H
 #define BITMAP_H
 
+#ifdef LINUX
+typedef unsigned int u32_t;
+#define WORD_SIZE 32
+#else
 #include <cos_types.h>
 #include <consts.h>
+#endif
 
-/* Many of these taken from aggregate.org/MAGIC */
+/* 
+ * Many of these were taken from aggregate.org/MAGIC.  Bit scans use
+ * the compiler's builtins (bsf/bsr).  Population count only does
+ * when there is an instruction for it, as otherwise the builtin is a
+ * libgcc call.
+ */
 
 static inline u32_t 
 ones(u32_t x)
 {
+#ifdef __POPCNT__
+	return __builtin_popcount(x);
+#else
 	x -= ((x >> 1) & 0x55555555);
 	x = (((x >> 2) & 0x33333333) + (x & 0x33333333));
 	x = (((x >> 4) + x) & 0x0F0F0F0F);
 	x += (x >> 8);
 	x += (x >> 16);
 	return x & 0x0000003f;
+#endif
 }
 
 /* next largest power of 2 */
@@ -36,49 +50,49 @@ ls_one(u32_t x)
 	return (x&-x);
 }
 
+/* 
+ * ceil(log2(x)), and 0 for x == 0.  For a power of two, such as
+ * ls_one's result, this is the offset of its bit, as with
+ * log32_floor.  For other values the two differ by one: use
+ * log32_floor for the most significant one.
+ */
 static inline u32_t
 log32(u32_t x)
 {
-	u32_t y = (x & (x - 1));
-	
-	y |= -y;
-	y >>= (WORD_SIZE - 1);
-	x |= (x >> 1);
-	x |= (x >> 2);
-	x |= (x >> 4);
-	x |= (x >> 8);
-	x |= (x >> 16);
-	return ones(x >> 1) - y;
+	return x <= 1 ? 0 : WORD_SIZE - __builtin_clz(x - 1);
 }
 
+/* floor(log2(x)): the most significant one */
 static inline u32_t
 log32_floor(u32_t x)
 {
-	x |= (x >> 1);
-	x |= (x >> 2);
-	x |= (x >> 4);
-	x |= (x >> 8);
-	x |= (x >> 16);
-	return ones(x >> 1);
+	return x == 0 ? 0 : (WORD_SIZE - 1) - __builtin_clz(x);
+}
+
+/* the offset of the least significant one; x must be non-zero */
+static inline int
+__bitmap_ffs(u32_t x)
+{
+	return __builtin_ctz(x);
 }
 
 /* set bit v in x.  v is offset from 0. */
 static inline u32_t
 __bitmap_set(u32_t x, int v)
 {
-	return x | (1<<v);
+	return x | (1U<<v);
 }
 
 static inline int
 __bitmap_check(u32_t x, int v)
 {
-	return x & (1<<v);
+	return x & (1U<<v);
 }
 
 static inline u32_t
 __bitmap_unset(u32_t x, int v)
 {
-	return x & ~(1<<v);
+	return x & ~(1U<<v);
 }
 
 static inline void
@@ -113,12 +127,10 @@ bitmap_unset(u32_t *x, int v)
 static inline int
 bitmap_one(u32_t *x, int max)
 {
-	int i, order;
+	int i;
 
 	for (i = 0 ; i < max ; i++) {
-		if (!x[i]) continue;
-		order = log32(ls_one(x[i]));
-		return (i * WORD_SIZE) + order;
+		if (x[i]) return (i * WORD_SIZE) + __bitmap_ffs(x[i]);
 	}
 	return -1;
 }
@@ -130,10 +142,11 @@ bitmap_one_offset(u32_t *x, int off, int max)
 {
 	int subword = off&(WORD_SIZE-1), words = off/WORD_SIZE, ret;
 	
+	if (words >= max) return -1;
 	/* do we have an offset into a word? */
 	if (subword) {
 		u32_t v = x[words] >> subword;
-		if (v) return log32(ls_one(v)) + off;
+		if (v) return __bitmap_ffs(v) + off;
 		words++;
 	}
 	ret = bitmap_one(x+words, max-words);
@@ -141,37 +154,131 @@ bitmap_one_offset(u32_t *x, int off, int max)
 	return ret;
 }
 
+/* a mask of n bits starting at bit b; b+n <= WORD_SIZE */
+static inline u32_t
+__bitmap_mask(int b, int n)
+{
+	return (n == WORD_SIZE) ? ~0U : ((1U<<n)-1) << b;
+}
+
 static inline void
 bitmap_set_contig(u32_t *x, int off, int extent, int one)
 {
-	int i;
+	int idx = off/WORD_SIZE, end = off+extent;
 
-	/* TODO: could optimize by setting blocks of 8, 16, 32... */
-	for (i = off ; i < off+extent ; i++) {
-		if (one) bitmap_set(x, i);
-		else     bitmap_unset(x, i);
-	} 
+	/* a partial word, whole words, then another partial word */
+	while (off < end) {
+		int b = off & (WORD_SIZE-1), n = WORD_SIZE - b;
+		u32_t m;
+
+		if (n > end-off) n = end-off;
+		m = __bitmap_mask(b, n);
+		if (one) x[idx] |= m;
+		else     x[idx] &= ~m;
+		off += n;
+		idx++;
+	}
 }
 
+/* 
+ * Find the end of the run of ones (if one), or zeros (otherwise),
+ * starting at bit off: the offset of the first bit that differs, or
+ * the size of the bitmap (max is in u32_ts) if the run reaches its
+ * end.  Whole words are skipped at a time.
+ */
 static inline int
-bitmap_contiguous_ones(u32_t *x, int off, int extent, int max)
+bitmap_run_end(u32_t *x, int off, int one, int max)
 {
-	int i, prev, start;
-
-	prev = start = 0;
-	for (i = 0 ; i < (int)(max*sizeof(u32_t)) ; i++) {
-		prev = i;
-		i = bitmap_one_offset(x, i, max);
-		/* end of bitmap? */
-		if (i < 0) return -1;
-		/* uncontiguous? */
-		else if (i != prev) start = i;
-		/* found an appropriate extent? */
-		else if (i-start == extent) return start;
+	int idx = off/WORD_SIZE;
+	u32_t w;
+
+	if (idx >= max) return max*WORD_SIZE;
+	/* the bits that end the run */
+	w  = one ? ~x[idx] : x[idx];
+	w &= ~0U << (off & (WORD_SIZE-1));
+	while (!w) {
+		if (++idx == max) return max*WORD_SIZE;
+		w = one ? ~x[idx] : x[idx];
+	}
+	return idx*WORD_SIZE + __bitmap_ffs(w);
+}
+
+/* 
+ * The inverse of bitmap_run_end: the first bit of the run of ones
+ * (or zeros) that includes bit off.
+ */
+static inline int
+bitmap_run_start(u32_t *x, int off, int one)
+{
+	int idx = off/WORD_SIZE, b = off & (WORD_SIZE-1);
+	u32_t w;
+
+	w = one ? ~x[idx] : x[idx];
+	if (b != WORD_SIZE-1) w &= (1U<<(b+1))-1;
+	while (!w) {
+		if (idx-- == 0) return 0;
+		w = one ? ~x[idx] : x[idx];
+	}
+	return idx*WORD_SIZE + log32_floor(w) + 1;
+}
+
+/* set or clear the bits in [off, off+extent) */
+static inline void
+bitmap_set_range(u32_t *x, int off, int extent)
+{
+	bitmap_set_contig(x, off, extent, 1);
+}
+
+static inline void
+bitmap_clear_range(u32_t *x, int off, int extent)
+{
+	bitmap_set_contig(x, off, extent, 0);
+}
+
+/* the number of ones in the bitmap */
+static inline int
+bitmap_count(u32_t *x, int max)
+{
+	int i, n = 0;
+
+	for (i = 0 ; i < max ; i++) n += ones(x[i]);
+	return n;
+}
+
+/* 
+ * Find the first run of at least extent ones (if one), or zeros,
+ * at or after bit off.  Runs are delimited a word at a time.
+ */
+static inline int
+__bitmap_run_find(u32_t *x, int off, int extent, int max, int one)
+{
+	int i = off, end;
+
+	while (i < max*WORD_SIZE) {
+		/* the start of the next run */
+		i = bitmap_run_end(x, i, !one, max);
+		if (i >= max*WORD_SIZE) return -1;
+		end = bitmap_run_end(x, i, one, max);
+		if (end - i >= extent) return i;
+		i = end;
 	}
 	return -1;
 }
 
+/* find extent contiguous ones at or after bit off */
+static inline int
+bitmap_contiguous_ones(u32_t *x, int off, int extent, int max)
+{
+	return __bitmap_run_find(x, off, extent, max, 1);
+}
+
+/* find extent contiguous zeros at or after bit off */
+static inline int
+bitmap_zero_run_find(u32_t *x, int off, int extent, int max)
+{
+	return __bitmap_run_find(x, off, extent, max, 0);
+}
+
 /* find a contiguous extent of ones, and set them to zero */
 static inline int
 bitmap_extent_find_set(u32_t *x, int off, int extent, int max)
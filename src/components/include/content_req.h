@@ -3,4 +3,17 @@
 
 typedef long content_req_t;
 
+/* 
+ * The *more argument of the *_retrieve_cbuf functions returns these
+ * flags.
+ */
+#define CONTENT_MORE    0x1 	/* more of the response is to come */
+#define CONTENT_PERSIST 0x2 	/* the cbuf is never freed or modified */
+/* 
+ * A content provider ORs this into *more on the last retrieve of a
+ * response that must not be cached (e.g. an error or "not found").
+ * The content manager masks it out before returning *more.
+ */
+#define CONTENT_NOCACHE 0x4
+
 #endif 	    /* !CONTENT_REQ_H */
@@ -7,6 +7,8 @@
 
 void *malloc(size_t sz);
 void free(void *addr);
+void *calloc(size_t nmemb, size_t sz);
+void *realloc(void *addr, size_t sz);
 void free_page(void *ptr);
 void *alloc_page(void);
 
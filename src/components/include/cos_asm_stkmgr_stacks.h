@@ -15,16 +15,46 @@
 #ifdef  USE_NEW_STACKS
 
 
+/*
+ * The component's stack freelist (the first word of cos_comp_info)
+ * is shared by its threads, and refilled by the stack manager, so
+ * stacks are popped and pushed with cmpxchg, retrying if another
+ * thread changed the freelist in the meantime.  A pop replaces the
+ * head and increments the generation in the word after it with one
+ * cmpxchg8b: a thread preempted between reading the head's next
+ * pointer and its cmpxchg will fail (rather than install a stale
+ * next) if the head was popped and pushed back in the meantime.  The
+ * pop needs %ebx and %ecx, so it saves them on the thread's scratch
+ * stack (in stkmgr_stack_space).  Pushes can't suffer from ABA, so
+ * they cmpxchg only the head.  The push clobbers %eax, which holds
+ * the return capability.
+ */
 #define COS_ASM_GET_STACK                       \
+        /* get stk space */                     \
+        movl $THD_ID_SHARED_PAGE, %eax;         \
+        movl (%eax), %eax;                      \
+        movl $stkmgr_stack_space, %esp;         \
+        shl  $7, %eax;                          \
+        addl %eax, %esp;                        \
+        pushl %ebx;                             \
+        pushl %ecx;                             \
+5:                                              \
         /* Check to see if we have a stk */     \
-        movl  cos_comp_info, %edx;              \
-        testl %edx, %edx;                       \
-        je    2f;                               \
+        movl  cos_comp_info+4, %edx;            \
+        movl  cos_comp_info, %eax;              \
+        testl %eax, %eax;                       \
+        je    6f;                               \
                                                 \
-        /* We have a stack */                   \
-        movl cos_comp_info, %eax;               \
-        movl (%eax), %edx;                      \
-        movl %edx, cos_comp_info;               \
+        /* We have a stack: pop it */           \
+        movl  (%eax), %ebx;                     \
+        leal  1(%edx), %ecx;                    \
+        cmpxchg8b cos_comp_info;                \
+        jne   5b;                               \
+6:                                              \
+        popl  %ecx;                             \
+        popl  %ebx;                             \
+        testl %eax, %eax;                       \
+        je    2f;                               \
         addl $4, %eax;                          \
 1:                                              \
         /* Return Stack */                      \
@@ -36,7 +66,9 @@
 
 #define COS_ASM_REQUEST_STACK                   \
 2:                                              \
-        /* get stk space */                     \
+        /* get stk space (again) */             \
+        movl $THD_ID_SHARED_PAGE, %eax;         \
+        movl (%eax), %eax;                      \
         movl $stkmgr_stack_space, %esp;         \
         shl  $7, %eax;                          \
         addl %eax, %esp;                        \
@@ -77,9 +109,12 @@
         addl $4, %esp;                          \
         pushl $0x00;  /* Flag Mark Not in Use */\
         pushl $0xFACE;  /* next */              \
-        movl cos_comp_info, %edx;               \
-        movl %edx, (%esp);                      \
-        movl %esp, cos_comp_info;               \
+6:                                              \
+        movl cos_comp_info, %eax;               \
+        movl %eax, (%esp);                      \
+        cmpxchgl %esp, cos_comp_info;           \
+        jne  6b;                                \
+        movl $RET_CAP, %eax;                    \
         jmp  4f;                                \
 3:                                              \
         /* stkmgr wants stack back */           \
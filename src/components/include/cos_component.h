@@ -349,8 +349,10 @@ static inline void *cos_memset(void * s, char c , int count)
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
 
-/* functionality for managing the argument region */
-#define COS_ARGREG_SZ PAGE_SIZE /* must be power of 2 */
+/* 
+ * functionality for managing the argument region: COS_ARGREG_SZ
+ * (COS_ARGREG_PAGES pages, see consts.h) per thread.
+ */
 #define COS_ARGREG_USABLE_SZ \
 	(COS_ARGREG_SZ-sizeof(struct cos_argreg_extent)-sizeof(struct pt_regs))
 #define COS_MAX_ARG_SZ COS_ARGREG_USABLE_SZ
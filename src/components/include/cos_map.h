@@ -12,6 +12,9 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#ifndef BUG
+#define BUG() assert(0)
+#endif
 #else
 #define COS_FMT_PRINT
 #include <cos_component.h>
@@ -28,16 +31,18 @@
 #include <cos_vect.h>
 
 /* 
- * A map is one vector, that contains alternating slots for values and
- * freelist.  One to keep pointers to the data, and one to track the
- * free entries in the data vector.  Maps are optimized to add values
- * in general into an unspecified slot (they create the
- * index). Vectors are like arrays in that to find an arbitrary slot,
- * you have O(n).  This is the difference between the two.  In the
- * map, adding into a specific id is O(n).
+ * A map is three vectors: one keeps pointers to the data, and two
+ * parallel ones track the free entries in the data vector (the next
+ * and previous free ids).  All three are indexed by the map id, so a
+ * map spans the same ids as a vector.  Maps are optimized to add
+ * values in general into an unspecified slot (they create the
+ * index). Vectors are like arrays in that you choose the slot.  As
+ * the free list is doubly linked, a map can also add into a specific
+ * id in O(1).  Allocated ids are marked in the next vector so that
+ * deletions can be checked.
  */
 typedef struct cos_map_struct {
-	cos_vect_t data;
+	cos_vect_t data, next, prev;
 	long free_list, id_boundary;
 } cos_map_t;
 
@@ -45,34 +50,69 @@ typedef struct cos_map_struct {
 #define COS_MAP_BASE (COS_VECT_BASE/2)
 #endif
 
+#define COS_MAP_FREE_END   (-1)
+#define COS_MAP_ALLOCATED  (-2)
+
 /* depth = 0 indicates that we haven't initialized the structure */
 #define COS_MAP_CREATE_STATIC(name)					 \
 	struct cos_vect_intern_struct __##name##_vect[ COS_VECT_BASE ];	 \
+	struct cos_vect_intern_struct __##name##_next[ COS_VECT_BASE ];	 \
+	struct cos_vect_intern_struct __##name##_prev[ COS_VECT_BASE ];	 \
 	cos_map_t name = {.data = {.depth = 0, .vect = __##name##_vect}, \
+			  .next = {.depth = 0, .vect = __##name##_next}, \
+			  .prev = {.depth = 0, .vect = __##name##_prev}, \
 			  .free_list = 0}
 
+static inline long __cos_map_get(cos_vect_t *v, long mid)
+{
+	struct cos_vect_intern_struct *is = __cos_vect_lookup(v, mid);
 
-static inline long cos_vect_to_map_id(long vid) { return vid/2; }
-static inline long cos_map_to_vect_id(long mid) { return mid*2; }
-static inline long cos_map_to_vect_freeid(long mid) { return cos_map_to_vect_id(mid)+1; }
-static inline struct cos_vect_intern_struct *cos_val_to_free(struct cos_vect_intern_struct *val) { return val+1; }
-static inline struct cos_vect_intern_struct *cos_free_to_val(struct cos_vect_intern_struct *f) { return f-1; }
+	assert(is);
+	return (long)is->val;
+}
 
-static inline void __cos_map_init(cos_map_t *m)
+static inline void __cos_map_set(cos_vect_t *v, long mid, long val)
 {
-	int i;
+	if (__cos_vect_set(v, mid, (void*)val)) BUG();
+}
+
+/* 
+ * Add the ids from the current boundary up to (not including) upper
+ * to the head of the free list.
+ */
+static inline int __cos_map_grow(cos_map_t *m, long upper)
+{
+	long lower = m->id_boundary, i;
+
+	for (i = lower ; i < upper ; i += COS_MAP_BASE) {
+		if (NULL == __cos_vect_lookup(&m->data, i) && 
+		    __cos_vect_expand(&m->data, i)) return -1;
+		if (NULL == __cos_vect_lookup(&m->next, i) &&
+		    __cos_vect_expand(&m->next, i)) return -1;
+		if (NULL == __cos_vect_lookup(&m->prev, i) &&
+		    __cos_vect_expand(&m->prev, i)) return -1;
+	}
+	for (i = lower ; i < upper ; i++) {
+		__cos_map_set(&m->next, i, i+1 == upper ? m->free_list : i+1);
+		__cos_map_set(&m->prev, i, i == lower ? COS_MAP_FREE_END : i-1);
+	}
+	if (m->free_list != COS_MAP_FREE_END) __cos_map_set(&m->prev, m->free_list, upper-1);
+	m->free_list   = lower;
+	m->id_boundary = upper;
+
+	return 0;
+}
 
+static inline void __cos_map_init(cos_map_t *m)
+{
 	assert(m);
 	if (__cos_vect_init(&m->data)) BUG();
-	m->free_list = 0;
-	m->id_boundary = COS_MAP_BASE;
+	if (__cos_vect_init(&m->next)) BUG();
+	if (__cos_vect_init(&m->prev)) BUG();
+	m->free_list   = COS_MAP_FREE_END;
+	m->id_boundary = 0;
 	/* Create the freelist */
-	for (i = 0 ; i < (int)COS_MAP_BASE ; i++) {
-		int j = cos_map_to_vect_freeid(i);
-		if (__cos_vect_set(&m->data, j, (void*)(i+1))) BUG();
-	}
-	/* The end of the freelist */
-	if (__cos_vect_set(&m->data, cos_map_to_vect_freeid(COS_MAP_BASE-1), (void*)-1)) BUG();
+	if (__cos_map_grow(m, COS_MAP_BASE)) BUG();
 }
 
 static inline void cos_map_init_static(cos_map_t *m)
@@ -101,10 +141,16 @@ static cos_map_t *cos_map_alloc_map()
 	if (NULL == m) goto err;
 	
 	if (cos_vect_alloc_vect_data(&m->data)) goto err_free_map;
+	if (cos_vect_alloc_vect_data(&m->next)) goto err_free_data;
+	if (cos_vect_alloc_vect_data(&m->prev)) goto err_free_next;
 	cos_map_init(m);
 
 	return m;
 
+err_free_next:
+	COS_VECT_FREE(m->next.vect);
+err_free_data:
+	COS_VECT_FREE(m->data.vect);
 err_free_map:
 	free(m);
 err:
@@ -115,6 +161,8 @@ static void cos_map_free_map(cos_map_t *m)
 {
 	assert(m);
 	COS_VECT_FREE(m->data.vect);
+	COS_VECT_FREE(m->next.vect);
+	COS_VECT_FREE(m->prev.vect);
 	free(m);
 }
 
@@ -122,42 +170,35 @@ static void cos_map_free_map(cos_map_t *m)
 
 static inline void *cos_map_lookup(cos_map_t *m, long mid)
 {
-	long vid = cos_map_to_vect_id(mid);
+	return cos_vect_lookup(&m->data, mid);
+}
 
-	return cos_vect_lookup(&m->data, vid);
+/* take mid off of the free list, and store val there */
+static inline void __cos_map_take(cos_map_t *m, void *val, long mid)
+{
+	long next, prev;
+
+	next = __cos_map_get(&m->next, mid);
+	prev = __cos_map_get(&m->prev, mid);
+	assert(next != COS_MAP_ALLOCATED);
+	if (prev == COS_MAP_FREE_END) m->free_list = next;
+	else                          __cos_map_set(&m->next, prev, next);
+	if (next != COS_MAP_FREE_END) __cos_map_set(&m->prev, next, prev);
+	__cos_map_set(&m->next, mid, COS_MAP_ALLOCATED);
+	if (__cos_vect_set(&m->data, mid, val)) BUG();
 }
 
 /* return the id of the value */
 static inline long cos_map_add(cos_map_t *m, void *val)
 {
 	long free;
-	struct cos_vect_intern_struct *is_free, *is;
 
 	assert(m);
-	free = m->free_list;
 	/* no free slots? Create more! */
-	if (free == -1) {
-		long lower, upper;
-		if (0 > cos_vect_add_id(&m->data, val, cos_map_to_vect_id(m->id_boundary))) return -1;	
-		free = lower = m->id_boundary;
-		m->id_boundary = upper = lower + COS_MAP_BASE;
-		/* Add the new values to the free list */
-		while (lower != upper) {
-			int idx = cos_map_to_vect_freeid(lower);
-			if (__cos_vect_set(&m->data, idx, (void*)(lower+1))) BUG();
-			lower++;
-		}
-		/* The end of the freelist */
-		if (__cos_vect_set(&m->data, cos_map_to_vect_freeid(upper-1), (void*)-1)) BUG();
-	}
-
-	is = __cos_vect_lookup(&m->data, cos_map_to_vect_id(free));
-	assert(NULL != is);
-	is->val = val;
-
-	is_free = cos_val_to_free(is);
-	m->free_list = (long)is_free->val;
-	is_free->val = (void*)-1;
+	if (m->free_list == COS_MAP_FREE_END &&
+	    __cos_map_grow(m, m->id_boundary + COS_MAP_BASE)) return -1;
+	free = m->free_list;
+	__cos_map_take(m, val, free);
 
 	return free;
 }
@@ -165,75 +206,41 @@ static inline long cos_map_add(cos_map_t *m, void *val)
 /* 
  * This function will try to find an empty slot specifically for the
  * identifier id, or fail.
- *
- * This is O(n), n = MAX_EVENTS.  If we make the cos_vect_intern_struct
- * have a doubly linked free list, this would go away, but I don't
- * want the memory consumption.  
- *
- * If you don't O(n), then just use a vect, not a map.  Map is for
- * cos_map_add.
  */
 static inline long cos_map_add_id(cos_map_t *m, void *val, long mid)
 {
-	struct cos_vect_intern_struct *is;
-	long next, prev;
-
-	/* not really tested enough.  This is not the purpose of map,
-	 * use vect instead */
-	BUG();
-
-	/* All of this to maintain the free list... */
 	assert(m);
-	prev = next = m->free_list;
-	is = __cos_vect_lookup(&m->data, cos_map_to_vect_freeid(next));
-	if (NULL == is) return -1;
-	if (next == mid) {
-		struct cos_vect_intern_struct *data_is;
-		
-		data_is = cos_free_to_val(is);
-		assert(data_is);
-		m->free_list = (long)is->val;
-		data_is->val = val;
-		is->val = (void*)-1;
-		return mid;
-	}
-	next = (long)is->val;
-	while (-1 != next) {
-		is = __cos_vect_lookup(&m->data, cos_map_to_vect_freeid(next));
-		assert(is);
-		next = (long)is->val;
-		if (next == mid) {
-			struct cos_vect_intern_struct *prev_is, *data_is;
-
-			prev_is = __cos_vect_lookup(&m->data, cos_map_to_vect_freeid(prev));
-			data_is = cos_free_to_val(is);
-			assert(prev_is && data_is);
-			/* remove from free list */
-			prev_is->val = is->val;
-			data_is->val = val;
-			is->val = (void*)-1;
-			
-			return mid;
-		}
-		prev = next;
-		next = (long)is->val;
-	}
-	return -1;
+	if (mid < 0) return -1;
+	if (mid >= m->id_boundary &&
+	    __cos_map_grow(m, (mid/COS_MAP_BASE + 1) * COS_MAP_BASE)) return -1;
+	if (__cos_map_get(&m->next, mid) == COS_MAP_ALLOCATED) return -1;
+	__cos_map_take(m, val, mid);
+
+	return mid;
 }
 
 static inline int cos_map_del(cos_map_t *m, long mid)
 {
-	struct cos_vect_intern_struct *is;
-
 	assert(m);
-	is = __cos_vect_lookup(&m->data, cos_map_to_vect_id(mid));
-	if (NULL == is) return -1;
-	is->val = COS_VECT_INIT_VAL;
-	is = __cos_vect_lookup(&m->data, cos_map_to_vect_freeid(mid));
-	assert(NULL != is);
-	is->val = (void*)m->free_list;
+	if (mid < 0 || mid >= m->id_boundary) return -1;
+	if (__cos_map_get(&m->next, mid) != COS_MAP_ALLOCATED) return -1;
+	if (__cos_vect_set(&m->data, mid, (void*)COS_VECT_INIT_VAL)) BUG();
+	__cos_map_set(&m->next, mid, m->free_list);
+	__cos_map_set(&m->prev, mid, COS_MAP_FREE_END);
+	if (m->free_list != COS_MAP_FREE_END) __cos_map_set(&m->prev, m->free_list, mid);
 	m->free_list = mid;
+
 	return 0;
 }
 
+/* 
+ * Bulk iteration over the allocated ids: see cos_vect_iter_batch.
+ * Entries with a COS_VECT_INIT_VAL value are skipped.
+ */
+static inline int 
+cos_map_iter_batch(cos_map_t *m, long *pos, long *ids, void **vals, int n)
+{
+	return cos_vect_iter_batch(&m->data, pos, ids, vals, n);
+}
+
 #endif /* COS_MAP_H */
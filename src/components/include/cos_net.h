@@ -11,4 +11,34 @@
 
 typedef int net_connection_t;
 
+/* 
+ * Number of flows that the interface steers received packets across.
+ * Each flow is serviced by its own upcall thread in the transport
+ * layer, so both use this.
+ */
+#define NET_NUM_FLOWS 4
+
+/* 
+ * Hash of a TCP or UDP 4-tuple: the source and destination addresses,
+ * and the (source, destination) ports word, all as they appear in the
+ * packet (network byte order).  The interface steers packets to flow
+ * hash % number of active flows.
+ */
+static inline u32_t net_flow_hash(u32_t saddr, u32_t daddr, u32_t ports)
+{
+	u32_t h;
+
+	/* Jenkins' final mix of the three words */
+	h = saddr ^ daddr;
+	ports ^= h; ports -= (h << 14) | (h >> 18);
+	saddr ^= ports; saddr -= (ports << 11) | (ports >> 21);
+	h ^= saddr; h -= (saddr << 25) | (saddr >> 7);
+	ports ^= h; ports -= (h << 16) | (h >> 16);
+	saddr ^= ports; saddr -= (ports << 4) | (ports >> 28);
+	h ^= saddr; h -= (saddr << 14) | (saddr >> 18);
+	ports ^= h; ports -= (h << 24) | (h >> 8);
+
+	return ports;
+}
+
 #endif /* COS_NET_H */
@@ -0,0 +1,241 @@
+/**
+ * Copyright 2012 by The George Washington University.  All rights reserved.
+ *
+ * Redistribution of this file is permitted under the GNU General
+ * Public License v2.
+ */
+
+#ifndef COS_RING_H
+#define COS_RING_H
+
+/*
+ * Bounded, lock-free rings of word-sized values.  struct cos_ring
+ * has a single producer and a single consumer; struct cos_mpring
+ * has any number of producers and a single consumer.  Both enqueue
+ * and dequeue in batches: a call moves as many of the n values as
+ * it can, and returns how many it moved, so the indices are read
+ * and written once per batch rather than once per value.
+ *
+ * The producers' index (head) and the consumer's (tail) are on
+ * separate cache lines, so that the two sides don't contend for a
+ * line on each operation.  Indices are free-running (the slot is
+ * index & mask), and the ring holds no pointers, so it can be placed
+ * in memory shared between components (mapped at different
+ * addresses): the caller provides the memory to cos_ring_init, and
+ * the values are whatever both sides agree on (e.g. offsets).  The
+ * capacity is the largest power of 2 that fits in the memory.
+ *
+ * MPSC producers reserve slots by a cmpxchg on head, and then
+ * publish each slot by writing its sequence number.  The consumer
+ * stops at the first unpublished slot, so it never waits on a
+ * preempted producer (it will see that producer's values on a later
+ * dequeue), and producers never wait on each other.
+ */
+
+#ifdef LINUX
+#include <stddef.h>
+typedef unsigned int u32_t;
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+#define round_up_to_cacheline(x) ((((unsigned long)(x))+CACHE_LINE-1)&~(CACHE_LINE-1))
+/* 
+ * On the (32 bit) indices.  As cos_cmpxchg, returns result on
+ * success, and anticipated on failure.
+ */
+static inline long
+cos_cmpxchg(volatile void *memory, long anticipated, long result)
+{
+	return __sync_bool_compare_and_swap((volatile u32_t *)memory, (u32_t)anticipated, (u32_t)result) ?
+		result : anticipated;
+}
+#else
+#include <cos_component.h>
+#endif
+
+/* 
+ * Order accesses to values and the indices (or sequence numbers)
+ * publishing them.  x86 doesn't reorder stores with stores, or loads
+ * with loads, so only the compiler must be prevented from doing so.
+ */
+#define cos_ring_barrier() __asm__ __volatile__("" : : : "memory")
+
+struct cos_ring_idx {
+	volatile u32_t idx;
+	char __pad[CACHE_LINE - sizeof(u32_t)];
+} __attribute__((aligned(CACHE_LINE)));
+
+struct cos_ring {
+	struct cos_ring_idx head, tail;
+	u32_t mask;
+	unsigned long vals[0] __attribute__((aligned(CACHE_LINE)));
+};
+
+struct cos_mpring_slot {
+	volatile u32_t seq;
+	unsigned long val;
+};
+
+struct cos_mpring {
+	struct cos_ring_idx head, tail;
+	u32_t mask;
+	struct cos_mpring_slot slots[0] __attribute__((aligned(CACHE_LINE)));
+};
+
+/* Memory required for a ring of n (a power of 2) values */
+#define COS_RING_SZ(n)   round_up_to_cacheline(sizeof(struct cos_ring) + (n)*sizeof(unsigned long))
+#define COS_MPRING_SZ(n) round_up_to_cacheline(sizeof(struct cos_mpring) + (n)*sizeof(struct cos_mpring_slot))
+
+static inline u32_t
+__cos_ring_cap(unsigned long sz, unsigned long hdr, unsigned long ent)
+{
+	u32_t n = 1;
+
+	if (sz < hdr + ent) return 0;
+	while (hdr + (n*2)*ent <= sz) n *= 2;
+	return n;
+}
+
+/*************************** SPSC ***************************/
+
+/* mem must be cache-line aligned; returns NULL if it is too small */
+static inline struct cos_ring *
+cos_ring_init(void *mem, unsigned long sz)
+{
+	struct cos_ring *r = mem;
+	u32_t n = __cos_ring_cap(sz, sizeof(struct cos_ring), sizeof(unsigned long));
+
+	if (0 == n) return NULL;
+	r->head.idx = r->tail.idx = 0;
+	r->mask     = n-1;
+
+	return r;
+}
+
+static inline u32_t cos_ring_count(struct cos_ring *r) { return r->head.idx - r->tail.idx; }
+static inline int   cos_ring_empty(struct cos_ring *r) { return r->head.idx == r->tail.idx; }
+
+/* producer only */
+static inline int
+cos_ring_enqueue_batch(struct cos_ring *r, unsigned long *vs, int n)
+{
+	u32_t h = r->head.idx, space;
+	int i;
+
+	space = r->mask + 1 - (h - r->tail.idx);
+	if ((u32_t)n > space) n = space;
+	for (i = 0 ; i < n ; i++) r->vals[(h + i) & r->mask] = vs[i];
+	cos_ring_barrier();
+	r->head.idx = h + n;
+
+	return n;
+}
+
+/* consumer only */
+static inline int
+cos_ring_dequeue_batch(struct cos_ring *r, unsigned long *vs, int n)
+{
+	u32_t t = r->tail.idx, avail;
+	int i;
+
+	avail = r->head.idx - t;
+	cos_ring_barrier();
+	if ((u32_t)n > avail) n = avail;
+	for (i = 0 ; i < n ; i++) vs[i] = r->vals[(t + i) & r->mask];
+	cos_ring_barrier();
+	r->tail.idx = t + n;
+
+	return n;
+}
+
+/* 0 on success, -1 if the ring is full (enqueue) or empty (dequeue) */
+static inline int
+cos_ring_enqueue(struct cos_ring *r, unsigned long v)
+{
+	return cos_ring_enqueue_batch(r, &v, 1) ? 0 : -1;
+}
+
+static inline int
+cos_ring_dequeue(struct cos_ring *r, unsigned long *v)
+{
+	return cos_ring_dequeue_batch(r, v, 1) ? 0 : -1;
+}
+
+/*************************** MPSC ***************************/
+
+static inline struct cos_mpring *
+cos_mpring_init(void *mem, unsigned long sz)
+{
+	struct cos_mpring *r = mem;
+	u32_t i, n = __cos_ring_cap(sz, sizeof(struct cos_mpring), sizeof(struct cos_mpring_slot));
+
+	if (0 == n) return NULL;
+	r->head.idx = r->tail.idx = 0;
+	r->mask     = n-1;
+	/* the slot of index p is published when its seq is p+1 */
+	for (i = 0 ; i < n ; i++) r->slots[i].seq = i;
+
+	return r;
+}
+
+static inline u32_t cos_mpring_count(struct cos_mpring *r) { return r->head.idx - r->tail.idx; }
+static inline int   cos_mpring_empty(struct cos_mpring *r) { return r->head.idx == r->tail.idx; }
+
+/* any producer */
+static inline int
+cos_mpring_enqueue_batch(struct cos_mpring *r, unsigned long *vs, int n)
+{
+	u32_t h, space;
+	int i;
+
+	do {
+		h     = r->head.idx;
+		space = r->mask + 1 - (h - r->tail.idx);
+		if (0 == space) return 0;
+		if ((u32_t)n > space) n = space;
+	} while (cos_cmpxchg(&r->head.idx, (long)h, (long)(h + n)) != (long)(h + n));
+
+	for (i = 0 ; i < n ; i++) {
+		struct cos_mpring_slot *s = &r->slots[(h + i) & r->mask];
+
+		s->val = vs[i];
+		cos_ring_barrier();
+		s->seq = h + i + 1;
+	}
+
+	return n;
+}
+
+/* consumer only: stops at the first slot not yet published */
+static inline int
+cos_mpring_dequeue_batch(struct cos_mpring *r, unsigned long *vs, int n)
+{
+	u32_t t = r->tail.idx;
+	int i;
+
+	for (i = 0 ; i < n ; i++) {
+		struct cos_mpring_slot *s = &r->slots[(t + i) & r->mask];
+
+		if (s->seq != t + i + 1) break;
+		cos_ring_barrier();
+		vs[i] = s->val;
+	}
+	cos_ring_barrier();
+	r->tail.idx = t + i;
+
+	return i;
+}
+
+static inline int
+cos_mpring_enqueue(struct cos_mpring *r, unsigned long v)
+{
+	return cos_mpring_enqueue_batch(r, &v, 1) ? 0 : -1;
+}
+
+static inline int
+cos_mpring_dequeue(struct cos_mpring *r, unsigned long *v)
+{
+	return cos_mpring_dequeue_batch(r, v, 1) ? 0 : -1;
+}
+
+#endif /* COS_RING_H */
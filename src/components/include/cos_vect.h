@@ -9,7 +9,9 @@
  * A simple data structure that behaves like an array in term of
  * getting and setting, but is O(log(n)) with a base that is chose
  * below.  In most situations this will be O(log_1024(n)), or
- * essentially at most 3.
+ * essentially at most 3.  The tree grows in depth as larger ids are
+ * added, up to COS_VECT_DEPTH_MAX (which can be overridden); the
+ * lookup is unrolled for that maximum depth.
  */
 
 #ifdef COS_LINUX_ENV
@@ -36,7 +38,11 @@ typedef struct cos_vect_struct {
 #endif
 #define COS_VECT_PAGE_BASE (PAGE_SIZE/sizeof(struct cos_vect_intern_struct))
 #ifndef COS_VECT_SHIFT
+#if __SIZEOF_POINTER__ == 8
+#define COS_VECT_SHIFT (PAGE_SHIFT-3) /* -3 for pow2sizeof struct cos_vect_intern_struct (on 64 bit hosts) */
+#else
 #define COS_VECT_SHIFT (PAGE_SHIFT-2) /* -2 for pow2sizeof struct cos_vect_intern_struct */
+#endif
 #define COS_VECT_MASK  (COS_VECT_PAGE_BASE-1)
 #endif
 
@@ -51,6 +57,9 @@ typedef struct cos_vect_struct {
 #ifndef COS_VECT_DEPTH_MAX
 #define COS_VECT_DEPTH_MAX 2
 #endif
+#if COS_VECT_DEPTH_MAX < 1 || COS_VECT_DEPTH_MAX > 4
+#error "COS_VECT_DEPTH_MAX must be between 1 and 4"
+#endif
 
 #define COS_VECT_CREATE_STATIC(name)					\
 	struct cos_vect_intern_struct __cos_##name##_vect[ COS_VECT_BASE ] = {{.val=COS_VECT_INIT_VAL},}; \
@@ -142,36 +151,50 @@ static void cos_vect_free_vect(cos_vect_t *v)
 
 #endif /* COS_VECT_DYNAMIC */
 
+/* can a tree of depth hold id? */
+static inline int __cos_vect_spans(long depth, long id)
+{
+	if (COS_VECT_SHIFT * depth >= (long)(sizeof(long)*8 - 1)) return 1;
+	return id < (1L << (COS_VECT_SHIFT * depth));
+}
+
 static inline struct cos_vect_intern_struct *__cos_vect_lookup(cos_vect_t *v, long id)
 {
-	long depth;
 	struct cos_vect_intern_struct *is;
 
 	/* make sure the data structure is configured and initialized */
 	assert(v);
 	assert(v->depth != 0);
-	assert(v->depth <= 2);
-	if (id < 0) return NULL;
-	depth = v->depth;
-#if COS_VECT_DEPTH_MAX != 2
-#error "__cos_vect_lookup assumes a max depth of 2"
-#endif
+	assert(v->depth <= COS_VECT_DEPTH_MAX);
+	if (id < 0 || !__cos_vect_spans(v->depth, id)) return NULL;
 	is = v->vect;
-	switch (depth) {
+	/* 
+	 * Each fallthrough annotation directly precedes its case label:
+	 * -Wimplicit-fallthrough ignores one followed by an #endif.
+	 */
+	switch (v->depth) {
+#if COS_VECT_DEPTH_MAX >= 4
+	case 4:
+		is = (struct cos_vect_intern_struct*)is[(id >> (COS_VECT_SHIFT*3)) & COS_VECT_MASK].val;
+		if (NULL == is) return NULL;
+#endif
+#if COS_VECT_DEPTH_MAX >= 3
+		/* fallthrough */
+	case 3:
+		is = (struct cos_vect_intern_struct*)is[(id >> (COS_VECT_SHIFT*2)) & COS_VECT_MASK].val;
+		if (NULL == is) return NULL;
+#endif
+#if COS_VECT_DEPTH_MAX >= 2
+		/* fallthrough */
 	case 2:
-	{
-		long t = (id >> COS_VECT_SHIFT);
-		
-		if (t >= (long)COS_VECT_BASE) return NULL;
-		is = (struct cos_vect_intern_struct*)is[t & COS_VECT_MASK].val;
+		is = (struct cos_vect_intern_struct*)is[(id >> COS_VECT_SHIFT) & COS_VECT_MASK].val;
 		if (NULL == is) return NULL;
-		id &= COS_VECT_MASK;
+#endif
 		/* fallthrough */
-	}
 	case 1:
-		if (id >= (long)COS_VECT_BASE) return NULL;
+		break;
 	}
-	return &is[id];
+	return &is[id & COS_VECT_MASK];
 }
 
 static inline void *cos_vect_lookup(cos_vect_t *v, long id)
@@ -185,12 +208,14 @@ static inline void *cos_vect_lookup(cos_vect_t *v, long id)
 static inline int __cos_vect_expand(cos_vect_t *v, long id)
 {
 	struct cos_vect_intern_struct *is, *root;
+	long d;
 	int i;
 
 	assert(v && NULL == __cos_vect_lookup(v, id));
+	if (id < 0) return -1;
 
 	/* do we want an index outside of the range of the current structure? */
-	if (id >= (1 << (COS_VECT_SHIFT * v->depth))) {
+	while (!__cos_vect_spans(v->depth, id)) {
 		if (v->depth >= COS_VECT_DEPTH_MAX) return -1;
 		
 		is = COS_VECT_ALLOC(COS_VECT_BASE * sizeof(struct cos_vect_intern_struct));
@@ -201,17 +226,25 @@ static inline int __cos_vect_expand(cos_vect_t *v, long id)
 		v->vect = is;
 	} 
 
-	/* we must be asking for an index that doesn't have a complete
-	 * path through the tree (intermediate nodes) */
-	assert(v->depth == 2);
-
-	is = COS_VECT_ALLOC(COS_VECT_BASE * sizeof(struct cos_vect_intern_struct));
-	if (NULL == is) return -1;
-	for (i = 0 ; i < (int)COS_VECT_BASE ; i++) is[i].val = (void*)COS_VECT_INIT_VAL;
-
-	root = &v->vect[(id >> COS_VECT_SHIFT) & COS_VECT_MASK];
-	assert(NULL == root->val);
-	root->val = is;
+	/* 
+	 * We must be asking for an index that doesn't have a complete
+	 * path through the tree: add the missing intermediate nodes,
+	 * and the leaf.
+	 */
+	assert(v->depth > 1);
+	is = v->vect;
+	for (d = v->depth ; d > 1 ; d--) {
+		root = &is[(id >> (COS_VECT_SHIFT * (d-1))) & COS_VECT_MASK];
+		if (NULL == root->val) {
+			void *init = d > 2 ? NULL : (void*)COS_VECT_INIT_VAL;
+
+			is = COS_VECT_ALLOC(COS_VECT_BASE * sizeof(struct cos_vect_intern_struct));
+			if (NULL == is) return -1;
+			for (i = 0 ; i < (int)COS_VECT_BASE ; i++) is[i].val = init;
+			root->val = is;
+		}
+		is = root->val;
+	}
 
 	return 0;
 }
@@ -253,5 +286,53 @@ static int cos_vect_del(cos_vect_t *v, long id)
 	return 0;
 }
 
+/* 
+ * Bulk iteration: find up to n set (not COS_VECT_INIT_VAL) entries
+ * with ids starting at *pos, and return them in ids and vals, in id
+ * order.  *pos is updated to where the next call should start, and
+ * the number of entries found is returned (0 when there are no
+ * more).  Each leaf is scanned sequentially, and missing subtrees are
+ * skipped in one step, so this is much cheaper than a lookup per id:
+ *
+ * long pos = 0, ids[16];
+ * void *vals[16];
+ * while ((n = cos_vect_iter_batch(v, &pos, ids, vals, 16))) ...
+ */
+static inline int 
+cos_vect_iter_batch(cos_vect_t *v, long *pos, long *ids, void **vals, int n)
+{
+	long id = *pos;
+	int found = 0;
+
+	assert(v && v->depth != 0 && n > 0);
+	while (found < n && id >= 0 && __cos_vect_spans(v->depth, id)) {
+		struct cos_vect_intern_struct *is = v->vect;
+		long d, i;
+
+		/* find the leaf, or the missing subtree, for id */
+		for (d = v->depth ; d > 1 ; d--) {
+			long shift = COS_VECT_SHIFT * (d-1);
+
+			is = is[(id >> shift) & COS_VECT_MASK].val;
+			if (NULL == is) break;
+		}
+		if (NULL == is) {
+			long span = 1L << (COS_VECT_SHIFT * (d-1));
+
+			id = (id + span) & ~(span-1);
+			continue;
+		}
+		for (i = id & COS_VECT_MASK ; i < (long)COS_VECT_BASE && found < n ; i++, id++) {
+			if (is[i].val == (void*)COS_VECT_INIT_VAL) continue;
+			ids[found]  = id;
+			vals[found] = is[i].val;
+			found++;
+		}
+	}
+	*pos = id;
+
+	return found;
+}
+
 
 #endif /* COS_VECT_H */
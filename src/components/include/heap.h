@@ -26,4 +26,130 @@ struct heap *heap_alloc(int max_sz, cmp_fn_t c, update_fn_t u);
 int heap_size(struct heap *h);
 static inline int heap_empty(struct heap *h) { return heap_size(h) == 0; }
 
+/* 
+ * A 4-ary heap of (key, value) entries stored inline, specialized
+ * for its types at compile time so that comparisons and position
+ * updates inline, rather than going through function pointers.  The
+ * caller provides the storage (max_sz entries), so it doesn't
+ * allocate.  A node's four children are adjacent, so sifting down
+ * touches one or two cache lines per level, and the tree is half as
+ * deep as a binary heap's.  Entries are moved into a hole rather than
+ * swapped.
+ *
+ * HEAP4_DEFINE(name, key_t, val_t, higher, update) defines struct
+ * name, struct name##_ent, and the name##_* functions below, where:
+ *
+ * higher(a, b): are keys a and b in heap order (a >= b for a max-heap)?
+ * update(v, pos): value v is now at index pos (-1 once removed); use
+ *                 HEAP4_NO_UPDATE if positions aren't needed.
+ *
+ * Unlike struct heap, indexes start at 0.
+ */
+#define HEAP4_NO_UPDATE(v, pos)
+
+#define HEAP4_DEFINE(name, key_t, val_t, higher, update)		\
+struct name##_ent {							\
+	key_t k;							\
+	val_t v;							\
+};									\
+struct name {								\
+	int e, max_sz;							\
+	struct name##_ent *data;					\
+};									\
+static inline void							\
+name##_init(struct name *h, struct name##_ent *data, int max_sz)	\
+{									\
+	h->e      = 0;							\
+	h->max_sz = max_sz;						\
+	h->data   = data;						\
+}									\
+static inline int name##_size(struct name *h) { return h->e; }		\
+static inline int name##_empty(struct name *h) { return h->e == 0; }	\
+static inline struct name##_ent *					\
+name##_peek(struct name *h) { return h->e ? &h->data[0] : NULL; }	\
+static inline int							\
+name##__up(struct name *h, int c, struct name##_ent ent)		\
+{									\
+	while (c > 0) {							\
+		int p = (c-1)/4;					\
+									\
+		if (higher(h->data[p].k, ent.k)) break;			\
+		h->data[c] = h->data[p];				\
+		update(h->data[c].v, c);				\
+		c = p;							\
+	}								\
+	h->data[c] = ent;						\
+	update(ent.v, c);						\
+	return c;							\
+}									\
+static inline int							\
+name##__down(struct name *h, int c, struct name##_ent ent)		\
+{									\
+	while (1) {							\
+		int f = 4*c+1, l = f+4, i, n = f;			\
+									\
+		if (f >= h->e) break;					\
+		if (l > h->e) l = h->e;					\
+		for (i = f+1 ; i < l ; i++) {				\
+			if (!higher(h->data[n].k, h->data[i].k)) n = i;	\
+		}							\
+		if (higher(ent.k, h->data[n].k)) break;			\
+		h->data[c] = h->data[n];				\
+		update(h->data[c].v, c);				\
+		c = n;							\
+	}								\
+	h->data[c] = ent;						\
+	update(ent.v, c);						\
+	return c;							\
+}									\
+static inline int							\
+name##_add(struct name *h, key_t k, val_t v)				\
+{									\
+	struct name##_ent ent;						\
+									\
+	if (h->e == h->max_sz) return -1;				\
+	ent.k = k;							\
+	ent.v = v;							\
+	name##__up(h, h->e++, ent);					\
+	return 0;							\
+}									\
+/* remove the entry at index c into *ent */				\
+static inline void							\
+name##_remove(struct name *h, int c, struct name##_ent *ent)		\
+{									\
+	struct name##_ent last;						\
+									\
+	assert(c >= 0 && c < h->e);					\
+	*ent = h->data[c];						\
+	update(ent->v, -1);						\
+	last = h->data[--h->e];						\
+	if (c == h->e) return;						\
+	if (c > 0 && !higher(h->data[(c-1)/4].k, last.k)) {		\
+		name##__up(h, c, last);					\
+	} else {							\
+		name##__down(h, c, last);				\
+	}								\
+}									\
+/* remove the highest entry into *ent: -1 if the heap is empty */	\
+static inline int							\
+name##_highest(struct name *h, struct name##_ent *ent)			\
+{									\
+	if (!h->e) return -1;						\
+	name##_remove(h, 0, ent);					\
+	return 0;							\
+}									\
+/* change the key of the entry at index c */				\
+static inline int							\
+name##_adjust(struct name *h, int c, key_t k)				\
+{									\
+	struct name##_ent ent = h->data[c];				\
+									\
+	assert(c >= 0 && c < h->e);					\
+	ent.k = k;							\
+	if (c > 0 && !higher(h->data[(c-1)/4].k, k)) {			\
+		return name##__up(h, c, ent);				\
+	}								\
+	return name##__down(h, c, ent);					\
+}
+
 #endif /* HEAP_H */
@@ -0,0 +1,132 @@
+/**
+ * Copyright 2011 by The George Washington University.  All rights reserved.
+ *
+ * Redistribution of this file is permitted under the GNU General
+ * Public License v2.
+ */
+
+#ifndef   	RESP_DESC_H
+#define   	RESP_DESC_H
+
+/* 
+ * A response descriptor describes data to be sent as a sequence of
+ * segments.  Each segment is either in the descriptor's slab (for
+ * headers, and other small pieces generated on the fly), or is a
+ * reference to a cbuf (for content).  The descriptor is passed in
+ * the argument region as the memory of a struct cos_array, from the
+ * component generating the response (content_read_resp), through the
+ * fd component (cos_read_resp/cos_write_resp), to the transport
+ * (net_send_resp), so that the content is never copied on the way.
+ *
+ * The component assembling the descriptor must keep the referenced
+ * cbufs alive until the descriptor has been sent.  The transport
+ * copies out the data of cbufs that are not RESP_SEG_PERSIST; those
+ * that are persistent it can reference until they are acknowledged.
+ */
+
+#define RESP_DESC_MAX_SEGS 16
+
+#define RESP_SEG_PERSIST 0x1
+
+struct resp_seg {
+	u32_t cb;		/* a cbuf_t, or 0 if the data is in the slab */
+	int cb_len;		/* the length to pass to cbuf2buf */
+	int off, len;		/* into the cbuf or slab */
+	u32_t flags;
+};
+
+struct resp_desc {
+	int nsegs;
+	int tot_len;		/* bytes in all segments */
+	int max_len;		/* set by the reader: max tot_len */
+	int slab_sz, slab_used;
+	struct resp_seg segs[RESP_DESC_MAX_SEGS];
+	char slab[0];
+};
+
+/* sz is the size of the memory holding the descriptor and its slab */
+static inline struct resp_desc *
+resp_desc_init(void *mem, int sz, int max_len)
+{
+	struct resp_desc *d = mem;
+
+	if (sz < (int)sizeof(struct resp_desc)) return NULL;
+	d->nsegs     = 0;
+	d->tot_len   = 0;
+	d->max_len   = max_len;
+	d->slab_sz   = sz - sizeof(struct resp_desc);
+	d->slab_used = 0;
+
+	return d;
+}
+
+/* 
+ * Is the descriptor (in memory of size sz) consistent?  Must be
+ * checked by any component receiving one.
+ */
+static inline int 
+resp_desc_valid(struct resp_desc *d, int sz)
+{
+	int i, tot = 0;
+
+	if (sz < (int)sizeof(struct resp_desc)) return 0;
+	if (d->nsegs < 0 || d->nsegs > RESP_DESC_MAX_SEGS) return 0;
+	if (d->slab_sz < 0 || d->slab_sz > sz - (int)sizeof(struct resp_desc)) return 0;
+	for (i = 0 ; i < d->nsegs ; i++) {
+		struct resp_seg *s = &d->segs[i];
+
+		if (s->off < 0 || s->len < 0) return 0;
+		if (0 == s->cb && s->len > d->slab_sz - s->off) return 0;
+		if (0 != s->cb && s->len > s->cb_len - s->off) return 0;
+		tot += s->len;
+	}
+	return tot == d->tot_len;
+}
+
+/* 
+ * Append len bytes to the slab, returning where they should be
+ * written, or NULL if they don't fit.
+ */
+static inline char *
+resp_desc_slab_add(struct resp_desc *d, int len)
+{
+	struct resp_seg *s = d->nsegs ? &d->segs[d->nsegs-1] : NULL;
+	char *p;
+
+	if (len > d->slab_sz - d->slab_used || len > d->max_len - d->tot_len) return NULL;
+	/* extend the last segment if it ends at the top of the slab */
+	if (!s || s->cb || s->off + s->len != d->slab_used) {
+		if (d->nsegs == RESP_DESC_MAX_SEGS) return NULL;
+		s = &d->segs[d->nsegs++];
+		s->cb     = 0;
+		s->cb_len = 0;
+		s->off    = d->slab_used;
+		s->len    = 0;
+		s->flags  = 0;
+	}
+	p             = &d->slab[d->slab_used];
+	s->len       += len;
+	d->slab_used += len;
+	d->tot_len   += len;
+
+	return p;
+}
+
+static inline int 
+resp_desc_cbuf_add(struct resp_desc *d, u32_t cb, int cb_len, int off, int len, u32_t flags)
+{
+	struct resp_seg *s;
+
+	if (d->nsegs == RESP_DESC_MAX_SEGS || len > d->max_len - d->tot_len) return -1;
+	s = &d->segs[d->nsegs++];
+	s->cb       = cb;
+	s->cb_len   = cb_len;
+	s->off      = off;
+	s->len      = len;
+	s->flags    = flags;
+	d->tot_len += len;
+
+	return 0;
+}
+
+#endif 	    /* !RESP_DESC_H */
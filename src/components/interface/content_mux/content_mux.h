@@ -3,9 +3,27 @@
 
 #include <content_req.h>
 
+/* The content providers that routes can direct requests to */
+typedef enum {
+	CONTENT_PROVIDER_STATIC,
+	CONTENT_PROVIDER_MAP,
+	CONTENT_PROVIDER_ASYNC,
+	CONTENT_PROVIDER_MAX
+} content_provider_t;
+
 content_req_t content_open(spdid_t spdid, long evt_id, struct cos_array *data);
 int content_request(spdid_t spdid, content_req_t cr, struct cos_array *data);
 int content_retrieve(spdid_t spdid, content_req_t cr, struct cos_array *data, int *more);
 int content_close(spdid_t spdid, content_req_t cr);
 
+/* Response cache: see content_mgr */
+int content_retrieve_cbuf(spdid_t spdid, content_req_t cr, int *len, int *more);
+long content_etag(spdid_t spdid, content_req_t cr);
+int content_invalidate(spdid_t spdid, struct cos_array *path);
+unsigned long *content_stats(spdid_t spdid, unsigned long *stats);
+int content_stats_len(spdid_t spdid);
+
+int content_route_add(spdid_t spdid, struct cos_array *prefix, int provider, int cache);
+int content_route_del(spdid_t spdid, struct cos_array *prefix);
+
 #endif 	    /* !CONTENT_MUX_H */
@@ -11,12 +11,15 @@ typedef enum {
 } evt_flags_t;
 
 long evt_create(spdid_t spdid);
+int evt_create_mult(spdid_t spdid, struct cos_array *data);
 void evt_free(spdid_t spdid, long extern_evt);
 int evt_wait(spdid_t spdid, long extern_evt);
 long evt_grp_wait(spdid_t spdid);
 int evt_grp_mult_wait(spdid_t spdid, struct cos_array *data);
 int evt_trigger(spdid_t spdid, long extern_evt);
 int evt_set_prio(spdid_t spdid, long extern_evt, int prio);
+int evt_set_level(spdid_t spdid, long extern_evt, int level);
+int evt_clear(spdid_t spdid, long extern_evt);
 unsigned long *evt_stats(spdid_t spdid, unsigned long *stats);
 int evt_stats_len(spdid_t spdid);
 
@@ -10,7 +10,64 @@ int cos_close(int fd);
 int cos_split(int fd);
 int cos_write(int fd, char *buf, int sz);
 int cos_read(int fd, char *buf, int sz);
+/* 
+ * Read/write response descriptors (resp_desc.h): content read from
+ * an application descriptor is passed by reference to a network
+ * descriptor, rather than copied.
+ */
+int cos_read_resp(int fd, struct cos_array *data);
+int cos_write_resp(int fd, struct cos_array *data);
+/* 
+ * Vectored read/write: data->mem starts with a struct cos_iov, and
+ * each segment is an offset and length into data->mem (after the
+ * header).  The segments are filled or written in order.
+ */
+#define COS_IOV_MAX 16
+struct cos_iovec {
+	int off, len;
+};
+struct cos_iov {
+	int cnt;
+	struct cos_iovec iov[0];
+};
+int cos_readv(int fd, struct cos_array *data);
+int cos_writev(int fd, struct cos_array *data);
+/* 
+ * Move up to len bytes from fd_in to fd_out within the fd component,
+ * passing responses by reference when both sides support it.
+ */
+int cos_splice(int fd_in, int fd_out, int len);
 int cos_wait(int fd);
 int cos_wait_all(void);
 
+/* 
+ * epoll-like interface: register interest in a set of descriptors,
+ * and retrieve the set of those that are ready in a single call.
+ * cos_epoll_wait fills the array with struct cos_epoll_events, sets
+ * its size in bytes, and returns the number of ready descriptors.
+ * Notifications are edge-triggered: a descriptor is reported, with
+ * its current readiness, when its event triggers.  A connection
+ * triggers on received data, on its close, and when sent data frees
+ * up a full send buffer.  COS_EPOLLHUP is reported whether or not it
+ * is in the events of interest.
+ */
+#define COS_EPOLLIN  0x1
+#define COS_EPOLLOUT 0x4
+#define COS_EPOLLHUP 0x10
+
+enum {
+	COS_EPOLL_CTL_ADD = 1,
+	COS_EPOLL_CTL_DEL,
+	COS_EPOLL_CTL_MOD
+};
+
+struct cos_epoll_event {
+	u32_t events;
+	int fd;
+};
+
+int cos_epoll_create(int size);
+int cos_epoll_ctl(int epfd, int op, int fd, u32_t events);
+int cos_epoll_wait(int epfd, struct cos_array *evts);
+
 #endif 	    /* !FD_H */
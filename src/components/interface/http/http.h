@@ -4,6 +4,12 @@
 long content_split(spdid_t spdid, long conn_id, long evt_id);
 int content_write(spdid_t spdid, long connection_id, char *reqs, int sz);
 int content_read(spdid_t spdid, long connection_id, char *buff, int sz);
+/* 
+ * Read responses as a descriptor (see resp_desc.h) in data, which
+ * the caller initializes with resp_desc_init.  Returns the number
+ * of bytes described.
+ */
+int content_read_resp(spdid_t spdid, long connection_id, struct cos_array *data);
 long content_create(spdid_t spdid, long evt_id, struct cos_array *d);
 int content_remove(spdid_t spdid, long conn_id);
 
@@ -20,10 +20,36 @@
 
 #include <mem_mgr_config.h>
 
+/* 
+ * Define UNIX_TEST to build this as a multi-threaded allocator
+ * benchmark on the host (see the end of the file):
+ *
+ * gcc -DUNIX_TEST -O2 -pthread -I. cos_alloc.c -o alloc_test
+ */
 //#define UNIX_TEST
 #ifdef UNIX_TEST
 #define PAGE_SIZE 4096
+#define MAX_NUM_THREADS 30
+#define round_up_to_page(x) (((x)+PAGE_SIZE-1) & ~(PAGE_SIZE-1))
+#define ALLOC_DEBUG_STATS 1
+#define ALLOC_DEBUG_ALL   2
 #include <sys/mman.h>
+#include <stddef.h>
+#include <string.h>
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+static inline long cos_cmpxchg(volatile void *mem, long old, long new)
+{
+	return __sync_bool_compare_and_swap((volatile long *)mem, old, new) ? new : old;
+}
+/* thread ids, as in Composite, start at 1 */
+static __thread int __test_thd_id;
+static int __test_nthds;
+static inline unsigned short int cos_get_thd_id(void)
+{
+	if (unlikely(!__test_thd_id)) __test_thd_id = __sync_add_and_fetch(&__test_nthds, 1);
+	return __test_thd_id;
+}
 #else
 #include <cos_component.h>
 #include <cos_alloc.h>
@@ -38,15 +64,15 @@ int alloc_debug = 0;
 #include "../valloc/valloc.h"
 #endif
 
+extern void *mman_get_page(spdid_t spd, void *addr, int flags);
+extern void mman_release_page(spdid_t spd, void *addr, int flags);
+#endif
+
 struct free_page {
 	struct free_page *next;
 };
 static struct free_page page_list = {.next = NULL};
 
-extern void *mman_get_page(spdid_t spd, void *addr, int flags);
-extern void mman_release_page(spdid_t spd, void *addr, int flags);
-#endif
-
 #define DIE() (*((int*)0) = 0xDEADDEAD)
 #define massert(prop) do { if (!(prop)) DIE(); } while (0)
 
@@ -96,101 +122,248 @@ static inline REGPARM(1) void *do_mmap(size_t size) {
 /*static inline*/ REGPARM(2) int do_munmap(void *addr, size_t size) {
 	return munmap(addr, size);
 }
+static inline int do_mgrow(void *addr, size_t size, size_t new) { return -1; }
 #else 
 
-static inline REGPARM(1) void *do_mmap(size_t size) {
-	void *hp, *ret;
-	unsigned long p;
-	size_t s = round_up_to_page(size);
+/* 
+ * Contiguous ranges of virtual addresses.  With valloc, ranges come
+ * from, and are returned to, the valloc component.  Otherwise, they
+ * are taken from the top of the heap, and can only be returned if
+ * they are still at its top.
+ */
+static void *__vas_alloc(unsigned long npages)
+{
+#ifdef USE_VALLOC
+	return valloc_alloc(cos_spd_id(), cos_spd_id(), npages);
+#else
+	char *h;
+	long r;
 
+	do {
+		h = cos_get_heap_ptr();
+		r = (long)h + npages*PAGE_SIZE;
+	} while (unlikely(cos_cmpxchg(&cos_comp_info.cos_heap_ptr, (long)h, r) != r));
+
+	return h;
+#endif
+}
+
+static void __vas_free(void *addr, unsigned long npages)
+{
 #ifdef USE_VALLOC
-	hp = valloc_alloc(cos_spd_id(), cos_spd_id(), s/PAGE_SIZE);
-	if (!hp) return NULL;
+	if (unlikely(valloc_free(cos_spd_id(), cos_spd_id(), addr, npages))) DIE();
 #else
-	massert(size <= PAGE_SIZE);
-	//hp = cos_get_prealloc_page();
-	//if (!hp) 
-	hp = cos_get_vas_page();
+	cos_set_heap_ptr_conditional((char *)addr + npages*PAGE_SIZE, addr);
 #endif
-	for (p = (unsigned long)hp ; 
-	     p < (unsigned long)hp + s ; 
-	     p += PAGE_SIZE) {
-		ret = (void*)mman_get_page(cos_spd_id(), (void*)p, 0);
-		if (unlikely(!ret)) {
-			for (p -= PAGE_SIZE ; hp <= (void*)p ; p -= PAGE_SIZE) {
-				mman_release_page(cos_spd_id(), (void*)p, 0);
-			}
+}
+
+/* Allocate the range starting at addr, if it is free. */
+static int __vas_alloc_at(void *addr, unsigned long npages)
+{
 #ifdef USE_VALLOC
-			if (unlikely(valloc_free(cos_spd_id(), cos_spd_id(), hp, s/PAGE_SIZE))) DIE();
+	return valloc_alloc_at(cos_spd_id(), cos_spd_id(), addr, npages);
 #else
-			cos_release_vas_page(hp);
+	long r = (long)addr + npages*PAGE_SIZE;
+
+	return cos_cmpxchg(&cos_comp_info.cos_heap_ptr, (long)addr, r) == r ? 0 : -1;
 #endif
-			return NULL;
+}
+
+static void __pages_unmap(void *addr, unsigned long npages)
+{
+	unsigned long p;
+
+	for (p = (unsigned long)addr ; 
+	     p < (unsigned long)addr + npages*PAGE_SIZE ; 
+	     p += PAGE_SIZE) {
+		mman_release_page(cos_spd_id(), (void*)p, 0);
+	}
+}
+
+static int __pages_map(void *addr, unsigned long npages)
+{
+	unsigned long p;
+
+	for (p = (unsigned long)addr ; 
+	     p < (unsigned long)addr + npages*PAGE_SIZE ; 
+	     p += PAGE_SIZE) {
+		if (unlikely(!mman_get_page(cos_spd_id(), (void*)p, 0))) {
+			__pages_unmap(addr, (p - (unsigned long)addr)/PAGE_SIZE);
+			return -1;
 		}
 	}
+	return 0;
+}
+
+static inline REGPARM(1) void *do_mmap(size_t size) {
+	void *hp;
+	unsigned long npages = round_up_to_page(size)/PAGE_SIZE;
+
+	hp = __vas_alloc(npages);
+	if (unlikely(!hp)) return NULL;
+	if (__pages_map(hp, npages)) {
+		__vas_free(hp, npages);
+		return NULL;
+	}
 #if ALLOC_DEBUG >= ALLOC_DEBUG_ALL
-	if (alloc_debug) printc("malloc in %d: mmapped region into %x", cos_spd_id(), ret);
+	if (alloc_debug) printc("malloc in %d: mmapped region into %x", cos_spd_id(), hp);
 #endif
 	return hp;
 }
 
 /* remove qualifiers to make debugging easier */
 /*static inline*/ REGPARM(2) int do_munmap(void *addr, size_t size) {
-#ifndef USE_VALLOC
-	  /* not supported and given that we can't allocate > PAGE_SIZE, this should never happen */
-	  DIE();
-#else
-	  unsigned long p;
+	unsigned long npages = round_up_to_page(size)/PAGE_SIZE;
 
-	  massert((unsigned long)addr == round_to_page((unsigned long)addr)); 
-	  for (p = (unsigned long)addr ; p < ((unsigned long)addr + size) ; p += PAGE_SIZE) {
-		  mman_release_page(cos_spd_id(), (void*)p, 0);
-	  }
-	  if (valloc_free(cos_spd_id(), cos_spd_id(), addr, round_up_to_page(size)/PAGE_SIZE)) DIE();
-#endif
-  return 0;
+	massert((unsigned long)addr == round_to_page((unsigned long)addr)); 
+	__pages_unmap(addr, npages);
+	__vas_free(addr, npages);
+
+	return 0;
+}
+
+/* 
+ * Grow the mapping at addr from size to new bytes (both page
+ * multiples) in place, if the virtual pages following it are free.
+ */
+static int do_mgrow(void *addr, size_t size, size_t new) {
+	void *end = (char *)addr + size;
+	unsigned long npages = (new - size)/PAGE_SIZE;
+
+	if (__vas_alloc_at(end, npages)) return -1;
+	if (__pages_map(end, npages)) {
+		__vas_free(end, npages);
+		return -1;
+	}
+	return 0;
 }
 #endif
 
 /* -- SMALL MEM ----------------------------------------------------------- */
 
-static __alloc_t* __small_mem[8];
+/* 
+ * Small allocations are carved out of pages of a single size class.
+ * Classes are 16 bytes apart up to 128 bytes, and then four per
+ * power of two, so that rounding up wastes at most 25%.  Each page
+ * starts with a header used to find the pages that are completely
+ * free.
+ *
+ * Each thread caches free objects of each class, and allocates from
+ * and frees to that cache without synchronization (only it accesses
+ * it).  Objects move between the threads' caches and a global list
+ * per class in batches.  The global lists are only ever pushed onto
+ * (single objects or chains), or emptied as a whole.  Neither
+ * dereferences the head it replaces, so they don't suffer from the
+ * ABA problem.  When enough objects are free in a class's global
+ * list, the freeing thread takes the list, and returns the pages
+ * whose objects are all in it to the memory manager.
+ */
+struct small_page {
+	unsigned short int idx, nobjs;
+	/* objects found free while reclaiming */
+	unsigned short int scan;
+	struct small_page *next;
+} __attribute__((aligned(8)));
+
+#define SMALL_NCLASSES		24
+#define SMALL_PAGE(p)		((struct small_page *)(((unsigned long)(p))&(~(MEM_BLOCK_SIZE-1))))
+#define SMALL_OBJS_OFF		sizeof(struct small_page)
+#define __SMALL_NR(sz)		((MEM_BLOCK_SIZE-SMALL_OBJS_OFF)/(sz))
+
+#define __MIN_SMALL_SIZE	16
+/* at least two objects per page */
+#define __MAX_SMALL_SIZE	(((MEM_BLOCK_SIZE-SMALL_OBJS_OFF)/2) & ~7UL)
+
+/* a thread caches at most this many pages of objects per class */
+#define SMALL_CACHE_PAGES	2
+/* reclaim a class's free pages past this many pages of free objects */
+#define SMALL_RELEASE_THRESH	8
+/* ...but keep this many empty pages */
+#define SMALL_KEEP_PAGES	2
+
+static __alloc_t *__small_mem[SMALL_NCLASSES];
+static long __small_nfree[SMALL_NCLASSES];
+static long __small_reclaiming[SMALL_NCLASSES];
+
+struct small_cache {
+	__alloc_t *head;
+	int cnt;
+};
+/* thread ids start at 1 */
+static struct small_cache __small_cache[MAX_NUM_THREADS+1][SMALL_NCLASSES];
+
+static inline int __small_log2(size_t s) { return 31 - __builtin_clz((unsigned int)s); }
+
+static inline size_t REGPARM(1) get_index(size_t size) {
+	int b;
+
+	if (size <= 128) return size <= __MIN_SMALL_SIZE ? 0 : (size-1) >> 4;
+	b = __small_log2(size-1);
+	return 8 + (b-7)*4 + (((size-1) - (1UL<<b)) >> (b-2));
+}
 
-#define __SMALL_NR(i)		(MEM_BLOCK_SIZE/(i))
+static inline size_t get_size(size_t idx) {
+	size_t b, sz;
 
-#define __MIN_SMALL_SIZE	__SMALL_NR(256)		/*   16 /   32 */
-#define __MAX_SMALL_SIZE	__SMALL_NR(2)		/* 2048 / 4096 */
+	if (idx < 8) return (idx+1) << 4;
+	b  = 7 + (idx-8)/4;
+	sz = (1UL<<b) + (((idx-8)%4)+1) * (1UL<<(b-2));
 
-#define GET_SIZE(s)		(__MIN_SMALL_SIZE<<get_index((s)))
+	return sz > __MAX_SMALL_SIZE ? __MAX_SMALL_SIZE : sz;
+}
+
+#define GET_SIZE(s)		get_size(get_index((s)))
+
+static inline void __small_nfree_add(size_t idx, long n)
+{
+	long v;
 
-#define FIRST_SMALL(p)		(((unsigned long)(p))&(~(MEM_BLOCK_SIZE-1)))
+	do {
+		v = __small_nfree[idx];
+	} while (unlikely(cos_cmpxchg(&__small_nfree[idx], v, v+n) != v+n));
+}
 
-static inline int __ind_shift() { return (MEM_BLOCK_SIZE==4096)?4:5; }
+/* push the chain of objects from first to last onto the global list */
+static inline void __small_push(size_t idx, __alloc_t *first, __alloc_t *last)
+{
+	__alloc_t *h;
 
-static size_t REGPARM(1) get_index(size_t _size) {
-	size_t idx, size;
-	for (idx = 0, size = ((_size-1)&(MEM_BLOCK_SIZE-1))>>__ind_shift() ;  
-	     size ; 
-	     size>>=1, ++idx );
-	return idx;
+	do {
+		h = __small_mem[idx];
+		last->next = h;
+	} while (unlikely(cos_cmpxchg(&__small_mem[idx], (long)h, (long)first) != (long)first));
+}
+
+/* take the entire global list */
+static inline __alloc_t *__small_take(size_t idx)
+{
+	__alloc_t *h;
+
+	do {
+		h = __small_mem[idx];
+		if (NULL == h) return NULL;
+	} while (unlikely(cos_cmpxchg(&__small_mem[idx], (long)h, 0) != 0));
+
+	return h;
 }
 
 #if ALLOC_DEBUG >= ALLOC_DEBUG_STATS
 struct mem_stats {
-	unsigned long long alloc, free;
+	unsigned long long alloc, free, pages_alloc, pages_free;
 };
-typedef enum { DBG_ALLOC, DBG_FREE } alloc_dbg_type_t;
-static struct mem_stats __mem_stats[8];
+typedef enum { DBG_ALLOC, DBG_FREE, DBG_PAGE_ALLOC, DBG_PAGE_FREE } alloc_dbg_type_t;
+static struct mem_stats __mem_stats[SMALL_NCLASSES];
 
 void alloc_stats_print(void)
 {
 	int i;
 
-	for (i = 0 ; i < 8 ; i++) {
+	for (i = 0 ; i < SMALL_NCLASSES ; i++) {
 		unsigned long long min;
 
-		printc("cos_alloc: bin %d, alloc %lld, free %lld", 
-		       i, __mem_stats[i].alloc, __mem_stats[i].free);
+		printc("cos_alloc: bin %d (%d bytes), alloc %lld, free %lld, pages alloc %lld, free %lld", 
+		       i, get_size(i), __mem_stats[i].alloc, __mem_stats[i].free,
+		       __mem_stats[i].pages_alloc, __mem_stats[i].pages_free);
 		min = (__mem_stats[i].alloc < __mem_stats[i].free) ? 
 			__mem_stats[i].alloc : 
 			__mem_stats[i].free;
@@ -208,90 +381,168 @@ static void alloc_stats_report(alloc_dbg_type_t type, int bin)
 	case DBG_FREE:
 		__mem_stats[bin].free++;
 		break;
+	case DBG_PAGE_ALLOC:
+		__mem_stats[bin].pages_alloc++;
+		break;
+	case DBG_PAGE_FREE:
+		__mem_stats[bin].pages_free++;
+		break;
 	}
 }
 #else
 #define alloc_stats_report(t, b)
 #endif
 
-/* small mem */
+/* 
+ * Return the pages of a class whose objects are all on its global
+ * list (not allocated, nor in a thread's cache) to the memory
+ * manager.  Only one thread reclaims a class at a time, and while it
+ * does, it owns the objects it took from the list.
+ */
+static void __small_reclaim(size_t idx)
+{
+	__alloc_t *lst, *p, *keep = NULL, *keep_end = NULL, *next;
+	struct small_page *pg, *release = NULL;
+	long n = 0;
+	int kept = 0;
+
+	if (cos_cmpxchg(&__small_reclaiming[idx], 0, 1) != 1) return;
+	lst = __small_take(idx);
+	for (p = lst ; p ; p = p->next) {
+		SMALL_PAGE(p)->scan++;
+		n++;
+	}
+	for (p = lst ; p ; p = next) {
+		next = p->next;
+		pg   = SMALL_PAGE(p);
+		if (pg->scan == pg->nobjs && kept >= SMALL_KEEP_PAGES) {
+			/* the first of the page's objects: release it */
+			pg->scan  = pg->nobjs + 1;
+			pg->next  = release;
+			release   = pg;
+			n        -= pg->nobjs;
+			continue;
+		}
+		if (pg->scan > pg->nobjs) continue;
+		if (pg->scan == pg->nobjs) {
+			/* keep the page: it is reset below */
+			pg->scan = 0;
+			kept++;
+		}
+		p->next = keep;
+		keep    = p;
+		if (!keep_end) keep_end = p;
+	}
+	for (p = keep ; p ; p = p->next) SMALL_PAGE(p)->scan = 0;
+	if (keep) __small_push(idx, keep, keep_end);
+	/* the count is only an estimate: resynchronize it */
+	__small_nfree_add(idx, n - __small_nfree[idx]);
+	__small_reclaiming[idx] = 0;
+
+	while (release) {
+		pg      = release;
+		release = pg->next;
+		alloc_stats_report(DBG_PAGE_FREE, idx);
+		do_munmap(pg, MEM_BLOCK_SIZE);
+	}
+}
+
+/* Carve a new page into a chain of objects */
+static __alloc_t *__small_page_alloc(size_t idx, int *nr)
+{
+	struct small_page *pg;
+	__alloc_t *ptr, *start;
+	size_t size = get_size(idx);
+	int i;
+
+	pg = do_mmap(MEM_BLOCK_SIZE);
+	if (pg == MAP_FAILED) return NULL;
+	pg->idx   = idx;
+	pg->nobjs = __SMALL_NR(size);
+	pg->scan  = 0;
+	pg->next  = NULL;
+	alloc_stats_report(DBG_PAGE_ALLOC, idx);
+
+	start = ptr = (__alloc_t *)(((char *)pg) + SMALL_OBJS_OFF);
+	for (i = 0 ; i < pg->nobjs-1 ; i++) {
+		ptr->next = (__alloc_t *)(((char *)ptr) + size);
+		ptr       = ptr->next;
+	}
+	ptr->next = NULL;
+	*nr       = pg->nobjs;
+
+	return start;
+}
+
+static inline struct small_cache *__small_cache_get(size_t idx)
+{
+	return &__small_cache[cos_get_thd_id()][idx];
+}
+
 static void __small_free(void*_ptr,size_t _size) REGPARM(2);
 
 static inline void REGPARM(2) __small_free(void*_ptr,size_t _size) {
-	__alloc_t* ptr=BLOCK_START(_ptr), *prev;
-	size_t size=_size;
-	size_t idx=get_index(size);
+	__alloc_t *ptr=BLOCK_START(_ptr), *p, *last;
+	size_t idx=get_index(_size);
+	struct small_cache *c = __small_cache_get(idx);
+	int max, i;
 	
-//	memset(ptr,0,size);	/* allways zero out small mem */
 #if ALLOC_DEBUG >= ALLOC_DEBUG_ALL
 	if (alloc_debug) printc("free (in %d): freeing %p of size %d and index %d.", 
-				cos_spd_id(), ptr, size, idx);
+				cos_spd_id(), ptr, _size, idx);
 #endif
-	do {
-		prev = __small_mem[idx];
-		ptr->next=prev;
-	} while (unlikely(cos_cmpxchg(&__small_mem[idx], (int)prev, (int)ptr) != (int)ptr));
+	ptr->next = c->head;
+	c->head   = ptr;
+	c->cnt++;
 	alloc_stats_report(DBG_FREE, idx);
+
+	max = SMALL_CACHE_PAGES * __SMALL_NR(get_size(idx));
+	if (likely(c->cnt <= max)) return;
+
+	/* keep the most recently freed half, and give the rest back */
+	for (i = 1, p = c->head ; i < max/2 ; i++) p = p->next;
+	last    = p;
+	p       = last->next;
+	last->next = NULL;
+	for (last = p, i = 1 ; last->next ; last = last->next) i++;
+	c->cnt -= i;
+	__small_push(idx, p, last);
+	__small_nfree_add(idx, i);
+	if (__small_nfree[idx] > SMALL_RELEASE_THRESH * (long)__SMALL_NR(get_size(idx))) {
+		__small_reclaim(idx);
+	}
 }
 
 static inline void* REGPARM(1) __small_malloc(size_t _size) {
-	__alloc_t *ptr, *next;
-	size_t size=_size;
-	size_t idx;
+	__alloc_t *ptr;
+	size_t idx=get_index(_size);
+	struct small_cache *c = __small_cache_get(idx);
 
-	idx=get_index(size);
-	do {
-		ptr=__small_mem[idx];
-#if ALLOC_DEBUG >= ALLOC_DEBUG_ALL
-		if (alloc_debug) printc("malloc (in %d): head of list for size %d (idx %d) is %x", 
-					cos_spd_id(), _size, idx, __small_mem[idx]);
-#endif
-		if (unlikely(ptr==0))  {	/* no free blocks ? */
-			register int i,nr;
-			__alloc_t *start, *second, *end;
-			
-			start = ptr = do_mmap(MEM_BLOCK_SIZE);
-			if (ptr==MAP_FAILED) return MAP_FAILED;
-
-			nr=__SMALL_NR(size)-1;
-			for (i=0;i<nr;i++) {
-				ptr->next=(((void*)ptr)+size);
-				ptr=ptr->next;
-			}
-			end = ptr;
-			end->next=0;
-			/* Make malloc thread-safe with lock-free sync: */
-			second = start->next;
-			start->next = 0;
-			do {
-				ptr = __small_mem[idx];
-				/* Hook a possibly existing list to
-				 * the end of our new list */
-				end->next = ptr;
-			} while (unlikely(cos_cmpxchg(&__small_mem[idx], (long)ptr, (long)second) != (long)second));
-#if ALLOC_DEBUG >= ALLOC_DEBUG_ALL
-			if (alloc_debug) printc("malloc (in %d): returning memory region @ %x, size %d, index %d, (head of list is %x)", 
-						cos_spd_id(), ptr, size, idx, __small_mem[idx]);
-#endif
-			return start;
-		} 
-		next = ptr->next;
-		//__small_mem[idx]=ptr->next;
-	} while (unlikely(cos_cmpxchg(&__small_mem[idx], (long)ptr, (long)next) != (long)next));
+	ptr = c->head;
+	if (unlikely(NULL == ptr)) {
+		int n = 0;
+
+		/* refill from the global list, or from a new page */
+		ptr = __small_take(idx);
+		if (ptr) {
+			__alloc_t *p;
+
+			for (p = ptr ; p ; p = p->next) n++;
+			__small_nfree_add(idx, -n);
+		} else {
+			ptr = __small_page_alloc(idx, &n);
+			if (NULL == ptr) return MAP_FAILED;
+		}
+		c->cnt = n;
+	}
+	c->head = ptr->next;
+	c->cnt--;
 	ptr->next=0;
 
 #if ALLOC_DEBUG >= ALLOC_DEBUG_ALL
-	if (alloc_debug) printc("malloc (in %d): returning memory region @ %x, size %d, index %d, (head of list is %x)", 
-				cos_spd_id(), ptr, size, idx, __small_mem[idx]);
+	if (alloc_debug) printc("malloc (in %d): returning memory region @ %x, size %d, index %d", 
+				cos_spd_id(), ptr, _size, idx);
 #endif
-	/* 
-	 * FIXME: This still suffers from the ABA problem -- still a
-	 * race if ptr and next are removed from list, then ptr put
-	 * back in between ptr=__small_mem[idx] and the cmpxchg.  next
-	 * is used elsewhere, but we are still going to put it back at
-	 * the head of the list.  This can be solved with another
-	 * cos_cmpxchg loop to verify next as well.
-	 */
 	alloc_stats_report(DBG_ALLOC, idx);
 
 	return ptr;
@@ -312,7 +563,9 @@ static void _alloc_libc_free(void *ptr) {
   }
 }
 //void __libc_free(void *ptr) __attribute__((alias("_alloc_libc_free")));
+#ifndef UNIX_TEST
 void free(void *ptr) __attribute__((weak,alias("_alloc_libc_free")));
+#endif
 
 #ifdef WANT_MALLOC_ZERO
 static __alloc_t zeromem[2];
@@ -344,65 +597,28 @@ err_out:
   return 0;
 }
 //void* __libc_malloc(size_t size) __attribute__((alias("_alloc_libc_malloc")));
+#ifndef UNIX_TEST
 void* malloc(size_t size) __attribute__((weak,alias("_alloc_libc_malloc")));
-
-void *__libc_calloc(size_t nmemb, size_t _size)
-{
-	size_t tot = nmemb*_size;
-	char *ret = malloc(tot);
-	
-	memset(ret, 0, tot);
-	return ret;
-}
-
-void* calloc(size_t nmemb, size_t _size) __attribute__((weak,alias("__libc_calloc")));
-
-/* gabep1 additions for allocations of pages. */
-
-void *alloc_page(void)
-{
-	struct free_page *fp;
-	void *a;
-
-	fp = page_list.next;
-	if (NULL == fp) {
-		a = do_mmap(PAGE_SIZE);
-	} else {
-		page_list.next = fp->next;
-		fp->next = NULL;
-		a = (void*)fp;
-	}
-	
-	return a;
-}
-
-void free_page(void *ptr)
-{
-	struct free_page *fp;
-	
-	fp = (struct free_page *)ptr;
-	fp->next = page_list.next;
-	page_list.next = fp;
-
-	return;
-}
-
-/* end gabep1 additions */
-
-
-#ifdef NIL
+#endif
 
 void* __libc_calloc(size_t nmemb, size_t _size);
 void* __libc_calloc(size_t nmemb, size_t _size) {
   register size_t size=_size*nmemb;
-  if (nmemb && size/nmemb!=_size) {
-    (*__errno_location())=ENOMEM;
-    return 0;
-  }
-  return malloc(size);
+  void *ret;
+  if (nmemb && size/nmemb!=_size) return 0;
+  ret=_alloc_libc_malloc(size);
+  if (ret) memset(ret,0,size);
+  return ret;
 }
+#ifndef UNIX_TEST
 void* calloc(size_t nmemb, size_t _size) __attribute__((weak,alias("__libc_calloc")));
+#endif
 
+/* 
+ * Large allocations are resized in place when possible: they shrink
+ * by unmapping their tail, and grow by mapping the pages following
+ * them if those are free.
+ */
 void* __libc_realloc(void* ptr, size_t _size);
 void* __libc_realloc(void* ptr, size_t _size) {
   register size_t size=_size;
@@ -410,10 +626,21 @@ void* __libc_realloc(void* ptr, size_t _size) {
     if (size) {
       __alloc_t* tmp=BLOCK_START(ptr);
       size+=sizeof(__alloc_t);
-      if (size<sizeof(__alloc_t)) goto retzero;
+      if (size<sizeof(__alloc_t)) return 0;
       size=(size<=__MAX_SMALL_SIZE)?GET_SIZE(size):PAGE_ALIGN(size);
       if (tmp->size!=size) {
-	if ((tmp->size<=__MAX_SMALL_SIZE)) {
+	if (tmp->size>__MAX_SMALL_SIZE && size>__MAX_SMALL_SIZE) {
+	  if (size<tmp->size) {
+	    do_munmap(((char*)tmp)+size,tmp->size-size);
+	    tmp->size=size;
+	    return ptr;
+	  }
+	  if (!do_mgrow(tmp,tmp->size,size)) {
+	    tmp->size=size;
+	    return ptr;
+	  }
+	}
+	{
 	  void *new=_alloc_libc_malloc(_size);
 	  if (new) {
 	    register __alloc_t* foo=BLOCK_START(new);
@@ -424,20 +651,6 @@ void* __libc_realloc(void* ptr, size_t _size) {
 	  }
 	  ptr=new;
 	}
-	else {
-	  register __alloc_t* foo;
-	  size=PAGE_ALIGN(size);
-	  foo=mremap(tmp,tmp->size,size,MREMAP_MAYMOVE);
-	  if (foo==MAP_FAILED) {
-retzero:
-	    (*__errno_location())=ENOMEM;
-	    ptr=0;
-	  }
-	  else {
-	    foo->size=size;
-	    ptr=BLOCK_RET(foo);
-	  }
-	}
       }
     }
     else { /* size==0 */
@@ -452,10 +665,43 @@ retzero:
   }
   return ptr;
 }
+#ifndef UNIX_TEST
 void* realloc(void* ptr, size_t size) __attribute__((weak,alias("__libc_realloc")));
-
 #endif
 
+/* gabep1 additions for allocations of pages. */
+
+void *alloc_page(void)
+{
+	struct free_page *fp;
+	void *a;
+
+	fp = page_list.next;
+	if (NULL == fp) {
+		a = do_mmap(PAGE_SIZE);
+	} else {
+		page_list.next = fp->next;
+		fp->next = NULL;
+		a = (void*)fp;
+	}
+	
+	return a;
+}
+
+void free_page(void *ptr)
+{
+	struct free_page *fp;
+	
+	fp = (struct free_page *)ptr;
+	fp->next = page_list.next;
+	page_list.next = fp;
+
+	return;
+}
+
+/* end gabep1 additions */
+
+
 /* void */
 /* __alloc_libc_initilize(void) */
 /* { */
@@ -479,114 +725,149 @@ void* realloc(void* ptr, size_t size) __attribute__((weak,alias("__libc_realloc"
 
 #ifdef UNIX_TEST
 
-#define ITER 100000
+/* 
+ * Each thread randomly allocates and frees objects, keeping at most
+ * PTRS_LIVE live, and checks that each object's contents were not
+ * changed while it was allocated.  Objects are sometimes freed by a
+ * different thread than allocated them (through a shared exchange
+ * slot) to exercise the movement of memory between the threads'
+ * caches and the global lists.
+ */
+#define ITER 1000000
 #define PTRS_LIVE 100
 #define SIZE_LB 4
-#define SIZE_UB 8192
-#define SIZE_GET ((rand() % (SIZE_UB-SIZE_LB)) + SIZE_LB)
+#define SIZE_UB 2048
+#define MAX_THDS 8
 
 #include <stdlib.h>
 #include <time.h>
 #include <stdio.h>
-#include <string.h>
-
-int find_ptr(long *ptrs, int sz, int empty)
-{
-	int i; 
+#include <pthread.h>
+#include <sys/time.h>
 
-	for (i = 0 ; i < sz ; i++) {
-		if (empty && ptrs[i] == 0) return i;
-		else if (!empty && ptrs[i] != 0) return i;
-	}
+static long exchange[MAX_THDS];
+static int nerrors;
 
-	return -1;
+static inline int rand_next(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7fff;
 }
 
-void malloc_rand(long *ptrs, int sz)
+static void *malloc_rand(unsigned int *seed)
 {
-	int idx = find_ptr(ptrs, sz, 1);
-	long *ptr;
-	int asz;
-
-	if (idx < 0) printf("Hmm, index errors when mallocing.\n");
-
-	ptr = &ptrs[idx];
+	int asz = (rand_next(seed) % (SIZE_UB-SIZE_LB)) + SIZE_LB;
+	char *p;
 
-	asz = SIZE_GET;
-	*ptr = (long)malloc(asz);
-	if (*ptr == 0) {
+	p = _alloc_libc_malloc(asz);
+	if (!p) {
 		printf("could not malloc!\n");
+		exit(-1);
 	}
+	*(int*)p = asz;
+	memset(p+sizeof(int), asz & 0xff, asz-sizeof(int));
 
-	*(int*)*ptr = asz;
-	memset((char*)(*ptr)+sizeof(int), rand() % 256, asz-sizeof(int));
-	printf("+");
-	
-	return;
+	return p;
 }
 
-void free_rand(long *ptrs, int sz)
+static void free_rand(char *p)
 {
-	int i, idx = find_ptr(ptrs, sz, 0), asz;
-	long *ptr;
-	char c, *arr;
+	int i, asz = *(int*)p;
 
-	if (idx < 0) printf("Hmm, index errors when freeing.\n");
+	for (i = sizeof(int) ; i < asz ; i++) {
+		if (p[i] != (char)(asz & 0xff)) {
+			__sync_fetch_and_add(&nerrors, 1);
+			break;
+		}
+	}
+	_alloc_libc_free(p);
+}
 
-	ptr = &ptrs[idx];
-	asz = *(int*)(*ptr);
-	arr = ((char*)(*ptr)) + sizeof(int);
-	c = *arr;
+static void *bench_thd(void *d)
+{
+	long ptrs[PTRS_LIVE] = {0, };
+	int i, thd = (int)(long)d, nthds = (int)(long)d >> 8;
+	unsigned int seed = thd;
 
-	for (i = 0 ; i < asz-sizeof(int) ; i++) {
-		if (((char *)arr)[i] != c) {
-			printf("we have a problem.\n");
-			break;
+	thd &= 0xff;
+	for (i = 0 ; i < ITER ; i++) {
+		int idx = rand_next(&seed) % PTRS_LIVE;
+		
+		if (ptrs[idx]) {
+			/* occasionally hand the object to another thread */
+			if (nthds > 1 && !(rand_next(&seed) % 8)) {
+				long *x = &exchange[(thd+1) % nthds];
+				
+				ptrs[idx] = __sync_lock_test_and_set(x, ptrs[idx]);
+				if (ptrs[idx]) free_rand((char *)ptrs[idx]);
+			} else {
+				free_rand((char *)ptrs[idx]);
+			}
+			ptrs[idx] = 0;
+		} else {
+			ptrs[idx] = (long)malloc_rand(&seed);
 		}
 	}
+	for (i = 0 ; i < PTRS_LIVE ; i++) if (ptrs[i]) free_rand((char *)ptrs[i]);
 
-	free((void*)*ptr);
-	*ptr = 0;
-	printf("-");
+	return NULL;
+}
 
-	return;
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+/* grow, then shrink, an allocation, checking that it is preserved */
+static void realloc_test(void)
+{
+	char *p = NULL;
+	int i, sz, prev = 0;
+
+	for (sz = 8 ; sz <= 64*PAGE_SIZE ; sz *= 2) {
+		p = __libc_realloc(p, sz);
+		for (i = 0 ; i < prev ; i++) if (p[i] != (char)i) nerrors++;
+		for (i = 0 ; i < sz ; i++) p[i] = (char)i;
+		prev = sz;
+	}
+	for (sz /= 4 ; sz >= 8 ; sz /= 4) {
+		p = __libc_realloc(p, sz);
+		for (i = 0 ; i < sz ; i++) if (p[i] != (char)i) nerrors++;
+	}
+	__libc_realloc(p, 0);
 }
 
 int main(void)
 {
-	long ptrs[PTRS_LIVE] = {0, };
-	int i, live = 0;
+	pthread_t thds[MAX_THDS];
+	int i, n;
 
-	memset(ptrs, 0, sizeof(long) * PTRS_LIVE);
-	srand(time(NULL));
+	realloc_test();
 
-	for (i = 0 ; i < ITER ; i++) {
-		int alloc;
+	for (n = 1 ; n <= MAX_THDS ; n *= 2) {
+		double start, t;
 
-		switch (live) {
-		case 0:
-			alloc = 1;
-			break;
-		case PTRS_LIVE:
-			alloc = 0;
-			break;
-		default:
-			if (rand() % 2) {
-				alloc = 1;
-			} else {
-				alloc = 0;
+		start = now();
+		for (i = 0 ; i < n ; i++) {
+			if (pthread_create(&thds[i], NULL, bench_thd, (void *)(long)(i | (n << 8)))) {
+				perror("pthread_create");
+				return -1;
 			}
 		}
-
-		if (alloc) {
-			malloc_rand(ptrs, PTRS_LIVE);
-			live++;
-		} else {
-			free_rand(ptrs, PTRS_LIVE);
-			live--;
+		for (i = 0 ; i < n ; i++) pthread_join(thds[i], NULL);
+		for (i = 0 ; i < n ; i++) {
+			if (exchange[i]) free_rand((char *)exchange[i]);
+			exchange[i] = 0;
 		}
+		t = now() - start;
+		printf("%d threads: %.0f malloc+free/sec (%.3f sec)\n", n, (double)n*ITER/t, t);
 	}
-	return 0; 
+	if (nerrors) printf("%d corrupted allocations\n", nerrors);
+
+	return nerrors;
 }
 
 #endif
@@ -0,0 +1,9 @@
+/* 
+ * Configuration of the cos_alloc allocator, shared (through
+ * symlinks) by the mem_mgr and mem_mgr_large interface libraries:
+ *
+ * USE_VALLOC: take virtual address ranges from the valloc component
+ * (which the component must depend on), rather than from the top of
+ * the component's heap.  Freed ranges can then always be reused, and
+ * large allocations can grow in place.
+ */
@@ -1 +1,2 @@
+/* see ../mem_mgr/mem_mgr_config.h */
 #define USE_VALLOC 1
@@ -12,6 +12,14 @@ int net_bind(spdid_t spdid, net_connection_t nc, u32_t ip, u16_t port);
 int net_connect(spdid_t spdid, net_connection_t nc, u32_t ip, u16_t port);
 int net_close(spdid_t spdid, net_connection_t nc);
 int net_send(spdid_t spdid, net_connection_t nc, void *data, int sz);
+/* send the data described by a response descriptor (resp_desc.h) */
+int net_send_resp(spdid_t spdid, net_connection_t nc, struct cos_array *data);
 int net_recv(spdid_t spdid, net_connection_t nc, void *data, int sz);
 
+/* net_ready replaces each connection id in the array with a mask of these */
+#define NET_READY_IN  0x1	/* data or connections to accept */
+#define NET_READY_OUT 0x4	/* room in the send buffer */
+#define NET_READY_HUP 0x10	/* closed by the remote end */
+int net_ready(spdid_t spdid, struct cos_array *conns);
+
 #endif 	    /* !NET_TRANSPORT_H */
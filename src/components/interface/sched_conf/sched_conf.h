@@ -5,5 +5,11 @@ int sched_comp_config_default(spdid_t spdid, spdid_t target, struct cos_array *d
 spdid_t sched_comp_config(spdid_t spdid, int index, struct cos_array *data);
 spdid_t sched_comp_config_poststart(spdid_t spdid, int i, struct cos_array *data);
 int sched_comp_config_initstr(spdid_t spdid, struct cos_array *data);
+/* 
+ * Components report the depth of their request queues so that the
+ * scheduler configuration can adapt to load.
+ */
+int sched_comp_load_report(spdid_t spdid, int depth);
+int sched_comp_load(spdid_t spdid, spdid_t target);
 
 #endif 	    /* !SCHED_CONF_H */
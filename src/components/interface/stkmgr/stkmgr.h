@@ -21,6 +21,8 @@ int stkmgr_set_concurrency(spdid_t spdid, int concur_lvl, int remove_spare);
 int stkmgr_spd_concurrency_estimate(spdid_t spdid);
 unsigned long stkmgr_thd_blk_time(unsigned short int tid, spdid_t spdid, int reset);
 int stkmgr_thd_blk_cnt(unsigned short int tid, spdid_t spdid, int reset);
+/* the time (in cycles) within which pct percent of spdid's stack misses were satisfied */
+unsigned long stkmgr_spd_blk_percentile(spdid_t spdid, int pct, int reset);
 
 /* map a stack to the destination location, from the source component */
 int stkmgr_stack_introspect(spdid_t d_spdid, vaddr_t d_addr, spdid_t s_spdid, vaddr_t s_addr);
@@ -4,6 +4,8 @@
 /* Virtual address space allocation for a component */
 
 void *valloc_alloc(spdid_t spdid, spdid_t dest, unsigned long npages);
+/* allocate the npages at addr if they are all free: 0 on success */
+int valloc_alloc_at(spdid_t spdid, spdid_t dest, void *addr, unsigned long npages);
 int valloc_free(spdid_t spdid, spdid_t dest, void *addr, unsigned long npages);
 
 #endif 	    /* !VALLOC_H */
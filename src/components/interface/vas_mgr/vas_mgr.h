@@ -10,7 +10,9 @@
 #ifndef VAS_MGR_H
 #define VAS_MGR_H
 
-vaddr_t vas_mgr_expand(spdid_t spd, long amnt);
-void    vas_mgr_contract(spdid_t spd, vaddr_t addr);
+/* expand dest's virtual address space by amnt bytes, returning their base */
+vaddr_t vas_mgr_expand(spdid_t spd, spdid_t dest, long amnt);
+/* remove a region returned by vas_mgr_expand from dest */
+int     vas_mgr_contract(spdid_t spd, spdid_t dest, vaddr_t addr);
 
 #endif 	/* !VAS_MGR_H */
@@ -0,0 +1,147 @@
+/*
+ * Test and microbenchmark for bitmap.h, checking each operation
+ * against a simple bit-at-a-time version:
+ *
+ * gcc -O2 -I../include bitmap.c -o bitmap_test
+ */
+
+#define LINUX
+#include <bitmap.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define MAX_WORDS 8
+#define NBITS     (MAX_WORDS*WORD_SIZE)
+#define ITER      100000
+
+static int nfail;
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL (line %d): %s\n", __LINE__, #cond); nfail++; } } while (0)
+
+static int ref_bit(u32_t *x, int i) { return (x[i/WORD_SIZE] >> (i%WORD_SIZE)) & 1; }
+
+static int ref_run_find(u32_t *x, int off, int extent, int one)
+{
+	int i, j;
+
+	for (i = off ; i + extent <= NBITS ; i++) {
+		for (j = 0 ; j < extent && ref_bit(x, i+j) == one ; j++) ;
+		if (j == extent) return i;
+	}
+	return -1;
+}
+
+static u32_t ref_log32_floor(u32_t x) { u32_t r = 0; while (x >>= 1) r++; return r; }
+static u32_t ref_log32(u32_t x) { u32_t r = 0; while ((1ULL << r) < x) r++; return r; }
+
+/* random bitmaps with long runs of both ones and zeros */
+static void rand_map(u32_t *x)
+{
+	int i;
+
+	for (i = 0 ; i < MAX_WORDS ; i++) {
+		switch (rand() % 4) {
+		case 0:  x[i] = 0; break;
+		case 1:  x[i] = ~0U; break;
+		default: x[i] = (u32_t)rand() ^ ((u32_t)rand() << 16);
+		}
+	}
+}
+
+static void unit_test(void)
+{
+	u32_t x[MAX_WORDS], y[MAX_WORDS];
+	int it, i;
+
+	for (it = 0 ; it < ITER ; it++) {
+		int off = rand() % NBITS, ext = rand() % (NBITS - off + 1), n = 1 + rand() % 48, cnt = 0;
+		u32_t w = (u32_t)rand() >> (rand() % 32);
+
+		CHECK(log32(w) == ref_log32(w));
+		CHECK(log32_floor(w) == ref_log32_floor(w));
+		rand_map(x);
+		memcpy(y, x, sizeof(x));
+
+		if (rand() % 2) bitmap_set_range(x, off, ext);
+		else            bitmap_clear_range(x, off, ext);
+		for (i = 0 ; i < NBITS ; i++) {
+			if (i < off || i >= off+ext) CHECK(ref_bit(x, i) == ref_bit(y, i));
+			cnt += ref_bit(x, i);
+		}
+		CHECK(bitmap_count(x, MAX_WORDS) == cnt);
+		for (i = off ; i < NBITS && !ref_bit(x, i) ; i++) ;
+		CHECK(bitmap_one_offset(x, off, MAX_WORDS) == (i == NBITS ? -1 : i));
+		CHECK(bitmap_contiguous_ones(x, off, n, MAX_WORDS) == ref_run_find(x, off, n, 1));
+		CHECK(bitmap_zero_run_find(x, off, n, MAX_WORDS) == ref_run_find(x, off, n, 0));
+		if (ref_bit(x, off)) {
+			int s = off;
+
+			while (s > 0 && ref_bit(x, s-1)) s--;
+			CHECK(bitmap_run_start(x, off, 1) == s);
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+/*
+ * Sparse bitmaps of 1024 bits (e.g. valloc's page maps): find runs,
+ * and set and clear ranges.
+ */
+#define BENCH_WORDS 32
+#define BENCH_ITER  1000000
+
+static void bench(void)
+{
+	static u32_t x[BENCH_WORDS];
+	double s, t;
+	int i, sum = 0;
+
+	for (i = 0 ; i < BENCH_WORDS ; i++) x[i] = (i % 5 == 4) ? 0xFF00FF00 : 0;
+	s = now();
+	for (i = 0 ; i < BENCH_ITER ; i++) sum += bitmap_contiguous_ones(x, i % 64, 8, BENCH_WORDS);
+	t = now() - s;
+	printf("contiguous_ones: %.1f ns/op\n", t*1e9/BENCH_ITER);
+
+	s = now();
+	for (i = 0 ; i < BENCH_ITER ; i++) sum += bitmap_zero_run_find(x, i % 64, 100, BENCH_WORDS);
+	t = now() - s;
+	printf("zero_run_find: %.1f ns/op\n", t*1e9/BENCH_ITER);
+
+	s = now();
+	for (i = 0 ; i < BENCH_ITER ; i++) sum += bitmap_one(x, BENCH_WORDS);
+	t = now() - s;
+	printf("one: %.1f ns/op\n", t*1e9/BENCH_ITER);
+
+	s = now();
+	for (i = 0 ; i < BENCH_ITER ; i++) {
+		bitmap_set_range(x, i % 512, 300);
+		bitmap_clear_range(x, i % 512, 300);
+	}
+	t = now() - s;
+	printf("set+clear 300 bits: %.1f ns/op\n", t*1e9/BENCH_ITER);
+
+	s = now();
+	for (i = 0 ; i < BENCH_ITER ; i++) sum += bitmap_count(x, BENCH_WORDS);
+	t = now() - s;
+	printf("count: %.1f ns/op\n", t*1e9/BENCH_ITER);
+	if (!sum) printf("\n");
+}
+
+int main(void)
+{
+	srand(1);
+	unit_test();
+	printf("%s unit tests.\n", nfail ? "Failed" : "Passed");
+	bench();
+
+	return nfail;
+}
@@ -1,9 +1,14 @@
 /* 
- * Test for cos_map.h
+ * Test and microbenchmark for cos_map.h and cos_vect.h:
+ *
+ * gcc -O2 -I../include cos_map.c -o cos_map_test
  */
 
 #define COS_LINUX_ENV
+/* exercise trees deeper than the default */
+#define COS_VECT_DEPTH_MAX 3
 #include <cos_map.h>
+#include <sys/time.h>
 
 #define ID_NUM (515)
 
@@ -13,6 +18,116 @@ COS_MAP_CREATE_STATIC(static_map);
 
 #define PRINT(args...) //printf(args)
 
+static int nfail;
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL (line %d): %s\n", __LINE__, #cond); nfail++; } } while (0)
+
+static void add_id_test(void)
+{
+	cos_map_t *m = cos_map_alloc_map();
+	long id;
+
+	CHECK(m);
+	/* specific ids, in and well past the initial range */
+	CHECK(cos_map_add_id(m, (void*)1, 3) == 3);
+	CHECK(cos_map_add_id(m, (void*)2, 3) == -1);
+	CHECK(cos_map_add_id(m, (void*)3, 5000) == 5000);
+	CHECK(cos_map_lookup(m, 5000) == (void*)3);
+	/* general adds must skip the ids taken */
+	for (id = 0 ; id < 6000 ; id++) {
+		long r = cos_map_add(m, (void*)(id+10));
+
+		CHECK(r != 3 && r != 5000 && r >= 0);
+		CHECK(cos_map_lookup(m, r) == (void*)(id+10));
+	}
+	CHECK(cos_map_del(m, 5000) == 0);
+	CHECK(cos_map_del(m, 5000) == -1);
+	CHECK(cos_map_add_id(m, (void*)4, 5000) == 5000);
+	CHECK(cos_map_add(m, (void*)5) == 6002);
+	printf("Completed add_id.\n");
+}
+
+static void iter_test(void)
+{
+	cos_vect_t *v = cos_vect_alloc_vect();
+	long ids[7], pos = 0, i, expect = 0, big = 1L << (COS_VECT_SHIFT*2 + 1);
+	void *vals[7];
+	int n, tot = 0;
+
+	/* sparse ids over all three levels */
+	for (i = 1 ; i < big ; i = i*3 + 1) CHECK(cos_vect_add_id(v, (void*)i, i) == i);
+	while ((n = cos_vect_iter_batch(v, &pos, ids, vals, 7))) {
+		int j;
+
+		for (j = 0 ; j < n ; j++) {
+			expect = expect*3 + 1;
+			CHECK(ids[j] == expect && vals[j] == (void*)expect);
+		}
+		tot += n;
+	}
+	for (i = 1, n = 0 ; i < big ; i = i*3 + 1) n++;
+	CHECK(tot == n);
+	printf("Completed iteration (%d entries, depth %d).\n", tot, v->depth);
+}
+
+#define BENCH_N (1<<16)
+#define BENCH_ITER 64
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+static void bench(void)
+{
+	static long mids[BENCH_N], ids[64];
+	static void *vals[64];
+	cos_map_t *m = cos_map_alloc_map();
+	cos_vect_t *v = cos_vect_alloc_vect();
+	double s, t;
+	long i, j, sum = 0, pos;
+	int n;
+
+	for (i = 0 ; i < BENCH_N ; i++) cos_vect_add_id(v, (void*)(i+1), i);
+	s = now();
+	for (j = 0 ; j < BENCH_ITER ; j++) {
+		for (i = 0 ; i < BENCH_N ; i++) sum += (long)cos_vect_lookup(v, (i*7919) & (BENCH_N-1));
+	}
+	t = now() - s;
+	printf("vect lookup: %.1f M/sec\n", BENCH_N*BENCH_ITER/t/1000000);
+
+	s = now();
+	for (j = 0 ; j < BENCH_ITER ; j++) {
+		for (pos = 0 ; (n = cos_vect_iter_batch(v, &pos, ids, vals, 64)) ; ) {
+			for (i = 0 ; i < n ; i++) sum += (long)vals[i];
+		}
+	}
+	t = now() - s;
+	printf("vect iteration: %.1f M entries/sec\n", BENCH_N*BENCH_ITER/t/1000000);
+
+	s = now();
+	for (j = 0 ; j < BENCH_ITER ; j++) {
+		for (i = 0 ; i < BENCH_N ; i++) mids[i] = cos_map_add(m, (void*)(i+1));
+		for (i = 0 ; i < BENCH_N ; i++) sum += (long)cos_map_lookup(m, mids[i]);
+		for (i = 0 ; i < BENCH_N ; i++) cos_map_del(m, mids[i]);
+	}
+	t = now() - s;
+	printf("map add+lookup+del: %.1f M/sec\n", BENCH_N*BENCH_ITER/t/1000000);
+
+	s = now();
+	for (j = 0 ; j < BENCH_ITER ; j++) {
+		for (i = 0 ; i < BENCH_N ; i++) cos_map_add_id(m, (void*)(i+1), (i*7919) & (BENCH_N-1));
+		for (i = 0 ; i < BENCH_N ; i++) cos_map_del(m, i);
+	}
+	t = now() - s;
+	printf("map add_id+del: %.1f M/sec\n", BENCH_N*BENCH_ITER/t/1000000);
+	if (!sum) printf("\n");
+	cos_map_free_map(m);
+	cos_vect_free_vect(v);
+}
+
 int main(void)
 {
 	int i;
@@ -21,13 +136,13 @@ int main(void)
 
 	printf("Allocated.\n");
 	for (i = 0 ; i < ID_NUM ; i++) {
-		ids[i] = cos_map_add(&static_map, (void*)i);
+		ids[i] = cos_map_add(&static_map, (void*)(long)i);
 		answers[i] = i;
 		PRINT("%d @ %ld\n", i, ids[i]);
 	}
 	printf("Added.\n");
 	for (i = 0 ; i < ID_NUM ; i++) {
-		int ret = (int)cos_map_lookup(&static_map, ids[i]);
+		int ret = (int)(long)cos_map_lookup(&static_map, ids[i]);
 		if (ret != answers[i]) printf("FAIL: %d != %ld @ %ld\n", ret, answers[i], ids[i]);
 		PRINT("%d @ %ld\n", ret, ids[i]);
 	}
@@ -37,31 +152,34 @@ int main(void)
 	}
 	printf("Deleted.\n");
 	for (i = 0 ; i < ID_NUM ; i++) {
-		ids[i] = cos_map_add(&static_map, (void*)i);
+		ids[i] = cos_map_add(&static_map, (void*)(long)i);
 		answers[i] = i;
 		PRINT("%d @ %ld\n", i, ids[i]);
 	}
 	printf("Added.\n");
 	for (i = 0 ; i < ID_NUM ; i++) {
-		int ret = (int)cos_map_lookup(&static_map, ids[i]);
+		int ret = (int)(long)cos_map_lookup(&static_map, ids[i]);
 		if (ret != answers[i]) printf("FAIL: %d != %ld @ %ld\n", ret, answers[i], ids[i]);
 		PRINT("%d @ %ld\n", ret, ids[i]);
 	}
 	printf("Completed Lookups.\n");
 	for (i = 0 ; i < ID_NUM ; i++) {
-		ids[i] = cos_map_add(&static_map, (void*)i);
+		ids[i] = cos_map_add(&static_map, (void*)(long)i);
 		answers[i] = i;
 		PRINT("%d @ %ld\n", i, ids[i]);
 	}
 	printf("Added.\n");
 	for (i = 0 ; i < ID_NUM ; i++) {
-		int ret = (int)cos_map_lookup(&static_map, ids[i]);
+		int ret = (int)(long)cos_map_lookup(&static_map, ids[i]);
 		if (ret != answers[i]) printf("FAIL: %d != %ld @ %ld\n", ret, answers[i], ids[i]);
 		PRINT("%d @ %ld\n", ret, ids[i]);
 	}
 	printf("Completed Lookups.\n");
 
 	printf("\ndone.\n");
+	add_id_test();
+	iter_test();
+	bench();
 
-	return 0;
+	return nfail;
 }
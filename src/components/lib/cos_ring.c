@@ -0,0 +1,140 @@
+/*
+ * Test and throughput benchmark for cos_ring.h: producers each send
+ * an increasing sequence through the ring, and the consumer checks
+ * that each producer's values arrive in order, and that none are
+ * lost:
+ *
+ * gcc -O2 -pthread -I../include cos_ring.c -o cos_ring_test
+ */
+
+#define LINUX
+#include <cos_ring.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define RING_ENTS   1024
+#define ITEMS       (1<<22)
+#define MAX_PRODS   4
+#define PROD_SHIFT  28 		/* producer id in the top bits of a value */
+
+static int nfail;
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL (line %d): %s\n", __LINE__, #cond); nfail++; } } while (0)
+
+static char mem[COS_MPRING_SZ(RING_ENTS)] __attribute__((aligned(CACHE_LINE)));
+static struct cos_ring *spsc;
+static struct cos_mpring *mpsc;
+static int batch, nprods;
+
+static void *producer(void *a)
+{
+	unsigned long vs[64], id = (unsigned long)a, i, j, n, m, tot = ITEMS/nprods;
+
+	for (i = 0 ; i < tot ; i += n) {
+		n = tot - i;
+		if (n > (unsigned long)batch) n = batch;
+		for (j = 0 ; j < n ; j++) vs[j] = (id << PROD_SHIFT) | (i + j);
+		for (j = 0 ; j < n ; j += m) {
+			if (mpsc) m = cos_mpring_enqueue_batch(mpsc, vs + j, n - j);
+			else      m = cos_ring_enqueue_batch(spsc, vs + j, n - j);
+			/* full: let the consumer run if we share a cpu */
+			if (0 == m) sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+static void consume(void)
+{
+	unsigned long vs[64], next[MAX_PRODS] = {0}, tot = 0;
+	int i, n;
+
+	while (tot < ITEMS) {
+		if (mpsc) n = cos_mpring_dequeue_batch(mpsc, vs, batch);
+		else      n = cos_ring_dequeue_batch(spsc, vs, batch);
+		if (0 == n) sched_yield();
+		for (i = 0 ; i < n ; i++) {
+			unsigned long id = vs[i] >> PROD_SHIFT;
+
+			CHECK(id < (unsigned long)nprods && (vs[i] & ((1UL<<PROD_SHIFT)-1)) == next[id]);
+			if (id < MAX_PRODS) next[id]++;
+		}
+		tot += n;
+	}
+	if (mpsc) CHECK(cos_mpring_empty(mpsc));
+	else      CHECK(cos_ring_empty(spsc));
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+static void run(int mp, int np, int b)
+{
+	pthread_t ts[MAX_PRODS];
+	double s;
+	long i;
+
+	spsc   = mp ? NULL : cos_ring_init(mem, COS_RING_SZ(RING_ENTS));
+	mpsc   = mp ? cos_mpring_init(mem, COS_MPRING_SZ(RING_ENTS)) : NULL;
+	nprods = np;
+	batch  = b;
+	CHECK(mp ? mpsc->mask == RING_ENTS-1 : spsc->mask == RING_ENTS-1);
+
+	s = now();
+	for (i = 0 ; i < np ; i++) pthread_create(&ts[i], NULL, producer, (void *)i);
+	consume();
+	for (i = 0 ; i < np ; i++) pthread_join(ts[i], NULL);
+	printf("%s, %d producer(s), batch %2d: %6.1f M values/sec\n",
+	       mp ? "MPSC" : "SPSC", np, b, ITEMS/(now() - s)/1e6);
+}
+
+static void unit_test(void)
+{
+	unsigned long vs[8] = {1, 2, 3, 4, 5, 6, 7, 8}, out[8];
+	struct cos_ring *r;
+	struct cos_mpring *m;
+
+	CHECK(NULL == cos_ring_init(mem, sizeof(struct cos_ring)));
+	/* rounds the capacity down to a power of 2 */
+	r = cos_ring_init(mem, sizeof(struct cos_ring) + 6*sizeof(unsigned long));
+	CHECK(r && r->mask == 3);
+	CHECK(cos_ring_enqueue_batch(r, vs, 8) == 4 && cos_ring_count(r) == 4);
+	CHECK(cos_ring_enqueue(r, 9) == -1);
+	CHECK(cos_ring_dequeue_batch(r, out, 3) == 3 && out[0] == 1 && out[2] == 3);
+	CHECK(cos_ring_enqueue_batch(r, vs + 4, 4) == 3);
+	CHECK(cos_ring_dequeue_batch(r, out, 8) == 4 && out[0] == 4 && out[3] == 7);
+	CHECK(cos_ring_dequeue(r, out) == -1 && cos_ring_empty(r));
+
+	m = cos_mpring_init(mem, COS_MPRING_SZ(4));
+	CHECK(m && m->mask == 3);
+	CHECK(cos_mpring_enqueue_batch(m, vs, 8) == 4 && cos_mpring_enqueue(m, 9) == -1);
+	CHECK(cos_mpring_dequeue_batch(m, out, 2) == 2 && out[1] == 2);
+	/* a reserved, but not yet published slot stops the consumer */
+	m->head.idx++;
+	CHECK(cos_mpring_dequeue_batch(m, out, 8) == 2 && out[1] == 4);
+	CHECK(cos_mpring_dequeue(m, out) == -1 && !cos_mpring_empty(m));
+	m->slots[4 & m->mask].val = 5;
+	m->slots[4 & m->mask].seq = 5;
+	CHECK(cos_mpring_dequeue(m, out) == 0 && out[0] == 5 && cos_mpring_empty(m));
+}
+
+int main(void)
+{
+	int b;
+
+	unit_test();
+	for (b = 1 ; b <= 32 ; b *= 4) run(0, 1, b);
+	for (b = 1 ; b <= 32 ; b *= 4) run(1, 1, b);
+	for (b = 1 ; b <= 32 ; b *= 4) run(1, MAX_PRODS, b);
+	printf("%s tests.\n", nfail ? "Failed" : "Passed");
+
+	return nfail;
+}
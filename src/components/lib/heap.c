@@ -308,6 +308,127 @@ static void test_driver(int amnt)
 	free(es);
 }
 
+/* a min-heap of ints with the position of each value tracked in hentry */
+#define h4_higher(a, b) ((a) <= (b))
+#define h4_update(e, pos) ((e)->index = (pos))
+HEAP4_DEFINE(h4, int, struct hentry *, h4_higher, h4_update)
+
+static void test4_driver(int amnt)
+{
+	int i, prev;
+	struct hentry *es;
+	struct h4_ent *d, ent;
+	struct h4 h;
+
+	d  = malloc(sizeof(struct h4_ent) * (amnt+1));
+	es = malloc(sizeof(struct hentry) * (amnt+1));
+	assert(d && es);
+	h4_init(&h, d, amnt);
+
+	for (i = 0 ; i < amnt ; i++) {
+		es[i].value = rand();
+		assert(!h4_add(&h, es[i].value, &es[i]));
+	}
+	assert(h4_add(&h, 0, &es[amnt]) == -1);
+	for (i = 0 ; i < amnt ; i++) {
+		assert(d[es[i].index].v == &es[i]);
+		es[i].value = rand();
+		h4_adjust(&h, es[i].index, es[i].value);
+	}
+	for (i = 0, prev = -1 ; i < amnt ; i++) {
+		assert(!h4_highest(&h, &ent));
+		assert(ent.k >= prev && ent.k == ent.v->value && ent.v->index == -1);
+		prev = ent.k;
+	}
+	assert(h4_highest(&h, &ent) == -1);
+	for (i = 0 ; i < amnt ; i++) assert(!h4_add(&h, rand(), &es[i]));
+	for (i = amnt ; i > 0 ; i--) {
+		h4_remove(&h, rand() % i, &ent);
+		assert(h4_size(&h) == i-1);
+	}
+	free(d);
+	free(es);
+}
+
+/* 
+ * Compare the heaps with 10k entries: fill and drain them, and
+ * "hold" (remove the highest and add a new entry, as a timer queue
+ * does).
+ */
+#define BENCH_SZ   10000
+#define BENCH_HOLD 1000000
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec/1000000000.0;
+}
+
+int cmin(void *a, void *b) { return ((struct hentry*)a)->value <= ((struct hentry*)b)->value; }
+
+static void bench(void)
+{
+	struct hentry *es = malloc(sizeof(struct hentry) * BENCH_SZ), *e;
+	struct h4_ent *d = malloc(sizeof(struct h4_ent) * BENCH_SZ), ent;
+	struct heap *h = heap_alloc(BENCH_SZ, cmin, u);
+	struct h4 h4;
+	double s, t2, t4;
+	int i, r;
+
+	assert(es && d && h);
+	h4_init(&h4, d, BENCH_SZ);
+
+	for (r = 0, t2 = t4 = 0 ; r < 10 ; r++) {
+		srand(r);
+		s = now();
+		for (i = 0 ; i < BENCH_SZ ; i++) {
+			es[i].value = rand();
+			heap_add(h, &es[i]);
+		}
+		for (i = 0 ; i < BENCH_SZ ; i++) heap_highest(h);
+		t2 += now() - s;
+
+		srand(r);
+		s = now();
+		for (i = 0 ; i < BENCH_SZ ; i++) {
+			es[i].value = rand();
+			h4_add(&h4, es[i].value, &es[i]);
+		}
+		for (i = 0 ; i < BENCH_SZ ; i++) h4_highest(&h4, &ent);
+		t4 += now() - s;
+	}
+	printd("fill+drain %d: binary %.1f ns/op, 4-ary %.1f ns/op\n", BENCH_SZ,
+	       t2*1e9/(20*BENCH_SZ), t4*1e9/(20*BENCH_SZ));
+
+	for (i = 0 ; i < BENCH_SZ ; i++) {
+		es[i].value = rand();
+		heap_add(h, &es[i]);
+	}
+	s = now();
+	for (i = 0 ; i < BENCH_HOLD ; i++) {
+		e = heap_highest(h);
+		e->value += rand() % BENCH_SZ;
+		heap_add(h, e);
+	}
+	t2 = now() - s;
+	for (i = 0 ; i < BENCH_SZ ; i++) h4_add(&h4, es[i].value, &es[i]);
+	s = now();
+	for (i = 0 ; i < BENCH_HOLD ; i++) {
+		if (h4_highest(&h4, &ent)) break;
+		ent.v->value += rand() % BENCH_SZ;
+		h4_add(&h4, ent.v->value, ent.v);
+	}
+	t4 = now() - s;
+	printd("hold %d: binary %.1f ns/op, 4-ary %.1f ns/op\n", BENCH_SZ,
+	       t2*1e9/BENCH_HOLD, t4*1e9/BENCH_HOLD);
+
+	heap_destroy(h);
+	free(d);
+	free(es);
+}
+
 #define ITER 50
 #define BOUND 4096
 
@@ -319,7 +440,9 @@ int main(void)
 
 	for (i = 0 ; i < ITER ; i++) {
 		test_driver(rand() % BOUND);
+		test4_driver(rand() % BOUND);
 	}
+	bench();
 
 	return 0;
 }
@@ -0,0 +1,199 @@
+/*
+ * Test for the stack freelist pop and push in cos_asm_stkmgr_stacks.h.
+ * The stub code runs as is, on 32 bit Linux, without a libc.  A
+ * timer signal plays the part of a second thread that preempts the
+ * first at arbitrary instructions: it pops two stacks and pushes the
+ * first back (the ABA pattern), while the main thread pops and
+ * pushes in a loop.  Each stack must only ever be held by one of the
+ * two:
+ *
+ * gcc -m32 -static -nostdlib -ffreestanding -fno-pic -fno-stack-protector -fno-dollars-in-identifiers -O2 \
+ *     -I../include -I../../kernel/include/shared stkmgr_stacks.c -o stkmgr_stacks_test
+ */
+
+#define RET_CAP ((1<<20)-1)
+#include <cos_asm_stkmgr_stacks.h>
+
+#define STR(...)  #__VA_ARGS__
+#define XSTR(...) STR(__VA_ARGS__)
+
+#define PAGE_SIZE 4096
+#define NSTK      8
+#define ITER      (1<<24)
+#define SIG_HOLD  3		/* most stacks the signal "thread" holds */
+#define MAIN_TID  1
+#define SIG_TID   2
+
+struct stack_fl {
+	unsigned long freelist, gen;
+} cos_comp_info;
+char stkmgr_stack_space[(SIG_TID+1)*128] __attribute__((aligned(128)));
+static char stks[NSTK][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static char sigstk[4*PAGE_SIZE] __attribute__((aligned(16)));
+/* 0: on the freelist, otherwise the tid of the holder */
+static volatile int owner[NSTK];
+static volatile int nfail, nsigs;
+static volatile int * const curr_tid = (volatile int *)THD_ID_SHARED_PAGE;
+
+/* void *stub_pop(void): returns the %esp the stub leaves */
+__asm__(".text\n"
+	"stub_pop:\n\t"
+	"pushal\n\t"
+	"movl %esp, %ebp\n\t"
+	XSTR(COS_ASM_GET_STACK) "\n\t"
+	"movl %esp, %eax\n\t"
+	"movl %ebp, %esp\n\t"
+	"movl %eax, 28(%esp)\n\t"
+	"popal\n\t"
+	"ret\n\t"
+	XSTR(COS_ASM_REQUEST_STACK) "\n");
+
+/* void stub_push(void *esp): esp as returned by stub_pop */
+__asm__(".text\n"
+	"stub_push:\n\t"
+	"pushal\n\t"
+	"movl %esp, %ebp\n\t"
+	"movl 36(%esp), %esp\n\t"
+	XSTR(COS_ASM_RET_STACK) "\n\t"
+	"movl %ebp, %esp\n\t"
+	"popal\n\t"
+	"ret\n");
+
+void *stub_pop(void);
+void stub_push(void *esp);
+
+/*************************** No libc ***************************/
+
+__asm__(".text\n"
+	".globl _start\n"
+	"_start:\n\t"
+	"call main\n\t"
+	"movl %eax, %ebx\n\t"
+	"movl $252, %eax\n\t"	/* exit_group */
+	"int $0x80\n"
+	"sig_restorer:\n\t"
+	"movl $173, %eax\n\t"	/* rt_sigreturn */
+	"int $0x80\n");
+void sig_restorer(void);
+
+static int sys(int n, int a, int b, int c, int d)
+{
+	int r;
+
+	__asm__ __volatile__("int $0x80" : "=a" (r) : "a" (n), "b" (a), "c" (b), "d" (c), "S" (d) : "memory");
+	return r;
+}
+
+static void out(const char *s)
+{
+	int n = 0;
+
+	while (s[n]) n++;
+	sys(4, 1, (int)s, n, 0);
+}
+
+static void outn(unsigned long v)
+{
+	char b[12];
+	int i = 11;
+
+	b[i] = '\0';
+	do { b[--i] = '0' + v % 10; v /= 10; } while (v);
+	out(&b[i]);
+}
+
+#define CHECK(cond) do { if (!(cond)) { out("FAIL: " #cond "\n"); nfail++; } } while (0)
+
+/***************************************************************/
+
+/* The stubs only request a stack if the freelist is empty, which it never should be */
+void *stkmgr_grant_stack(int spdid)
+{
+	out("FAIL: freelist empty\n");
+	sys(252, 1, 0, 0, 0);
+	return 0;
+}
+
+void stkmgr_return_stack(int spdid, void *addr)
+{
+	out("FAIL: stack relinquished\n");
+	sys(252, 1, 0, 0, 0);
+}
+
+static int stk_idx(void *esp)
+{
+	return ((char *)esp - &stks[0][0]) / PAGE_SIZE;
+}
+
+static int take(int tid)
+{
+	int i = stk_idx(stub_pop());
+
+	CHECK(i >= 0 && i < NSTK && 0 == owner[i]);
+	owner[i] = tid;
+	return i;
+}
+
+static void give(int i)
+{
+	owner[i] = 0;
+	stub_push(&stks[i][PAGE_SIZE - 8]);
+}
+
+static void handler(int sig)
+{
+	static int held[SIG_HOLD], nheld;
+	int prev = *curr_tid, a;
+
+	*curr_tid = SIG_TID;
+	nsigs++;
+	if (nheld < SIG_HOLD) {
+		/* pop the head and the next, and push the head back */
+		a = take(SIG_TID);
+		held[nheld++] = take(SIG_TID);
+		give(a);
+	} else {
+		while (nheld) give(held[--nheld]);
+	}
+	*curr_tid = prev;
+}
+
+int main(void)
+{
+	struct { unsigned long addr, len, prot, flags, fd, off; } mm =
+		{ THD_ID_SHARED_PAGE, PAGE_SIZE, 3, 0x32 /* MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS */, -1, 0 };
+	/* SA_SIGINFO for the rt signal frame that sig_restorer's rt_sigreturn expects */
+	struct { void *h; unsigned long flags; void *restorer; unsigned long mask[2]; } sa =
+		{ handler, 0x08000000 | 0x04000000 | 4 /* SA_ONSTACK|SA_RESTORER|SA_SIGINFO */, sig_restorer, {0, 0} };
+	struct { void *sp; int flags; unsigned long sz; } ss = { sigstk, 0, sizeof(sigstk) };
+	struct { long isec, iusec, sec, usec; } it = { 0, 20, 0, 20 };
+	int i;
+
+	if (sys(90, (int)&mm, 0, 0, 0) != THD_ID_SHARED_PAGE) {
+		out("FAIL: could not map the shared page\n");
+		return 1;
+	}
+	*curr_tid = MAIN_TID;
+	for (i = 0 ; i < NSTK ; i++) give(i);
+	CHECK(cos_comp_info.freelist == (unsigned long)&stks[NSTK-1][PAGE_SIZE - 8]);
+
+	/* single threaded pop and push */
+	i = take(MAIN_TID);
+	CHECK(i == NSTK-1 && cos_comp_info.gen == 1);
+	CHECK(*(unsigned long *)&stks[i][PAGE_SIZE - 4] == 1);	/* flags: in use */
+	give(i);
+	CHECK(*(unsigned long *)&stks[i][PAGE_SIZE - 4] == 0);
+	CHECK(cos_comp_info.freelist == (unsigned long)&stks[i][PAGE_SIZE - 8]);
+
+	sys(186, (int)&ss, 0, 0, 0);		/* sigaltstack */
+	sys(174, 14, (int)&sa, 0, 8);		/* rt_sigaction(SIGALRM) */
+	sys(104, 0, (int)&it, 0, 0);		/* setitimer(ITIMER_REAL) */
+	for (i = 0 ; i < ITER && !nfail ; i++) give(take(MAIN_TID));
+	it.iusec = it.usec = 0;
+	sys(104, 0, (int)&it, 0, 0);
+
+	out("pops "); outn(i); out(", preemptions "); outn(nsigs); out("\n");
+	out(nfail ? "Failed tests.\n" : "Passed tests.\n");
+
+	return nfail;
+}
@@ -92,8 +92,25 @@ struct pt_regs {
 /* size of virtual address spanned by one pgd entry */
 #define SERVICE_SIZE PGD_RANGE
 #define COS_INFO_REGION_ADDR SHARED_REGION_START
-#define COS_DATA_REGION_LOWER_ADDR (COS_INFO_REGION_ADDR+PAGE_SIZE)
-#define COS_DATA_REGION_MAX_SIZE (MAX_NUM_THREADS*PAGE_SIZE)
+/* 
+ * Each thread's argument region is COS_ARGREG_PAGES pages (a power
+ * of 2) aligned to its size: thread i's region is the i-th such
+ * region in the shared region, the 0th holding the info page.  All
+ * of them must fit in the single page-table of the shared region.
+ * Only the first page is mapped when the thread is created, the
+ * others when they are first accessed, and a thread switch only
+ * toggles the mapped pages.
+ */
+#ifndef COS_ARGREG_PAGES
+#define COS_ARGREG_PAGES 4
+#endif
+#define COS_ARGREG_SZ    (COS_ARGREG_PAGES*PAGE_SIZE)
+#define COS_ARGREG_ADDR(tid) (COS_INFO_REGION_ADDR+((tid)*COS_ARGREG_SZ))
+#if (MAX_NUM_THREADS+1)*COS_ARGREG_PAGES > PGD_PER_PTBL
+#error "Argument regions for MAX_NUM_THREADS don't fit in the shared region."
+#endif
+#define COS_DATA_REGION_LOWER_ADDR COS_ARGREG_ADDR(1)
+#define COS_DATA_REGION_MAX_SIZE (MAX_NUM_THREADS*COS_ARGREG_SZ)
 
 #define COS_NUM_ATOMIC_SECTIONS 10
 
@@ -218,13 +218,14 @@ struct usr_inv_cap {
 #define COMP_INFO_INIT_STR_LEN 128
 #define COMP_INFO_STACK_FREELISTS 1
 
-/* Each stack freelist is associated with a thread id that can be used
- * by the assembly entry routines into a component to decide which
- * freelist to use. */
+/* The generation is incremented by each pop from the freelist, so
+ * that a pop can replace the (freelist, gen) pair with cmpxchg8b
+ * without suffering from ABA (see cos_asm_stkmgr_stacks.h).  It
+ * must follow freelist. */
 struct cos_stack_freelists {
 	struct stack_fl {
 		vaddr_t freelist;
-		unsigned long thd_id;
+		unsigned long gen;
 	} freelists[COMP_INFO_STACK_FREELISTS];
 };
 
@@ -81,7 +81,9 @@ struct thread {
 	struct thd_invocation_frame stack_base[MAX_SERVICE_DEPTH] HALF_CACHE_ALIGNED;
 	struct pt_regs fault_regs;
 
-	void *data_region;
+	void *data_region[COS_ARGREG_PAGES];
+	/* the first data_region_mapped pages of the region are mapped */
+	int data_region_mapped;
 	vaddr_t ul_data_page;
 
 	struct thd_sched_info sched_info[MAX_SCHED_HIER_DEPTH] CACHE_ALIGNED; 
@@ -114,6 +116,7 @@ struct thread {
 
 struct thread *thd_alloc(struct spd *spd);
 void thd_free(struct thread *thd);
+int thd_data_region_map(struct thread *thd, vaddr_t addr);
 void thd_free_all(void);
 void thd_init(void);
 
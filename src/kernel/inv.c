@@ -310,7 +310,7 @@ COS_SYSCALL int cos_syscall_void(int spdid)
 	return 0;
 }
 
-extern int switch_thread_data_page(int old_thd, int new_thd);
+extern void switch_thread_data_page(struct thread *old, struct thread *new);
 struct thread *ready_boot_thread(struct spd *init)
 {
 	struct shared_user_data *ud = get_shared_data();
@@ -328,10 +328,10 @@ struct thread *ready_boot_thread(struct spd *init)
 	tid = thd_get_id(thd);
 	thd_set_current(thd);
 
-	switch_thread_data_page(2, tid);
+	switch_thread_data_page(NULL, thd);
 	/* thread ids start @ 1 */
 	ud->current_thread = tid;
-	ud->argument_region = (void*)((tid * PAGE_SIZE) + COS_INFO_REGION_ADDR);
+	ud->argument_region = (void*)COS_ARGREG_ADDR(tid);
 
 	return thd;
 }
@@ -340,18 +340,17 @@ static inline void __switch_thread_context(struct thread *curr, struct thread *n
 					   struct spd_poly *cspd)
 {
 	struct shared_user_data *ud = get_shared_data();
-	unsigned int ctid, ntid;
+	unsigned int ntid;
 
 	assert(thd_get_current() != next);
 
-	ctid = thd_get_id(curr);
 	ntid = thd_get_id(next);
 	thd_set_current(next);
 
-	switch_thread_data_page(ctid, ntid);
-	/* thread ids start @ 1, thus thd pages are offset above the data page */
+	switch_thread_data_page(curr, next);
+	/* thread ids start @ 1, thus thd regions are offset above the data page */
 	ud->current_thread = ntid;
-	ud->argument_region = (void*)((ntid * PAGE_SIZE) + COS_INFO_REGION_ADDR);
+	ud->argument_region = (void*)COS_ARGREG_ADDR(ntid);
 
 	return;
 }
@@ -1735,11 +1734,13 @@ COS_SYSCALL int cos_syscall_buff_mgmt_cont(int spd_id, void *addr, unsigned int
 				printk("cos: buff mgmt -- buffer address  %p does not fit onto page\n", user_gi->data);
 				return -1;
 			}
-			if ((void*)((unsigned int)(user_gi->data) & PAGE_MASK) == 
+			if ((void*)((unsigned int)(user_gi->data) & ~(COS_ARGREG_SZ-1)) == 
 			    get_shared_data()->argument_region) {
 				/* If the pointer is into the argument
 				 * region, we now that the memory is
-				 * pinned. */
+				 * pinned, but it might not be mapped
+				 * yet. */
+				thd_data_region_map(thd_get_current(), (vaddr_t)user_gi->data);
 				kaddr = (vaddr_t)user_gi->data;
 			} else {
 				kaddr = pgtbl_vaddr_to_kaddr(spd->spd_info.pg_tbl, (unsigned long)user_gi->data);
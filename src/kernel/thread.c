@@ -54,13 +54,15 @@ void thd_init_all(struct thread *thds)
 }
 
 extern void *va_to_pa(void *va);
-extern void thd_publish_data_page(struct thread *thd, vaddr_t page);
+extern void thd_publish_data_page(struct thread *thd, int pg, vaddr_t page);
+extern void thd_unpublish_data_region(struct thread *thd);
 
 struct thread *thd_alloc(struct spd *spd)
 {
 	struct thread *thd;
 	unsigned short int id;
-	void *page;
+	void *pages[COS_ARGREG_PAGES];
+	int i;
 
 	thd = thread_freelist_head;
 	if (thd == NULL) {
@@ -68,10 +70,13 @@ struct thread *thd_alloc(struct spd *spd)
 		return NULL;
 	}
 	
-	page = cos_get_pg_pool();
-	if (NULL == page) {
-		printk("cos: Could not allocate the data page for new thread.\n");
-		
+	for (i = 0 ; i < COS_ARGREG_PAGES ; i++) {
+		pages[i] = cos_get_pg_pool();
+		if (NULL == pages[i]) {
+			printk("cos: Could not allocate the data region for new thread.\n");
+			while (i-- > 0) cos_put_pg_pool((struct page_list*)pages[i]);
+			return NULL;
+		}
 	}
 	thread_freelist_head = thread_freelist_head->freelist_next;
 
@@ -79,10 +84,12 @@ struct thread *thd_alloc(struct spd *spd)
 	memset(thd, 0, sizeof(struct thread));
 	thd->thread_id = id;
 
-	thd->data_region = page;
-	*(int*)page = 4; /* HACK: sizeof(struct cos_argr_placekeeper) */
-	thd->ul_data_page = COS_INFO_REGION_ADDR + (PAGE_SIZE * id);
-	thd_publish_data_page(thd, (vaddr_t)page);
+	*(int*)pages[0] = 4; /* HACK: sizeof(struct cos_argr_placekeeper) */
+	thd->ul_data_page = COS_ARGREG_ADDR(id);
+	for (i = 0 ; i < COS_ARGREG_PAGES ; i++) thd->data_region[i] = pages[i];
+	/* the rest of the region is mapped by thd_data_region_map */
+	thd_publish_data_page(thd, 0, (vaddr_t)pages[0]);
+	thd->data_region_mapped = 1;
 
 	/* Initialization */
 	thd->stack_ptr = -1;
@@ -101,6 +108,8 @@ struct thread *thd_alloc(struct spd *spd)
 
 void thd_free(struct thread *thd)
 {
+	int i;
+
 	if (NULL == thd) return;
 
 	while (thd->stack_ptr > 0) {
@@ -117,8 +126,12 @@ void thd_free(struct thread *thd)
 		thd->stack_ptr--;
 	}
 
-	if (NULL != thd->data_region) {
-		cos_put_pg_pool((struct page_list*)thd->data_region);
+	thd_unpublish_data_region(thd);
+	thd->data_region_mapped = 0;
+	for (i = 0 ; i < COS_ARGREG_PAGES ; i++) {
+		if (NULL == thd->data_region[i]) continue;
+		cos_put_pg_pool((struct page_list*)thd->data_region[i]);
+		thd->data_region[i] = NULL;
 	}
 
 	thd->freelist_next = thread_freelist_head;
@@ -127,6 +140,29 @@ void thd_free(struct thread *thd)
 	return;
 }
 
+/* 
+ * Map the pages of thd's argument region up to, and including, the
+ * one holding addr, so that the mapped pages remain a prefix of the
+ * region.  They were allocated with the thread, so this doesn't
+ * block, and can be done on a page fault.  Returns 1 if pages were
+ * mapped, and 0 if addr isn't in an unmapped page of the region.
+ */
+int thd_data_region_map(struct thread *thd, vaddr_t addr)
+{
+	int pg;
+
+	if (addr < thd->ul_data_page || addr >= thd->ul_data_page + COS_ARGREG_SZ) return 0;
+	pg = (addr - thd->ul_data_page) / PAGE_SIZE;
+	if (pg < thd->data_region_mapped) return 0;
+	for ( ; thd->data_region_mapped <= pg ; thd->data_region_mapped++) {
+		int i = thd->data_region_mapped;
+
+		thd_publish_data_page(thd, i, (vaddr_t)thd->data_region[i]);
+	}
+
+	return 1;
+}
+
 void thd_free_all(void)
 {
 	struct thread *t;
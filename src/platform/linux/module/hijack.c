@@ -1020,6 +1020,11 @@ int main_page_fault_interposition(struct pt_regs *rs, unsigned int error_code)
 #ifdef FAULT_DEBUG
 	fault_addrs[BUCKET_HASH(fault_addr)]++;
 #endif
+	/* the first access to a page of the thread's argument region */
+	if (PF_ABSENT(error_code) && thd_data_region_map(thd, fault_addr)) {
+		ret = 0;
+		goto linux_handler_release;
+	}
 	if (PF_ABSENT(error_code) && PF_READ(error_code) && 
 	    cos_prelinux_handle_page_fault(thd, rs, fault_addr)) {
 		ret = 0;
@@ -1724,32 +1729,54 @@ static void deregister_timers(void)
 
 /***** end timer handling *****/
 
-void thd_publish_data_page(struct thread *thd, vaddr_t page)
+/* Map the pg-th page of thd's argument region */
+void thd_publish_data_page(struct thread *thd, int pg, vaddr_t page)
 {
 	unsigned int id = thd_get_id(thd);
 
 	//assert(0 != id && 0 == (page & ~PAGE_MASK));
+	assert(pg >= 0 && pg < COS_ARGREG_PAGES);
 
 	//printk("cos: shared_region_pte is %p, page is %x.\n", shared_region_pte, page);
 	/* _PAGE_PRESENT is not set */
-	((pte_t*)shared_region_page)[id].pte_low = (vaddr_t)va_to_pa((void*)page) |
+	((pte_t*)shared_region_page)[id*COS_ARGREG_PAGES + pg].pte_low = (vaddr_t)va_to_pa((void*)page) |
 		(_PAGE_PRESENT | _PAGE_RW | _PAGE_USER | _PAGE_ACCESSED);
 
 	return;
 }
 
-void switch_thread_data_page(int old_thd, int new_thd)
+/* Unmap all of thd's argument region */
+void thd_unpublish_data_region(struct thread *thd)
 {
-	assert(0 != old_thd && 0 != new_thd);
+	pte_t *p = &((pte_t*)shared_region_page)[thd_get_id(thd)*COS_ARGREG_PAGES];
+	int i;
+
+	for (i = 0 ; i < thd->data_region_mapped ; i++) p[i].pte_low = 0;
+
+	return;
+}
+
+/* old is NULL when switching to the boot thread */
+void switch_thread_data_page(struct thread *old, struct thread *new)
+{
+	pte_t *o, *n;
+	int i;
+
+	assert(new);
 
 	/*
 	 * Use shared_region_page here to avoid a cache miss going
 	 * through a level of indirection for a pointer.
 	 *
-	 * unmap the current thread map in the new thread
+	 * unmap the current thread map in the new thread.  Only the
+	 * mapped prefix of each region has pages.
 	 */
-	((pte_t*)shared_region_page)[old_thd].pte_low &= ~_PAGE_PRESENT;
-	((pte_t*)shared_region_page)[new_thd].pte_low |= _PAGE_PRESENT;
+	if (old) {
+		o = &((pte_t*)shared_region_page)[thd_get_id(old)*COS_ARGREG_PAGES];
+		for (i = 0 ; i < old->data_region_mapped ; i++) o[i].pte_low &= ~_PAGE_PRESENT;
+	}
+	n = &((pte_t*)shared_region_page)[thd_get_id(new)*COS_ARGREG_PAGES];
+	for (i = 0 ; i < new->data_region_mapped ; i++) n[i].pte_low |= _PAGE_PRESENT;
 
 	return;
 }
@@ -190,19 +190,24 @@ static void cosnet_purge_queues(struct tun_struct *ts)
 	}
 }
 
-/* be more aggressive here????? */
+/* 
+ * Are all brands backed up?  Packets are delivered through the
+ * brands' ring buffers, so the depth of a brand's queue is the
+ * number of its upcalls that are pending.
+ */
 static int cosnet_queues_full(struct tun_struct *ts) 
 {
-	int i;
+	int i, nbrands = 0;
 
 	for (i = 0 ; i < COSNET_NUM_CHANNELS ; i++) {
-		if (ts->cosnet[i].packet_queue &&
-		    skb_queue_len(ts->cosnet[i].packet_queue) < COSNET_QUEUE_LEN) {
-			return 0;
-		}
+		struct cos_brand_info *bi = ts->cosnet[i].brand_info;
+
+		if (!bi || !bi->brand) continue;
+		nbrands++;
+		if (bi->brand->pending_upcall_requests < COSNET_DROP_THRESH) return 0;
 	}
 	
-	return 1;
+	return nbrands > 0;
 }
 
 struct tun_struct *local_ts = NULL;
@@ -547,13 +552,15 @@ static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 		//goto drop;
 	}
 
-	/* Packet dropping */
-/*	if (cosnet_queues_full(tun)) {
-		netif_stop_queue(dev);
-		tun->stats.tx_fifo_errors++;
+	/* 
+	 * Early drop: if the system is overloaded, drop the packet
+	 * before it is copied, and an upcall made for it.  The queue
+	 * is not stopped, as there is nothing to restart it.
+	 */
+	if (cosnet_queues_full(tun)) {
+		tun->stats.rx_fifo_errors++;
 		goto drop;
 	}
-*/
 	if (!cosnet->packet_queue) {
 		printk("cos: packet queue not set up for brand.\n");
 		goto drop;
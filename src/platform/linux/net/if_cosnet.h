@@ -37,6 +37,11 @@
 #define COSNET_NUM_CHANNELS 5
 #define COSNET_QUEUE_LEN 500
 //#define COSNET_QUEUE_LEN 1000
+/* 
+ * Packets are dropped on arrival, before being copied into a ring,
+ * once every brand has this many upcalls pending.
+ */
+#define COSNET_DROP_THRESH 256
 
 struct cosnet_struct {
 	struct cos_brand_info   *brand_info;
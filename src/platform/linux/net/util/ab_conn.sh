@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# Compare conn_mgr's cos_epoll_wait loop with its cos_wait_all loop.
+# Start the web-server (e.g. lws_static.sh) with conn_mgr built with
+# USE_EPOLL defined, run this, then rebuild conn_mgr without it and
+# run this again.  conn_mgr also prints the average number of
+# descriptors handled per wait, which is 1 for the cos_wait_all loop.
+#
+# sh ab_conn.sh [server] [uri] [requests]
+
+SERVER=${1:-10.0.2.8}
+URI=${2:-/hw}
+NREQS=${3:-100000}
+
+for run in 1 2 3 ; do
+	echo "run $run: ab -c 256 -n $NREQS http://$SERVER:200$URI"
+	ab -c 256 -n $NREQS http://$SERVER:200$URI 2>&1 | \
+		grep -E "^(Complete requests|Failed requests|Requests per second|Time per request)"
+	sleep 5
+done
@@ -11,6 +11,7 @@
 #include <unistd.h>
 
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <signal.h>
 #include <time.h>
 
@@ -130,14 +131,97 @@ void start_timers()
 	return;
 }
 
+/* 
+ * Accept rate: fork a number of connectors, each opening and closing
+ * connections to the server as fast as it can, and report the total
+ * connections accepted per second.
+ */
+static unsigned long connector(struct sockaddr_in *sa, int secs)
+{
+	struct timeval end, now;
+	unsigned long n = 0;
+	int fd;
+
+	gettimeofday(&end, NULL);
+	end.tv_sec += secs;
+	do {
+		if ((fd = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
+			perror("Establishing socket");
+			break;
+		}
+		if (connect(fd, (struct sockaddr*)sa, sizeof(*sa))) {
+			if (errno != ECONNREFUSED && errno != ETIMEDOUT) {
+				perror("connecting");
+				close(fd);
+				break;
+			}
+		} else {
+			n++;
+		}
+		close(fd);
+		gettimeofday(&now, NULL);
+	} while (timercmp(&now, &end, <));
+
+	return n;
+}
+
+static int accept_rate(char *ip, int port, int connectors, int secs)
+{
+	struct sockaddr_in sa;
+	unsigned long tot = 0;
+	int i, p[2];
+
+	if (connectors <= 0 || secs <= 0) return -1;
+	sa.sin_family      = AF_INET;
+	sa.sin_port        = htons(port);
+	sa.sin_addr.s_addr = inet_addr(ip);
+	if (pipe(p)) {
+		perror("pipe");
+		return -1;
+	}
+	printf("Starting %d connectors for %d seconds\n", connectors, secs);
+	fflush(stdout);
+	for (i = 0 ; i < connectors ; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return -1;
+		}
+		if (0 == pid) {
+			unsigned long n;
+
+			close(p[0]);
+			n = connector(&sa, secs);
+			if (write(p[1], &n, sizeof(n)) != sizeof(n)) exit(-1);
+			exit(0);
+		}
+	}
+	close(p[1]);
+	for (i = 0 ; i < connectors ; i++) {
+		unsigned long n;
+
+		if (read(p[0], &n, sizeof(n)) != sizeof(n)) break;
+		tot += n;
+	}
+	while (wait(NULL) > 0) ;
+	printf("Connections accepted: %lu (%lu/sec)\n", tot, tot/secs);
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	struct sockaddr_in sa;
 	char *msg;
 	int sleep_val, i, msg_size;
 
+	if (argc == 6 && !strcmp(argv[1], "-a")) {
+		return accept_rate(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]));
+	}
 	if (argc != 6) {
 		printf("Usage: %s <ip> <port> <msg size> <sleep_val> <conns>\n", argv[0]);
+		printf("       %s -a <ip> <port> <connectors> <secs>\n", argv[0]);
 		return -1;
 	}
 	sleep_val = atoi(argv[4]);
@@ -0,0 +1,187 @@
+/*
+ * Multi-client load generator built on tcp_client: fork a number of
+ * client processes, each driving its own set of connections in a
+ * send/receive (echo) loop.  Per-client throughput and latency are
+ * reported at the end of the run, along with the ratio between the
+ * slowest and the fastest client.  When flows are steered to
+ * independent upcall threads, a slow client should not degrade the
+ * others, and that ratio should stay close to 1.
+ *
+ * ./tcp_mclient 10.0.2.8 200 64 8 4 10
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct client_stats {
+	unsigned long long sent, rcved;
+	unsigned long long tot_lat, max_lat, min_lat; /* usec */
+};
+
+static unsigned long long now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int socket_nonblock(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0) {
+		perror("retrieving flags for socket");
+		return -1;
+	}
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("setting socket's flags to nonblocking");
+		return -1;
+	}
+	return 0;
+}
+
+static int client(struct sockaddr_in *sa, int msg_sz, int conns, int secs, struct client_stats *cs)
+{
+	int *fds, i;
+	char *msg, *rcv_msg;
+	unsigned long long end;
+
+	fds     = malloc(conns * sizeof(int));
+	msg     = malloc(msg_sz);
+	rcv_msg = malloc(msg_sz);
+	if (!fds || !msg || !rcv_msg) return -1;
+	memset(msg, 0, msg_sz);
+	memset(cs, 0, sizeof(struct client_stats));
+	cs->min_lat = (unsigned long long)-1;
+
+	for (i = 0 ; i < conns ; i++) {
+		if ((fds[i] = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
+			perror("Establishing socket");
+			return -1;
+		}
+		if (connect(fds[i], (struct sockaddr*)sa, sizeof(*sa))) {
+			perror("connecting");
+			return -1;
+		}
+		if (socket_nonblock(fds[i])) return -1;
+	}
+
+	end = now_usec() + (unsigned long long)secs * 1000000;
+	while (now_usec() < end) {
+		for (i = 0 ; i < conns ; i++) {
+			unsigned long long *ts = (unsigned long long *)msg;
+			int ret;
+
+			*ts = now_usec();
+			if (write(fds[i], msg, msg_sz) < 0) {
+				if (errno == EINTR || errno == EAGAIN) continue;
+				perror("write");
+				return -1;
+			}
+			cs->sent++;
+			while ((ret = recv(fds[i], rcv_msg, msg_sz, MSG_DONTWAIT)) == msg_sz) {
+				unsigned long long lat;
+
+				lat = now_usec() - *(unsigned long long *)rcv_msg;
+				cs->rcved++;
+				cs->tot_lat += lat;
+				if (lat > cs->max_lat) cs->max_lat = lat;
+				if (lat < cs->min_lat) cs->min_lat = lat;
+			}
+			if (-1 == ret && EAGAIN != errno) {
+				perror("Reading from recv socket");
+				return -1;
+			}
+		}
+	}
+	for (i = 0 ; i < conns ; i++) close(fds[i]);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in sa;
+	int msg_sz, clients, conns, secs, i;
+	int (*pipes)[2];
+	struct client_stats *stats;
+	double min_tput = -1, max_tput = 0;
+
+	if (argc != 7) {
+		printf("Usage: %s <ip> <port> <msg size> <clients> <conns/client> <secs>\n", argv[0]);
+		return -1;
+	}
+	msg_sz  = atoi(argv[3]);
+	msg_sz  = msg_sz < (int)sizeof(unsigned long long) ? (int)sizeof(unsigned long long) : msg_sz;
+	clients = atoi(argv[4]);
+	conns   = atoi(argv[5]);
+	secs    = atoi(argv[6]);
+	if (clients <= 0 || conns <= 0 || secs <= 0) return -1;
+
+	pipes = malloc(clients * sizeof(*pipes));
+	stats = malloc(clients * sizeof(struct client_stats));
+	if (!pipes || !stats) return -1;
+
+	sa.sin_family      = AF_INET;
+	sa.sin_port        = htons(atoi(argv[2]));
+	sa.sin_addr.s_addr = inet_addr(argv[1]);
+
+	printf("Starting %d clients with %d connections each for %d seconds\n", clients, conns, secs);
+	fflush(stdout);
+	for (i = 0 ; i < clients ; i++) {
+		pid_t p;
+
+		if (pipe(pipes[i])) {
+			perror("pipe");
+			return -1;
+		}
+		p = fork();
+		if (p < 0) {
+			perror("fork");
+			return -1;
+		}
+		if (0 == p) {
+			struct client_stats cs;
+			int ret;
+
+			close(pipes[i][0]);
+			ret = client(&sa, msg_sz, conns, secs, &cs);
+			if (write(pipes[i][1], &cs, sizeof(cs)) != sizeof(cs)) ret = -1;
+			exit(ret);
+		}
+		close(pipes[i][1]);
+	}
+
+	for (i = 0 ; i < clients ; i++) {
+		struct client_stats *cs = &stats[i];
+		double tput;
+
+		if (read(pipes[i][0], cs, sizeof(*cs)) != sizeof(*cs)) {
+			printf("client %d: failed\n", i);
+			memset(cs, 0, sizeof(*cs));
+			continue;
+		}
+		tput = (double)cs->rcved / secs;
+		printf("client %d: sent %llu, received %llu (%.0f msgs/sec), avg lat %llu, max %llu, min %llu usec\n",
+		       i, cs->sent, cs->rcved, tput,
+		       cs->rcved == 0 ? 0 : cs->tot_lat/cs->rcved, cs->max_lat,
+		       cs->rcved == 0 ? 0 : cs->min_lat);
+		if (min_tput < 0 || tput < min_tput) min_tput = tput;
+		if (tput > max_tput) max_tput = tput;
+	}
+	while (wait(NULL) > 0) ;
+	printf("slowest/fastest client throughput: %.2f\n", max_tput == 0 ? 0 : min_tput/max_tput);
+
+	return 0;
+}
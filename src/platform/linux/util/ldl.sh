@@ -10,7 +10,7 @@
 \
 c0.o-fprr.o;\
 fprr.o-print.o|mm.o|st.o|schedconf.o|[parent_]bc.o;\
-net.o-sm.o|fprr.o|mm.o|print.o|l.o|te.o|e.o|ip.o|port.o|va.o;\
+net.o-sm.o|fprr.o|mm.o|print.o|l.o|te.o|e.o|ip.o|port.o|va.o|schedconf.o;\
 l.o-fprr.o|mm.o|print.o;\
 te.o-sm.o|print.o|fprr.o|mm.o|va.o;\
 mm.o-print.o;\
@@ -0,0 +1,57 @@
+#!/bin/sh
+
+# The web-server of lws.sh, with each cgi component serving its requests
+# with $1 worker threads (default 1).  Measure the scaling with 1, 2, 4,
+# and 8 workers with:
+#
+# for n in 1 2 4 8 ; do
+#     sh lws_cgi.sh $n ; sleep 5
+#     httperf --server=10.0.2.8 --port=200 --uri=/cgi/hw --num-conns=20000 --num-calls=10 --rate=2000
+#     ...stop the system...
+# done
+
+NWORKERS=${1:-1}
+
+./cos_loader \
+"c0.o, ;*ds.o, ;mm.o, ;mh.o, ;print.o, ;boot.o,a2;schedconf.o, ;cg.o,a1;bc.o, ;st.o, ;\
+\
+!sm.o,a1;!mpd.o,a5;!stat.o,a25;!cm.o,a7;!sc.o,a6;!if.o,a5;!ip.o, ;!ainv.o,a6;!fn.o, ;!cgi.o,a9'n$NWORKERS';\
+!port.o, ;!l.o,a4;!te.o,a3;(!fd2.o=fd.o),a8;(!fd3.o=fd.o),a8;(!cgi2.o=cgi.o),a9'n$NWORKERS';(!ainv2.o=ainv.o),a6;\
+!net.o,d6c2t2;!e.o,a5;!fd.o,a8;!conn.o,a9;!http.o,a8;!va.o,a2;!buf.o,a5:\
+\
+c0.o-ds.o;\
+ds.o-print.o|mh.o|st.o|schedconf.o|[parent_]bc.o;\
+net.o-sm.o|ds.o|mh.o|print.o|l.o|te.o|e.o|ip.o|port.o|buf.o|va.o|schedconf.o;\
+l.o-sm.o|ds.o|mh.o|print.o|te.o;\
+te.o-sm.o|print.o|ds.o|mh.o;\
+mm.o-print.o;\
+mh.o-[parent_]mm.o|[main_]mm.o|print.o;\
+e.o-sm.o|ds.o|print.o|mh.o|l.o|st.o;\
+fd.o-sm.o|print.o|e.o|net.o|l.o|ds.o|http.o|mh.o|buf.o|va.o;\
+conn.o-sm.o|fd.o|print.o|mh.o|ds.o;\
+http.o-sm.o|mh.o|print.o|ds.o|cm.o|te.o|buf.o|va.o|e.o|l.o|schedconf.o;\
+stat.o-sm.o|te.o|ds.o|l.o|print.o|e.o;\
+st.o-print.o;\
+ip.o-sm.o|if.o;\
+port.o-sm.o|l.o;\
+cm.o-sm.o|print.o|mh.o|sc.o|ds.o|ainv.o|[alt_]ainv2.o|e.o|l.o|buf.o|va.o;\
+sc.o-sm.o|print.o|mh.o|e.o|ds.o;\
+if.o-sm.o|print.o|mh.o|l.o|ds.o;\
+fn.o-sm.o|ds.o;\
+fd2.o-sm.o|fn.o|ainv.o|print.o|mh.o|ds.o|e.o|l.o|buf.o|va.o;\
+ainv.o-sm.o|mh.o|print.o|ds.o|l.o|e.o;\
+cgi.o-sm.o|fd2.o|ds.o|print.o|cm.o|schedconf.o;\
+fd3.o-sm.o|fn.o|ainv2.o|print.o|mh.o|ds.o|e.o|l.o|buf.o|va.o;\
+ainv2.o-sm.o|mh.o|print.o|ds.o|l.o|e.o;\
+cgi2.o-sm.o|fd3.o|ds.o|print.o|cm.o|schedconf.o;\
+va.o-ds.o|print.o|mm.o|l.o|boot.o;\
+buf.o-sm.o|ds.o|print.o|l.o|mh.o|va.o;\
+schedconf.o-print.o;\
+boot.o-print.o|ds.o|mm.o|cg.o;\
+sm.o-print.o|ds.o|mm.o|boot.o;\
+mpd.o-sm.o|cg.o|ds.o|print.o|te.o|mh.o;\
+cg.o-ds.o;\
+bc.o-print.o\
+" ./gen_client_stub
+
+
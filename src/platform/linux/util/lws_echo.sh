@@ -7,25 +7,27 @@
 "c0.o, ;*ds.o, ;mm.o, ;mh.o, ;print.o, ;boot.o,a2;schedconf.o, ;cg.o,a1;bc.o, ;st.o, ;\
 \
 !sm.o,a1;!mpd.o,a5;!stat.o,a25;!cm.o,a7;!if.o,a5;!ip.o, ;\
-!port.o, ;!l.o,a4;!te.o,a3;!net.o,d6c2t2;!e.o,a5;!fd.o,a8;!conn.o,a9;!va.o,a2;!echo.o,a8:\
+!port.o, ;!l.o,a4;!te.o,a3;!net.o,d6c2t2;!e.o,a5;!fd.o,a8;!conn.o,a9;!va.o,a2;!echo.o,a8;!buf.o,a5;!ainv.o,a6:\
 \
 c0.o-ds.o;\
 ds.o-print.o|mh.o|st.o|schedconf.o|[parent_]bc.o;\
-net.o-sm.o|ds.o|mh.o|print.o|l.o|te.o|e.o|ip.o|port.o|va.o;\
+net.o-sm.o|ds.o|mh.o|print.o|l.o|te.o|e.o|ip.o|port.o|va.o|buf.o|schedconf.o;\
 l.o-ds.o|mh.o|print.o;\
 te.o-sm.o|print.o|ds.o|mh.o|va.o;\
 mm.o-print.o;\
 mh.o-[parent_]mm.o|[main_]mm.o|print.o;\
 e.o-sm.o|ds.o|print.o|mh.o|l.o|st.o|va.o;\
-fd.o-sm.o|print.o|e.o|net.o|l.o|ds.o|echo.o|mh.o|va.o;\
-conn.o-sm.o|fd.o|print.o|mh.o|ds.o|va.o;\
+fd.o-sm.o|print.o|e.o|net.o|l.o|ds.o|echo.o|mh.o|va.o|buf.o;\
+conn.o-sm.o|fd.o|print.o|mh.o|ds.o;\
 echo.o-sm.o|mh.o|print.o|ds.o|e.o|va.o;\
 stat.o-sm.o|te.o|ds.o|l.o|print.o|e.o|va.o;\
 st.o-print.o;\
 ip.o-sm.o|if.o|va.o;\
 port.o-sm.o|l.o;\
-cm.o-sm.o|print.o|mh.o|echo.o|[alt_]echo.o|ds.o|va.o;\
+cm.o-sm.o|print.o|mh.o|echo.o|[alt_]echo.o|ds.o|va.o|e.o|l.o|buf.o|ainv.o;\
 if.o-sm.o|print.o|mh.o|l.o|ds.o|va.o;\
+buf.o-sm.o|ds.o|print.o|l.o|mh.o|va.o;\
+ainv.o-sm.o|mh.o|print.o|ds.o|l.o|e.o|va.o;\
 schedconf.o-print.o;\
 va.o-ds.o|print.o|mm.o|l.o|boot.o;\
 boot.o-print.o|ds.o|mm.o|cg.o;\
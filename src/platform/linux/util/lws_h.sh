@@ -13,7 +13,7 @@
 \
 !stat.o,a25;!cm.o,a7;!sc.o,a6;!if.o,a5;!ip.o, ;!ainv.o,a6;!fn.o, ;!cgi.o,a9;\
 !port.o, ;!l.o,a4;!te.o,a3;(!fd2.o=fd.o),a8;(!fd3.o=fd.o),a8;(!cgi2.o=cgi.o),a9;(!ainv2.o=ainv.o),a6;\
-!net.o,a6;!e.o,a5;!fd.o,a8;!conn.o,a9;!http.o,a8;!cpu.o,d10c4t25;(!cpu2.o=cpu.o),d9c3t20;(!cpu3.o=cpu.o),d8c1t10:\
+!net.o,a6;!e.o,a5;!fd.o,a8;!conn.o,a9;!http.o,a8;!cpu.o,d10c4t25;(!cpu2.o=cpu.o),d9c3t20;(!cpu3.o=cpu.o),d8c1t10;!va.o,a2;!buf.o,a5:\
 \
 c0.o-ds.o;\
 cpu.o-ds.o|sm.o;\
@@ -21,29 +21,31 @@ cpu2.o-ds.o|sm.o;\
 cpu3.o-ds.o|sm.o;\
 ds.o-print.o|mh.o|st.o|schedconf.o|[parent_]bc.o;\
 fprrc1.o-print.o|mh.o|st.o|schedconf.o|[parent_]ds.o;\
-net.o-sm.o|fprrc1.o|mh.o|print.o|l.o|te.o|e.o|ip.o|port.o;\
+net.o-sm.o|fprrc1.o|mh.o|print.o|l.o|te.o|e.o|ip.o|port.o|buf.o|va.o|schedconf.o;\
 l.o-sm.o|fprrc1.o|mh.o|print.o|te.o;\
 te.o-sm.o|print.o|fprrc1.o|mh.o;\
 mm.o-print.o;\
 mh.o-[parent_]mm.o|[main_]mm.o|print.o;\
 e.o-sm.o|fprrc1.o|print.o|mh.o|l.o|st.o;\
-fd.o-sm.o|print.o|e.o|net.o|l.o|fprrc1.o|http.o|mh.o;\
+fd.o-sm.o|print.o|e.o|net.o|l.o|fprrc1.o|http.o|mh.o|buf.o|va.o;\
 conn.o-sm.o|fd.o|print.o|mh.o|fprrc1.o;\
-http.o-sm.o|mh.o|print.o|fprrc1.o|cm.o|te.o;\
+http.o-sm.o|mh.o|print.o|fprrc1.o|cm.o|te.o|buf.o|va.o|e.o|l.o|schedconf.o;\
 stat.o-sm.o|te.o|fprrc1.o|l.o|print.o|e.o;\
 st.o-print.o;\
 ip.o-sm.o|if.o;\
 port.o-sm.o|l.o;\
-cm.o-sm.o|print.o|mh.o|sc.o|fprrc1.o|ainv.o|[alt_]ainv2.o;\
+cm.o-sm.o|print.o|mh.o|sc.o|fprrc1.o|ainv.o|[alt_]ainv2.o|e.o|l.o|buf.o|va.o;\
 sc.o-sm.o|print.o|mh.o|e.o|fprrc1.o;\
 if.o-sm.o|print.o|mh.o|l.o|fprrc1.o;\
 fn.o-sm.o|fprrc1.o;\
-fd2.o-sm.o|fn.o|ainv.o|print.o|mh.o|fprrc1.o|e.o|l.o;\
+fd2.o-sm.o|fn.o|ainv.o|print.o|mh.o|fprrc1.o|e.o|l.o|buf.o|va.o;\
 ainv.o-sm.o|mh.o|print.o|fprrc1.o|l.o|e.o;\
-cgi.o-sm.o|fd2.o|fprrc1.o|print.o;\
-fd3.o-sm.o|fn.o|ainv2.o|print.o|mh.o|fprrc1.o|e.o|l.o;\
+cgi.o-sm.o|fd2.o|fprrc1.o|print.o|cm.o|schedconf.o;\
+fd3.o-sm.o|fn.o|ainv2.o|print.o|mh.o|fprrc1.o|e.o|l.o|buf.o|va.o;\
 ainv2.o-sm.o|mh.o|print.o|fprrc1.o|l.o|e.o;\
-cgi2.o-sm.o|fd3.o|fprrc1.o|print.o;\
+cgi2.o-sm.o|fd3.o|fprrc1.o|print.o|cm.o|schedconf.o;\
+va.o-ds.o|print.o|mm.o|l.o|boot.o;\
+buf.o-sm.o|fprrc1.o|print.o|l.o|mh.o|va.o;\
 schedconf.o-print.o;\
 boot.o-print.o|ds.o|mm.o|cg.o;\
 sm.o-print.o|ds.o|mm.o|boot.o;\